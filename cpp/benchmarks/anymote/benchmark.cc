@@ -0,0 +1,282 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "anymote/benchmark.h"
+
+#include <google/protobuf/stubs/common.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+
+// Every heap allocation in the process is counted, so benchmarks can report
+// allocations per operation.
+static std::atomic<int64_t> allocation_count(0);
+
+void* operator new(size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  void* pointer = malloc(size == 0 ? 1 : size);
+  if (pointer == NULL) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* pointer) throw() {
+  free(pointer);
+}
+
+void operator delete[](void* pointer) throw() {
+  free(pointer);
+}
+
+namespace anymote {
+namespace bench {
+
+// The minimum duration of a throughput batch.
+static const int64_t kMinBatchNanos = 1000000;
+
+// The default number of batches of a throughput benchmark.
+static const int kDefaultBatches = 30;
+
+// The default number of samples of a latency benchmark.
+static const int kDefaultSamples = 10000;
+
+namespace {
+
+// A registered benchmark.
+struct Benchmark {
+  const char* name;
+  BenchmarkFunction function;
+  bool latency;
+};
+
+// The results of a benchmark.
+struct Result {
+  std::string name;
+  int64_t iterations;
+  int64_t batches;
+  std::vector<double> nanos_per_op;
+  double allocations_per_op;
+  double bytes_per_second;
+};
+
+}  // namespace
+
+// Returns the registered benchmarks. This is a function so it is initialized
+// before the first registrar runs.
+static std::vector<Benchmark>* Benchmarks() {
+  static std::vector<Benchmark>* benchmarks = new std::vector<Benchmark>();
+  return benchmarks;
+}
+
+int64_t AllocationCount() {
+  return allocation_count.load(std::memory_order_relaxed);
+}
+
+int64_t NowNanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+State::State(int64_t iterations)
+    : iterations_(iterations),
+      running_(false),
+      start_nanos_(0),
+      start_allocations_(0),
+      elapsed_nanos_(0),
+      allocations_(0),
+      bytes_processed_(0) {
+  ResetTiming();
+}
+
+void State::ResetTiming() {
+  elapsed_nanos_ = 0;
+  allocations_ = 0;
+  running_ = false;
+  ResumeTiming();
+}
+
+void State::PauseTiming() {
+  if (running_) {
+    elapsed_nanos_ += NowNanos() - start_nanos_;
+    allocations_ += AllocationCount() - start_allocations_;
+    running_ = false;
+  }
+}
+
+void State::ResumeTiming() {
+  if (!running_) {
+    running_ = true;
+    start_allocations_ = AllocationCount();
+    start_nanos_ = NowNanos();
+  }
+}
+
+void State::Finish() {
+  PauseTiming();
+}
+
+Registrar::Registrar(const char* name, BenchmarkFunction function,
+                     bool latency) {
+  Benchmark benchmark = {name, function, latency};
+  Benchmarks()->push_back(benchmark);
+}
+
+// Runs one batch of a benchmark.
+static void RunBatch(const Benchmark& benchmark, State* state) {
+  benchmark.function(state);
+  state->Finish();
+}
+
+// Runs a benchmark and collects its results.
+static Result RunBenchmark(const Benchmark& benchmark, int batches,
+                           int samples) {
+  int64_t iterations = 1;
+  if (!benchmark.latency) {
+    // Double the batch size until a batch takes long enough to time.
+    for (;;) {
+      State state(iterations);
+      RunBatch(benchmark, &state);
+      if (state.elapsed_nanos() >= kMinBatchNanos || iterations >= (1 << 30)) {
+        break;
+      }
+      iterations *= 2;
+    }
+  } else {
+    batches = samples;
+
+    // Warm up caches and buffers.
+    State state(iterations);
+    RunBatch(benchmark, &state);
+  }
+
+  Result result;
+  result.name = benchmark.name;
+  result.iterations = iterations * batches;
+  result.batches = batches;
+  int64_t total_nanos = 0;
+  int64_t total_allocations = 0;
+  int64_t total_bytes = 0;
+  for (int i = 0; i < batches; ++i) {
+    State state(iterations);
+    RunBatch(benchmark, &state);
+    result.nanos_per_op.push_back(
+        static_cast<double>(state.elapsed_nanos()) / iterations);
+    total_nanos += state.elapsed_nanos();
+    total_allocations += state.allocations();
+    total_bytes += state.bytes_processed();
+  }
+
+  result.allocations_per_op =
+      static_cast<double>(total_allocations) / result.iterations;
+  result.bytes_per_second = total_nanos > 0 ?
+      total_bytes * 1e9 / total_nanos : 0;
+  std::sort(result.nanos_per_op.begin(), result.nanos_per_op.end());
+  return result;
+}
+
+// Returns the given percentile of sorted samples, using the nearest rank.
+static double Percentile(const std::vector<double>& sorted, double percent) {
+  size_t rank = static_cast<size_t>(percent / 100 * sorted.size() + 0.5);
+  if (rank > 0) {
+    rank--;
+  }
+  return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+// Prints a result as a JSON object.
+static void PrintResult(const Result& result, bool last) {
+  const std::vector<double>& samples = result.nanos_per_op;
+  double sum = 0;
+  for (size_t i = 0; i < samples.size(); ++i) {
+    sum += samples[i];
+  }
+  double mean = sum / samples.size();
+
+  printf("    {\n");
+  printf("      \"name\": \"%s\",\n", result.name.c_str());
+  printf("      \"iterations\": %lld,\n",
+         static_cast<long long>(result.iterations));
+  printf("      \"batches\": %lld,\n", static_cast<long long>(result.batches));
+  printf("      \"ns_per_op\": {\"mean\": %.2f, \"min\": %.2f, "
+         "\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"p999\": %.2f, "
+         "\"max\": %.2f},\n",
+         mean, samples.front(), Percentile(samples, 50),
+         Percentile(samples, 90), Percentile(samples, 99),
+         Percentile(samples, 99.9), samples.back());
+  printf("      \"ops_per_second\": %.1f,\n", mean > 0 ? 1e9 / mean : 0);
+  printf("      \"bytes_per_second\": %.1f,\n", result.bytes_per_second);
+  printf("      \"allocations_per_op\": %.3f\n", result.allocations_per_op);
+  printf("    }%s\n", last ? "" : ",");
+}
+
+int RunBenchmarks(int argc, char** argv) {
+  std::string filter;
+  int batches = kDefaultBatches;
+  int samples = kDefaultSamples;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--filter=", 9) == 0) {
+      filter = argv[i] + 9;
+    } else if (strncmp(argv[i], "--batches=", 10) == 0) {
+      batches = std::max(1, atoi(argv[i] + 10));
+    } else if (strncmp(argv[i], "--samples=", 10) == 0) {
+      samples = std::max(1, atoi(argv[i] + 10));
+    } else {
+      fprintf(stderr, "Usage: %s [--filter=<substring>] [--batches=<count>] "
+              "[--samples=<count>]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<Result> results;
+  const std::vector<Benchmark>& benchmarks = *Benchmarks();
+  for (size_t i = 0; i < benchmarks.size(); ++i) {
+    if (strstr(benchmarks[i].name, filter.c_str()) == NULL) {
+      continue;
+    }
+    fprintf(stderr, "Running %s\n", benchmarks[i].name);
+    results.push_back(RunBenchmark(benchmarks[i], batches, samples));
+  }
+
+  printf("{\n");
+  printf("  \"context\": {\n");
+  printf("    \"protobuf_version\": %d,\n", GOOGLE_PROTOBUF_VERSION);
+#ifdef __VERSION__
+  printf("    \"compiler\": \"%s\"\n", __VERSION__);
+#else
+  printf("    \"compiler\": \"unknown\"\n");
+#endif
+  printf("  },\n");
+  printf("  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    PrintResult(results[i], i + 1 == results.size());
+  }
+  printf("  ]\n");
+  printf("}\n");
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace anymote
@@ -0,0 +1,129 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Minimal micro-benchmark harness for anymote-bench.
+//
+// A benchmark is a function that runs the operation under test
+// state->iterations() times. The harness calls it repeatedly in batches, after
+// calibrating the number of iterations so a batch takes a measurable time, and
+// reports the distribution of the time per operation across batches together
+// with the number of heap allocations per operation. Example:
+//
+//   static void BM_Foo(bench::State* state) {
+//     Foo foo;
+//     state->ResetTiming();
+//     for (int64_t i = 0; i < state->iterations(); ++i) {
+//       foo.Run();
+//     }
+//   }
+//   BENCHMARK(BM_Foo);
+//
+// Benchmarks that measure latency rather than throughput register with
+// BENCHMARK_LATENCY so every batch runs a single operation.
+
+#ifndef ANYMOTE_BENCHMARKS_BENCHMARK_H_
+#define ANYMOTE_BENCHMARKS_BENCHMARK_H_
+
+#include <stdint.h>
+
+namespace anymote {
+namespace bench {
+
+// The state of a running batch.
+class State {
+ public:
+  explicit State(int64_t iterations);
+
+  // Returns the number of operations the benchmark should run.
+  int64_t iterations() const { return iterations_; }
+
+  // Restarts the timer and the allocation count, so setup done before the
+  // call is not measured.
+  void ResetTiming();
+
+  // Stops measuring, for work inside the loop that should not be measured.
+  void PauseTiming();
+
+  // Resumes measuring after PauseTiming.
+  void ResumeTiming();
+
+  // Sets the number of payload bytes processed by the batch, so throughput
+  // is reported in bytes per second too.
+  void set_bytes_processed(int64_t bytes) { bytes_processed_ = bytes; }
+
+  // Returns the measured time of the batch in nanoseconds.
+  int64_t elapsed_nanos() const { return elapsed_nanos_; }
+
+  // Returns the number of heap allocations made during the batch.
+  int64_t allocations() const { return allocations_; }
+
+  int64_t bytes_processed() const { return bytes_processed_; }
+
+  // Stops measuring at the end of the batch.
+  void Finish();
+
+ private:
+  const int64_t iterations_;
+  bool running_;
+  int64_t start_nanos_;
+  int64_t start_allocations_;
+  int64_t elapsed_nanos_;
+  int64_t allocations_;
+  int64_t bytes_processed_;
+};
+
+typedef void (*BenchmarkFunction)(State* state);
+
+// Registers a benchmark. Used by the BENCHMARK macros.
+class Registrar {
+ public:
+  // @param name The name of the benchmark.
+  // @param function The benchmark function.
+  // @param latency Whether every batch runs a single operation.
+  Registrar(const char* name, BenchmarkFunction function, bool latency);
+};
+
+// Runs the registered benchmarks whose name contains the filter and prints
+// the results as JSON to stdout.
+//
+// @param argc The number of command line arguments.
+// @param argv The command line arguments: --filter=<substring> and
+//             --batches=<count>.
+// @return The process exit code.
+int RunBenchmarks(int argc, char** argv);
+
+// Returns the number of heap allocations made by the process so far.
+int64_t AllocationCount();
+
+// Returns the current time of the monotonic clock in nanoseconds.
+int64_t NowNanos();
+
+// Prevents the compiler from optimizing away a value.
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+}  // namespace bench
+}  // namespace anymote
+
+#define BENCHMARK(function) \
+  static ::anymote::bench::Registrar function##_registrar( \
+      #function, &function, false)
+
+#define BENCHMARK_LATENCY(function) \
+  static ::anymote::bench::Registrar function##_registrar( \
+      #function, &function, true)
+
+#endif  // ANYMOTE_BENCHMARKS_BENCHMARK_H_
@@ -0,0 +1,231 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks for DeviceSession.
+
+#include <anymote/device/devicesession.h>
+#include <anymote/device/keymap.h>
+#include <anymote/server/serversession.h>
+#include <anymote/wire/loopbackwireinterface.h>
+#include <anymote/wire/protobufwireadapter.h>
+#include <string>
+#include <vector>
+#include "anymote/benchmark.h"
+
+namespace anymote {
+namespace device {
+
+namespace {
+
+// Listener that counts the responses it receives.
+class CountingAnymoteListener : public AnymoteListener {
+ public:
+  CountingAnymoteListener() : acks(0), responses(0) {}
+  virtual void OnAck() { acks++; }
+  virtual void OnData(const std::string& type, const std::string& data) {
+    responses++;
+  }
+  virtual void OnFlingResult(bool success, uint32_t sequence_number) {
+    responses++;
+  }
+  virtual void OnError() {}
+
+  int64_t acks;
+  int64_t responses;
+};
+
+// Request listener for the server side of the loopback benchmark.
+class NullRequestListener : public server::RequestListener {
+ public:
+  virtual void OnKeyEvent(messages::Code keycode, messages::Action action) {}
+  virtual void OnMouseEvent(int32_t x_delta, int32_t y_delta) {}
+  virtual void OnMouseWheel(int32_t x_scroll, int32_t y_scroll) {}
+  virtual void OnData(const std::string& type, const std::string& data) {}
+  virtual void OnConnect(const std::string& device_name, int32_t version) {}
+  virtual bool OnFling(const std::string& uri) { return true; }
+  virtual void OnError() {}
+};
+
+// Wire interface that counts and discards the writes it is handed.
+class CountingWireInterface : public wire::WireInterface {
+ public:
+  CountingWireInterface() : sends(0), bytes_sent(0) {}
+
+  virtual void Send(const std::vector<uint8_t>& data) {
+    sends++;
+    bytes_sent += data.size();
+  }
+
+  virtual void SendOwned(std::vector<uint8_t>* data) {
+    sends++;
+    bytes_sent += data->size();
+    data->swap(spare_);
+  }
+
+  virtual void Receive(size_t num_bytes) {}
+
+  int64_t sends;
+  int64_t bytes_sent;
+
+ private:
+  std::vector<uint8_t> spare_;
+};
+
+// A typical search query.
+const char kSearchText[] = "Live Sports Tonight";
+
+}  // namespace
+
+// Measures sending a d-pad press and release through a session.
+static void BM_SendKeyEventDpad(bench::State* state) {
+  CountingWireInterface interface;
+  wire::ProtobufWireAdapter adapter(&interface);
+  CountingAnymoteListener listener;
+  DeviceSession session(&adapter, &listener);
+  session.StartSession();
+
+  state->ResetTiming();
+  for (int64_t i = 0; i < state->iterations(); ++i) {
+    session.SendKeyEvent(messages::KEYCODE_DPAD_RIGHT, messages::DOWN);
+    session.SendKeyEvent(messages::KEYCODE_DPAD_RIGHT, messages::UP);
+  }
+  state->set_bytes_processed(interface.bytes_sent);
+}
+BENCHMARK(BM_SendKeyEventDpad);
+
+// Measures typing a search query with one key event per call, as callers
+// did before SendText, including the shift presses.
+static void BM_TypeTextKeyEvents(bench::State* state) {
+  CountingWireInterface interface;
+  wire::ProtobufWireAdapter adapter(&interface);
+  CountingAnymoteListener listener;
+  DeviceSession session(&adapter, &listener);
+  session.StartSession();
+  const std::string text(kSearchText);
+
+  state->ResetTiming();
+  for (int64_t i = 0; i < state->iterations(); ++i) {
+    for (size_t j = 0; j < text.size(); ++j) {
+      KeyStroke stroke;
+      if (!LookupKeyStroke(text[j], &stroke)) {
+        continue;
+      }
+      if (stroke.shift) {
+        session.SendKeyEvent(messages::KEYCODE_SHIFT_LEFT, messages::DOWN);
+      }
+      session.SendKeyEvent(stroke.keycode, messages::DOWN);
+      session.SendKeyEvent(stroke.keycode, messages::UP);
+      if (stroke.shift) {
+        session.SendKeyEvent(messages::KEYCODE_SHIFT_LEFT, messages::UP);
+      }
+    }
+  }
+  state->set_bytes_processed(interface.bytes_sent);
+  bench::DoNotOptimize(interface.sends);
+}
+BENCHMARK(BM_TypeTextKeyEvents);
+
+// Measures typing the same query with SendText.
+static void BM_TypeTextSendText(bench::State* state) {
+  CountingWireInterface interface;
+  wire::ProtobufWireAdapter adapter(&interface);
+  CountingAnymoteListener listener;
+  DeviceSession session(&adapter, &listener);
+  session.StartSession();
+  const std::string text(kSearchText);
+
+  state->ResetTiming();
+  for (int64_t i = 0; i < state->iterations(); ++i) {
+    session.SendText(text);
+  }
+  state->set_bytes_processed(interface.bytes_sent);
+  bench::DoNotOptimize(interface.sends);
+}
+BENCHMARK(BM_TypeTextSendText);
+
+// Measures dispatching a received message to the listener.
+static void RunOnMessage(bench::State* state,
+                         const messages::RemoteMessage& message) {
+  wire::LoopbackWireInterface interface;
+  wire::ProtobufWireAdapter adapter(&interface);
+  CountingAnymoteListener listener;
+  DeviceSession session(&adapter, &listener);
+
+  state->ResetTiming();
+  for (int64_t i = 0; i < state->iterations(); ++i) {
+    session.OnMessage(message);
+  }
+  bench::DoNotOptimize(listener.acks + listener.responses);
+}
+
+static void BM_OnMessageAck(bench::State* state) {
+  messages::RemoteMessage message;
+  message.set_sequence_number(1);
+  message.mutable_response_message();
+  RunOnMessage(state, message);
+}
+BENCHMARK(BM_OnMessageAck);
+
+static void BM_OnMessageFlingResult(bench::State* state) {
+  messages::RemoteMessage message;
+  message.set_sequence_number(1);
+  message.mutable_response_message()->mutable_fling_result_message()
+      ->set_result(messages::FlingResult_Result_SUCCESS);
+  RunOnMessage(state, message);
+}
+BENCHMARK(BM_OnMessageFlingResult);
+
+static void BM_OnMessageData(bench::State* state) {
+  messages::RemoteMessage message;
+  messages::Data* data =
+      message.mutable_response_message()->mutable_data_message();
+  data->set_type("com.google.tv.benchmark");
+  data->set_data(std::string(256, 'x'));
+  RunOnMessage(state, message);
+}
+BENCHMARK(BM_OnMessageData);
+
+// Measures the round trip of a ping and its ack through a session, a pair of
+// adapters and an in-memory connection, entirely on one thread.
+static void BM_LoopbackPingRtt(bench::State* state) {
+  wire::LoopbackWireInterface device_interface;
+  wire::LoopbackWireInterface server_interface;
+  wire::LoopbackWireInterface::Connect(&device_interface, &server_interface);
+
+  wire::ProtobufWireAdapter device_adapter(
+      &device_interface, wire::ProtobufWireAdapter::kStreamingReads);
+  CountingAnymoteListener listener;
+  DeviceSession session(&device_adapter, &listener);
+  session.StartSession();
+
+  wire::ProtobufWireAdapter server_adapter(
+      &server_interface, wire::ProtobufWireAdapter::kStreamingReads);
+  NullRequestListener server_listener;
+  server::ServerSession server(&server_adapter, &server_listener);
+  server.StartSession();
+
+  state->ResetTiming();
+  for (int64_t i = 0; i < state->iterations(); ++i) {
+    int64_t acks = listener.acks;
+    session.SendPing();
+    while (listener.acks == acks) {
+      server_interface.Pump();
+      device_interface.Pump();
+    }
+  }
+}
+BENCHMARK_LATENCY(BM_LoopbackPingRtt);
+
+}  // namespace device
+}  // namespace anymote
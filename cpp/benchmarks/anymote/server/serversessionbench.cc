@@ -0,0 +1,119 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks for ServerSession.
+
+#include <anymote/server/serversession.h>
+#include <anymote/wire/protobufwireadapter.h>
+#include <string>
+#include <vector>
+#include "anymote/benchmark.h"
+
+namespace anymote {
+namespace server {
+
+namespace {
+
+// Listener that counts the requests it receives.
+class CountingRequestListener : public RequestListener {
+ public:
+  CountingRequestListener() : requests(0) {}
+  virtual void OnKeyEvent(messages::Code keycode, messages::Action action) {
+    requests++;
+  }
+  virtual void OnMouseEvent(int32_t x_delta, int32_t y_delta) {
+    requests++;
+  }
+  virtual void OnMouseWheel(int32_t x_scroll, int32_t y_scroll) {
+    requests++;
+  }
+  virtual void OnData(const std::string& type, const std::string& data) {
+    requests++;
+  }
+  virtual void OnConnect(const std::string& device_name, int32_t version) {
+    requests++;
+  }
+  virtual bool OnFling(const std::string& uri) {
+    requests++;
+    return true;
+  }
+  virtual void OnError() {}
+
+  int64_t requests;
+};
+
+// Wire interface that discards everything sent, trading buffers with the
+// adapter as a transport recycling its write buffers would.
+class DiscardingWireInterface : public wire::WireInterface {
+ public:
+  virtual void Send(const std::vector<uint8_t>& data) {}
+
+  virtual void SendOwned(std::vector<uint8_t>* data) {
+    data->swap(spare_);
+  }
+
+  virtual void Receive(size_t num_bytes) {}
+
+ private:
+  std::vector<uint8_t> spare_;
+};
+
+}  // namespace
+
+// Measures dispatching a received request to the listener, including sending
+// the response, if any, through an adapter.
+static void RunOnMessage(bench::State* state,
+                         const messages::RemoteMessage& message) {
+  DiscardingWireInterface interface;
+  wire::ProtobufWireAdapter adapter(&interface);
+  CountingRequestListener listener;
+  ServerSession session(&adapter, &listener);
+  session.StartSession();
+
+  state->ResetTiming();
+  for (int64_t i = 0; i < state->iterations(); ++i) {
+    session.OnMessage(message);
+  }
+  bench::DoNotOptimize(listener.requests);
+}
+
+static void BM_ServerOnMessageKeyEvent(bench::State* state) {
+  messages::RemoteMessage message;
+  messages::KeyEvent* key_event =
+      message.mutable_request_message()->mutable_key_event_message();
+  key_event->set_keycode(messages::KEYCODE_DPAD_CENTER);
+  key_event->set_action(messages::DOWN);
+  RunOnMessage(state, message);
+}
+BENCHMARK(BM_ServerOnMessageKeyEvent);
+
+static void BM_ServerOnMessagePing(bench::State* state) {
+  messages::RemoteMessage message;
+  message.set_sequence_number(1);
+  message.mutable_request_message();
+  RunOnMessage(state, message);
+}
+BENCHMARK(BM_ServerOnMessagePing);
+
+static void BM_ServerOnMessageFling(bench::State* state) {
+  messages::RemoteMessage message;
+  message.set_sequence_number(1);
+  message.mutable_request_message()->mutable_fling_message()
+      ->set_uri("http://www.google.com/tv");
+  RunOnMessage(state, message);
+}
+BENCHMARK(BM_ServerOnMessageFling);
+
+}  // namespace server
+}  // namespace anymote
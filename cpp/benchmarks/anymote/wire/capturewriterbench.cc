@@ -0,0 +1,56 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks for CaptureWriter.
+
+#include <anymote/wire/capturewriter.h>
+#include <vector>
+#include "anymote/benchmark.h"
+
+namespace anymote {
+namespace wire {
+
+// Measures capturing frames of the given size to /dev/null with the real
+// clock, which is the cost a session pays per message with capture on. Each
+// iteration captures one frame.
+static void RunCapture(bench::State* state, size_t frame_size) {
+  std::vector<uint8_t> frame(frame_size, 0x2a);
+  CaptureWriter writer(util::Clock::GetRealClock());
+  if (!writer.Open("/dev/null")) {
+    return;
+  }
+
+  state->ResetTiming();
+  for (int64_t i = 0; i < state->iterations(); ++i) {
+    writer.OnFrame(i % 2 ? FrameTap::kSent : FrameTap::kReceived, &frame[0],
+                   frame.size());
+  }
+  writer.Close();
+  state->set_bytes_processed(state->iterations() * frame_size);
+}
+
+// Key events and other small messages.
+static void BM_CaptureSmallFrames(bench::State* state) {
+  RunCapture(state, 8);
+}
+BENCHMARK(BM_CaptureSmallFrames);
+
+// Data messages.
+static void BM_CaptureMediumFrames(bench::State* state) {
+  RunCapture(state, 300);
+}
+BENCHMARK(BM_CaptureMediumFrames);
+
+}  // namespace wire
+}  // namespace anymote
@@ -0,0 +1,143 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks for FrameDecoder.
+
+#include <anymote/wire/framedecoder.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <vector>
+#include "anymote/benchmark.h"
+
+using ::google::protobuf::io::CodedOutputStream;
+
+namespace anymote {
+namespace wire {
+
+namespace {
+
+// Handler that only counts frames and their bytes.
+class CountingHandler : public FrameDecoder::Handler {
+ public:
+  CountingHandler() : frames(0), bytes(0) {}
+  virtual void OnFrame(const uint8_t* data, size_t size) {
+    frames++;
+    bytes += size;
+  }
+  int64_t frames;
+  int64_t bytes;
+};
+
+}  // namespace
+
+// The number of frames in the streams used by the benchmarks.
+static const int kStreamFrames = 256;
+
+// Serializes frames of the given size back to back.
+static std::vector<uint8_t> FrameStream(size_t frame_size) {
+  std::vector<uint8_t> stream;
+  for (int i = 0; i < kStreamFrames; ++i) {
+    uint8_t preamble[FrameDecoder::kMaxPreambleSize];
+    uint8_t* end = CodedOutputStream::WriteVarint32ToArray(frame_size,
+                                                           preamble);
+    stream.insert(stream.end(), preamble, end);
+    stream.insert(stream.end(), frame_size, static_cast<uint8_t>(i));
+  }
+  return stream;
+}
+
+// Measures decoding a stream of frames fed in chunks of the given size. Each
+// iteration decodes one frame.
+static void RunDecode(bench::State* state, size_t frame_size,
+                      size_t chunk_size) {
+  std::vector<uint8_t> stream = FrameStream(frame_size);
+  FrameDecoder decoder;
+  CountingHandler handler;
+
+  state->ResetTiming();
+  while (handler.frames < state->iterations()) {
+    for (size_t offset = 0;
+         offset < stream.size() && handler.frames < state->iterations();
+         offset += chunk_size) {
+      size_t size = stream.size() - offset;
+      decoder.Decode(&stream[offset], size < chunk_size ? size : chunk_size,
+                     &handler);
+    }
+  }
+  state->set_bytes_processed(handler.bytes);
+}
+
+// Key events and other small messages, delivered in one read.
+static void BM_DecodeSmallBulk(bench::State* state) {
+  RunDecode(state, 8, 1 << 20);
+}
+BENCHMARK(BM_DecodeSmallBulk);
+
+// Small messages delivered a byte at a time, the worst case for resuming.
+static void BM_DecodeSmallSingleBytes(bench::State* state) {
+  RunDecode(state, 8, 1);
+}
+BENCHMARK(BM_DecodeSmallSingleBytes);
+
+// Small messages delivered in reads that split some frames and preambles.
+static void BM_DecodeSmallOddChunks(bench::State* state) {
+  RunDecode(state, 8, 37);
+}
+BENCHMARK(BM_DecodeSmallOddChunks);
+
+// Data messages with a two byte preamble, delivered in segment sized reads.
+static void BM_DecodeMediumSegments(bench::State* state) {
+  RunDecode(state, 300, 1448);
+}
+BENCHMARK(BM_DecodeMediumSegments);
+
+// Large payloads with a three byte preamble, delivered in segment sized
+// reads so that every frame is reassembled.
+static void BM_DecodeLargeSegments(bench::State* state) {
+  RunDecode(state, 20000, 1448);
+}
+BENCHMARK(BM_DecodeLargeSegments);
+
+// Measures decoding varints of the given value, from a buffer long enough for
+// the word at a time scan.
+static void RunDecodeVarint32(bench::State* state, uint32_t value) {
+  uint8_t bytes[16] = {0};
+  CodedOutputStream::WriteVarint32ToArray(value, bytes);
+
+  state->ResetTiming();
+  for (int64_t i = 0; i < state->iterations(); ++i) {
+    uint32_t decoded;
+    bench::DoNotOptimize(bytes);
+    bench::DoNotOptimize(FrameDecoder::DecodeVarint32(bytes, sizeof(bytes),
+                                                      &decoded));
+    bench::DoNotOptimize(decoded);
+  }
+}
+
+static void BM_DecodeVarint32OneByte(bench::State* state) {
+  RunDecodeVarint32(state, 100);
+}
+BENCHMARK(BM_DecodeVarint32OneByte);
+
+static void BM_DecodeVarint32ThreeBytes(bench::State* state) {
+  RunDecodeVarint32(state, 20000);
+}
+BENCHMARK(BM_DecodeVarint32ThreeBytes);
+
+static void BM_DecodeVarint32FiveBytes(bench::State* state) {
+  RunDecodeVarint32(state, 0xFFFFFFFF);
+}
+BENCHMARK(BM_DecodeVarint32FiveBytes);
+
+}  // namespace wire
+}  // namespace anymote
@@ -0,0 +1,86 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks for LoopbackWireInterface.
+
+#include <anymote/wire/loopbackwireinterface.h>
+#include <vector>
+#include "anymote/benchmark.h"
+
+namespace anymote {
+namespace wire {
+
+namespace {
+
+// Wire listener that counts the bytes it receives and asks for more.
+class CountingWireListener : public WireListener {
+ public:
+  explicit CountingWireListener(LoopbackWireInterface* interface)
+      : bytes(0), interface_(interface) {}
+  virtual void OnBytesReceived(const std::vector<uint8_t>& data) {
+    OnBufferReceived(&data[0], data.size());
+  }
+  virtual void OnBufferReceived(const uint8_t* data, size_t size) {
+    bytes += size;
+    interface_->ReceiveAvailable();
+  }
+  virtual void OnError() {}
+
+  int64_t bytes;
+
+ private:
+  LoopbackWireInterface* interface_;
+};
+
+}  // namespace
+
+// Measures sending a buffer of the given size and pumping it to the
+// listener of the peer. Each iteration transfers one buffer.
+static void RunTransfer(bench::State* state, size_t size,
+                        LoopbackWireInterface::Chunking chunking) {
+  LoopbackWireInterface::Options options;
+  options.chunking = chunking;
+  LoopbackWireInterface sender;
+  LoopbackWireInterface receiver(options);
+  LoopbackWireInterface::Connect(&sender, &receiver);
+  CountingWireListener listener(&receiver);
+  receiver.set_listener(&listener);
+  receiver.ReceiveAvailable();
+  std::vector<uint8_t> data(size, 0x5a);
+
+  state->ResetTiming();
+  for (int64_t i = 0; i < state->iterations(); ++i) {
+    sender.SendOwned(&data);
+    receiver.Pump();
+  }
+  state->set_bytes_processed(listener.bytes);
+}
+
+static void BM_TransferCoalesced64(bench::State* state) {
+  RunTransfer(state, 64, LoopbackWireInterface::kCoalesced);
+}
+BENCHMARK(BM_TransferCoalesced64);
+
+static void BM_TransferCoalesced4K(bench::State* state) {
+  RunTransfer(state, 4096, LoopbackWireInterface::kCoalesced);
+}
+BENCHMARK(BM_TransferCoalesced4K);
+
+static void BM_TransferSingleBytes64(bench::State* state) {
+  RunTransfer(state, 64, LoopbackWireInterface::kSingleBytes);
+}
+BENCHMARK(BM_TransferSingleBytes64);
+
+}  // namespace wire
+}  // namespace anymote
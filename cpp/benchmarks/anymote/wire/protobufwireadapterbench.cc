@@ -0,0 +1,303 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks for ProtobufWireAdapter.
+
+#include <anymote/wire/framecache.h>
+#include <anymote/wire/protobufwireadapter.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <string>
+#include <vector>
+#include "anymote/benchmark.h"
+
+namespace anymote {
+namespace wire {
+
+namespace {
+
+// Wire interface that discards everything sent, trading buffers with the
+// adapter as a transport recycling its write buffers would.
+class NullWireInterface : public WireInterface {
+ public:
+  NullWireInterface() : bytes_sent(0) {}
+
+  virtual void Send(const std::vector<uint8_t>& data) {
+    bytes_sent += data.size();
+  }
+
+  virtual void SendOwned(std::vector<uint8_t>* data) {
+    bytes_sent += data->size();
+    data->swap(spare_);
+  }
+
+  virtual void Receive(size_t num_bytes) {
+    requested = num_bytes;
+  }
+
+  virtual void ReceiveAvailable() {
+    requested = 0;
+  }
+
+  int64_t bytes_sent;
+
+  // The size of the last receive request, 0 meaning any available bytes.
+  size_t requested;
+
+ private:
+  std::vector<uint8_t> spare_;
+};
+
+// Listener that counts the messages it receives.
+class CountingMessageListener : public messages::MessageListener {
+ public:
+  CountingMessageListener() : count(0) {}
+  virtual void OnMessage(const messages::RemoteMessage& message) { count++; }
+  virtual void OnError() {}
+  int64_t count;
+};
+
+}  // namespace
+
+// Measures sending a message through the adapter.
+static void RunSendMessage(bench::State* state,
+                           const messages::RemoteMessage& message) {
+  NullWireInterface interface;
+  ProtobufWireAdapter adapter(&interface);
+  adapter.Init();
+
+  // Let the buffers reach their steady-state size.
+  adapter.SendMessage(message);
+  adapter.SendMessage(message);
+  interface.bytes_sent = 0;
+
+  state->ResetTiming();
+  for (int64_t i = 0; i < state->iterations(); ++i) {
+    adapter.SendMessage(message);
+  }
+  state->set_bytes_processed(interface.bytes_sent);
+}
+
+static void BM_SendMessagePing(bench::State* state) {
+  messages::RemoteMessage message;
+  message.set_sequence_number(1);
+  message.mutable_request_message();
+  RunSendMessage(state, message);
+}
+BENCHMARK(BM_SendMessagePing);
+
+// Returns a key event message.
+static messages::RemoteMessage KeyEventMessage() {
+  messages::RemoteMessage message;
+  messages::KeyEvent* key_event =
+      message.mutable_request_message()->mutable_key_event_message();
+  key_event->set_keycode(messages::KEYCODE_DPAD_CENTER);
+  key_event->set_action(messages::DOWN);
+  return message;
+}
+
+static void BM_SendMessageKeyEvent(bench::State* state) {
+  RunSendMessage(state, KeyEventMessage());
+}
+BENCHMARK(BM_SendMessageKeyEvent);
+
+// Measures sending the same key event from the frame cache.
+static void BM_SendEncodedFrameKeyEvent(bench::State* state) {
+  NullWireInterface interface;
+  ProtobufWireAdapter adapter(&interface);
+  adapter.Init();
+  size_t size = 0;
+  const uint8_t* frame = FrameCache::Get()->KeyEventFrame(
+      messages::KEYCODE_DPAD_CENTER, messages::DOWN, &size);
+
+  state->ResetTiming();
+  for (int64_t i = 0; i < state->iterations(); ++i) {
+    adapter.SendEncodedFrame(frame, size);
+  }
+  state->set_bytes_processed(interface.bytes_sent);
+}
+BENCHMARK(BM_SendEncodedFrameKeyEvent);
+
+static void BM_SendMessageMouseEvent(bench::State* state) {
+  messages::RemoteMessage message;
+  messages::MouseEvent* mouse_event =
+      message.mutable_request_message()->mutable_mouse_event_message();
+  mouse_event->set_x_delta(-12);
+  mouse_event->set_y_delta(7);
+  RunSendMessage(state, message);
+}
+BENCHMARK(BM_SendMessageMouseEvent);
+
+static void BM_SendMessageMouseWheel(bench::State* state) {
+  messages::RemoteMessage message;
+  messages::MouseWheel* mouse_wheel =
+      message.mutable_request_message()->mutable_mouse_wheel_message();
+  mouse_wheel->set_x_scroll(0);
+  mouse_wheel->set_y_scroll(-3);
+  RunSendMessage(state, message);
+}
+BENCHMARK(BM_SendMessageMouseWheel);
+
+static void BM_SendMessageData(bench::State* state) {
+  messages::RemoteMessage message;
+  messages::Data* data =
+      message.mutable_request_message()->mutable_data_message();
+  data->set_type("com.google.tv.benchmark");
+  data->set_data(std::string(256, 'x'));
+  RunSendMessage(state, message);
+}
+BENCHMARK(BM_SendMessageData);
+
+static void BM_SendMessageConnect(bench::State* state) {
+  messages::RemoteMessage message;
+  messages::Connect* connect =
+      message.mutable_request_message()->mutable_connect_message();
+  connect->set_device_name("benchmark");
+  connect->set_version(1);
+  RunSendMessage(state, message);
+}
+BENCHMARK(BM_SendMessageConnect);
+
+static void BM_SendMessageFling(bench::State* state) {
+  messages::RemoteMessage message;
+  message.set_sequence_number(1);
+  message.mutable_request_message()->mutable_fling_message()
+      ->set_uri("http://www.google.com/tv");
+  RunSendMessage(state, message);
+}
+BENCHMARK(BM_SendMessageFling);
+
+// The number of messages in the stream used by the receive benchmarks.
+static const int kStreamMessages = 256;
+
+// Serializes key event frames into a stream.
+// @param offsets Set to the offset of the end of each frame.
+static std::vector<uint8_t> KeyEventStream(std::vector<size_t>* offsets) {
+  std::string bytes = KeyEventMessage().SerializeAsString();
+  std::vector<uint8_t> stream;
+  for (int i = 0; i < kStreamMessages; ++i) {
+    // A key event is shorter than 128 bytes, so its preamble is one byte.
+    stream.push_back(static_cast<uint8_t>(bytes.size()));
+    stream.insert(stream.end(), bytes.begin(), bytes.end());
+    offsets->push_back(stream.size());
+  }
+  return stream;
+}
+
+// Measures receiving messages with framed reads, where the adapter requests
+// the preamble a byte at a time and then the exact message size.
+static void BM_ReceiveFramed(bench::State* state) {
+  std::vector<size_t> offsets;
+  std::vector<uint8_t> stream = KeyEventStream(&offsets);
+  NullWireInterface interface;
+  ProtobufWireAdapter adapter(&interface);
+  CountingMessageListener listener;
+  adapter.set_listener(&listener);
+  adapter.Init();
+
+  state->ResetTiming();
+  size_t offset = 0;
+  while (listener.count < state->iterations()) {
+    if (offset == stream.size()) {
+      offset = 0;
+    }
+    size_t size = interface.requested;
+    adapter.OnBufferReceived(&stream[offset], size);
+    offset += size;
+  }
+  state->set_bytes_processed(state->iterations() * offsets[0]);
+}
+BENCHMARK(BM_ReceiveFramed);
+
+// Measures receiving messages in streaming mode, delivered a byte at a time.
+static void BM_ReceiveStreamSingleBytes(bench::State* state) {
+  std::vector<size_t> offsets;
+  std::vector<uint8_t> stream = KeyEventStream(&offsets);
+  NullWireInterface interface;
+  ProtobufWireAdapter adapter(&interface,
+                              ProtobufWireAdapter::kStreamingReads);
+  CountingMessageListener listener;
+  adapter.set_listener(&listener);
+  adapter.Init();
+
+  state->ResetTiming();
+  size_t offset = 0;
+  while (listener.count < state->iterations()) {
+    if (offset == stream.size()) {
+      offset = 0;
+    }
+    adapter.OnBufferReceived(&stream[offset++], 1);
+  }
+  state->set_bytes_processed(state->iterations() * offsets[0]);
+}
+BENCHMARK(BM_ReceiveStreamSingleBytes);
+
+// Measures receiving messages in streaming mode, delivered in bulk.
+static void BM_ReceiveStreamBulk(bench::State* state) {
+  std::vector<size_t> offsets;
+  std::vector<uint8_t> stream = KeyEventStream(&offsets);
+  NullWireInterface interface;
+  ProtobufWireAdapter adapter(&interface,
+                              ProtobufWireAdapter::kStreamingReads);
+  CountingMessageListener listener;
+  adapter.set_listener(&listener);
+  adapter.Init();
+
+  state->ResetTiming();
+  while (listener.count < state->iterations()) {
+    int64_t remaining = state->iterations() - listener.count;
+    int messages = remaining < kStreamMessages ? remaining : kStreamMessages;
+    adapter.OnBufferReceived(&stream[0], offsets[messages - 1]);
+  }
+  state->set_bytes_processed(state->iterations() * offsets[0]);
+}
+BENCHMARK(BM_ReceiveStreamBulk);
+
+// Measures receiving data responses carrying a 1 KiB payload in streaming
+// mode, delivered in bulk. Parsing reuses the data strings of the previous
+// message.
+static void BM_ReceiveStreamDataResponses(bench::State* state) {
+  messages::RemoteMessage message;
+  message.set_sequence_number(1);
+  messages::Data* data =
+      message.mutable_response_message()->mutable_data_message();
+  data->set_type("com.google.tv.benchmark");
+  data->set_data(std::string(1024, 'x'));
+  std::string bytes = message.SerializeAsString();
+
+  std::vector<uint8_t> stream;
+  for (int i = 0; i < kStreamMessages; ++i) {
+    uint8_t preamble[5];
+    uint8_t* end = ::google::protobuf::io::CodedOutputStream::
+        WriteVarint32ToArray(bytes.size(), preamble);
+    stream.insert(stream.end(), preamble, end);
+    stream.insert(stream.end(), bytes.begin(), bytes.end());
+  }
+
+  NullWireInterface interface;
+  ProtobufWireAdapter adapter(&interface,
+                              ProtobufWireAdapter::kStreamingReads);
+  CountingMessageListener listener;
+  adapter.set_listener(&listener);
+  adapter.Init();
+
+  state->ResetTiming();
+  while (listener.count < state->iterations()) {
+    adapter.OnBufferReceived(&stream[0], stream.size());
+  }
+  state->set_bytes_processed(listener.count * bytes.size());
+}
+BENCHMARK(BM_ReceiveStreamDataResponses);
+
+}  // namespace wire
+}  // namespace anymote
@@ -44,6 +44,19 @@ class AnymoteListener {
   //                        sequence number.
   virtual void OnFlingResult(bool success, uint32_t sequence_number) = 0;
 
+  // Handles a change of the backpressure state of the session. While the
+  // session is congested it holds back movements and defers data and fling
+  // requests, so the listener may want to slow down its input too. See
+  // DeviceSession::EnableBackpressure.
+  //
+  // Notifications may be invoked from any thread that sends on the session,
+  // but never concurrently. They alternate and follow the order of the state
+  // changes, though a change that is undone before it is reported may not be
+  // reported at all.
+  //
+  // @param congested Whether the session is now congested.
+  virtual void OnBackpressure(bool congested) {}
+
   // Handles an Anymote error. This should be treated as a fatal error and the
   // session should be aborted.
   virtual void OnError() = 0;
@@ -13,124 +13,592 @@
 // limitations under the License.
 
 #include <glog/logging.h>
+#include <limits>
+#include <utility>
+#include <vector>
 #include "anymote/device/devicesession.h"
+#include "anymote/device/keymap.h"
 #include "anymote/messages/remote.pb.h"
+#include "anymote/messages/threadmessage.h"
 
-using ::anymote::messages::RemoteMessage;
 using ::anymote::messages::RequestMessage;
 using ::anymote::messages::ResponseMessage;
+using ::anymote::messages::ThreadMessage;
 
 namespace anymote {
 namespace device {
 
+namespace {
+
+// Records the time spent in a listener callback, from its construction to its
+// destruction.
+class ListenerTimer {
+ public:
+  // @param histograms The histograms to record into, or NULL.
+  explicit ListenerTimer(SessionHistograms* histograms)
+      : histogram_(histograms ? &histograms->listener_nanos : NULL),
+        start_nanos_(util::kMetricsEnabled && histogram_ ?
+                     util::Clock::GetRealClock()->NowNanos() : 0) {
+  }
+
+  ~ListenerTimer() {
+    if (util::kMetricsEnabled && histogram_) {
+      histogram_->Record(
+          util::Clock::GetRealClock()->NowNanos() - start_nanos_);
+    }
+  }
+
+ private:
+  util::Histogram* histogram_;
+  int64_t start_nanos_;
+};
+
+}  // namespace
+
 DeviceSession::DeviceSession(wire::WireAdapter* adapter,
                              AnymoteListener* listener)
+    : DeviceSession(adapter, listener, NULL) {
+  owned_histograms_ = new SessionHistograms;
+  metrics_.histograms = owned_histograms_;
+}
+
+DeviceSession::DeviceSession(wire::WireAdapter* adapter,
+                             AnymoteListener* listener,
+                             SessionHistograms* histograms)
     : adapter_(adapter),
       listener_(listener),
-      ping_counter_(0) {
+      frame_cache_(wire::FrameCache::Get()),
+      ping_counter_(0),
+      pending_requests_(NULL),
+      motion_clock_(NULL),
+      motion_interval_micros_(0),
+      last_motion_sent_micros_(0),
+      pending_motion_(kNoMotion),
+      pending_x_(0),
+      pending_y_(0),
+      motion_events_merged_(0),
+      motion_messages_sent_(0),
+      motion_events_dropped_(0),
+      backpressure_enabled_(false),
+      congested_(false),
+      reported_congested_(false),
+      notifying_backpressure_(false),
+      resuming_(false),
+      requests_deferred_(0),
+      requests_dropped_(0),
+      messages_received_(0),
+      last_ack_sequence_number_(0),
+      metrics_(histograms),
+      owned_histograms_(NULL) {
   CHECK_NOTNULL(adapter);
   CHECK_NOTNULL(listener);
 }
 
+DeviceSession::~DeviceSession() {
+  delete pending_requests_;
+  delete owned_histograms_;
+}
+
 void DeviceSession::StartSession() {
   adapter_->set_listener(this);
   adapter_->Init();
 }
 
-void DeviceSession::SendPing() {
-  RequestMessage request;
-  SendRequestWithSequence(request, ++ping_counter_);
+int32_t DeviceSession::SendPing() {
+  UpdateBackpressure();
+  FlushPendingMotion();
+  int32_t sequence_number = ++ping_counter_;
+  StartRequest();
+  SendRequest(kPingRequest, sequence_number, NULL);
+  return sequence_number;
+}
+
+int32_t DeviceSession::SendPing(RequestCallback* callback) {
+  CHECK(pending_requests_) << "Request tracking is not enabled";
+  UpdateBackpressure();
+  FlushPendingMotion();
+  int32_t sequence_number = ++ping_counter_;
+  StartRequest();
+  SendRequest(kPingRequest, sequence_number, callback);
+  return sequence_number;
 }
 
 void DeviceSession::SendKeyEvent(messages::Code keycode,
                                  messages::Action action) {
-  RequestMessage request;
-  request.mutable_key_event_message()->set_keycode(keycode);
-  request.mutable_key_event_message()->set_action(action);
-  SendRequest(request);
+  UpdateBackpressure();
+  FlushPendingMotion();
+  SendKey(keycode, action);
+}
+
+size_t DeviceSession::SendText(const std::string& text) {
+  UpdateBackpressure();
+  FlushPendingMotion();
+
+  size_t typed = 0;
+  bool shifted = false;
+  adapter_->BeginBatch();
+  for (std::string::const_iterator it = text.begin(); it != text.end();
+       ++it) {
+    KeyStroke stroke;
+    if (!LookupKeyStroke(*it, &stroke)) {
+      continue;
+    }
+    if (stroke.shift != shifted) {
+      SendKey(messages::KEYCODE_SHIFT_LEFT,
+              stroke.shift ? messages::DOWN : messages::UP);
+      shifted = stroke.shift;
+    }
+    SendKey(stroke.keycode, messages::DOWN);
+    SendKey(stroke.keycode, messages::UP);
+    typed++;
+  }
+  if (shifted) {
+    SendKey(messages::KEYCODE_SHIFT_LEFT, messages::UP);
+  }
+  adapter_->Flush();
+  return typed;
 }
 
 void DeviceSession::SendMouseMove(int x_delta, int y_delta) {
-  RequestMessage request;
-  request.mutable_mouse_event_message()->set_x_delta(x_delta);
-  request.mutable_mouse_event_message()->set_y_delta(y_delta);
-  SendRequest(request);
+  UpdateBackpressure();
+  if (motion_clock_ || congested_) {
+    std::lock_guard<std::mutex> lock(motion_mutex_);
+    CoalesceMotion(kMouseMove, x_delta, y_delta);
+  } else {
+    SendMotion(kMouseMove, x_delta, y_delta);
+  }
 }
 
 void DeviceSession::SendMouseWheel(int x_scroll, int y_scroll) {
-  RequestMessage request;
-  request.mutable_mouse_wheel_message()->set_x_scroll(x_scroll);
-  request.mutable_mouse_wheel_message()->set_y_scroll(y_scroll);
-  SendRequest(request);
+  UpdateBackpressure();
+  if (motion_clock_ || congested_) {
+    std::lock_guard<std::mutex> lock(motion_mutex_);
+    CoalesceMotion(kMouseWheel, x_scroll, y_scroll);
+  } else {
+    SendMotion(kMouseWheel, x_scroll, y_scroll);
+  }
 }
 
 void DeviceSession::SendData(const std::string& type,
                              const std::string& data) {
-  RequestMessage request;
-  request.mutable_data_message()->set_type(type);
-  request.mutable_data_message()->set_data(data);
-  SendRequest(request);
+  UpdateBackpressure();
+  FlushPendingMotion();
+  messages::Data* data_message = StartRequest()->mutable_data_message();
+  data_message->set_type(type);
+  data_message->set_data(data);
+  SendRequest(kDataRequest, 0, NULL);
+  ThreadMessage<DeviceSession>::Trim(data.size());
 }
 
 void DeviceSession::SendConnect(const std::string& device_name,
                                 int32_t version) {
-  RequestMessage request;
-  request.mutable_connect_message()->set_device_name(device_name);
-  request.mutable_connect_message()->set_version(version);
-  SendRequest(request);
+  UpdateBackpressure();
+  FlushPendingMotion();
+  messages::Connect* connect = StartRequest()->mutable_connect_message();
+  connect->set_device_name(device_name);
+  connect->set_version(version);
+  SendRequest(kConnectRequest, 0, NULL);
 }
 
-void DeviceSession::SendFling(std::string uri, int32_t sequence_number) {
-  RequestMessage request;
-  request.mutable_fling_message()->set_uri(uri);
-  SendRequestWithSequence(request, sequence_number);
+void DeviceSession::SendFling(const std::string& uri,
+                              int32_t sequence_number) {
+  UpdateBackpressure();
+  FlushPendingMotion();
+  StartRequest()->mutable_fling_message()->set_uri(uri);
+  SendRequest(kFlingRequest, sequence_number, NULL);
 }
 
-void DeviceSession::SendRequest(const messages::RequestMessage& request) {
-  SendRequestWithSequence(request, 0);
+void DeviceSession::SendFling(const std::string& uri, int32_t sequence_number,
+                              RequestCallback* callback) {
+  CHECK(pending_requests_) << "Request tracking is not enabled";
+  UpdateBackpressure();
+  FlushPendingMotion();
+  StartRequest()->mutable_fling_message()->set_uri(uri);
+  SendRequest(kFlingRequest, sequence_number, callback);
 }
 
-void DeviceSession::SendRequestWithSequence(
-    const messages::RequestMessage& request,
-    int32_t sequence_number) {
-  CHECK_GE(sequence_number, 0) << "Sequence number must not be negative";
+void DeviceSession::EnableRequestTracking(int64_t timeout_micros,
+                                          util::Clock* clock) {
+  CHECK_NOTNULL(clock);
+  CHECK(pending_requests_ == NULL) << "Request tracking already enabled";
+  pending_requests_ = new PendingRequests(timeout_micros, clock);
+  if (metrics_.histograms) {
+    pending_requests_->set_rtt_histogram(
+        &metrics_.histograms->ack_latency_micros);
+  }
+}
+
+int DeviceSession::ExpireRequests() {
+  if (pending_requests_ == NULL) {
+    return 0;
+  }
+  return pending_requests_->Expire();
+}
 
-  RemoteMessage message;
+void DeviceSession::EnableMotionCoalescing(int64_t interval_micros,
+                                           util::Clock* clock) {
+  CHECK_NOTNULL(clock);
+  CHECK_GE(interval_micros, 0) << "Interval must not be negative";
+  std::lock_guard<std::mutex> lock(motion_mutex_);
+  if (motion_clock_) {
+    FlushPendingMotionLocked();
+  }
+  motion_clock_ = clock;
+  motion_interval_micros_ = interval_micros;
+
+  // Allow the next movement to be sent immediately.
+  last_motion_sent_micros_ = clock->NowMicros() - interval_micros;
+}
+
+void DeviceSession::FlushPendingMotion() {
+  if (motion_clock_ == NULL && !backpressure_enabled_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(motion_mutex_);
+  FlushPendingMotionLocked();
+}
+
+void DeviceSession::FlushPendingMotionLocked() {
+  if (pending_motion_ == kNoMotion) {
+    return;
+  }
+
+  PendingMotion motion = pending_motion_;
+  pending_motion_ = kNoMotion;
+  if (motion_clock_) {
+    last_motion_sent_micros_ = motion_clock_->NowMicros();
+  }
+  motion_messages_sent_++;
+  SendMotion(motion, pending_x_, pending_y_);
+}
+
+int64_t DeviceSession::motion_flush_deadline_micros() {
+  std::lock_guard<std::mutex> lock(motion_mutex_);
+  // A movement held back by backpressure waits for the queue to drain.
+  if (pending_motion_ == kNoMotion || motion_clock_ == NULL || congested_) {
+    return -1;
+  }
+  return last_motion_sent_micros_ + motion_interval_micros_;
+}
+
+// Returns whether adding the given value would overflow the sum.
+static bool WouldOverflow(int sum, int value) {
+  return (value > 0 && sum > std::numeric_limits<int>::max() - value) ||
+      (value < 0 && sum < std::numeric_limits<int>::min() - value);
+}
+
+void DeviceSession::CoalesceMotion(PendingMotion motion, int x, int y) {
+  // The session may have resumed sending since the caller checked.
+  bool congested = congested_;
+
+  // Only one kind of movement is pending at a time so that mouse movements and
+  // wheel events stay in order.
+  if (pending_motion_ != kNoMotion &&
+      (pending_motion_ != motion ||
+       WouldOverflow(pending_x_, x) || WouldOverflow(pending_y_, y))) {
+    FlushPendingMotionLocked();
+  }
+
+  if (pending_motion_ == kNoMotion) {
+    pending_motion_ = motion;
+    pending_x_ = x;
+    pending_y_ = y;
+  } else if (congested &&
+             backpressure_options_.motion_policy == kDropOldestMotion) {
+    pending_x_ = x;
+    pending_y_ = y;
+    motion_events_dropped_++;
+  } else {
+    pending_x_ += x;
+    pending_y_ += y;
+    motion_events_merged_++;
+  }
+
+  if (!congested &&
+      (motion_clock_ == NULL ||
+       motion_clock_->NowMicros() - last_motion_sent_micros_
+           >= motion_interval_micros_)) {
+    FlushPendingMotionLocked();
+  }
+}
+
+void DeviceSession::SendKey(messages::Code keycode,
+                            messages::Action action) {
+  size_t size = 0;
+  const uint8_t* frame = frame_cache_->KeyEventFrame(keycode, action, &size);
+  if (frame != NULL && adapter_->SendEncodedFrame(frame, size)) {
+    metrics_.requests_sent[kKeyEventRequest].Increment();
+    return;
+  }
+
+  messages::KeyEvent* key_event = StartRequest()->mutable_key_event_message();
+  key_event->set_keycode(keycode);
+  key_event->set_action(action);
+  SendRequest(kKeyEventRequest, 0, NULL);
+}
+
+void DeviceSession::SendMotion(PendingMotion motion, int x, int y) {
+  RequestMessage* request = StartRequest();
+  if (motion == kMouseMove) {
+    messages::MouseEvent* mouse_event = request->mutable_mouse_event_message();
+    mouse_event->set_x_delta(x);
+    mouse_event->set_y_delta(y);
+  } else {
+    messages::MouseWheel* mouse_wheel = request->mutable_mouse_wheel_message();
+    mouse_wheel->set_x_scroll(x);
+    mouse_wheel->set_y_scroll(y);
+  }
+  SendRequest(motion == kMouseMove ? kMouseMoveRequest : kMouseWheelRequest,
+              0, NULL);
+}
+
+messages::RequestMessage* DeviceSession::StartRequest() {
+  // Clearing keeps the sub-messages and string buffers allocated, so filling
+  // in a request of a kind sent before does not allocate.
+  messages::RemoteMessage* message = ThreadMessage<DeviceSession>::Get();
+  message->Clear();
+  return message->mutable_request_message();
+}
+
+void DeviceSession::SendRequest(RequestType type, int32_t sequence_number,
+                                RequestCallback* callback) {
+  CHECK_GE(sequence_number, 0) << "Sequence number must not be negative";
+  messages::RemoteMessage* message = ThreadMessage<DeviceSession>::Get();
   if (sequence_number) {
-    message.set_sequence_number(sequence_number);
+    message->set_sequence_number(sequence_number);
+  }
+
+  if (congested_ && (type == kDataRequest || type == kFlingRequest) &&
+      DeferRequest(type, *message, callback)) {
+    return;
+  }
+  TransmitRequest(type, *message, callback);
+}
+
+void DeviceSession::TransmitRequest(RequestType type,
+                                    const messages::RemoteMessage& message,
+                                    RequestCallback* callback) {
+  // Track the request first, since the response may arrive on another thread
+  // as soon as it is sent.
+  if (callback) {
+    // Pings are answered by acks and flings by fling results, so a ping and
+    // a fling with the same sequence number do not answer each other.
+    pending_requests_->Add(
+        message.sequence_number(),
+        type == kFlingRequest ? kFlingResultResponse : kAckResponse,
+        callback);
   }
-  message.mutable_request_message()->CopyFrom(request);
+  metrics_.requests_sent[type].Increment();
   adapter_->SendMessage(message);
 }
 
+void DeviceSession::EnableBackpressure(const BackpressureOptions& options) {
+  CHECK_LE(options.low_watermark_bytes, options.high_watermark_bytes)
+      << "Low watermark must not be above the high watermark";
+  CHECK_GE(options.max_retries, 0) << "Retries must not be negative";
+  backpressure_options_ = options;
+  backpressure_enabled_ = true;
+}
+
+bool DeviceSession::CheckBackpressure() {
+  UpdateBackpressure();
+  if (!congested_) {
+    return false;
+  }
+
+  // Every held request has been retried as often as those behind it, so the
+  // oldest ones run out of retries first.
+  std::vector<DeferredRequest> dropped;
+  {
+    std::lock_guard<std::mutex> lock(backpressure_mutex_);
+    for (std::deque<DeferredRequest>::iterator it =
+             deferred_requests_.begin();
+         it != deferred_requests_.end(); ++it) {
+      it->retries++;
+    }
+    while (!deferred_requests_.empty() &&
+           deferred_requests_.front().retries >=
+               backpressure_options_.max_retries) {
+      DeferredRequest& request = deferred_requests_.front();
+      dropped.push_back(DeferredRequest());
+      dropped.back().message.Swap(&request.message);
+      dropped.back().type = request.type;
+      dropped.back().callback = request.callback;
+      deferred_requests_.pop_front();
+      requests_dropped_++;
+    }
+  }
+
+  for (size_t i = 0; i < dropped.size(); ++i) {
+    OnRequestDropped(dropped[i].type, dropped[i].message.sequence_number(),
+                     dropped[i].callback);
+  }
+  return true;
+}
+
+void DeviceSession::UpdateBackpressure() {
+  if (!backpressure_enabled_) {
+    return;
+  }
+
+  size_t queued = adapter_->queued_bytes();
+  if (congested_) {
+    if (queued <= backpressure_options_.low_watermark_bytes) {
+      ResumeSending();
+    }
+  } else if (queued >= backpressure_options_.high_watermark_bytes) {
+    {
+      std::lock_guard<std::mutex> lock(backpressure_mutex_);
+      congested_ = true;
+    }
+    NotifyBackpressure();
+  }
+}
+
+void DeviceSession::ResumeSending() {
+  {
+    std::lock_guard<std::mutex> lock(backpressure_mutex_);
+    if (!congested_ || resuming_) {
+      return;
+    }
+    resuming_ = true;
+  }
+
+  // The held requests are sent without the lock, so other senders keep
+  // deferring theirs meanwhile instead of waiting for the whole backlog.
+  // Requests deferred while sending are sent next, and the session stays
+  // congested until none are left, which keeps the requests in order.
+  std::deque<DeferredRequest> requests;
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(backpressure_mutex_);
+      if (deferred_requests_.empty()) {
+        congested_ = false;
+        resuming_ = false;
+        break;
+      }
+      requests.swap(deferred_requests_);
+    }
+
+    while (!requests.empty()) {
+      DeferredRequest& request = requests.front();
+      TransmitRequest(request.type, request.message, request.callback);
+      requests.pop_front();
+    }
+  }
+
+  FlushPendingMotion();
+  NotifyBackpressure();
+}
+
+void DeviceSession::NotifyBackpressure() {
+  for (;;) {
+    bool congested;
+    {
+      std::lock_guard<std::mutex> lock(backpressure_mutex_);
+      if (notifying_backpressure_ || reported_congested_ == congested_) {
+        return;
+      }
+      congested = congested_;
+      reported_congested_ = congested;
+      notifying_backpressure_ = true;
+    }
+
+    // The lock is released so that the listener may send on the session.
+    // Changes made meanwhile are reported by the loop.
+    listener_->OnBackpressure(congested);
+
+    std::lock_guard<std::mutex> lock(backpressure_mutex_);
+    notifying_backpressure_ = false;
+  }
+}
+
+bool DeviceSession::DeferRequest(RequestType type,
+                                 const messages::RemoteMessage& message,
+                                 RequestCallback* callback) {
+  {
+    std::lock_guard<std::mutex> lock(backpressure_mutex_);
+    if (!congested_) {
+      return false;
+    }
+    if (deferred_requests_.size() <
+        backpressure_options_.max_deferred_requests) {
+      deferred_requests_.push_back(DeferredRequest());
+      DeferredRequest& request = deferred_requests_.back();
+      request.message.CopyFrom(message);
+      request.type = type;
+      request.callback = callback;
+      request.retries = 0;
+      requests_deferred_++;
+      return true;
+    }
+    requests_dropped_++;
+  }
+
+  OnRequestDropped(type, message.sequence_number(), callback);
+  return true;
+}
+
+void DeviceSession::OnRequestDropped(RequestType type,
+                                     int32_t sequence_number,
+                                     RequestCallback* callback) {
+  VLOG(1) << "Dropped request of type " << type << " while congested";
+  if (type == kFlingRequest) {
+    ListenerTimer timer(metrics_.histograms);
+    listener_->OnFlingResult(false, sequence_number);
+  }
+
+  // The request was never sent, so it was never tracked.
+  if (callback) {
+    callback->OnRequestComplete(sequence_number, RequestCallback::kAborted,
+                                NULL, 0);
+  }
+}
+
 void DeviceSession::OnMessage(const messages::RemoteMessage& message) {
   const ResponseMessage& response = message.response_message();
   uint32_t sequence_number = message.has_sequence_number() ?
       message.sequence_number() : 0;
   bool empty = true;
+  messages_received_.fetch_add(1, std::memory_order_relaxed);
+
+  if (sequence_number && pending_requests_) {
+    pending_requests_->Complete(sequence_number, response);
+  }
 
   // Invoke the listener if the response has any of these messages.
   if (response.has_data_message()) {
     empty = false;
+    metrics_.responses_received[kDataResponse].Increment();
     const messages::Data& data = response.data_message();
+    ListenerTimer timer(metrics_.histograms);
     listener_->OnData(data.type(), data.data());
   }
 
   if (response.has_fling_result_message()) {
     empty = false;
+    metrics_.responses_received[kFlingResultResponse].Increment();
     bool success = response.fling_result_message().result()
         == messages::FlingResult_Result_SUCCESS;
+    ListenerTimer timer(metrics_.histograms);
     listener_->OnFlingResult(success, sequence_number);
   }
 
   // If the response was empty and there was a sequence number, treat it as an
   // ack.
   if (empty && sequence_number) {
+    last_ack_sequence_number_.store(sequence_number,
+                                    std::memory_order_relaxed);
+    metrics_.responses_received[kAckResponse].Increment();
+    ListenerTimer timer(metrics_.histograms);
     listener_->OnAck();
   }
 }
 
 void DeviceSession::OnError() {
+  if (pending_requests_) {
+    pending_requests_->AbortAll();
+  }
   listener_->OnError();
 }
 
@@ -15,10 +15,17 @@
 #ifndef ANYMOTE_DEVICE_DEVICESESSION_H_
 #define ANYMOTE_DEVICE_DEVICESESSION_H_
 
+#include <atomic>
+#include <deque>
+#include <mutex>
 #include <string>
 #include "anymote/device/anymotelistener.h"
+#include "anymote/device/pendingrequests.h"
+#include "anymote/device/sessionmetrics.h"
 #include "anymote/messages/keycodes.pb.h"
 #include "anymote/messages/messagelistener.h"
+#include "anymote/util/clock.h"
+#include "anymote/wire/framecache.h"
 #include "anymote/wire/wireadapter.h"
 
 namespace anymote {
@@ -33,9 +40,49 @@ namespace device {
 //   session.StartSession();
 //   session.SendConnect(device_name, version);
 //
-// Now the session can be used to call SendPing, SendKeyEvent, etc.
+// Now the session can be used to call SendPing, SendKeyEvent, etc. The Send
+// methods are thread-safe, so several threads may inject input into the same
+// session. Messages sent from one thread are sent in order.
 class DeviceSession : public messages::MessageListener {
  public:
+  // What a congested session does with the movements it holds back.
+  enum MotionPolicy {
+    // Sums the held movements, so that no displacement is lost.
+    kCoalesceMotion,
+
+    // Keeps only the latest movement, so that the pointer jumps to where the
+    // user is rather than replaying the stale path.
+    kDropOldestMotion,
+  };
+
+  // Limits on what a session sends while the transport cannot keep up. See
+  // EnableBackpressure.
+  struct BackpressureOptions {
+    BackpressureOptions()
+        : high_watermark_bytes(64 * 1024),
+          low_watermark_bytes(16 * 1024),
+          motion_policy(kCoalesceMotion),
+          max_deferred_requests(16),
+          max_retries(3) {
+    }
+
+    // The session becomes congested once the interface has this many bytes
+    // queued, and stops being congested once the queue has drained to the
+    // low watermark.
+    size_t high_watermark_bytes;
+    size_t low_watermark_bytes;
+
+    MotionPolicy motion_policy;
+
+    // The number of data and fling requests held while congested. Requests
+    // sent while this many are held are dropped.
+    size_t max_deferred_requests;
+
+    // The number of times CheckBackpressure may find the session still
+    // congested before the oldest held request is dropped.
+    int max_retries;
+  };
+
   // Creates a new Anymote device session.
   //
   // @param adapter The wire adapter used to send and receive Anymote messages.
@@ -46,14 +93,39 @@ class DeviceSession : public messages::MessageListener {
   //        session. No ownership is taken.
   DeviceSession(wire::WireAdapter* adapter, AnymoteListener* listener);
 
-  virtual ~DeviceSession() {}
+  // Creates a new Anymote device session that records into the given
+  // histograms instead of owning its own, which keeps idle sessions small.
+  //
+  // @param adapter The wire adapter used to send and receive Anymote messages.
+  //        The adapter must not be NULL and must exist for the duration of this
+  //        session. No ownership is taken.
+  // @param listener The listener that will be notified Anymote responses. The
+  //        listener must not be NULL and must exist for the duration of this
+  //        session. No ownership is taken.
+  // @param histograms The histograms to record into, which may be shared with
+  //        other sessions, or NULL to record none. No ownership is taken and
+  //        the pointer must be valid for the duration of this session.
+  DeviceSession(wire::WireAdapter* adapter, AnymoteListener* listener,
+                SessionHistograms* histograms);
+
+  virtual ~DeviceSession();
 
   // Starts the session. This must be called before sending any messages on
   // this session.
   void StartSession();
 
   // Sends a "ping" message that should receive an ack.
-  void SendPing();
+  // @return The sequence number of the ping.
+  int32_t SendPing();
+
+  // Sends a "ping" message and tracks its ack. Request tracking must be
+  // enabled.
+  //
+  // @param callback The callback to notify when the ack is received or the
+  //        ping times out. No ownership is taken and the pointer must be valid
+  //        until the callback has been invoked.
+  // @return The sequence number of the ping.
+  int32_t SendPing(RequestCallback* callback);
 
   // Sends a key event.
   //
@@ -61,6 +133,17 @@ class DeviceSession : public messages::MessageListener {
   // @param action The action of the event (up or down).
   void SendKeyEvent(messages::Code keycode, messages::Action action);
 
+  // Types text by sending the key events of each character, pressing shift
+  // around the characters that need it, in a single batch. Consecutive
+  // characters that need shift are typed while it is held. Characters that
+  // cannot be typed, including non-ASCII characters, are skipped; see
+  // LookupKeyStroke. Messages sent by other threads meanwhile may be written
+  // between the key events.
+  //
+  // @param text The text to type.
+  // @return The number of characters typed.
+  size_t SendText(const std::string& text);
+
   // Sends a relative mouse movement.
   //
   // @param x_delta The relative movement along the x-axis (horizontal).
@@ -91,7 +174,131 @@ class DeviceSession : public messages::MessageListener {
   // @param uri The uri to fling.
   // @param sequence_number The fling sequence number which must not be
   //        negative.
-  void SendFling(std::string uri, int32_t sequence_number);
+  void SendFling(const std::string& uri, int32_t sequence_number);
+
+  // Sends a fling event and tracks its result. Request tracking must be
+  // enabled. Flings are matched to fling results and pings to acks, so the
+  // sequence number may also be in use by a ping in flight; tracking another
+  // fling with the same sequence number aborts the first one.
+  //
+  // @param uri The uri to fling.
+  // @param sequence_number The fling sequence number which must be positive.
+  // @param callback The callback to notify when the result is received or the
+  //        fling times out. No ownership is taken and the pointer must be valid
+  //        until the callback has been invoked.
+  void SendFling(const std::string& uri, int32_t sequence_number,
+                 RequestCallback* callback);
+
+  // Enables tracking of sequenced requests, so that responses are matched to
+  // the requests that caused them and unanswered requests time out. Any
+  // number of requests may be in flight at once.
+  //
+  // Timeouts are only checked by ExpireRequests, so the owner should invoke it
+  // from a timer every pending_requests()->expire_interval_micros(). This
+  // must be invoked before the session is shared between threads.
+  //
+  // @param timeout_micros The time after which a request times out.
+  // @param clock The clock used for timeouts and round-trip times. The clock
+  //        must not be NULL and must exist for the duration of this session. No
+  //        ownership is taken.
+  void EnableRequestTracking(int64_t timeout_micros, util::Clock* clock);
+
+  // Times out the tracked requests whose timeout has passed.
+  //
+  // @return The number of requests that timed out.
+  int ExpireRequests();
+
+  // Returns the table of tracked requests, or NULL if tracking is disabled.
+  PendingRequests* pending_requests() { return pending_requests_; }
+
+  // Returns the metrics of this session.
+  const SessionMetrics& metrics() const { return metrics_; }
+
+  // Enables coalescing of mouse movements and mouse wheel events. The first
+  // event is sent immediately; events that follow within the interval are
+  // summed and sent as a single message once the interval has passed. Any
+  // other message flushes the pending movement first, so the order of
+  // messages is preserved and the total displacement is unchanged.
+  //
+  // The interval is only checked when a movement is sent, so the owner should
+  // invoke FlushPendingMotion from a timer to bound the delay of the last
+  // movement in a burst. This must be invoked before the session is shared
+  // between threads.
+  //
+  // @param interval_micros The minimum time between movement messages.
+  // @param clock The clock used to measure the interval. The clock must not be
+  //        NULL and must exist for the duration of this session. No ownership
+  //        is taken.
+  void EnableMotionCoalescing(int64_t interval_micros, util::Clock* clock);
+
+  // Sends the pending coalesced movement, if any.
+  void FlushPendingMotion();
+
+  // Returns the time, in microseconds of the coalescing clock, at which the
+  // pending movement should be flushed, or -1 if there is none.
+  int64_t motion_flush_deadline_micros();
+
+  // Returns the number of movements that were merged into another movement
+  // rather than sent as their own message.
+  uint64_t motion_events_merged() const { return motion_events_merged_; }
+
+  // Returns the number of movement messages sent while coalescing.
+  uint64_t motion_messages_sent() const { return motion_messages_sent_; }
+
+  // Enables backpressure, which bounds the memory and input latency of a
+  // session whose transport cannot keep up. Every send compares the bytes
+  // queued by the wire interface to the watermarks in the options.
+  //
+  // While the session is congested:
+  // - key events, pings and connection messages are still sent, so no key
+  //   press is ever lost or left without its release;
+  // - mouse movements and wheel events are held back and merged as the
+  //   motion policy says, then sent once the queue drains;
+  // - data and fling requests are held back and sent in order once the
+  //   queue drains, so they may be overtaken by key events. Requests that
+  //   do not fit or that are held for too long are dropped, and dropped
+  //   flings are reported as failed to the listener. Tracked requests are
+  //   only tracked once they are sent; the callback of a dropped one is
+  //   notified with RequestCallback::kAborted.
+  //
+  // The listener is notified with AnymoteListener::OnBackpressure when the
+  // state changes. Since the queue is only checked when something is sent,
+  // the owner should invoke CheckBackpressure from a timer while the session
+  // is congested. This must be invoked before the session is shared between
+  // threads.
+  //
+  // @param options The watermarks and policies.
+  void EnableBackpressure(const BackpressureOptions& options);
+
+  // Checks the queue of the wire interface. If it has drained to the low
+  // watermark, sends the held messages; otherwise counts a retry for the held
+  // requests and drops those that have run out of retries.
+  //
+  // @return Whether the session is still congested.
+  bool CheckBackpressure();
+
+  // Returns whether the session is congested.
+  bool congested() const { return congested_; }
+
+  // Returns the number of held movements that were replaced by a later one
+  // under the kDropOldestMotion policy.
+  uint64_t motion_events_dropped() const { return motion_events_dropped_; }
+
+  // Returns the number of data and fling requests that were held back, and
+  // the number that were dropped. These functions are thread-safe.
+  uint64_t requests_deferred() const { return requests_deferred_; }
+  uint64_t requests_dropped() const { return requests_dropped_; }
+
+  // Returns the number of messages received from the server. This function
+  // is thread-safe.
+  uint64_t messages_received() const { return messages_received_; }
+
+  // Returns the sequence number of the latest ack received, or 0 if none.
+  // The server answers requests in order, so every ping sent with a lower
+  // sequence number has been answered too. This function is thread-safe.
+  int32_t last_ack_sequence_number() const {
+    return last_ack_sequence_number_;
+  }
 
   // @override
   virtual void OnMessage(const messages::RemoteMessage& message);
@@ -100,18 +307,108 @@ class DeviceSession : public messages::MessageListener {
   virtual void OnError();
 
  private:
-  // Sends a request without a sequence number.
+  // The kind of movement waiting to be sent while coalescing.
+  enum PendingMotion {
+    kNoMotion,
+    kMouseMove,
+    kMouseWheel,
+  };
+
+  // Adds a movement to the pending movement, sending it if the coalescing
+  // interval has passed. motion_mutex_ must be held.
+  //
+  // @param motion The kind of movement.
+  // @param x The movement along the x-axis.
+  // @param y The movement along the y-axis.
+  void CoalesceMotion(PendingMotion motion, int x, int y);
+
+  // Sends a key event without checking backpressure or flushing movements.
+  // The event is sent from the frame cache if the adapter supports it.
+  //
+  // @param keycode The keycode of the event.
+  // @param action The action of the event (up or down).
+  void SendKey(messages::Code keycode, messages::Action action);
+
+  // Sends a mouse movement or mouse wheel message.
+  //
+  // @param motion The kind of movement.
+  // @param x The movement along the x-axis.
+  // @param y The movement along the y-axis.
+  void SendMotion(PendingMotion motion, int x, int y);
+
+  // Sends the pending coalesced movement, if any. motion_mutex_ must be held.
+  void FlushPendingMotionLocked();
+
+  // A data or fling request held back while the session is congested.
+  struct DeferredRequest {
+    messages::RemoteMessage message;
+    RequestType type;
+
+    // The callback of a tracked request, or NULL. The request is only
+    // tracked once it is sent.
+    RequestCallback* callback;
+    int retries;
+  };
+
+  // Enters or leaves the congested state according to the bytes queued by
+  // the wire interface. No lock may be held.
+  void UpdateBackpressure();
+
+  // Sends the held messages and leaves the congested state. Only one thread
+  // sends them at a time; other threads return at once. No lock may be held.
+  void ResumeSending();
+
+  // Tells the listener of the congested state if it changed since it was
+  // last reported. Only one thread reports at a time, and it keeps reporting
+  // until the listener has seen the latest state, so notifications always
+  // alternate and follow the order of the state changes. No lock may be
+  // held.
+  void NotifyBackpressure();
+
+  // Holds back a request while the session is congested, or drops it if too
+  // many requests are held.
+  //
+  // @param type The kind of request.
+  // @param message The request.
+  // @param callback The callback of a tracked request, or NULL.
+  // @return false if the session is no longer congested, in which case the
+  //         request should be sent.
+  bool DeferRequest(RequestType type, const messages::RemoteMessage& message,
+                    RequestCallback* callback);
+
+  // Notifies the listener, and the callback of a tracked request, of a
+  // dropped request.
   //
-  // @param request The request to send.
-  void SendRequest(const messages::RequestMessage& request);
+  // @param type The kind of request.
+  // @param sequence_number The sequence number of the request.
+  // @param callback The callback of a tracked request, or NULL.
+  void OnRequestDropped(RequestType type, int32_t sequence_number,
+                        RequestCallback* callback);
 
-  // Sends a request with a sequence number.
+  // Prepares the outgoing message for a new request. The request is built in
+  // place and then sent with SendRequest on the same thread, so it is never
+  // copied. Any pending coalesced movement must be flushed first.
   //
-  // @param request The request to send.
+  // @return The empty request to fill in. It is owned by the calling thread.
+  messages::RequestMessage* StartRequest();
+
+  // Sends the request prepared with StartRequest on the calling thread.
+  //
+  // @param type The kind of request, for metrics.
   // @param sequence_number The sequence number, or 0 if there is none. Must be
   //        non-negative.
-  void SendRequestWithSequence(const messages::RequestMessage& request,
-                               int32_t sequence_number);
+  // @param callback The callback to track the request with, or NULL.
+  void SendRequest(RequestType type, int32_t sequence_number,
+                   RequestCallback* callback);
+
+  // Hands a request to the adapter, tracking it first if it has a callback.
+  //
+  // @param type The kind of request, for metrics.
+  // @param message The request.
+  // @param callback The callback to track the request with, or NULL.
+  void TransmitRequest(RequestType type,
+                       const messages::RemoteMessage& message,
+                       RequestCallback* callback);
 
   // The wire adapter used to send and receive Anymote messages. The adapter
   // must not be NULL and must exist for the duration of this session. No
@@ -123,9 +420,72 @@ class DeviceSession : public messages::MessageListener {
   // taken.
   AnymoteListener* listener_;
 
+  // The process-wide cache of key event frames, which are sent without being
+  // serialized when the adapter supports it.
+  const wire::FrameCache* frame_cache_;
+
   // Counter that is incremented and used as the sequence number for each ping
   // message sent.
-  int32_t ping_counter_;
+  std::atomic<int32_t> ping_counter_;
+
+  // Guards the coalescing state below, other than the settings, which do not
+  // change once the session is shared between threads.
+  std::mutex motion_mutex_;
+
+  // The requests in flight, or NULL if request tracking is disabled. Owned by
+  // this session.
+  PendingRequests* pending_requests_;
+
+  // The clock used for coalescing movements, or NULL if coalescing is
+  // disabled. No ownership is taken.
+  util::Clock* motion_clock_;
+  int64_t motion_interval_micros_;
+  int64_t last_motion_sent_micros_;
+
+  // The movement waiting to be sent.
+  PendingMotion pending_motion_;
+  int pending_x_;
+  int pending_y_;
+
+  uint64_t motion_events_merged_;
+  uint64_t motion_messages_sent_;
+  uint64_t motion_events_dropped_;
+
+  // Backpressure settings, which do not change once the session is shared
+  // between threads.
+  bool backpressure_enabled_;
+  BackpressureOptions backpressure_options_;
+
+  // Whether the session is congested. Only changed with backpressure_mutex_
+  // held, and only cleared once the deferred requests have been sent.
+  std::atomic<bool> congested_;
+
+  // Guards the state below.
+  std::mutex backpressure_mutex_;
+
+  // The state last reported to the listener, and whether a thread is
+  // reporting it.
+  bool reported_congested_;
+  bool notifying_backpressure_;
+
+  // Whether a thread is sending the deferred requests.
+  bool resuming_;
+
+  std::deque<DeferredRequest> deferred_requests_;
+
+  // Only changed with backpressure_mutex_ held, but read without it.
+  std::atomic<uint64_t> requests_deferred_;
+  std::atomic<uint64_t> requests_dropped_;
+
+  // Kept apart from the metrics, which may be compiled out, since keepalives
+  // depend on them.
+  std::atomic<uint64_t> messages_received_;
+  std::atomic<int32_t> last_ack_sequence_number_;
+
+  SessionMetrics metrics_;
+
+  // The histograms this session owns, or NULL if it was given some.
+  SessionHistograms* owned_histograms_;
 
   // Disallow copy and assign.
   DeviceSession(const DeviceSession&);
@@ -0,0 +1,104 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "anymote/device/devicesessionmanager.h"
+
+#include <glog/logging.h>
+
+namespace anymote {
+namespace device {
+
+const size_t DeviceSessionManager::kSendQueueCapacity;
+
+DeviceSessionManager::ManagedSession::ManagedSession(
+    DeviceSessionManager* manager,
+    util::EventLoop* loop,
+    int fd,
+    AnymoteListener* listener,
+    wire::TransportSecurity* security,
+    SessionHistograms* histograms)
+    : manager_(manager),
+      loop_(loop),
+      interface_(loop, fd, security),
+      adapter_(&interface_, wire::ProtobufWireAdapter::kStreamingReads,
+               kSendQueueCapacity),
+      session_(&adapter_, listener, histograms),
+      start_closure_(this, &ManagedSession::Start),
+      remove_closure_(this, &ManagedSession::Remove) {
+}
+
+void DeviceSessionManager::ManagedSession::Start() {
+  session_.StartSession();
+  if (!interface_.Start()) {
+    session_.OnError();
+  }
+}
+
+void DeviceSessionManager::ManagedSession::Remove() {
+  manager_->DestroySession(this);
+}
+
+DeviceSessionManager::DeviceSessionManager(util::EventLoopPool* pool)
+    : pool_(pool) {
+  CHECK_NOTNULL(pool);
+}
+
+DeviceSessionManager::~DeviceSessionManager() {
+  std::set<ManagedSession*> sessions;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions.swap(sessions_);
+  }
+  for (std::set<ManagedSession*>::iterator it = sessions.begin();
+       it != sessions.end(); ++it) {
+    pool_->ReleaseLoop((*it)->loop());
+    delete *it;
+  }
+}
+
+DeviceSessionManager::ManagedSession* DeviceSessionManager::AddSession(
+    int fd, AnymoteListener* listener, wire::TransportSecurity* security) {
+  util::EventLoop* loop = pool_->AcquireLoop();
+  ManagedSession* session =
+      new ManagedSession(this, loop, fd, listener, security, &histograms_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_.insert(session);
+  }
+  loop->Post(&session->start_closure_);
+  return session;
+}
+
+void DeviceSessionManager::RemoveSession(ManagedSession* session) {
+  CHECK_NOTNULL(session);
+  session->loop()->Post(&session->remove_closure_);
+}
+
+size_t DeviceSessionManager::num_sessions() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return sessions_.size();
+}
+
+void DeviceSessionManager::DestroySession(ManagedSession* session) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_.erase(session);
+  }
+
+  pool_->ReleaseLoop(session->loop());
+  delete session;
+}
+
+}  // namespace device
+}  // namespace anymote
@@ -0,0 +1,149 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_DEVICE_DEVICESESSIONMANAGER_H_
+#define ANYMOTE_DEVICE_DEVICESESSIONMANAGER_H_
+
+#include <mutex>
+#include <set>
+#include "anymote/device/anymotelistener.h"
+#include "anymote/device/devicesession.h"
+#include "anymote/util/closure.h"
+#include "anymote/util/eventlooppool.h"
+#include "anymote/wire/protobufwireadapter.h"
+#include "anymote/wire/socketwireinterface.h"
+#include "anymote/wire/transportsecurity.h"
+
+namespace anymote {
+namespace device {
+
+// Runs many device sessions over a small pool of event loop threads. Each
+// session owns its socket interface, wire adapter and device session, and is
+// pinned to a single loop for its whole life, so that all of its I/O and
+// listener callbacks happen on one thread.
+//
+// Messages may be sent on a session from any thread, as described in
+// devicesession.h. Everything else, such as enabling request tracking, must
+// be done from the session's loop, for example by posting a closure to it.
+//
+// To keep idle sessions small, each has a short send queue and all sessions
+// of a manager record into one shared set of histograms. Example:
+//
+//   util::EventLoopPool pool(4);
+//   pool.Start();
+//   DeviceSessionManager manager(&pool);
+//   DeviceSessionManager::ManagedSession* session =
+//       manager.AddSession(fd, &listener, NULL);
+//   session->loop()->Post(&enable_tracking_closure);
+class DeviceSessionManager {
+ public:
+  // A device session and the objects it needs, pinned to one event loop.
+  class ManagedSession {
+   public:
+    // Returns the device session. Its Send methods may be invoked from any
+    // thread; everything else may only be used from loop().
+    DeviceSession* session() { return &session_; }
+
+    // Returns the event loop this session runs on.
+    util::EventLoop* loop() { return loop_; }
+
+   private:
+    friend class DeviceSessionManager;
+
+    ManagedSession(DeviceSessionManager* manager, util::EventLoop* loop,
+                   int fd, AnymoteListener* listener,
+                   wire::TransportSecurity* security,
+                   SessionHistograms* histograms);
+
+    // Starts the interface and the session. Runs on the session's loop.
+    void Start();
+
+    // Destroys the session. Runs on the session's loop.
+    void Remove();
+
+    DeviceSessionManager* manager_;
+    util::EventLoop* loop_;
+    wire::SocketWireInterface interface_;
+    wire::ProtobufWireAdapter adapter_;
+    DeviceSession session_;
+    util::MethodClosure<ManagedSession> start_closure_;
+    util::MethodClosure<ManagedSession> remove_closure_;
+
+    // Disallow copy and assign.
+    ManagedSession(const ManagedSession&);
+    void operator=(const ManagedSession&);
+  };
+
+  // Creates a new session manager.
+  //
+  // @param pool The event loops that sessions run on. The pool must not be
+  //        NULL and must exist for the duration of this manager. It must be
+  //        stopped before the manager is destroyed. No ownership is taken.
+  explicit DeviceSessionManager(util::EventLoopPool* pool);
+
+  // Destroys all remaining sessions. The pool must be stopped.
+  ~DeviceSessionManager();
+
+  // Adds a session for a connected socket and starts it on the least busy
+  // loop. This function is thread-safe.
+  //
+  // @param fd A connected stream socket. Ownership is taken.
+  // @param listener The listener that will be notified of Anymote responses,
+  //        from the session's loop. The listener must not be NULL and must
+  //        exist until the session is removed. No ownership is taken.
+  // @param security The security engine, or NULL to send data in the clear.
+  //        No ownership is taken and the pointer must be valid until the
+  //        session is removed.
+  // @return The new session, owned by this manager.
+  ManagedSession* AddSession(int fd, AnymoteListener* listener,
+                             wire::TransportSecurity* security);
+
+  // Removes a session. The session is destroyed and its socket closed on its
+  // loop, after which its listener will not be notified again. The session
+  // must not be used after invoking this. This function is thread-safe.
+  //
+  // @param session The session to remove.
+  void RemoveSession(ManagedSession* session);
+
+  // Returns the number of sessions that have not been destroyed yet. This
+  // function is thread-safe.
+  size_t num_sessions();
+
+  // Returns the histograms shared by all sessions of this manager.
+  const SessionHistograms& histograms() const { return histograms_; }
+
+  // The number of frames that concurrent senders can queue on a session.
+  static const size_t kSendQueueCapacity = 16;
+
+ private:
+  // Forgets and deletes a session.
+  void DestroySession(ManagedSession* session);
+
+  util::EventLoopPool* pool_;
+
+  // Guards sessions_.
+  std::mutex mutex_;
+  std::set<ManagedSession*> sessions_;
+
+  SessionHistograms histograms_;
+
+  // Disallow copy and assign.
+  DeviceSessionManager(const DeviceSessionManager&);
+  void operator=(const DeviceSessionManager&);
+};
+
+}  // namespace device
+}  // namespace anymote
+
+#endif  // ANYMOTE_DEVICE_DEVICESESSIONMANAGER_H_
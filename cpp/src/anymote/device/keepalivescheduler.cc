@@ -0,0 +1,127 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "anymote/device/keepalivescheduler.h"
+
+#include <glog/logging.h>
+
+namespace anymote {
+namespace device {
+
+// The number of slots of each level of the timer wheel. With the default
+// tick, the first level covers 51 seconds, which holds the timers of
+// sessions with the default intervals without moving them between levels.
+static const size_t kNumSlots = 512;
+
+KeepaliveScheduler::Entry::Entry(KeepaliveScheduler* scheduler,
+                                 DeviceSession* session)
+    : scheduler_(scheduler),
+      session_(session),
+      timer_(this),
+      messages_received_(session->messages_received()),
+      ping_sequence_number_(0),
+      missed_pings_(0) {
+}
+
+void KeepaliveScheduler::Entry::Run() {
+  KeepaliveScheduler* scheduler = scheduler_;
+  if (ping_sequence_number_ == 0) {
+    uint64_t received = session_->messages_received();
+    if (received != messages_received_) {
+      // The session is not idle, so check again once it might be.
+      messages_received_ = received;
+      scheduler->wheel_.Schedule(
+          &timer_,
+          scheduler->clock_->NowMicros() +
+              scheduler->options_.idle_interval_micros);
+      return;
+    }
+  } else if (session_->last_ack_sequence_number() >= ping_sequence_number_) {
+    // The ping was answered, so the session is alive.
+    messages_received_ = session_->messages_received();
+    ping_sequence_number_ = 0;
+    missed_pings_ = 0;
+    scheduler->wheel_.Schedule(
+        &timer_,
+        scheduler->clock_->NowMicros() +
+            scheduler->options_.idle_interval_micros);
+    return;
+  } else if (++missed_pings_ >= scheduler->options_.max_missed_pings) {
+    scheduler->liveness_failures_++;
+    VLOG(1) << "Liveness failure after " << missed_pings_ << " pings";
+    // The listener may remove and destroy this entry.
+    scheduler->listener_->OnLivenessFailure(session_, ping_sequence_number_);
+    return;
+  }
+
+  scheduler->SendPing(this);
+}
+
+KeepaliveScheduler::KeepaliveScheduler(const Options& options,
+                                       Listener* listener,
+                                       util::Clock* clock)
+    : options_(options),
+      listener_(listener),
+      clock_(clock),
+      wheel_(clock->NowMicros(), options.tick_micros, kNumSlots),
+      pings_sent_now_(0),
+      pings_sent_(0),
+      liveness_failures_(0) {
+  CHECK_NOTNULL(listener);
+  CHECK_GT(options.idle_interval_micros, 0) << "Interval must be positive";
+  CHECK_GT(options.ping_timeout_micros, 0) << "Timeout must be positive";
+  CHECK_GT(options.max_missed_pings, 0) << "Misses must be positive";
+}
+
+KeepaliveScheduler::~KeepaliveScheduler() {
+  for (EntryMap::iterator it = entries_.begin(); it != entries_.end(); ++it) {
+    delete it->second;
+  }
+}
+
+void KeepaliveScheduler::AddSession(DeviceSession* session) {
+  Entry*& entry = entries_[session];
+  if (entry != NULL) {
+    return;
+  }
+  entry = new Entry(this, session);
+  wheel_.Schedule(&entry->timer_,
+                  clock_->NowMicros() + options_.idle_interval_micros);
+}
+
+void KeepaliveScheduler::RemoveSession(DeviceSession* session) {
+  EntryMap::iterator it = entries_.find(session);
+  if (it == entries_.end()) {
+    return;
+  }
+  delete it->second;
+  entries_.erase(it);
+}
+
+int KeepaliveScheduler::Advance() {
+  pings_sent_now_ = 0;
+  wheel_.Advance(clock_->NowMicros());
+  return pings_sent_now_;
+}
+
+void KeepaliveScheduler::SendPing(Entry* entry) {
+  entry->ping_sequence_number_ = entry->session_->SendPing();
+  pings_sent_now_++;
+  pings_sent_++;
+  wheel_.Schedule(&entry->timer_,
+                  clock_->NowMicros() + options_.ping_timeout_micros);
+}
+
+}  // namespace device
+}  // namespace anymote
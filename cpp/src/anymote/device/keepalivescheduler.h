@@ -0,0 +1,170 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_DEVICE_KEEPALIVESCHEDULER_H_
+#define ANYMOTE_DEVICE_KEEPALIVESCHEDULER_H_
+
+#include <stdint.h>
+#include <unordered_map>
+#include "anymote/device/devicesession.h"
+#include "anymote/util/clock.h"
+#include "anymote/util/closure.h"
+#include "anymote/util/timerwheel.h"
+
+namespace anymote {
+namespace device {
+
+// Sends keepalive pings on idle device sessions and detects sessions whose
+// server stopped answering, long before the transport would time out.
+//
+// Each session is checked once per idle interval, and pinged if it received
+// nothing since the previous check. Only the ack of the ping, or of a later
+// one, shows that the server is alive; other traffic does not answer a ping.
+// A ping left unanswered for the ping timeout is a miss, followed at once by
+// another ping, and the listener is told of a liveness failure after
+// max_missed_pings misses in a row. Sessions that keep receiving traffic are
+// not pinged.
+//
+// All sessions share one hierarchical timer wheel with a single timer each,
+// so a tick costs constant time however many sessions are registered, plus
+// the work for the sessions whose timers are due.
+//
+// The scheduler is driven by its owner, which invokes Advance every
+// tick_micros. AddSession, RemoveSession and Advance must be invoked from a
+// single thread, usually the dispatch thread of the sessions; the sessions
+// themselves may be used from any thread.
+class KeepaliveScheduler {
+ public:
+  // Keepalive settings.
+  struct Options {
+    Options()
+        : idle_interval_micros(15 * 1000 * 1000),
+          ping_timeout_micros(5 * 1000 * 1000),
+          max_missed_pings(3),
+          tick_micros(100 * 1000) {
+    }
+
+    // How long a session receives nothing before it is pinged.
+    int64_t idle_interval_micros;
+
+    // How long to wait for the server to answer a ping.
+    int64_t ping_timeout_micros;
+
+    // The number of unanswered pings in a row that make a liveness failure.
+    int max_missed_pings;
+
+    // The resolution of the timer wheel, and the interval at which the owner
+    // should invoke Advance.
+    int64_t tick_micros;
+  };
+
+  // Interface for the owner of the sessions.
+  class Listener {
+   public:
+    virtual ~Listener() {}
+
+    // Handles a session whose server did not answer max_missed_pings pings
+    // in a row. The session is no longer pinged, but stays registered until
+    // it is removed. The listener may remove the session, and may destroy it
+    // once it is removed.
+    // @param session The session.
+    // @param last_ping_sequence_number The sequence number of the last
+    //                                  unanswered ping.
+    virtual void OnLivenessFailure(DeviceSession* session,
+                                   int32_t last_ping_sequence_number) = 0;
+  };
+
+  // Creates a scheduler.
+  // @param options The keepalive settings.
+  // @param listener The listener notified of liveness failures. No ownership
+  //                 is taken and the pointer must be valid for the duration
+  //                 of the existence of this instance.
+  // @param clock The clock used for intervals and timeouts. No ownership is
+  //              taken and the pointer must be valid for the duration of the
+  //              existence of this instance.
+  KeepaliveScheduler(const Options& options, Listener* listener,
+                     util::Clock* clock);
+
+  // Forgets all sessions.
+  ~KeepaliveScheduler();
+
+  // Starts watching a session. Nothing happens if the session is already
+  // watched.
+  // @param session The session. No ownership is taken and the pointer must
+  //                be valid until the session is removed.
+  void AddSession(DeviceSession* session);
+
+  // Stops watching a session. Nothing happens if the session is not watched.
+  // @param session The session.
+  void RemoveSession(DeviceSession* session);
+
+  // Sends the pings that are due and counts the ones that went unanswered.
+  // @return The number of pings sent.
+  int Advance();
+
+  // Returns the number of sessions watched.
+  size_t num_sessions() const { return entries_.size(); }
+
+  // Returns the number of pings sent and of liveness failures reported.
+  uint64_t pings_sent() const { return pings_sent_; }
+  uint64_t liveness_failures() const { return liveness_failures_; }
+
+ private:
+  // The keepalive state of a session.
+  class Entry : public util::Closure {
+   public:
+    Entry(KeepaliveScheduler* scheduler, DeviceSession* session);
+
+    // Checks the session when its timer expires.
+    virtual void Run();
+
+    KeepaliveScheduler* scheduler_;
+    DeviceSession* session_;
+    util::TimerWheel::Timer timer_;
+
+    // The number of messages received as of the last idle check.
+    uint64_t messages_received_;
+
+    // The sequence number of the latest unanswered ping, or 0 if none.
+    int32_t ping_sequence_number_;
+    int missed_pings_;
+  };
+
+  // Pings a session and waits for the answer.
+  // @param entry The state of the session.
+  void SendPing(Entry* entry);
+
+  const Options options_;
+  Listener* listener_;
+  util::Clock* clock_;
+  util::TimerWheel wheel_;
+
+  typedef std::unordered_map<DeviceSession*, Entry*> EntryMap;
+  EntryMap entries_;
+
+  // The number of pings sent during the current Advance.
+  int pings_sent_now_;
+
+  uint64_t pings_sent_;
+  uint64_t liveness_failures_;
+
+  // Disallow copy and assign.
+  KeepaliveScheduler(const KeepaliveScheduler&);
+  void operator=(const KeepaliveScheduler&);
+};
+
+}  // namespace device
+}  // namespace anymote
+
+#endif  // ANYMOTE_DEVICE_KEEPALIVESCHEDULER_H_
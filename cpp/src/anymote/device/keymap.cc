@@ -0,0 +1,118 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdint.h>
+#include "anymote/device/keymap.h"
+
+namespace anymote {
+namespace device {
+
+namespace {
+
+// Flag of the table entries for characters typed with shift held. Every
+// keycode that types a character is below it.
+const uint8_t kShift = 0x80;
+
+// Returns the table entry of a character typed with the given key.
+constexpr uint8_t Key(int keycode) {
+  return static_cast<uint8_t>(keycode);
+}
+
+// Returns the table entry of a character typed with the given key and shift.
+constexpr uint8_t ShiftKey(int keycode) {
+  return static_cast<uint8_t>(keycode | kShift);
+}
+
+// Returns the table entry of a character: its keycode, with kShift set if it
+// is typed with shift held, or 0 if the character cannot be typed.
+constexpr uint8_t Entry(int c) {
+  return
+      c >= 'a' && c <= 'z' ? Key(messages::KEYCODE_A + (c - 'a')) :
+      c >= 'A' && c <= 'Z' ? ShiftKey(messages::KEYCODE_A + (c - 'A')) :
+      c >= '0' && c <= '9' ? Key(messages::KEYCODE_0 + (c - '0')) :
+      c == '\b' ? Key(messages::KEYCODE_DEL) :
+      c == '\t' ? Key(messages::KEYCODE_TAB) :
+      c == '\n' ? Key(messages::KEYCODE_ENTER) :
+      c == ' ' ? Key(messages::KEYCODE_SPACE) :
+      c == '#' ? Key(messages::KEYCODE_POUND) :
+      c == '\'' ? Key(messages::KEYCODE_APOSTROPHE) :
+      c == '*' ? Key(messages::KEYCODE_STAR) :
+      c == '+' ? Key(messages::KEYCODE_PLUS) :
+      c == ',' ? Key(messages::KEYCODE_COMMA) :
+      c == '-' ? Key(messages::KEYCODE_MINUS) :
+      c == '.' ? Key(messages::KEYCODE_PERIOD) :
+      c == '/' ? Key(messages::KEYCODE_SLASH) :
+      c == ';' ? Key(messages::KEYCODE_SEMICOLON) :
+      c == '=' ? Key(messages::KEYCODE_EQUALS) :
+      c == '@' ? Key(messages::KEYCODE_AT) :
+      c == '[' ? Key(messages::KEYCODE_LEFT_BRACKET) :
+      c == '\\' ? Key(messages::KEYCODE_BACKSLASH) :
+      c == ']' ? Key(messages::KEYCODE_RIGHT_BRACKET) :
+      c == '`' ? Key(messages::KEYCODE_GRAVE) :
+      c == '!' ? ShiftKey(messages::KEYCODE_1) :
+      c == '"' ? ShiftKey(messages::KEYCODE_APOSTROPHE) :
+      c == '$' ? ShiftKey(messages::KEYCODE_4) :
+      c == '%' ? ShiftKey(messages::KEYCODE_5) :
+      c == '&' ? ShiftKey(messages::KEYCODE_7) :
+      c == '(' ? ShiftKey(messages::KEYCODE_9) :
+      c == ')' ? ShiftKey(messages::KEYCODE_0) :
+      c == ':' ? ShiftKey(messages::KEYCODE_SEMICOLON) :
+      c == '<' ? ShiftKey(messages::KEYCODE_COMMA) :
+      c == '>' ? ShiftKey(messages::KEYCODE_PERIOD) :
+      c == '?' ? ShiftKey(messages::KEYCODE_SLASH) :
+      c == '^' ? ShiftKey(messages::KEYCODE_6) :
+      c == '_' ? ShiftKey(messages::KEYCODE_MINUS) :
+      c == '{' ? ShiftKey(messages::KEYCODE_LEFT_BRACKET) :
+      c == '|' ? ShiftKey(messages::KEYCODE_BACKSLASH) :
+      c == '}' ? ShiftKey(messages::KEYCODE_RIGHT_BRACKET) :
+      c == '~' ? ShiftKey(messages::KEYCODE_GRAVE) :
+      0;
+}
+
+static_assert(messages::KEYCODE_PLUS < kShift &&
+              messages::KEYCODE_AT < kShift &&
+              messages::KEYCODE_Z < kShift,
+              "Keycodes of characters must fit below the shift flag");
+
+#define ANYMOTE_KEYMAP_ROW(c) \
+  Entry(c), Entry(c + 1), Entry(c + 2), Entry(c + 3), \
+  Entry(c + 4), Entry(c + 5), Entry(c + 6), Entry(c + 7), \
+  Entry(c + 8), Entry(c + 9), Entry(c + 10), Entry(c + 11), \
+  Entry(c + 12), Entry(c + 13), Entry(c + 14), Entry(c + 15)
+
+// The entries of all ASCII characters.
+constexpr uint8_t kCharacterTable[128] = {
+  ANYMOTE_KEYMAP_ROW(0x00), ANYMOTE_KEYMAP_ROW(0x10),
+  ANYMOTE_KEYMAP_ROW(0x20), ANYMOTE_KEYMAP_ROW(0x30),
+  ANYMOTE_KEYMAP_ROW(0x40), ANYMOTE_KEYMAP_ROW(0x50),
+  ANYMOTE_KEYMAP_ROW(0x60), ANYMOTE_KEYMAP_ROW(0x70),
+};
+
+#undef ANYMOTE_KEYMAP_ROW
+
+}  // namespace
+
+bool LookupKeyStroke(char c, KeyStroke* stroke) {
+  uint8_t index = static_cast<uint8_t>(c);
+  if (index >= sizeof(kCharacterTable) || kCharacterTable[index] == 0) {
+    return false;
+  }
+  uint8_t entry = kCharacterTable[index];
+  stroke->keycode = static_cast<messages::Code>(entry & ~kShift);
+  stroke->shift = (entry & kShift) != 0;
+  return true;
+}
+
+}  // namespace device
+}  // namespace anymote
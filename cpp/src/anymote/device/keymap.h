@@ -0,0 +1,48 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_DEVICE_KEYMAP_H_
+#define ANYMOTE_DEVICE_KEYMAP_H_
+
+#include "anymote/messages/keycodes.pb.h"
+
+namespace anymote {
+namespace device {
+
+// A key stroke that types a character.
+struct KeyStroke {
+  // The key to press.
+  messages::Code keycode;
+
+  // Whether shift must be held while the key is pressed.
+  bool shift;
+};
+
+// Looks up the key stroke that types a character on a US keyboard, the layout
+// of the server's default key character map. The map is a 128 byte table
+// generated at compile time, so a lookup is a single load from memory that
+// stays cached while typing.
+//
+// @param c The character.
+// @param stroke Set to the key stroke, if any.
+// @return false if the character cannot be typed, in which case the stroke is
+//         not modified. This is the case for control characters other than
+//         tab, newline and backspace, and for every byte of a multi-byte UTF-8
+//         sequence.
+bool LookupKeyStroke(char c, KeyStroke* stroke);
+
+}  // namespace device
+}  // namespace anymote
+
+#endif  // ANYMOTE_DEVICE_KEYMAP_H_
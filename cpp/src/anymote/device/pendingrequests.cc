@@ -0,0 +1,209 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "anymote/device/pendingrequests.h"
+
+#include <glog/logging.h>
+
+namespace anymote {
+namespace device {
+
+// The number of wheel ticks per timeout. This bounds how late a request may
+// time out to a small fraction of the timeout.
+static const int64_t kTicksPerTimeout = 64;
+
+// The number of wheel slots. Covering twice the timeout keeps every request
+// in a slot of its own lap.
+static const size_t kNumSlots = 2 * kTicksPerTimeout;
+
+// Returns the wheel tick for the given timeout.
+static int64_t TickForTimeout(int64_t timeout_micros) {
+  int64_t tick = timeout_micros / kTicksPerTimeout;
+  return tick > 0 ? tick : 1;
+}
+
+PendingRequests::Request::Request(PendingRequests* requests,
+                                  int32_t sequence_number,
+                                  ResponseType response_type,
+                                  RequestCallback* callback,
+                                  int64_t sent_micros)
+    : requests_(requests),
+      sequence_number_(sequence_number),
+      response_type_(response_type),
+      callback_(callback),
+      sent_micros_(sent_micros),
+      timer_(this) {
+}
+
+void PendingRequests::Request::Run() {
+  // The request cannot be removed while the wheel is iterating, so it is only
+  // recorded here.
+  requests_->expired_.push_back(RequestKey(sequence_number_, response_type_));
+}
+
+PendingRequests::PendingRequests(int64_t timeout_micros, util::Clock* clock)
+    : timeout_micros_(timeout_micros),
+      clock_(clock),
+      rtt_histogram_(NULL),
+      wheel_(clock->NowMicros(), TickForTimeout(timeout_micros), kNumSlots) {
+  CHECK_GT(timeout_micros, 0) << "Timeout must be positive";
+}
+
+PendingRequests::~PendingRequests() {
+  for (RequestMap::iterator it = requests_.begin(); it != requests_.end();
+       ++it) {
+    delete it->second;
+  }
+}
+
+void PendingRequests::Add(int32_t sequence_number, ResponseType response_type,
+                          RequestCallback* callback) {
+  CHECK_GT(sequence_number, 0) << "Sequence number must be positive";
+  CHECK_NOTNULL(callback);
+
+  std::vector<Completion> completions;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = clock_->NowMicros();
+    RequestKey key(sequence_number, response_type);
+    RequestMap::iterator it = requests_.find(key);
+    if (it != requests_.end()) {
+      LOG(WARNING) << "Replacing request in flight: " << sequence_number;
+      CompleteLocked(it, RequestCallback::kAborted, now, &completions);
+    }
+
+    Request* request =
+        new Request(this, sequence_number, response_type, callback, now);
+    requests_[key] = request;
+    wheel_.Schedule(&request->timer_, now + timeout_micros_);
+  }
+  Notify(completions);
+}
+
+bool PendingRequests::Complete(int32_t sequence_number,
+                               const messages::ResponseMessage& response) {
+  RequestCallback* callback;
+  int64_t rtt_micros;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    RequestMap::iterator it =
+        requests_.find(RequestKey(sequence_number, ResponseTypeOf(response)));
+    if (it == requests_.end()) {
+      return false;
+    }
+
+    Request* request = it->second;
+    callback = request->callback_;
+    rtt_micros = clock_->NowMicros() - request->sent_micros_;
+
+    if (rtt_stats_.count == 0 || rtt_micros < rtt_stats_.min_micros) {
+      rtt_stats_.min_micros = rtt_micros;
+    }
+    if (rtt_micros > rtt_stats_.max_micros) {
+      rtt_stats_.max_micros = rtt_micros;
+    }
+    rtt_stats_.count++;
+    rtt_stats_.total_micros += rtt_micros;
+    rtt_stats_.last_micros = rtt_micros;
+    if (rtt_histogram_) {
+      rtt_histogram_->Record(rtt_micros);
+    }
+
+    requests_.erase(it);
+    delete request;
+  }
+
+  callback->OnRequestComplete(sequence_number, RequestCallback::kResponse,
+                              &response, rtt_micros);
+  return true;
+}
+
+int PendingRequests::Expire() {
+  std::vector<Completion> completions;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = clock_->NowMicros();
+    wheel_.Advance(now);
+    for (size_t i = 0; i < expired_.size(); ++i) {
+      RequestMap::iterator it = requests_.find(expired_[i]);
+      CHECK(it != requests_.end());
+      CompleteLocked(it, RequestCallback::kTimeout, now, &completions);
+    }
+    expired_.clear();
+  }
+  Notify(completions);
+  return completions.size();
+}
+
+void PendingRequests::AbortAll() {
+  std::vector<Completion> completions;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = clock_->NowMicros();
+    while (!requests_.empty()) {
+      CompleteLocked(requests_.begin(), RequestCallback::kAborted, now,
+                     &completions);
+    }
+  }
+  Notify(completions);
+}
+
+size_t PendingRequests::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return requests_.size();
+}
+
+RttStats PendingRequests::rtt_stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return rtt_stats_;
+}
+
+ResponseType PendingRequests::ResponseTypeOf(
+    const messages::ResponseMessage& response) {
+  if (response.has_fling_result_message()) {
+    return kFlingResultResponse;
+  }
+  if (response.has_data_message()) {
+    return kDataResponse;
+  }
+  return kAckResponse;
+}
+
+void PendingRequests::CompleteLocked(RequestMap::iterator it,
+                                     RequestCallback::Result result,
+                                     int64_t now_micros,
+                                     std::vector<Completion>* completions) {
+  Request* request = it->second;
+  Completion completion;
+  completion.sequence_number = request->sequence_number_;
+  completion.callback = request->callback_;
+  completion.result = result;
+  completion.rtt_micros = now_micros - request->sent_micros_;
+  completions->push_back(completion);
+
+  requests_.erase(it);
+  delete request;
+}
+
+void PendingRequests::Notify(const std::vector<Completion>& completions) {
+  for (size_t i = 0; i < completions.size(); ++i) {
+    const Completion& completion = completions[i];
+    completion.callback->OnRequestComplete(completion.sequence_number,
+                                           completion.result, NULL,
+                                           completion.rtt_micros);
+  }
+}
+
+}  // namespace device
+}  // namespace anymote
@@ -0,0 +1,218 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_DEVICE_PENDINGREQUESTS_H_
+#define ANYMOTE_DEVICE_PENDINGREQUESTS_H_
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "anymote/device/sessionmetrics.h"
+#include "anymote/messages/remote.pb.h"
+#include "anymote/util/clock.h"
+#include "anymote/util/metrics.h"
+#include "anymote/util/timerwheel.h"
+
+namespace anymote {
+namespace device {
+
+// Interface for a callback that is notified when a sequenced request
+// completes.
+class RequestCallback {
+ public:
+  // How a request completed.
+  enum Result {
+    // The server responded.
+    kResponse,
+
+    // No response was received before the timeout.
+    kTimeout,
+
+    // The session failed, the request was dropped before it was sent, or it
+    // was replaced by another request with the same sequence number that
+    // expects the same kind of response.
+    kAborted,
+  };
+
+  virtual ~RequestCallback() {}
+
+  // Handles the completion of a request. This is invoked exactly once per
+  // request, from the thread that received the response, expired the request
+  // or aborted it.
+  //
+  // @param sequence_number The sequence number of the request.
+  // @param result How the request completed.
+  // @param response The response if result is kResponse, NULL otherwise. It
+  //                 is only valid for the duration of the call.
+  // @param rtt_micros The time between sending the request and its completion.
+  virtual void OnRequestComplete(int32_t sequence_number, Result result,
+                                 const messages::ResponseMessage* response,
+                                 int64_t rtt_micros) = 0;
+};
+
+// Round-trip time statistics of the requests that received a response.
+struct RttStats {
+  RttStats()
+      : count(0),
+        total_micros(0),
+        min_micros(0),
+        max_micros(0),
+        last_micros(0) {
+  }
+
+  uint64_t count;
+  int64_t total_micros;
+  int64_t min_micros;
+  int64_t max_micros;
+  int64_t last_micros;
+};
+
+// Table of requests in flight, keyed by sequence number and the kind of
+// response that answers them, that correlates responses with the requests
+// that caused them. Pings are answered by acks and flings by fling results,
+// so a ping and a fling with the same sequence number are tracked apart.
+// Requests that are not
+// answered within the timeout complete with kTimeout; the timeouts are kept
+// on a timing wheel, so the owner must invoke Expire periodically.
+//
+// This class is thread-safe. Callbacks are invoked without holding any lock,
+// so they may add requests.
+class PendingRequests {
+ public:
+  // Creates an empty table.
+  //
+  // @param timeout_micros The time after which a request times out.
+  // @param clock The clock used for timeouts and round-trip times. No
+  //              ownership is taken and the pointer must be valid for the
+  //              duration of the existence of this instance.
+  PendingRequests(int64_t timeout_micros, util::Clock* clock);
+
+  // Drops any requests still in flight without completing them.
+  ~PendingRequests();
+
+  // Adds a request that is about to be sent. A request in flight with the
+  // same sequence number and response type is aborted.
+  //
+  // @param sequence_number The sequence number of the request. Must be
+  //                        positive.
+  // @param response_type The kind of response that answers the request.
+  // @param callback The callback to notify of completion. No ownership is
+  //                 taken and the pointer must be valid until the callback
+  //                 has been invoked.
+  void Add(int32_t sequence_number, ResponseType response_type,
+           RequestCallback* callback);
+
+  // Completes the request with the given sequence number that is answered by
+  // the kind of the given response, if it is in flight.
+  //
+  // @param sequence_number The sequence number of the response.
+  // @param response The response.
+  // @return true if a request was completed.
+  bool Complete(int32_t sequence_number,
+                const messages::ResponseMessage& response);
+
+  // Completes all requests whose timeout has passed.
+  //
+  // @return The number of requests that timed out.
+  int Expire();
+
+  // Aborts all requests in flight.
+  void AbortAll();
+
+  // Returns the number of requests in flight.
+  size_t size();
+
+  // Returns the round-trip time statistics of all completed requests.
+  RttStats rtt_stats();
+
+  // Sets a histogram that records the round-trip time of every request that
+  // receives a response.
+  // @param histogram The histogram. No ownership is taken and the pointer must
+  //                  be valid for the duration of the existence of this
+  //                  instance.
+  void set_rtt_histogram(util::Histogram* histogram) {
+    rtt_histogram_ = histogram;
+  }
+
+  // Returns the interval at which Expire should be invoked.
+  int64_t expire_interval_micros() const { return wheel_.tick_micros(); }
+
+ private:
+  // A request in flight.
+  class Request : public util::Closure {
+   public:
+    Request(PendingRequests* requests, int32_t sequence_number,
+            ResponseType response_type, RequestCallback* callback,
+            int64_t sent_micros);
+
+    // Records that the request timed out.
+    virtual void Run();
+
+    PendingRequests* requests_;
+    int32_t sequence_number_;
+    ResponseType response_type_;
+    RequestCallback* callback_;
+    int64_t sent_micros_;
+    util::TimerWheel::Timer timer_;
+  };
+
+  // A request that has completed, waiting for its callback to be invoked.
+  struct Completion {
+    int32_t sequence_number;
+    RequestCallback* callback;
+    RequestCallback::Result result;
+    int64_t rtt_micros;
+  };
+
+  // Requests are keyed by sequence number and response type.
+  typedef std::pair<int32_t, ResponseType> RequestKey;
+  typedef std::map<RequestKey, Request*> RequestMap;
+
+  // Returns the kind of a response.
+  static ResponseType ResponseTypeOf(
+      const messages::ResponseMessage& response);
+
+  // Removes a request from the table and records its completion. mutex_ must
+  // be held.
+  void CompleteLocked(RequestMap::iterator it,
+                      RequestCallback::Result result, int64_t now_micros,
+                      std::vector<Completion>* completions);
+
+  // Invokes the callbacks of completed requests. No lock may be held.
+  static void Notify(const std::vector<Completion>& completions);
+
+  const int64_t timeout_micros_;
+  util::Clock* clock_;
+  util::Histogram* rtt_histogram_;
+
+  // Guards all the members below.
+  std::mutex mutex_;
+  RequestMap requests_;
+  util::TimerWheel wheel_;
+  RttStats rtt_stats_;
+
+  // Keys of the requests that expired during Expire.
+  std::vector<RequestKey> expired_;
+
+  // Disallow copy and assign.
+  PendingRequests(const PendingRequests&);
+  void operator=(const PendingRequests&);
+};
+
+}  // namespace device
+}  // namespace anymote
+
+#endif  // ANYMOTE_DEVICE_PENDINGREQUESTS_H_
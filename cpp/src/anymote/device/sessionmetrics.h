@@ -0,0 +1,96 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_DEVICE_SESSIONMETRICS_H_
+#define ANYMOTE_DEVICE_SESSIONMETRICS_H_
+
+#include "anymote/util/metrics.h"
+
+namespace anymote {
+namespace device {
+
+// The kinds of requests a device session sends.
+enum RequestType {
+  kPingRequest,
+  kKeyEventRequest,
+  kMouseMoveRequest,
+  kMouseWheelRequest,
+  kDataRequest,
+  kConnectRequest,
+  kFlingRequest,
+  kNumRequestTypes,
+};
+
+// The kinds of responses a device session receives.
+enum ResponseType {
+  kAckResponse,
+  kDataResponse,
+  kFlingResultResponse,
+  kNumResponseTypes,
+};
+
+// A snapshot of SessionMetrics.
+struct SessionMetricsSnapshot {
+  uint64_t requests_sent[kNumRequestTypes];
+  uint64_t responses_received[kNumResponseTypes];
+  util::HistogramSnapshot ack_latency_micros;
+  util::HistogramSnapshot listener_nanos;
+};
+
+// Histograms of device sessions. Each histogram takes several kilobytes, so
+// many sessions may share one set instead of each owning its own.
+struct SessionHistograms {
+  // The time between sending a tracked request and receiving its response.
+  util::Histogram ack_latency_micros;
+
+  // The time spent in each listener callback.
+  util::Histogram listener_nanos;
+};
+
+// Metrics of a device session. See util/metrics.h.
+struct SessionMetrics {
+  // @param histograms The histograms to record into, or NULL to record none.
+  explicit SessionMetrics(SessionHistograms* histograms)
+      : histograms(histograms) {
+  }
+
+  // Requests sent and responses received, by kind.
+  util::Counter requests_sent[kNumRequestTypes];
+  util::Counter responses_received[kNumResponseTypes];
+
+  // The histograms, which may be shared with other sessions, or NULL.
+  SessionHistograms* histograms;
+
+  // Returns a snapshot of the metrics. The histograms are empty if there are
+  // none.
+  SessionMetricsSnapshot Snapshot() const {
+    SessionMetricsSnapshot snapshot;
+    for (int i = 0; i < kNumRequestTypes; ++i) {
+      snapshot.requests_sent[i] = requests_sent[i].value();
+    }
+    for (int i = 0; i < kNumResponseTypes; ++i) {
+      snapshot.responses_received[i] = responses_received[i].value();
+    }
+    if (histograms) {
+      snapshot.ack_latency_micros = histograms->ack_latency_micros.Snapshot();
+      snapshot.listener_nanos = histograms->listener_nanos.Snapshot();
+    }
+    return snapshot;
+  }
+};
+
+}  // namespace device
+}  // namespace anymote
+
+#endif  // ANYMOTE_DEVICE_SESSIONMETRICS_H_
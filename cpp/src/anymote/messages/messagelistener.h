@@ -23,16 +23,40 @@ namespace messages {
 // Interface for listeners that receive AnyMote messages.
 class MessageListener {
  public:
+  // The protocol errors reported to OnProtocolError.
+  enum ProtocolError {
+    // A message preamble is not a valid varint32.
+    kInvalidPreamble,
+
+    // A message is larger than the maximum frame size.
+    kFrameTooLarge,
+  };
+
   virtual ~MessageListener() {}
 
   // Handles a received Anymote message.
   //
+  // The message is owned by the caller and is only valid for the duration of
+  // this call: adapters reuse the same message object for every message they
+  // receive, so neither the message nor any of its fields may be referenced
+  // after this returns. Listeners that need a message later must copy it.
+  //
   // @param message The received message.
   virtual void OnMessage(const messages::RemoteMessage& message) = 0;
 
   // Handles an AnyMote error. This should be treated as a fatal error and the
   // session should be aborted.
   virtual void OnError() = 0;
+
+  // Handles a violation of the wire protocol by the peer. This should be
+  // treated as a fatal error, like OnError.
+  //
+  // The default implementation calls OnError, so existing listeners do not
+  // need to implement this.
+  // @param error The protocol error.
+  virtual void OnProtocolError(ProtocolError error) {
+    OnError();
+  }
 };
 
 }  // namespace messages
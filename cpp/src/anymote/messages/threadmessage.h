@@ -0,0 +1,71 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_MESSAGES_THREADMESSAGE_H_
+#define ANYMOTE_MESSAGES_THREADMESSAGE_H_
+
+#include <stddef.h>
+#include "anymote/messages/remote.pb.h"
+
+namespace anymote {
+namespace messages {
+
+// The size of the largest sent payload whose buffers a thread message keeps
+// for building the next messages.
+static const size_t kMaxRetainedPayloadSize = 64 * 1024;
+
+// A message that the calling thread reuses to build the messages it sends.
+// Clearing the message keeps its sub-messages and strings allocated, so
+// concurrent senders neither allocate nor contend once a message of each kind
+// has been sent.
+//
+// Each Owner type gets its own message per thread, so a device session whose
+// send is answered on the same thread by a server session, as over a loopback
+// link, does not see its message rebuilt underneath it.
+//
+// Example:
+//
+//   RemoteMessage* message = ThreadMessage<DeviceSession>::Get();
+//   message->Clear();
+//   ...
+//   adapter->SendMessage(*message);
+//   ThreadMessage<DeviceSession>::Trim(payload_size);
+template <typename Owner>
+class ThreadMessage {
+ public:
+  // Returns the message of the calling thread.
+  static RemoteMessage* Get() {
+    static thread_local RemoteMessage message;
+    return &message;
+  }
+
+  // Frees the buffers of the calling thread's message after it carried an
+  // unusually large payload, so that a single large message does not pin its
+  // memory for the life of the thread.
+  // @param payload_size The size of the payload just sent.
+  static void Trim(size_t payload_size) {
+    if (payload_size > kMaxRetainedPayloadSize) {
+      RemoteMessage().Swap(Get());
+    }
+  }
+
+ private:
+  // Not instantiable.
+  ThreadMessage();
+};
+
+}  // namespace messages
+}  // namespace anymote
+
+#endif  // ANYMOTE_MESSAGES_THREADMESSAGE_H_
@@ -0,0 +1,78 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_SERVER_REQUESTLISTENER_H_
+#define ANYMOTE_SERVER_REQUESTLISTENER_H_
+
+#include <stdint.h>
+#include <string>
+#include "anymote/messages/keycodes.pb.h"
+
+namespace anymote {
+namespace server {
+
+// Interface for a listener that handles the requests sent by an Anymote
+// device. Listeners must not perform any blocking I/O.
+class RequestListener {
+ public:
+  virtual ~RequestListener() {}
+
+  // Handles a key event.
+  //
+  // @param keycode The keycode of the event.
+  // @param action The action of the event (up or down).
+  virtual void OnKeyEvent(messages::Code keycode,
+                          messages::Action action) = 0;
+
+  // Handles a relative mouse movement.
+  //
+  // @param x_delta The relative movement along the x-axis (horizontal).
+  // @param y_delta The relative movement along the y-axis (vertical).
+  virtual void OnMouseEvent(int32_t x_delta, int32_t y_delta) = 0;
+
+  // Handles a mouse wheel movement.
+  //
+  // @param x_scroll The scroll amount along the x-axis (horizontal).
+  // @param y_scroll The scroll amount along the y-axis (vertical).
+  virtual void OnMouseWheel(int32_t x_scroll, int32_t y_scroll) = 0;
+
+  // Handles generic data sent by the device. The interpretation of the data
+  // is up to the server.
+  //
+  // @param type The data type identifier.
+  // @param data The data payload.
+  virtual void OnData(const std::string& type, const std::string& data) = 0;
+
+  // Handles the connection message sent by a device when it connects.
+  //
+  // @param device_name The device name.
+  // @param version The device version, or 0 if the device did not send one.
+  virtual void OnConnect(const std::string& device_name, int32_t version) = 0;
+
+  // Handles a request to view a URI.
+  //
+  // @param uri The URI to open.
+  // @return Whether the URI was opened. This is sent back to the device as the
+  //         fling result.
+  virtual bool OnFling(const std::string& uri) = 0;
+
+  // Handles an Anymote error. This should be treated as a fatal error and the
+  // session should be aborted.
+  virtual void OnError() = 0;
+};
+
+}  // namespace server
+}  // namespace anymote
+
+#endif  // ANYMOTE_SERVER_REQUESTLISTENER_H_
@@ -0,0 +1,134 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Anymote server session implementation, following the Java
+// com.google.anymote.server.ServerMessageAdapter.
+
+#include "anymote/server/serversession.h"
+
+#include <glog/logging.h>
+#include "anymote/messages/threadmessage.h"
+
+using ::anymote::messages::ThreadMessage;
+
+namespace anymote {
+namespace server {
+
+ServerSession::ServerSession(wire::WireAdapter* adapter,
+                             RequestListener* listener)
+    : adapter_(adapter),
+      listener_(listener),
+      requests_received_(0),
+      responses_sent_(0) {
+  CHECK_NOTNULL(adapter);
+  CHECK_NOTNULL(listener);
+}
+
+void ServerSession::StartSession() {
+  adapter_->set_listener(this);
+  adapter_->Init();
+}
+
+void ServerSession::SendData(const std::string& type,
+                             const std::string& data) {
+  messages::RemoteMessage* message = ThreadMessage<ServerSession>::Get();
+  message->Clear();
+  messages::Data* data_message =
+      message->mutable_response_message()->mutable_data_message();
+  data_message->set_type(type);
+  data_message->set_data(data);
+  adapter_->SendMessage(*message);
+  ThreadMessage<ServerSession>::Trim(data.size());
+}
+
+void ServerSession::OnMessage(const messages::RemoteMessage& message) {
+  if (message.has_request_message()) {
+    requests_received_++;
+    HandleRequest(message.request_message(), message.has_sequence_number(),
+                  message.sequence_number());
+  }
+}
+
+void ServerSession::HandleRequest(const messages::RequestMessage& request,
+                                  bool has_sequence_number,
+                                  uint32_t sequence_number) {
+  // A request with a sequence number and nothing else is a ping, which is
+  // acked with an empty response.
+  bool reply = has_sequence_number;
+
+  if (request.has_key_event_message()) {
+    reply = false;
+    const messages::KeyEvent& key_event = request.key_event_message();
+    listener_->OnKeyEvent(key_event.keycode(), key_event.action());
+  }
+
+  if (request.has_mouse_event_message()) {
+    reply = false;
+    const messages::MouseEvent& mouse_event = request.mouse_event_message();
+    listener_->OnMouseEvent(mouse_event.x_delta(), mouse_event.y_delta());
+  }
+
+  if (request.has_mouse_wheel_message()) {
+    reply = false;
+    const messages::MouseWheel& mouse_wheel = request.mouse_wheel_message();
+    listener_->OnMouseWheel(mouse_wheel.x_scroll(), mouse_wheel.y_scroll());
+  }
+
+  if (request.has_data_message()) {
+    reply = false;
+    const messages::Data& data = request.data_message();
+    listener_->OnData(data.type(), data.data());
+  }
+
+  if (request.has_connect_message()) {
+    reply = false;
+    const messages::Connect& connect = request.connect_message();
+    listener_->OnConnect(connect.device_name(), connect.version());
+  }
+
+  // The listener may send data from its callbacks, which uses the same
+  // message, so the response is only built once they have returned.
+  bool has_fling = request.has_fling_message();
+  bool fling_success = false;
+  if (has_fling) {
+    reply = true;
+    fling_success = listener_->OnFling(request.fling_message().uri());
+  }
+
+  if (!reply) {
+    return;
+  }
+
+  messages::RemoteMessage* response = ThreadMessage<ServerSession>::Get();
+  response->Clear();
+  messages::ResponseMessage* response_message =
+      response->mutable_response_message();
+  if (has_fling) {
+    response_message->mutable_fling_result_message()->set_result(
+        fling_success ? messages::FlingResult_Result_SUCCESS
+                      : messages::FlingResult_Result_FAILURE);
+  }
+  if (has_sequence_number) {
+    response->set_sequence_number(sequence_number);
+  }
+  responses_sent_++;
+  adapter_->SendMessage(*response);
+}
+
+void ServerSession::OnError() {
+  listener_->OnError();
+}
+
+}  // namespace server
+}  // namespace anymote
@@ -0,0 +1,106 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_SERVER_SERVERSESSION_H_
+#define ANYMOTE_SERVER_SERVERSESSION_H_
+
+#include <stdint.h>
+#include <string>
+#include "anymote/messages/messagelistener.h"
+#include "anymote/server/requestlistener.h"
+#include "anymote/wire/wireadapter.h"
+
+namespace anymote {
+namespace server {
+
+// Anymote server session used to receive requests from an Anymote device and
+// answer them. This is the counterpart of device::DeviceSession.
+//
+// Requests are dispatched to the request listener. Pings, that is requests
+// with a sequence number and nothing else, are acked with an empty response
+// carrying the same sequence number, and flings are answered with the fling
+// result returned by the listener. Other requests are not answered.
+//
+// Example:
+//
+//   ServerSession session(wire_adapter, request_listener);
+//   session.StartSession();
+//
+// Received messages are dispatched on the thread of the wire adapter. SendData
+// is thread-safe.
+class ServerSession : public messages::MessageListener {
+ public:
+  // Creates a new Anymote server session.
+  //
+  // @param adapter The wire adapter used to send and receive Anymote messages.
+  //        The adapter must not be NULL and must exist for the duration of this
+  //        session. No ownership is taken.
+  // @param listener The listener that will be notified of Anymote requests.
+  //        The listener must not be NULL and must exist for the duration of
+  //        this session. No ownership is taken.
+  ServerSession(wire::WireAdapter* adapter, RequestListener* listener);
+
+  virtual ~ServerSession() {}
+
+  // Starts the session, which starts receiving requests.
+  void StartSession();
+
+  // Sends generic data to the device.
+  //
+  // @param type The data type identifier.
+  // @param data The data payload.
+  void SendData(const std::string& type, const std::string& data);
+
+  // Returns the number of requests received.
+  uint64_t requests_received() const { return requests_received_; }
+
+  // Returns the number of responses sent, other than data.
+  uint64_t responses_sent() const { return responses_sent_; }
+
+  // @override
+  virtual void OnMessage(const messages::RemoteMessage& message);
+
+  // @override
+  virtual void OnError();
+
+ private:
+  // Dispatches a request to the listener and answers it if needed.
+  //
+  // @param request The request.
+  // @param has_sequence_number Whether the request has a sequence number.
+  // @param sequence_number The sequence number of the request.
+  void HandleRequest(const messages::RequestMessage& request,
+                     bool has_sequence_number, uint32_t sequence_number);
+
+  // The wire adapter used to send and receive Anymote messages. No ownership
+  // is taken.
+  wire::WireAdapter* adapter_;
+
+  // The listener that will be notified of Anymote requests. No ownership is
+  // taken.
+  RequestListener* listener_;
+
+  // Only updated on the thread of the wire adapter.
+  uint64_t requests_received_;
+  uint64_t responses_sent_;
+
+  // Disallow copy and assign.
+  ServerSession(const ServerSession&);
+  void operator=(const ServerSession&);
+};
+
+}  // namespace server
+}  // namespace anymote
+
+#endif  // ANYMOTE_SERVER_SERVERSESSION_H_
@@ -0,0 +1,141 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "anymote/util/bufferpool.h"
+
+#include <glog/logging.h>
+#include <algorithm>
+
+namespace anymote {
+namespace util {
+
+// The buffer sizes of the size classes.
+static const size_t kClassSizes[BufferPool::kNumSizeClasses] = {
+  64, 512, 4096, 64 * 1024, 256 * 1024, 1024 * 1024,
+};
+
+// The maximum number of bytes in the free buffers of a single class.
+static const size_t kMaxFreeBytesPerClass = 4 * 1024 * 1024;
+
+// The number of free buffers kept per class by the default pool.
+static const size_t kDefaultMaxFreeBuffers = 64;
+
+const int BufferPool::kNumSizeClasses;
+
+BufferPool::BufferPool(size_t max_free_buffers)
+    : large_allocations_(0) {
+  for (int i = 0; i < kNumSizeClasses; ++i) {
+    classes_[i].max_free = std::min(
+        max_free_buffers,
+        std::max<size_t>(1, kMaxFreeBytesPerClass / kClassSizes[i]));
+  }
+}
+
+BufferPool::~BufferPool() {
+  for (int i = 0; i < kNumSizeClasses; ++i) {
+    FreeBuffer* buffer = classes_[i].free_list;
+    while (buffer != NULL) {
+      FreeBuffer* next = buffer->next;
+      delete[] reinterpret_cast<uint8_t*>(buffer);
+      buffer = next;
+    }
+  }
+}
+
+uint8_t* BufferPool::Acquire(size_t size, size_t* capacity) {
+  int size_class = ClassForSize(size);
+  if (size_class < 0) {
+    std::lock_guard<std::mutex> lock(large_mutex_);
+    large_allocations_++;
+    *capacity = size;
+    return new uint8_t[size];
+  }
+
+  *capacity = kClassSizes[size_class];
+  SizeClass& free_buffers = classes_[size_class];
+  {
+    std::lock_guard<std::mutex> lock(free_buffers.mutex);
+    FreeBuffer* buffer = free_buffers.free_list;
+    if (buffer != NULL) {
+      free_buffers.free_list = buffer->next;
+      free_buffers.num_free--;
+      return reinterpret_cast<uint8_t*>(buffer);
+    }
+    free_buffers.allocations++;
+  }
+  return new uint8_t[*capacity];
+}
+
+void BufferPool::Release(uint8_t* buffer, size_t capacity) {
+  int size_class = ClassForSize(capacity);
+  if (size_class < 0 || kClassSizes[size_class] != capacity) {
+    CHECK_GT(capacity, kClassSizes[kNumSizeClasses - 1]);
+    delete[] buffer;
+    return;
+  }
+
+  SizeClass& free_buffers = classes_[size_class];
+  {
+    std::lock_guard<std::mutex> lock(free_buffers.mutex);
+    if (free_buffers.num_free < free_buffers.max_free) {
+      FreeBuffer* free_buffer = reinterpret_cast<FreeBuffer*>(buffer);
+      free_buffer->next = free_buffers.free_list;
+      free_buffers.free_list = free_buffer;
+      free_buffers.num_free++;
+      return;
+    }
+  }
+  delete[] buffer;
+}
+
+int64_t BufferPool::allocations() const {
+  int64_t total = 0;
+  for (int i = 0; i < kNumSizeClasses; ++i) {
+    std::lock_guard<std::mutex> lock(classes_[i].mutex);
+    total += classes_[i].allocations;
+  }
+  std::lock_guard<std::mutex> lock(large_mutex_);
+  return total + large_allocations_;
+}
+
+size_t BufferPool::free_buffers(int size_class) const {
+  CHECK_GE(size_class, 0);
+  CHECK_LT(size_class, kNumSizeClasses);
+  std::lock_guard<std::mutex> lock(classes_[size_class].mutex);
+  return classes_[size_class].num_free;
+}
+
+size_t BufferPool::ClassSize(int size_class) {
+  CHECK_GE(size_class, 0);
+  CHECK_LT(size_class, kNumSizeClasses);
+  return kClassSizes[size_class];
+}
+
+int BufferPool::ClassForSize(size_t size) {
+  for (int i = 0; i < kNumSizeClasses; ++i) {
+    if (size <= kClassSizes[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+BufferPool* BufferPool::GetDefaultPool() {
+  // Leaked, so that it outlives decoders destroyed during static destruction.
+  static BufferPool* pool = new BufferPool(kDefaultMaxFreeBuffers);
+  return pool;
+}
+
+}  // namespace util
+}  // namespace anymote
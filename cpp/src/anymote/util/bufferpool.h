@@ -0,0 +1,116 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_UTIL_BUFFERPOOL_H_
+#define ANYMOTE_UTIL_BUFFERPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+
+namespace anymote {
+namespace util {
+
+// A pool of byte buffers in a few size classes, from 64 bytes up to 1 MiB,
+// which is the default maximum frame size of FrameDecoder. A request is
+// served with a buffer of the smallest class that fits, and released buffers
+// are kept on a free list per class for the next request, so steady-state use
+// does not touch the global allocator. Requests larger than the largest
+// class are allocated and freed directly.
+//
+// Each class keeps at most a fixed number of free buffers, and the large
+// classes keep fewer so that no class holds more than 4 MiB. This bounds the
+// memory held by an idle pool.
+//
+// This class is thread-safe.
+class BufferPool {
+ public:
+  // The number of size classes.
+  static const int kNumSizeClasses = 6;
+
+  // Creates a new pool.
+  // @param max_free_buffers The maximum number of free buffers kept per size
+  //                         class, which the large classes lower further.
+  //                         Buffers released beyond this are freed.
+  explicit BufferPool(size_t max_free_buffers);
+
+  // Frees the buffers in the pool. Buffers still acquired must not be
+  // released afterwards.
+  ~BufferPool();
+
+  // Acquires a buffer of at least the given size.
+  // @param size The number of bytes needed.
+  // @param capacity Set to the size of the buffer, which must be passed back
+  //                 to Release.
+  // @return The buffer, whose contents are undefined.
+  uint8_t* Acquire(size_t size, size_t* capacity);
+
+  // Returns a buffer to the pool.
+  // @param buffer The buffer, as returned by Acquire.
+  // @param capacity The capacity returned by Acquire with the buffer.
+  void Release(uint8_t* buffer, size_t capacity);
+
+  // Returns the number of buffers that were allocated from the global
+  // allocator because the pool had no free buffer to serve a request.
+  int64_t allocations() const;
+
+  // Returns the number of free buffers of the given size class.
+  // @param size_class A size class, from 0 to kNumSizeClasses - 1.
+  size_t free_buffers(int size_class) const;
+
+  // Returns the buffer size of the given size class.
+  // @param size_class A size class, from 0 to kNumSizeClasses - 1.
+  static size_t ClassSize(int size_class);
+
+  // Returns a pool shared by the whole process. The pool must not be deleted.
+  static BufferPool* GetDefaultPool();
+
+ private:
+  // A free buffer, linked through its first bytes.
+  struct FreeBuffer {
+    FreeBuffer* next;
+  };
+
+  // The free buffers of a size class.
+  struct SizeClass {
+    SizeClass() : max_free(0), free_list(NULL), num_free(0), allocations(0) {}
+
+    // The maximum number of free buffers kept.
+    size_t max_free;
+
+    mutable std::mutex mutex;
+    FreeBuffer* free_list;
+    size_t num_free;
+    int64_t allocations;
+  };
+
+  // Returns the smallest size class whose buffers hold the given size, or -1
+  // if the size is larger than every class.
+  static int ClassForSize(size_t size);
+
+  SizeClass classes_[kNumSizeClasses];
+
+  // The number of buffers too large for any class that were allocated.
+  mutable std::mutex large_mutex_;
+  int64_t large_allocations_;
+
+  // Disallow copy and assign.
+  BufferPool(const BufferPool&);
+  void operator=(const BufferPool&);
+};
+
+}  // namespace util
+}  // namespace anymote
+
+#endif  // ANYMOTE_UTIL_BUFFERPOOL_H_
@@ -0,0 +1,51 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_UTIL_CLOCK_H_
+#define ANYMOTE_UTIL_CLOCK_H_
+
+#include <stdint.h>
+
+namespace anymote {
+namespace util {
+
+// A source of monotonic time, used for timeouts and for pacing messages.
+// Implementations must be thread-safe.
+class Clock {
+ public:
+  Clock() {}
+  virtual ~Clock() {}
+
+  // Returns the current time in microseconds, measured from an arbitrary
+  // fixed point. The value never decreases.
+  virtual int64_t NowMicros() = 0;
+
+  // Returns the current time in nanoseconds, for measuring short intervals.
+  // The default implementation has microsecond resolution.
+  virtual int64_t NowNanos() { return NowMicros() * 1000; }
+
+  // Returns a clock backed by the system monotonic clock. The clock is shared
+  // and must not be deleted.
+  static Clock* GetRealClock();
+
+ private:
+  // Disallow copy and assign.
+  Clock(const Clock&);
+  void operator=(const Clock&);
+};
+
+}  // namespace util
+}  // namespace anymote
+
+#endif  // ANYMOTE_UTIL_CLOCK_H_
@@ -0,0 +1,53 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_UTIL_CLOSURE_H_
+#define ANYMOTE_UTIL_CLOSURE_H_
+
+namespace anymote {
+namespace util {
+
+// A unit of work that can be scheduled to run later, possibly on another
+// thread.
+class Closure {
+ public:
+  virtual ~Closure() {}
+
+  // Runs the work.
+  virtual void Run() = 0;
+};
+
+// Closure that invokes a method on an object. This is useful for closures that
+// are members of the object they act on and are posted repeatedly.
+template <typename T>
+class MethodClosure : public Closure {
+ public:
+  // @param object The object to invoke the method on. No ownership is taken.
+  // @param method The method to invoke.
+  MethodClosure(T* object, void (T::*method)())
+      : object_(object),
+        method_(method) {
+  }
+
+  virtual void Run() { (object_->*method_)(); }
+
+ private:
+  T* object_;
+  void (T::*method_)();
+};
+
+}  // namespace util
+}  // namespace anymote
+
+#endif  // ANYMOTE_UTIL_CLOSURE_H_
@@ -0,0 +1,204 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "anymote/util/eventloop.h"
+
+#include <errno.h>
+#include <glog/logging.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace anymote {
+namespace util {
+
+// The maximum number of events dispatched per wait.
+static const int kMaxEvents = 64;
+
+EventLoop::EventLoop()
+    : epoll_fd_(-1),
+      wakeup_fd_(-1),
+      stopped_(false),
+      dispatching_(false) {
+}
+
+EventLoop::~EventLoop() {
+  if (wakeup_fd_ >= 0) {
+    close(wakeup_fd_);
+  }
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+}
+
+bool EventLoop::Init() {
+  CHECK_LT(epoll_fd_, 0) << "Event loop already initialized";
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    PLOG(ERROR) << "epoll_create1 failed";
+    return false;
+  }
+
+  wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeup_fd_ < 0) {
+    PLOG(ERROR) << "eventfd failed";
+    return false;
+  }
+
+  // The wakeup file descriptor is registered without a handler.
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &event) < 0) {
+    PLOG(ERROR) << "Failed to watch wakeup fd";
+    return false;
+  }
+  return true;
+}
+
+bool EventLoop::AddFd(int fd, uint32_t events, Handler* handler) {
+  CHECK_NOTNULL(handler);
+  struct epoll_event event;
+  event.events = events;
+  event.data.ptr = handler;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+    PLOG(ERROR) << "Failed to watch fd " << fd;
+    return false;
+  }
+
+  // The handler may reuse the address of a handler removed earlier in this
+  // dispatch, in which case its events must no longer be skipped.
+  removed_handlers_.erase(
+      std::remove(removed_handlers_.begin(), removed_handlers_.end(), handler),
+      removed_handlers_.end());
+  return true;
+}
+
+bool EventLoop::ModifyFd(int fd, uint32_t events, Handler* handler) {
+  struct epoll_event event;
+  event.events = events;
+  event.data.ptr = handler;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) < 0) {
+    PLOG(ERROR) << "Failed to modify fd " << fd;
+    return false;
+  }
+  return true;
+}
+
+void EventLoop::RemoveFd(int fd, Handler* handler) {
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+  if (dispatching_) {
+    removed_handlers_.push_back(handler);
+  }
+}
+
+void EventLoop::Post(Closure* closure) {
+  CHECK_NOTNULL(closure);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    posted_closures_.push_back(closure);
+  }
+  Wakeup();
+}
+
+void EventLoop::Cancel(Closure* closure) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    posted_closures_.erase(
+        std::remove(posted_closures_.begin(), posted_closures_.end(), closure),
+        posted_closures_.end());
+  }
+  if (IsInLoopThread()) {
+    std::replace(running_closures_.begin(), running_closures_.end(), closure,
+                 static_cast<Closure*>(NULL));
+  }
+}
+
+void EventLoop::Run() {
+  while (!stopped_) {
+    RunOnce(-1);
+  }
+}
+
+void EventLoop::RunOnce(int timeout_ms) {
+  loop_thread_ = std::this_thread::get_id();
+
+  struct epoll_event events[kMaxEvents];
+  int num_events = epoll_wait(epoll_fd_, events, kMaxEvents, timeout_ms);
+  if (num_events < 0) {
+    if (errno != EINTR) {
+      PLOG(ERROR) << "epoll_wait failed";
+    }
+    num_events = 0;
+  }
+
+  dispatching_ = true;
+  for (int i = 0; i < num_events; ++i) {
+    Handler* handler = static_cast<Handler*>(events[i].data.ptr);
+    if (handler == NULL) {
+      uint64_t value;
+      while (read(wakeup_fd_, &value, sizeof(value)) > 0) {
+      }
+      continue;
+    }
+    if (!removed_handlers_.empty() &&
+        std::find(removed_handlers_.begin(), removed_handlers_.end(),
+                  handler) != removed_handlers_.end()) {
+      continue;
+    }
+    handler->OnEvents(events[i].events);
+  }
+  removed_handlers_.clear();
+  dispatching_ = false;
+
+  RunPostedClosures();
+}
+
+void EventLoop::Stop() {
+  stopped_ = true;
+  Wakeup();
+}
+
+bool EventLoop::IsInLoopThread() const {
+  return loop_thread_ == std::this_thread::get_id();
+}
+
+void EventLoop::RunPostedClosures() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_closures_.swap(posted_closures_);
+  }
+
+  // A closure may cancel the ones after it, so check each entry as it is run.
+  for (size_t i = 0; i < running_closures_.size(); ++i) {
+    Closure* closure = running_closures_[i];
+    if (closure != NULL) {
+      running_closures_[i] = NULL;
+      closure->Run();
+    }
+  }
+  running_closures_.clear();
+}
+
+void EventLoop::Wakeup() {
+  uint64_t value = 1;
+  if (write(wakeup_fd_, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+    PLOG(ERROR) << "Failed to wake up event loop";
+  }
+}
+
+}  // namespace util
+}  // namespace anymote
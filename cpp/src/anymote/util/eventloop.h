@@ -0,0 +1,161 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_UTIL_EVENTLOOP_H_
+#define ANYMOTE_UTIL_EVENTLOOP_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "anymote/util/closure.h"
+
+namespace anymote {
+namespace util {
+
+// Event loop that dispatches file descriptor readiness events using epoll.
+// The loop runs on a single dispatch thread. File descriptors may only be
+// added, modified and removed from the dispatch thread, or before the loop
+// starts running. Post and Stop may be invoked from any thread.
+//
+// Example:
+//
+//   EventLoop loop;
+//   CHECK(loop.Init());
+//   loop.AddFd(fd, EPOLLIN, &handler);
+//   loop.Run();
+class EventLoop {
+ public:
+  // Interface for handlers of file descriptor events.
+  class Handler {
+   public:
+    virtual ~Handler() {}
+
+    // Handles events on a file descriptor. Invoked from the dispatch thread.
+    //
+    // @param events The epoll event bits that are ready, such as EPOLLIN,
+    //        EPOLLOUT, EPOLLERR or EPOLLHUP.
+    virtual void OnEvents(uint32_t events) = 0;
+  };
+
+  EventLoop();
+  ~EventLoop();
+
+  // Initializes the event loop. This must be called once before using the
+  // loop.
+  //
+  // @return false if the epoll instance could not be created.
+  bool Init();
+
+  // Starts watching a file descriptor.
+  //
+  // @param fd The file descriptor to watch.
+  // @param events The epoll event bits to watch for. May be 0.
+  // @param handler The handler to notify. No ownership is taken and the
+  //        pointer must be valid until the file descriptor is removed.
+  // @return false if the file descriptor could not be watched.
+  bool AddFd(int fd, uint32_t events, Handler* handler);
+
+  // Changes the events watched for a file descriptor.
+  //
+  // @param fd The file descriptor, which must have been added.
+  // @param events The epoll event bits to watch for. May be 0.
+  // @param handler The handler to notify.
+  // @return false if the file descriptor could not be modified.
+  bool ModifyFd(int fd, uint32_t events, Handler* handler);
+
+  // Stops watching a file descriptor. Pending events for the handler that
+  // were already received will not be dispatched.
+  //
+  // @param fd The file descriptor.
+  // @param handler The handler that was notified for the file descriptor.
+  void RemoveFd(int fd, Handler* handler);
+
+  // Schedules a closure to run on the dispatch thread. This function is
+  // thread-safe and returns immediately.
+  //
+  // @param closure The closure to run. No ownership is taken and the pointer
+  //        must be valid until the closure has run.
+  void Post(Closure* closure);
+
+  // Cancels all pending runs of a posted closure. This function is
+  // thread-safe, but a closure that is about to run can only be cancelled
+  // from the dispatch thread.
+  //
+  // @param closure The closure to cancel.
+  void Cancel(Closure* closure);
+
+  // Runs the loop on the calling thread until Stop is invoked. Returns
+  // immediately if Stop was already invoked.
+  void Run();
+
+  // Waits for events once and dispatches them on the calling thread, along
+  // with any posted closures.
+  //
+  // @param timeout_ms The maximum time to wait for events, in milliseconds,
+  //        or -1 to wait indefinitely.
+  void RunOnce(int timeout_ms);
+
+  // Makes Run return. This function is thread-safe.
+  void Stop();
+
+  // Returns whether the calling thread is the dispatch thread.
+  bool IsInLoopThread() const;
+
+  // Returns a buffer that handlers may use as temporary storage while handling
+  // an event, so that idle handlers do not need buffers of their own. The
+  // buffer may only be used from the dispatch thread, and its contents are
+  // not preserved once the handler returns.
+  std::vector<uint8_t>* scratch_buffer() { return &scratch_buffer_; }
+
+ private:
+  // Runs all posted closures.
+  void RunPostedClosures();
+
+  // Wakes the dispatch thread if it is waiting for events.
+  void Wakeup();
+
+  int epoll_fd_;
+  int wakeup_fd_;
+
+  // The thread currently dispatching events.
+  std::atomic<std::thread::id> loop_thread_;
+
+  std::atomic<bool> stopped_;
+
+  // Handlers removed while dispatching a set of events. Events for these
+  // handlers are skipped.
+  std::vector<Handler*> removed_handlers_;
+  bool dispatching_;
+
+  // Guards posted_closures_.
+  std::mutex mutex_;
+  std::vector<Closure*> posted_closures_;
+
+  std::vector<uint8_t> scratch_buffer_;
+
+  // Closures being run by the dispatch thread. Cancelled entries are set to
+  // NULL.
+  std::vector<Closure*> running_closures_;
+
+  // Disallow copy and assign.
+  EventLoop(const EventLoop&);
+  void operator=(const EventLoop&);
+};
+
+}  // namespace util
+}  // namespace anymote
+
+#endif  // ANYMOTE_UTIL_EVENTLOOP_H_
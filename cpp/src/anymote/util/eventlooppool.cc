@@ -0,0 +1,85 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "anymote/util/eventlooppool.h"
+
+#include <glog/logging.h>
+
+namespace anymote {
+namespace util {
+
+EventLoopPool::EventLoopPool(int num_threads)
+    : num_users_(num_threads, 0) {
+  CHECK_GT(num_threads, 0) << "Pool must have at least one thread";
+  for (int i = 0; i < num_threads; ++i) {
+    loops_.push_back(new EventLoop());
+  }
+}
+
+EventLoopPool::~EventLoopPool() {
+  Stop();
+  for (size_t i = 0; i < loops_.size(); ++i) {
+    delete loops_[i];
+  }
+}
+
+bool EventLoopPool::Start() {
+  CHECK(threads_.empty()) << "Pool already started";
+  for (size_t i = 0; i < loops_.size(); ++i) {
+    if (!loops_[i]->Init()) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < loops_.size(); ++i) {
+    threads_.push_back(std::thread(&EventLoop::Run, loops_[i]));
+  }
+  return true;
+}
+
+void EventLoopPool::Stop() {
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    loops_[i]->Stop();
+  }
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    threads_[i].join();
+  }
+  threads_.clear();
+}
+
+EventLoop* EventLoopPool::AcquireLoop() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t best = 0;
+  for (size_t i = 1; i < num_users_.size(); ++i) {
+    if (num_users_[i] < num_users_[best]) {
+      best = i;
+    }
+  }
+  num_users_[best]++;
+  return loops_[best];
+}
+
+void EventLoopPool::ReleaseLoop(EventLoop* loop) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < loops_.size(); ++i) {
+    if (loops_[i] == loop) {
+      CHECK_GT(num_users_[i], 0) << "Loop released too many times";
+      num_users_[i]--;
+      return;
+    }
+  }
+  LOG(FATAL) << "Loop does not belong to this pool";
+}
+
+}  // namespace util
+}  // namespace anymote
@@ -0,0 +1,83 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_UTIL_EVENTLOOPPOOL_H_
+#define ANYMOTE_UTIL_EVENTLOOPPOOL_H_
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "anymote/util/eventloop.h"
+
+namespace anymote {
+namespace util {
+
+// A fixed set of event loops, each running on its own thread. Users acquire
+// a loop to run on and stay pinned to it until they release it, so that
+// everything a user does happens on a single dispatch thread. Loops are
+// handed out least-loaded first to spread users evenly across threads.
+class EventLoopPool {
+ public:
+  // Creates a pool. The loops do not run until Start is invoked.
+  //
+  // @param num_threads The number of event loops and threads. Must be
+  //        positive.
+  explicit EventLoopPool(int num_threads);
+
+  // Stops the pool, if it is running, and destroys the loops.
+  ~EventLoopPool();
+
+  // Initializes the loops and starts a thread for each one.
+  //
+  // @return false if a loop could not be initialized.
+  bool Start();
+
+  // Stops all loops and waits for their threads to exit. Closures that were
+  // posted but have not run are not run.
+  void Stop();
+
+  // Returns the loop with the fewest users and counts the caller as one of
+  // its users. This function is thread-safe.
+  EventLoop* AcquireLoop();
+
+  // Stops counting a user of a loop. This function is thread-safe.
+  //
+  // @param loop A loop returned by AcquireLoop.
+  void ReleaseLoop(EventLoop* loop);
+
+  // Returns the number of loops.
+  int size() const { return static_cast<int>(loops_.size()); }
+
+  // Returns a loop.
+  //
+  // @param index The index of the loop, which must be less than size().
+  EventLoop* loop(int index) { return loops_[index]; }
+
+ private:
+  std::vector<EventLoop*> loops_;
+  std::vector<std::thread> threads_;
+
+  // Guards num_users_.
+  std::mutex mutex_;
+  std::vector<int> num_users_;
+
+  // Disallow copy and assign.
+  EventLoopPool(const EventLoopPool&);
+  void operator=(const EventLoopPool&);
+};
+
+}  // namespace util
+}  // namespace anymote
+
+#endif  // ANYMOTE_UTIL_EVENTLOOPPOOL_H_
@@ -0,0 +1,138 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Histogram buckets are log-linear: the first 16 buckets count the values 0 to
+// 15 exactly, and every following group of 16 buckets splits the next power of
+// two into 16 equal parts. The bucket of a value is found from the position of
+// its highest set bit and the 4 bits below it.
+
+#include "anymote/util/metrics.h"
+
+#include <algorithm>
+
+namespace anymote {
+namespace util {
+
+// The number of bits of a value that select its bucket within a power of two.
+static const int kSubBucketBits = 4;
+static const int kSubBuckets = 1 << kSubBucketBits;
+
+// Values are clamped below this, which falls in the last bucket.
+static const int64_t kMaxValue = (static_cast<int64_t>(1) << 32) - 1;
+
+// Returns the largest value counted by the given bucket.
+static int64_t BucketMaxValue(int bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+
+  int exponent = bucket / kSubBuckets + kSubBucketBits - 1;
+  int sub_bucket = bucket % kSubBuckets;
+  int shift = exponent - kSubBucketBits;
+  return ((static_cast<int64_t>(kSubBuckets + sub_bucket + 1)) << shift) - 1;
+}
+
+int64_t HistogramSnapshot::Percentile(double percent) const {
+  if (count == 0) {
+    return 0;
+  }
+
+  // The rank of the value, counting from 1.
+  uint64_t rank = static_cast<uint64_t>(percent / 100 * count + 0.5);
+  rank = std::max<uint64_t>(rank, 1);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      return std::min(BucketMaxValue(i), max);
+    }
+  }
+  return max;
+}
+
+double HistogramSnapshot::Mean() const {
+  return count == 0 ? 0 : static_cast<double>(sum) / count;
+}
+
+#ifndef ANYMOTE_DISABLE_METRICS
+
+// Returns the bucket that counts the given value, which must not be negative
+// or above kMaxValue.
+static int BucketForValue(int64_t value) {
+  if (value < kSubBuckets) {
+    return value;
+  }
+
+  int exponent = 63 - __builtin_clzll(value);
+  int sub_bucket = (value >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+  return (exponent - kSubBucketBits + 1) * kSubBuckets + sub_bucket;
+}
+
+void Gauge::Set(int64_t value) {
+  value_.store(value, std::memory_order_relaxed);
+  int64_t max = max_.load(std::memory_order_relaxed);
+  while (value > max &&
+         !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+Histogram::Histogram()
+    : count_(0),
+      sum_(0),
+      min_(kMaxValue),
+      max_(0) {
+  for (int i = 0; i < kNumBuckets; ++i) {
+    buckets_[i] = 0;
+  }
+}
+
+void Histogram::Record(int64_t value) {
+  if (value < 0) {
+    value = 0;
+  } else if (value > kMaxValue) {
+    value = kMaxValue;
+  }
+
+  buckets_[BucketForValue(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+
+  int64_t min = min_.load(std::memory_order_relaxed);
+  while (value < min &&
+         !min_.compare_exchange_weak(min, value, std::memory_order_relaxed)) {
+  }
+  int64_t max = max_.load(std::memory_order_relaxed);
+  while (value > max &&
+         !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+HistogramSnapshot Histogram::Snapshot() const {
+  HistogramSnapshot snapshot;
+  snapshot.buckets.resize(kNumBuckets);
+  for (int i = 0; i < kNumBuckets; ++i) {
+    snapshot.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+    snapshot.count += snapshot.buckets[i];
+  }
+  snapshot.sum = sum_.load(std::memory_order_relaxed);
+  snapshot.max = max_.load(std::memory_order_relaxed);
+  snapshot.min = snapshot.count == 0 ?
+      0 : std::min(min_.load(std::memory_order_relaxed), snapshot.max);
+  return snapshot;
+}
+
+#endif  // ANYMOTE_DISABLE_METRICS
+
+}  // namespace util
+}  // namespace anymote
@@ -0,0 +1,163 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_UTIL_METRICS_H_
+#define ANYMOTE_UTIL_METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#ifndef ANYMOTE_DISABLE_METRICS
+#include <atomic>
+#endif
+
+namespace anymote {
+namespace util {
+
+// Low-overhead metrics for the hot paths of the library. Counters, gauges and
+// histograms are updated with relaxed atomic operations, so any thread may
+// update them without locking and a reader may take a snapshot at any time.
+// A snapshot is consistent per value, but values updated concurrently may be
+// from slightly different moments.
+//
+// Building with ANYMOTE_DISABLE_METRICS defined (configure --disable-metrics)
+// replaces every class here with an empty one whose methods do nothing, so
+// the metrics compile out completely and snapshots are all zero.
+#ifdef ANYMOTE_DISABLE_METRICS
+static const bool kMetricsEnabled = false;
+#else
+static const bool kMetricsEnabled = true;
+#endif
+
+// A snapshot of a histogram.
+struct HistogramSnapshot {
+  HistogramSnapshot() : count(0), sum(0), min(0), max(0) {}
+
+  // Returns the value at the given percentile, which is accurate to the
+  // histogram's precision, or 0 if there are no values.
+  // @param percent The percentile, between 0 and 100.
+  int64_t Percentile(double percent) const;
+
+  // Returns the mean of the values, or 0 if there are no values.
+  double Mean() const;
+
+  // The number of values recorded in each bucket.
+  std::vector<uint64_t> buckets;
+
+  uint64_t count;
+  int64_t sum;
+  int64_t min;
+  int64_t max;
+};
+
+#ifndef ANYMOTE_DISABLE_METRICS
+
+// A monotonically increasing count.
+class Counter {
+ public:
+  Counter() : value_(0) {}
+
+  void Increment() { Add(1); }
+
+  void Add(uint64_t amount) {
+    value_.fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint64_t> value_;
+
+  // Disallow copy and assign.
+  Counter(const Counter&);
+  void operator=(const Counter&);
+};
+
+// A level, such as the depth of a queue, that also remembers its maximum.
+class Gauge {
+ public:
+  Gauge() : value_(0), max_(0) {}
+
+  void Set(int64_t value);
+
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+  int64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_;
+  std::atomic<int64_t> max_;
+
+  // Disallow copy and assign.
+  Gauge(const Gauge&);
+  void operator=(const Gauge&);
+};
+
+// A histogram of non-negative values with a fixed relative precision, in the
+// style of HdrHistogram. Values below 16 are counted exactly; larger values
+// fall in one of 16 buckets per power of two, so a percentile is within 1/16
+// of the true value. Values from 2^32 up are counted in the last bucket.
+class Histogram {
+ public:
+  // The number of buckets.
+  static const int kNumBuckets = 464;
+
+  Histogram();
+
+  // Records a value. Negative values are recorded as 0.
+  void Record(int64_t value);
+
+  // Returns a snapshot of the recorded values.
+  HistogramSnapshot Snapshot() const;
+
+ private:
+  std::atomic<uint64_t> buckets_[kNumBuckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<int64_t> sum_;
+  std::atomic<int64_t> min_;
+  std::atomic<int64_t> max_;
+
+  // Disallow copy and assign.
+  Histogram(const Histogram&);
+  void operator=(const Histogram&);
+};
+
+#else  // ANYMOTE_DISABLE_METRICS
+
+class Counter {
+ public:
+  void Increment() {}
+  void Add(uint64_t amount) {}
+  uint64_t value() const { return 0; }
+};
+
+class Gauge {
+ public:
+  void Set(int64_t value) {}
+  int64_t value() const { return 0; }
+  int64_t max() const { return 0; }
+};
+
+class Histogram {
+ public:
+  void Record(int64_t value) {}
+  HistogramSnapshot Snapshot() const { return HistogramSnapshot(); }
+};
+
+#endif  // ANYMOTE_DISABLE_METRICS
+
+}  // namespace util
+}  // namespace anymote
+
+#endif  // ANYMOTE_UTIL_METRICS_H_
@@ -0,0 +1,146 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_UTIL_MPSCQUEUE_H_
+#define ANYMOTE_UTIL_MPSCQUEUE_H_
+
+#include <glog/logging.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace anymote {
+namespace util {
+
+// Bounded lock-free queue for many producers and a single consumer, based on
+// Dmitry Vyukov's bounded queue. Elements live in preallocated slots and are
+// written in place, so elements that own memory, such as buffers, keep their
+// capacity from one use to the next and the queue never allocates after it
+// has been created.
+//
+// Producers reserve a slot with BeginPush, fill it in and publish it with
+// CommitPush. Only one thread may consume at a time, with Front and Pop;
+// the consumer may change as long as the handoff is synchronized.
+template <typename T>
+class MpscQueue {
+ public:
+  // Creates a queue.
+  //
+  // @param capacity The maximum number of elements. Must be a power of two.
+  explicit MpscQueue(size_t capacity)
+      : slots_(new Slot[capacity]),
+        mask_(capacity - 1),
+        push_position_(0),
+        pop_position_(0) {
+    CHECK(capacity > 0 && (capacity & mask_) == 0)
+        << "Capacity must be a power of two";
+    for (size_t i = 0; i < capacity; ++i) {
+      slots_[i].sequence = i;
+    }
+  }
+
+  ~MpscQueue() { delete[] slots_; }
+
+  // Reserves a slot at the back of the queue. This function is thread-safe.
+  //
+  // @param ticket Set to the ticket to pass to CommitPush.
+  // @return The element to fill in, or NULL if the queue is full. The element
+  //         holds whatever value it had when it was last popped.
+  T* BeginPush(uint64_t* ticket) {
+    uint64_t position = push_position_.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot* slot = &slots_[position & mask_];
+      int64_t difference = static_cast<int64_t>(
+          slot->sequence.load(std::memory_order_acquire) - position);
+      if (difference == 0) {
+        if (push_position_.compare_exchange_weak(position, position + 1,
+                                                 std::memory_order_relaxed)) {
+          *ticket = position;
+          return &slot->value;
+        }
+      } else if (difference < 0) {
+        return NULL;
+      } else {
+        position = push_position_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Publishes an element reserved with BeginPush to the consumer.
+  //
+  // @param ticket The ticket returned by BeginPush.
+  void CommitPush(uint64_t ticket) {
+    slots_[ticket & mask_].sequence.store(ticket + 1);
+  }
+
+  // Returns the element at the front of the queue, or NULL if the queue is
+  // empty or the front element has not been published yet. Only the
+  // consumer may invoke this.
+  T* Front() {
+    uint64_t position = pop_position_.load(std::memory_order_relaxed);
+    Slot* slot = &slots_[position & mask_];
+    if (slot->sequence.load() != position + 1) {
+      return NULL;
+    }
+    return &slot->value;
+  }
+
+  // Removes the element at the front of the queue, which must have been
+  // returned by Front. Only the consumer may invoke this.
+  void Pop() {
+    uint64_t position = pop_position_.load(std::memory_order_relaxed);
+    slots_[position & mask_].sequence.store(position + mask_ + 1,
+                                            std::memory_order_release);
+    pop_position_.store(position + 1, std::memory_order_relaxed);
+  }
+
+  // Returns the number of elements reserved and not yet popped. The result may
+  // be stale by the time it is used. This function is thread-safe.
+  size_t size() const {
+    // A producer may see the consumer pop past the push position it read, so
+    // the pop position is read first and the result is clamped at zero.
+    uint64_t pop_position = pop_position_.load(std::memory_order_relaxed);
+    uint64_t push_position = push_position_.load(std::memory_order_relaxed);
+    return push_position > pop_position ? push_position - pop_position : 0;
+  }
+
+  // Returns whether there is no published element at the front of the queue.
+  // This function is thread-safe.
+  bool empty() const {
+    uint64_t position = pop_position_.load();
+    return slots_[position & mask_].sequence.load() != position + 1;
+  }
+
+ private:
+  struct Slot {
+    // Equal to the push position when the slot is free, and to the push
+    // position plus one when it holds a published element.
+    std::atomic<uint64_t> sequence;
+    T value;
+  };
+
+  Slot* slots_;
+  const uint64_t mask_;
+  std::atomic<uint64_t> push_position_;
+  std::atomic<uint64_t> pop_position_;
+
+  // Disallow copy and assign.
+  MpscQueue(const MpscQueue&);
+  void operator=(const MpscQueue&);
+};
+
+}  // namespace util
+}  // namespace anymote
+
+#endif  // ANYMOTE_UTIL_MPSCQUEUE_H_
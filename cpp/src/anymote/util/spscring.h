@@ -0,0 +1,149 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_UTIL_SPSCRING_H_
+#define ANYMOTE_UTIL_SPSCRING_H_
+
+#include <glog/logging.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+
+namespace anymote {
+namespace util {
+
+// Bounded lock-free ring buffer of bytes for a single producer and a single
+// consumer. The producer and the consumer each own one position and only read
+// the other's, so neither ever waits for the other. Each side also caches the
+// last position it read of the other side, so the shared positions are only
+// read when the cached one says the ring looks full or empty.
+//
+// Only one thread may write at a time and only one thread may read at a
+// time; either side may change threads as long as the handoff is
+// synchronized.
+class SpscByteRing {
+ public:
+  // Creates a ring.
+  //
+  // @param capacity The size of the ring in bytes. Must be a power of two.
+  explicit SpscByteRing(size_t capacity)
+      : buffer_(new uint8_t[capacity]),
+        mask_(capacity - 1),
+        read_position_(0),
+        cached_write_position_(0),
+        write_position_(0),
+        cached_read_position_(0) {
+    CHECK(capacity > 0 && (capacity & mask_) == 0)
+        << "Capacity must be a power of two";
+  }
+
+  ~SpscByteRing() { delete[] buffer_; }
+
+  // Writes as many of the given bytes as fit. Producer only.
+  //
+  // @param data The bytes to write.
+  // @param size The number of bytes to write.
+  // @return The number of bytes written.
+  size_t Write(const uint8_t* data, size_t size) {
+    uint64_t position = write_position_.load(std::memory_order_relaxed);
+    size_t capacity = mask_ + 1;
+    if (position - cached_read_position_ + size > capacity) {
+      cached_read_position_ = read_position_.load(std::memory_order_acquire);
+    }
+    size = std::min(size, static_cast<size_t>(
+        capacity - (position - cached_read_position_)));
+
+    size_t offset = position & mask_;
+    size_t first = std::min(size, capacity - offset);
+    memcpy(buffer_ + offset, data, first);
+    memcpy(buffer_, data + first, size - first);
+    write_position_.store(position + size, std::memory_order_release);
+    return size;
+  }
+
+  // Returns the longest run of readable bytes that is contiguous in memory.
+  // The bytes stay valid until they are consumed. Consumer only.
+  //
+  // @param size Set to the number of bytes in the run.
+  // @return The start of the run.
+  const uint8_t* ReadableRegion(size_t* size) {
+    uint64_t position = read_position_.load(std::memory_order_relaxed);
+    if (cached_write_position_ <= position) {
+      cached_write_position_ =
+          write_position_.load(std::memory_order_acquire);
+    }
+    size_t offset = position & mask_;
+    *size = std::min(static_cast<size_t>(cached_write_position_ - position),
+                     mask_ + 1 - offset);
+    return buffer_ + offset;
+  }
+
+  // Copies readable bytes out without consuming them. Consumer only.
+  //
+  // @param data The buffer to copy to.
+  // @param size The number of bytes to copy. Must not be more than readable.
+  void Peek(uint8_t* data, size_t size) {
+    uint64_t position = read_position_.load(std::memory_order_relaxed);
+    size_t offset = position & mask_;
+    size_t first = std::min(size, mask_ + 1 - offset);
+    memcpy(data, buffer_ + offset, first);
+    memcpy(data + first, buffer_, size - first);
+  }
+
+  // Frees the given number of bytes at the front of the ring for the
+  // producer. Consumer only.
+  //
+  // @param size The number of bytes to consume. Must not be more than
+  //             readable.
+  void Consume(size_t size) {
+    read_position_.store(
+        read_position_.load(std::memory_order_relaxed) + size,
+        std::memory_order_release);
+  }
+
+  // Returns the number of bytes that can be read. Consumer only.
+  size_t readable() {
+    cached_write_position_ = write_position_.load(std::memory_order_acquire);
+    return cached_write_position_ -
+        read_position_.load(std::memory_order_relaxed);
+  }
+
+  // Returns the size of the ring in bytes.
+  size_t capacity() const { return mask_ + 1; }
+
+ private:
+  uint8_t* const buffer_;
+  const size_t mask_;
+
+  // The consumer's position, and its copy of the producer's position, on
+  // their own cache line so that the two sides do not invalidate each other's
+  // cache lines on every access.
+  alignas(64) std::atomic<uint64_t> read_position_;
+  uint64_t cached_write_position_;
+
+  // The producer's position and its copy of the consumer's position.
+  alignas(64) std::atomic<uint64_t> write_position_;
+  uint64_t cached_read_position_;
+
+  // Disallow copy and assign.
+  SpscByteRing(const SpscByteRing&);
+  void operator=(const SpscByteRing&);
+};
+
+}  // namespace util
+}  // namespace anymote
+
+#endif  // ANYMOTE_UTIL_SPSCRING_H_
@@ -0,0 +1,223 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Each slot holds a circular list of timers. A timer whose deadline is d
+// ticks away goes in the lowest level L for which d is less than the span of
+// a slot of level L + 1, in the slot that covers its deadline. Advancing
+// visits the first level slot of every tick since the last advance and fires
+// the timers in it that are due. When the wheel enters a new slot of a higher
+// level, the timers in that slot are inserted again, which moves them to a
+// lower level. Timers beyond the top level stay in it, a lap at a time.
+//
+// The number of timers in each level tells which stretches of ticks can be
+// skipped: while the first level is empty nothing can happen until the next
+// slot of the lowest level that has timers.
+
+#include "anymote/util/timerwheel.h"
+
+#include <glog/logging.h>
+
+namespace anymote {
+namespace util {
+
+const int TimerWheel::kMaxLevels;
+
+TimerWheel::Timer::Timer(Closure* closure)
+    : closure_(closure),
+      deadline_micros_(0),
+      level_count_(NULL),
+      prev_(NULL),
+      next_(NULL) {
+  CHECK_NOTNULL(closure);
+}
+
+TimerWheel::Timer::Timer()
+    : closure_(NULL),
+      deadline_micros_(0),
+      level_count_(NULL),
+      prev_(this),
+      next_(this) {
+}
+
+TimerWheel::Timer::~Timer() {
+  if (closure_ != NULL && scheduled()) {
+    Remove();
+  }
+}
+
+void TimerWheel::Timer::LinkBefore(Timer* timer) {
+  prev_ = timer->prev_;
+  next_ = timer;
+  prev_->next_ = this;
+  timer->prev_ = this;
+}
+
+void TimerWheel::Timer::Unlink() {
+  prev_->next_ = next_;
+  next_->prev_ = prev_;
+  prev_ = NULL;
+  next_ = NULL;
+}
+
+void TimerWheel::Timer::Remove() {
+  if (level_count_ != NULL) {
+    (*level_count_)--;
+    level_count_ = NULL;
+  }
+  Unlink();
+}
+
+TimerWheel::TimerWheel(int64_t now_micros, int64_t tick_micros,
+                       size_t num_slots)
+    : tick_micros_(tick_micros),
+      num_slots_(num_slots),
+      num_levels_(1),
+      slots_(NULL),
+      current_tick_(0) {
+  CHECK_GT(tick_micros, 0) << "Tick must be positive";
+  CHECK_GT(num_slots, 0U) << "Wheel must have slots";
+
+  // Add levels while the span of their slots fits in a tick count.
+  spans_[0] = 1;
+  level_counts_[0] = 0;
+  while (num_levels_ < kMaxLevels && num_slots > 1 &&
+         spans_[num_levels_ - 1] <= INT64_MAX / static_cast<int64_t>(
+             num_slots)) {
+    spans_[num_levels_] = spans_[num_levels_ - 1] * num_slots;
+    level_counts_[num_levels_] = 0;
+    num_levels_++;
+  }
+
+  slots_ = new Timer[num_levels_ * num_slots];
+  current_tick_ = now_micros / tick_micros;
+}
+
+TimerWheel::~TimerWheel() {
+  for (size_t i = 0; i < num_levels_ * num_slots_; ++i) {
+    while (slots_[i].next_ != &slots_[i]) {
+      slots_[i].next_->Remove();
+    }
+  }
+  while (expired_.next_ != &expired_) {
+    expired_.next_->Remove();
+  }
+  delete[] slots_;
+}
+
+void TimerWheel::Schedule(Timer* timer, int64_t deadline_micros) {
+  Cancel(timer);
+  timer->deadline_micros_ = deadline_micros;
+  Insert(timer);
+}
+
+void TimerWheel::Insert(Timer* timer) {
+  int64_t tick = timer->deadline_micros_ / tick_micros_;
+  if (tick < current_tick_) {
+    tick = current_tick_;
+  }
+
+  // The deadline falls within the lap of the current slot of a level once
+  // the slots in between are fewer than the slots of the level.
+  int level = 0;
+  while (level + 1 < num_levels_ &&
+         tick / spans_[level] - current_tick_ / spans_[level] >=
+             static_cast<int64_t>(num_slots_)) {
+    level++;
+  }
+  timer->LinkBefore(Slot(level, tick));
+  timer->level_count_ = &level_counts_[level];
+  level_counts_[level]++;
+}
+
+void TimerWheel::Cancel(Timer* timer) {
+  if (timer->scheduled()) {
+    timer->Remove();
+  }
+}
+
+int TimerWheel::Advance(int64_t now_micros) {
+  int64_t target_tick = now_micros / tick_micros_;
+
+  // Timers due later in the current tick are still in its slot.
+  CollectExpired(Slot(0, current_tick_), now_micros);
+  while (current_tick_ < target_tick) {
+    current_tick_ = NextTick(target_tick);
+    for (int level = num_levels_ - 1; level > 0; --level) {
+      if (current_tick_ % spans_[level] == 0) {
+        Cascade(level);
+      }
+    }
+    CollectExpired(Slot(0, current_tick_), now_micros);
+  }
+
+  // Closures may change any timer, so each is unlinked before it runs.
+  int count = 0;
+  while (expired_.next_ != &expired_) {
+    Timer* timer = expired_.next_;
+    timer->Remove();
+    count++;
+    timer->closure_->Run();
+  }
+  return count;
+}
+
+int64_t TimerWheel::NextTick(int64_t target_tick) const {
+  int level = 0;
+  while (level < num_levels_ && level_counts_[level] == 0) {
+    level++;
+  }
+  if (level == 0) {
+    return current_tick_ + 1;
+  }
+  if (level == num_levels_) {
+    return target_tick;
+  }
+
+  // Nothing happens before the next slot of the lowest level with timers.
+  int64_t next_slot_tick =
+      (current_tick_ / spans_[level] + 1) * spans_[level];
+  return next_slot_tick < target_tick ? next_slot_tick : target_tick;
+}
+
+void TimerWheel::Cascade(int level) {
+  // Move the timers to a list of their own first, since a timer that is
+  // still a lap away goes back into the same slot.
+  Timer* slot = Slot(level, current_tick_);
+  Timer pending;
+  while (slot->next_ != slot) {
+    Timer* timer = slot->next_;
+    timer->Remove();
+    timer->LinkBefore(&pending);
+  }
+  while (pending.next_ != &pending) {
+    Timer* timer = pending.next_;
+    timer->Unlink();
+    Insert(timer);
+  }
+}
+
+void TimerWheel::CollectExpired(Timer* slot, int64_t now_micros) {
+  Timer* timer = slot->next_;
+  while (timer != slot) {
+    Timer* next = timer->next_;
+    if (timer->deadline_micros_ <= now_micros) {
+      timer->Remove();
+      timer->LinkBefore(&expired_);
+    }
+    timer = next;
+  }
+}
+
+}  // namespace util
+}  // namespace anymote
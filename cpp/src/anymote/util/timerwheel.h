@@ -0,0 +1,176 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_UTIL_TIMERWHEEL_H_
+#define ANYMOTE_UTIL_TIMERWHEEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "anymote/util/closure.h"
+
+namespace anymote {
+namespace util {
+
+// Hierarchical timing wheel for large numbers of timeouts, such as one per
+// request in flight or one keepalive per session. Scheduling and cancelling a
+// timer take constant time and do not allocate, since timers are embedded in
+// their owners.
+//
+// The wheel has several levels of slots. Each slot of the first level covers
+// one tick, and each slot of the next level covers as many ticks as a whole
+// lap of the level below. A timer goes in the lowest level whose lap reaches
+// its deadline, and moves down a level each time the wheel enters the slot it
+// is in, so every timer is moved at most once per level and timers that are
+// far away are not looked at until they come close. Stretches of ticks
+// without any timers in the lower levels are skipped.
+//
+// The wheel does not keep time itself. Its owner invokes Advance with the
+// current time, usually from a periodic timer whose period is about one tick,
+// and the closures of expired timers run from within Advance. Timers fire no
+// earlier than their deadline and at most one tick plus the owner's timer
+// period late.
+//
+// This class is not thread-safe.
+class TimerWheel {
+ public:
+  // The largest number of levels of a wheel.
+  static const int kMaxLevels = 4;
+
+  // A timer that can be scheduled on a wheel.
+  class Timer {
+   public:
+    // Creates an unscheduled timer.
+    // @param closure The closure to run when the timer expires. No ownership
+    //                is taken and the pointer must be valid for the duration
+    //                of the existence of this instance.
+    explicit Timer(Closure* closure);
+
+    // Cancels the timer if it is scheduled.
+    ~Timer();
+
+    // Returns whether the timer is scheduled.
+    bool scheduled() const { return next_ != NULL; }
+
+    // Returns the time at which the timer was last scheduled to expire.
+    int64_t deadline_micros() const { return deadline_micros_; }
+
+   private:
+    friend class TimerWheel;
+
+    // Creates the head of a list of timers.
+    Timer();
+
+    // Inserts this timer before the given one in its list.
+    void LinkBefore(Timer* timer);
+
+    // Removes this timer from its list.
+    void Unlink();
+
+    // Removes this timer from its list and from the timer count of its level.
+    void Remove();
+
+    Closure* closure_;
+    int64_t deadline_micros_;
+
+    // The number of timers in the level this timer is in, or NULL if the
+    // timer is not in a level.
+    size_t* level_count_;
+
+    // Neighbors in a circular list of timers, or NULL if not scheduled.
+    Timer* prev_;
+    Timer* next_;
+
+    // Disallow copy and assign.
+    Timer(const Timer&);
+    void operator=(const Timer&);
+  };
+
+  // Creates a wheel.
+  //
+  // @param now_micros The current time.
+  // @param tick_micros The resolution of the wheel. Must be positive.
+  // @param num_slots The number of slots of each level. The levels reach
+  //                  num_slots to the power kMaxLevels ticks away; timers
+  //                  further away share slots with nearer ones and are
+  //                  skipped until they come close.
+  TimerWheel(int64_t now_micros, int64_t tick_micros, size_t num_slots);
+
+  // Cancels all timers.
+  ~TimerWheel();
+
+  // Schedules a timer, rescheduling it if it is already scheduled.
+  //
+  // @param timer The timer to schedule. It must not be scheduled on another
+  //              wheel.
+  // @param deadline_micros The time at which the timer expires.
+  void Schedule(Timer* timer, int64_t deadline_micros);
+
+  // Cancels a timer. Nothing happens if the timer is not scheduled.
+  void Cancel(Timer* timer);
+
+  // Runs the closures of all timers that have expired. Closures may schedule
+  // and cancel timers, including their own.
+  //
+  // @param now_micros The current time.
+  // @return The number of timers that expired.
+  int Advance(int64_t now_micros);
+
+  int64_t tick_micros() const { return tick_micros_; }
+
+ private:
+  // Returns the slot of a level that covers the given tick.
+  Timer* Slot(int level, int64_t tick) {
+    return &slots_[level * num_slots_ + (tick / spans_[level]) % num_slots_];
+  }
+
+  // Adds a timer to the level that its deadline falls in.
+  void Insert(Timer* timer);
+
+  // Moves the timers of the current slot of a level to lower levels.
+  void Cascade(int level);
+
+  // Returns the next tick at which anything may happen, up to the given one.
+  int64_t NextTick(int64_t target_tick) const;
+
+  // Moves the timers of a slot that have expired to the expired list.
+  void CollectExpired(Timer* slot, int64_t now_micros);
+
+  const int64_t tick_micros_;
+  const size_t num_slots_;
+  int num_levels_;
+
+  // The number of ticks covered by a slot of each level.
+  int64_t spans_[kMaxLevels];
+
+  // The number of timers in each level.
+  size_t level_counts_[kMaxLevels];
+
+  // The heads of the timer list of each slot, level by level.
+  Timer* slots_;
+
+  // The head of the list of expired timers whose closures have not run yet.
+  Timer expired_;
+
+  // The tick of the last Advance.
+  int64_t current_tick_;
+
+  // Disallow copy and assign.
+  TimerWheel(const TimerWheel&);
+  void operator=(const TimerWheel&);
+};
+
+}  // namespace util
+}  // namespace anymote
+
+#endif  // ANYMOTE_UTIL_TIMERWHEEL_H_
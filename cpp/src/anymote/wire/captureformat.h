@@ -0,0 +1,70 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_WIRE_CAPTUREFORMAT_H_
+#define ANYMOTE_WIRE_CAPTUREFORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace anymote {
+namespace wire {
+
+// Layout of Anymote capture files, written by CaptureWriter and read by
+// CaptureReader. All integers are little-endian.
+//
+// A capture starts with a file header, followed by one record per frame:
+//
+//   file header: magic "AMCAPTUR" (8) | version (4) | header size (4)
+//   record:      payload size (4) | type (1) | reserved (3) |
+//                timestamp in microseconds (8) | payload
+//
+// The payload of a frame record is the serialized message, without its
+// preamble. Records are only ever appended, so a capture that was not closed
+// can be read up to its last complete record, and the whole file can be
+// memory-mapped and read in place. When the capture is closed, an index
+// record is appended whose payload lists the timestamp (8) and file offset
+// (8) of every kCaptureIndexInterval-th frame record, followed by a trailer:
+//
+//   trailer:     index record offset (8) | magic "AMCAPIDX" (8)
+
+// The type of a capture record.
+enum CaptureRecordType {
+  // A frame received by the adapter. The value matches FrameTap::kReceived.
+  kCaptureReceived = 0,
+
+  // A frame sent by the adapter. The value matches FrameTap::kSent.
+  kCaptureSent = 1,
+
+  // The index, written when the capture is closed.
+  kCaptureIndex = 2,
+};
+
+static const char kCaptureFileMagic[] = "AMCAPTUR";
+static const char kCaptureIndexMagic[] = "AMCAPIDX";
+static const size_t kCaptureMagicSize = 8;
+static const uint32_t kCaptureVersion = 1;
+
+static const size_t kCaptureFileHeaderSize = 16;
+static const size_t kCaptureRecordHeaderSize = 16;
+static const size_t kCaptureIndexEntrySize = 16;
+static const size_t kCaptureTrailerSize = 16;
+
+// The number of frame records per index entry.
+static const size_t kCaptureIndexInterval = 256;
+
+}  // namespace wire
+}  // namespace anymote
+
+#endif  // ANYMOTE_WIRE_CAPTUREFORMAT_H_
@@ -0,0 +1,195 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "anymote/wire/capturereader.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "anymote/wire/captureformat.h"
+
+using ::google::protobuf::io::CodedInputStream;
+
+namespace anymote {
+namespace wire {
+
+static uint32_t ReadFixed32(const uint8_t* data) {
+  uint32_t value;
+  CodedInputStream::ReadLittleEndian32FromArray(data, &value);
+  return value;
+}
+
+static uint64_t ReadFixed64(const uint8_t* data) {
+  uint64_t value;
+  CodedInputStream::ReadLittleEndian64FromArray(data, &value);
+  return value;
+}
+
+CaptureReader::CaptureReader()
+    : data_(NULL),
+      size_(0),
+      first_record_(0),
+      end_(0),
+      position_(0),
+      index_(NULL),
+      index_entries_(0) {
+}
+
+CaptureReader::~CaptureReader() {
+  Close();
+}
+
+bool CaptureReader::Open(const std::string& path) {
+  Close();
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG(ERROR) << "Cannot open capture " << path;
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < kCaptureFileHeaderSize) {
+    LOG(ERROR) << "Not a capture: " << path;
+    close(fd);
+    return false;
+  }
+
+  void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "Cannot map capture " << path;
+    return false;
+  }
+  data_ = static_cast<const uint8_t*>(data);
+  size_ = info.st_size;
+
+  uint32_t header_size = ReadFixed32(data_ + kCaptureMagicSize + 4);
+  if (memcmp(data_, kCaptureFileMagic, kCaptureMagicSize) != 0 ||
+      ReadFixed32(data_ + kCaptureMagicSize) != kCaptureVersion ||
+      header_size < kCaptureFileHeaderSize || header_size > size_) {
+    LOG(ERROR) << "Not a capture: " << path;
+    Close();
+    return false;
+  }
+
+  first_record_ = header_size;
+  end_ = size_;
+  position_ = first_record_;
+  LoadIndex();
+  return true;
+}
+
+void CaptureReader::Close() {
+  if (data_ != NULL) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+  data_ = NULL;
+  size_ = 0;
+  first_record_ = end_ = position_ = 0;
+  index_ = NULL;
+  index_entries_ = 0;
+}
+
+void CaptureReader::LoadIndex() {
+  if (size_ < first_record_ + kCaptureRecordHeaderSize + kCaptureTrailerSize) {
+    return;
+  }
+  const uint8_t* trailer = data_ + size_ - kCaptureTrailerSize;
+  if (memcmp(trailer + 8, kCaptureIndexMagic, kCaptureMagicSize) != 0) {
+    return;
+  }
+
+  uint64_t offset = ReadFixed64(trailer);
+  size_t records_end = size_ - kCaptureTrailerSize;
+  if (offset < first_record_ ||
+      offset > records_end - kCaptureRecordHeaderSize) {
+    return;
+  }
+  const uint8_t* record = data_ + offset;
+  uint32_t index_size = ReadFixed32(record);
+  if (record[4] != kCaptureIndex ||
+      index_size != records_end - offset - kCaptureRecordHeaderSize ||
+      index_size % kCaptureIndexEntrySize != 0) {
+    return;
+  }
+
+  end_ = offset;
+  index_ = record + kCaptureRecordHeaderSize;
+  index_entries_ = index_size / kCaptureIndexEntrySize;
+}
+
+bool CaptureReader::ReadFrame(size_t offset, Frame* frame) const {
+  if (offset >= end_ || end_ - offset < kCaptureRecordHeaderSize) {
+    return false;
+  }
+  const uint8_t* record = data_ + offset;
+  uint32_t size = ReadFixed32(record);
+  if (size > end_ - offset - kCaptureRecordHeaderSize) {
+    // The capture ends with a partially written record.
+    return false;
+  }
+  if (record[4] != kCaptureReceived && record[4] != kCaptureSent) {
+    return false;
+  }
+
+  frame->timestamp_micros = static_cast<int64_t>(ReadFixed64(record + 8));
+  frame->direction = static_cast<FrameTap::Direction>(record[4]);
+  frame->data = record + kCaptureRecordHeaderSize;
+  frame->size = size;
+  return true;
+}
+
+bool CaptureReader::Next(Frame* frame) {
+  if (!ReadFrame(position_, frame)) {
+    return false;
+  }
+  position_ += kCaptureRecordHeaderSize + frame->size;
+  return true;
+}
+
+void CaptureReader::SeekToTime(int64_t timestamp_micros) {
+  position_ = first_record_;
+
+  // Start the scan from the last index entry before the given time.
+  size_t low = 0;
+  size_t high = index_entries_;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    const uint8_t* entry = index_ + middle * kCaptureIndexEntrySize;
+    if (static_cast<int64_t>(ReadFixed64(entry)) < timestamp_micros) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low > 0) {
+    uint64_t offset =
+        ReadFixed64(index_ + (low - 1) * kCaptureIndexEntrySize + 8);
+    if (offset >= first_record_ && offset < end_) {
+      position_ = offset;
+    }
+  }
+
+  Frame frame;
+  while (ReadFrame(position_, &frame) &&
+         frame.timestamp_micros < timestamp_micros) {
+    position_ += kCaptureRecordHeaderSize + frame.size;
+  }
+}
+
+}  // namespace wire
+}  // namespace anymote
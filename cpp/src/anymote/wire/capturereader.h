@@ -0,0 +1,108 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_WIRE_CAPTUREREADER_H_
+#define ANYMOTE_WIRE_CAPTUREREADER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "anymote/wire/frametap.h"
+
+namespace anymote {
+namespace wire {
+
+// Reads the frames of a capture file written by CaptureWriter. The file is
+// memory-mapped and frames are read in place, without copying.
+//
+// A capture that was not closed has no index. It is still read up to its
+// last complete record, but seeking scans it from the start.
+class CaptureReader {
+ public:
+  // A captured frame.
+  struct Frame {
+    // The time at which the frame was captured, in microseconds of the
+    // writer's clock.
+    int64_t timestamp_micros;
+
+    FrameTap::Direction direction;
+
+    // The serialized message, without its preamble. It points into the
+    // mapped file and is valid until the reader is closed.
+    const uint8_t* data;
+    size_t size;
+  };
+
+  CaptureReader();
+
+  // Closes the capture, if open.
+  ~CaptureReader();
+
+  // Maps a capture file and positions the reader at its first frame.
+  // @param path The path of the file.
+  // @return false if the file could not be mapped or is not a capture.
+  bool Open(const std::string& path);
+
+  // Unmaps the file.
+  void Close();
+
+  // Reads the next frame.
+  // @param frame Set to the frame.
+  // @return false if there are no more frames.
+  bool Next(Frame* frame);
+
+  // Positions the reader at the first frame.
+  void Rewind() { position_ = first_record_; }
+
+  // Positions the reader at the first frame captured at or after the given
+  // time.
+  // @param timestamp_micros The time, in microseconds of the writer's clock.
+  void SeekToTime(int64_t timestamp_micros);
+
+  // Returns whether the capture was closed and has an index.
+  bool indexed() const { return index_ != NULL; }
+
+ private:
+  // Reads the header of the record at the given offset, if it is a complete
+  // frame record.
+  // @param offset The offset of the record.
+  // @param frame Set to the frame.
+  // @return false if there is no complete frame record at the offset.
+  bool ReadFrame(size_t offset, Frame* frame) const;
+
+  // Loads the index described by the trailer, if there is a valid one.
+  void LoadIndex();
+
+  const uint8_t* data_;
+  size_t size_;
+
+  // The offset of the first record, of the index record or the end of the
+  // file, and of the next record to read.
+  size_t first_record_;
+  size_t end_;
+  size_t position_;
+
+  // The index entries in the mapped file, or NULL if there is no index.
+  const uint8_t* index_;
+  size_t index_entries_;
+
+  // Disallow copy and assign.
+  CaptureReader(const CaptureReader&);
+  void operator=(const CaptureReader&);
+};
+
+}  // namespace wire
+}  // namespace anymote
+
+#endif  // ANYMOTE_WIRE_CAPTUREREADER_H_
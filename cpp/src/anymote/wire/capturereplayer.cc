@@ -0,0 +1,104 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "anymote/wire/capturereplayer.h"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+using ::google::protobuf::io::CodedOutputStream;
+
+namespace anymote {
+namespace wire {
+
+const size_t CaptureReplayer::kMaxWriteBytes;
+
+CaptureReplayer::CaptureReplayer(CaptureReader* reader,
+                                 FrameTap::Direction direction,
+                                 WireInterface* interface, Pacing pacing,
+                                 util::Clock* clock)
+    : reader_(reader),
+      direction_(direction),
+      interface_(interface),
+      pacing_(pacing),
+      clock_(clock),
+      start_micros_(clock->NowMicros()),
+      first_timestamp_micros_(0),
+      has_next_(false),
+      frames_sent_(0),
+      bytes_sent_(0) {
+  Advance();
+  if (has_next_) {
+    first_timestamp_micros_ = next_.timestamp_micros;
+  }
+}
+
+void CaptureReplayer::Advance() {
+  while ((has_next_ = reader_->Next(&next_)) &&
+         next_.direction != direction_) {
+  }
+}
+
+int64_t CaptureReplayer::next_send_micros() const {
+  if (!has_next_) {
+    return -1;
+  }
+  if (pacing_ == kAsFastAsPossible) {
+    return start_micros_;
+  }
+  return start_micros_ + next_.timestamp_micros - first_timestamp_micros_;
+}
+
+size_t CaptureReplayer::SendDue() {
+  size_t frames = 0;
+  int64_t now = clock_->NowMicros();
+  while (has_next_ && next_send_micros() <= now) {
+    buffer_.clear();
+    do {
+      size_t offset = buffer_.size();
+      buffer_.resize(offset + CodedOutputStream::VarintSize32(next_.size) +
+                     next_.size);
+      uint8_t* target = CodedOutputStream::WriteVarint32ToArray(
+          next_.size, &buffer_[offset]);
+      if (next_.size > 0) {
+        memcpy(target, next_.data, next_.size);
+      }
+      frames++;
+      Advance();
+    } while (has_next_ && next_send_micros() <= now &&
+             buffer_.size() + next_.size < kMaxWriteBytes);
+
+    bytes_sent_ += buffer_.size();
+    interface_->SendOwned(&buffer_);
+  }
+  frames_sent_ += frames;
+  return frames;
+}
+
+size_t CaptureReplayer::Run() {
+  size_t frames = 0;
+  while (has_next_) {
+    int64_t delay = next_send_micros() - clock_->NowMicros();
+    if (delay > 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(delay));
+    }
+    frames += SendDue();
+  }
+  return frames;
+}
+
+}  // namespace wire
+}  // namespace anymote
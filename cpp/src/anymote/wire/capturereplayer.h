@@ -0,0 +1,123 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_WIRE_CAPTUREREPLAYER_H_
+#define ANYMOTE_WIRE_CAPTUREREPLAYER_H_
+
+#include <stdint.h>
+#include <vector>
+#include "anymote/util/clock.h"
+#include "anymote/wire/capturereader.h"
+#include "anymote/wire/wireinterface.h"
+
+namespace anymote {
+namespace wire {
+
+// Feeds the frames of one direction of a capture back through a wire
+// interface, with their preambles, as a peer would have sent them. Frames
+// that are due together are sent in one write.
+//
+// Replaying the frames a server received from a device through a client
+// interface reproduces the device's traffic, and replaying many captures at
+// once makes a realistic load.
+//
+// The replayer is driven by its owner, which calls SendDue when
+// next_send_micros is reached, or calls Run to replay a whole capture on the
+// calling thread.
+class CaptureReplayer {
+ public:
+  // How fast frames are replayed.
+  enum Pacing {
+    // Each frame is sent when as much time has passed since the replay
+    // started as had passed since the first replayed frame was captured.
+    kOriginalPacing,
+
+    // All frames are sent at once, in writes of up to kMaxWriteBytes.
+    kAsFastAsPossible,
+  };
+
+  // The largest write, unless a single frame is larger.
+  static const size_t kMaxWriteBytes = 64 * 1024;
+
+  // Creates a replayer starting at the current frame of the reader. The
+  // replay starts now, in terms of pacing.
+  // @param reader The capture to replay. No ownership is taken and the
+  //               pointer must be valid for the duration of the existence of
+  //               this instance.
+  // @param direction The direction of the frames to replay.
+  // @param interface The interface to send frames to. No ownership is taken
+  //                  and the pointer must be valid for the duration of the
+  //                  existence of this instance.
+  // @param pacing How fast frames are replayed.
+  // @param clock The clock used for pacing. No ownership is taken and the
+  //              pointer must be valid for the duration of the existence of
+  //              this instance.
+  CaptureReplayer(CaptureReader* reader, FrameTap::Direction direction,
+                  WireInterface* interface, Pacing pacing,
+                  util::Clock* clock);
+
+  // Sends the frames that are due.
+  // @return the number of frames sent.
+  size_t SendDue();
+
+  // Replays the rest of the capture, sleeping until each frame is due. This
+  // needs a clock that advances by itself.
+  // @return the number of frames sent.
+  size_t Run();
+
+  // Returns the time, in microseconds of the clock, at which the next frame
+  // is due, or -1 if the replay is done.
+  int64_t next_send_micros() const;
+
+  // Returns whether all frames have been sent.
+  bool done() const { return !has_next_; }
+
+  // Returns the number of frames and bytes, preambles included, sent so far.
+  uint64_t frames_sent() const { return frames_sent_; }
+  uint64_t bytes_sent() const { return bytes_sent_; }
+
+ private:
+  // Reads the next frame of the replayed direction into next_.
+  void Advance();
+
+  CaptureReader* const reader_;
+  const FrameTap::Direction direction_;
+  WireInterface* const interface_;
+  const Pacing pacing_;
+  util::Clock* const clock_;
+
+  // The start of the replay, and the capture time of the first frame.
+  int64_t start_micros_;
+  int64_t first_timestamp_micros_;
+
+  // The next frame to send.
+  bool has_next_;
+  CaptureReader::Frame next_;
+
+  // Buffer the frames of a write are assembled in. It is handed to the
+  // interface with SendOwned.
+  std::vector<uint8_t> buffer_;
+
+  uint64_t frames_sent_;
+  uint64_t bytes_sent_;
+
+  // Disallow copy and assign.
+  CaptureReplayer(const CaptureReplayer&);
+  void operator=(const CaptureReplayer&);
+};
+
+}  // namespace wire
+}  // namespace anymote
+
+#endif  // ANYMOTE_WIRE_CAPTUREREPLAYER_H_
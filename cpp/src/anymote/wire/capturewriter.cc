@@ -0,0 +1,226 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "anymote/wire/capturewriter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include "anymote/wire/captureformat.h"
+
+using ::google::protobuf::io::CodedOutputStream;
+
+namespace anymote {
+namespace wire {
+
+const size_t CaptureWriter::kDefaultMaxBufferedBytes;
+
+// The number of buffered bytes that wakes the writer thread early.
+static const size_t kWakeBytes = 64 * 1024;
+
+// How long frames stay buffered, at most, while the capture is quiet.
+static const int64_t kWriteIntervalMillis = 50;
+
+// Writes all of the given bytes to a file descriptor.
+// @return false if the file could not be written.
+static bool WriteFully(int fd, const uint8_t* data, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+// Appends a record header to a buffer.
+static void AppendRecordHeader(uint32_t size, CaptureRecordType type,
+                               int64_t timestamp_micros,
+                               std::vector<uint8_t>* buffer) {
+  size_t offset = buffer->size();
+  buffer->resize(offset + kCaptureRecordHeaderSize);
+  uint8_t* target = &(*buffer)[offset];
+  target = CodedOutputStream::WriteLittleEndian32ToArray(size, target);
+  target[0] = static_cast<uint8_t>(type);
+  target[1] = target[2] = target[3] = 0;
+  CodedOutputStream::WriteLittleEndian64ToArray(timestamp_micros, target + 4);
+}
+
+CaptureWriter::CaptureWriter(util::Clock* clock)
+    : clock_(clock),
+      max_buffered_bytes_(kDefaultMaxBufferedBytes),
+      fd_(-1),
+      open_(false),
+      closing_(false),
+      failed_(false),
+      next_offset_(0),
+      unindexed_frames_(0),
+      frames_captured_(0),
+      frames_dropped_(0) {
+}
+
+CaptureWriter::~CaptureWriter() {
+  Close();
+}
+
+bool CaptureWriter::Open(const std::string& path) {
+  CHECK(!open_) << "Capture already open";
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    LOG(ERROR) << "Cannot create capture " << path << ": " << strerror(errno);
+    return false;
+  }
+
+  uint8_t header[kCaptureFileHeaderSize];
+  memcpy(header, kCaptureFileMagic, kCaptureMagicSize);
+  CodedOutputStream::WriteLittleEndian32ToArray(
+      kCaptureVersion, header + kCaptureMagicSize);
+  CodedOutputStream::WriteLittleEndian32ToArray(
+      kCaptureFileHeaderSize, header + kCaptureMagicSize + 4);
+  if (!WriteFully(fd_, header, sizeof(header))) {
+    LOG(ERROR) << "Cannot write capture " << path << ": " << strerror(errno);
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+
+  pending_.reserve(kWakeBytes);
+  next_offset_ = kCaptureFileHeaderSize;
+  unindexed_frames_ = 0;
+  index_.clear();
+  closing_ = false;
+  failed_ = false;
+  open_ = true;
+  writer_thread_ = std::thread(&CaptureWriter::WriterLoop, this);
+  return true;
+}
+
+void CaptureWriter::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!open_) {
+      return;
+    }
+    closing_ = true;
+  }
+  wake_.notify_one();
+  writer_thread_.join();
+
+  if (!failed_ && !WriteIndex()) {
+    LOG(ERROR) << "Cannot write capture index: " << strerror(errno);
+  }
+  close(fd_);
+  fd_ = -1;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  open_ = false;
+}
+
+void CaptureWriter::OnFrame(Direction direction, const uint8_t* data,
+                            size_t size) {
+  size_t record_size = kCaptureRecordHeaderSize + size;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!open_ || closing_) {
+    return;
+  }
+  // Reading the clock under the lock keeps the timestamps of concurrent
+  // senders in file order.
+  int64_t now = clock_->NowMicros();
+  if (failed_ || pending_.size() + record_size > max_buffered_bytes_) {
+    lock.unlock();
+    frames_dropped_.fetch_add(1);
+    return;
+  }
+
+  if (unindexed_frames_ == 0) {
+    index_.push_back(std::make_pair(now, next_offset_));
+  }
+  if (++unindexed_frames_ == kCaptureIndexInterval) {
+    unindexed_frames_ = 0;
+  }
+  next_offset_ += record_size;
+
+  AppendRecordHeader(size, static_cast<CaptureRecordType>(direction), now,
+                     &pending_);
+  pending_.insert(pending_.end(), data, data + size);
+  bool wake = pending_.size() >= kWakeBytes;
+  lock.unlock();
+
+  frames_captured_.fetch_add(1);
+  if (wake) {
+    wake_.notify_one();
+  }
+}
+
+void CaptureWriter::WriterLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    wake_.wait_for(lock, std::chrono::milliseconds(kWriteIntervalMillis),
+                   [this] {
+                     return closing_ || pending_.size() >= kWakeBytes;
+                   });
+    if (pending_.empty()) {
+      if (closing_) {
+        return;
+      }
+      continue;
+    }
+
+    writing_.swap(pending_);
+    lock.unlock();
+    bool written = WriteFully(fd_, &writing_[0], writing_.size());
+    if (!written) {
+      LOG(ERROR) << "Cannot write capture: " << strerror(errno);
+    }
+    writing_.clear();
+    lock.lock();
+
+    if (!written) {
+      // Later frames are dropped, as the file now has a gap.
+      failed_ = true;
+    }
+  }
+}
+
+bool CaptureWriter::WriteIndex() {
+  std::vector<uint8_t> buffer;
+  size_t index_size = index_.size() * kCaptureIndexEntrySize;
+  AppendRecordHeader(index_size, kCaptureIndex, 0, &buffer);
+  buffer.resize(buffer.size() + index_size + kCaptureTrailerSize);
+
+  uint8_t* target = &buffer[kCaptureRecordHeaderSize];
+  for (size_t i = 0; i < index_.size(); ++i) {
+    target = CodedOutputStream::WriteLittleEndian64ToArray(index_[i].first,
+                                                           target);
+    target = CodedOutputStream::WriteLittleEndian64ToArray(index_[i].second,
+                                                           target);
+  }
+  target = CodedOutputStream::WriteLittleEndian64ToArray(next_offset_,
+                                                         target);
+  memcpy(target, kCaptureIndexMagic, kCaptureMagicSize);
+  return WriteFully(fd_, &buffer[0], buffer.size());
+}
+
+}  // namespace wire
+}  // namespace anymote
@@ -0,0 +1,124 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_WIRE_CAPTUREWRITER_H_
+#define ANYMOTE_WIRE_CAPTUREWRITER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "anymote/util/clock.h"
+#include "anymote/wire/frametap.h"
+
+namespace anymote {
+namespace wire {
+
+// Frame tap that records timestamped frames to a capture file, in the format
+// described in captureformat.h.
+//
+// Frames are copied into a memory buffer and written to the file by a
+// background thread, so capturing a frame costs a clock read, a short lock
+// and a copy. If the file cannot keep up and the buffer reaches its limit,
+// frames are dropped rather than delaying the session, and counted.
+class CaptureWriter : public FrameTap {
+ public:
+  // The default limit on the bytes buffered for the writer thread.
+  static const size_t kDefaultMaxBufferedBytes = 4 * 1024 * 1024;
+
+  // Creates a writer that is not yet recording.
+  // @param clock The clock used to timestamp frames. No ownership is taken
+  //              and the pointer must be valid for the duration of the
+  //              existence of this instance.
+  explicit CaptureWriter(util::Clock* clock);
+
+  // Closes the capture, if open.
+  virtual ~CaptureWriter();
+
+  // Sets the limit on the bytes buffered for the writer thread. This must be
+  // invoked before Open.
+  // @param max_bytes The limit, in bytes.
+  void set_max_buffered_bytes(size_t max_bytes) {
+    max_buffered_bytes_ = max_bytes;
+  }
+
+  // Creates or truncates a capture file and starts recording to it.
+  // @param path The path of the file.
+  // @return false if the file could not be created.
+  bool Open(const std::string& path);
+
+  // Writes all buffered frames and the index, and closes the file. Frames
+  // shown to the tap afterwards are ignored.
+  void Close();
+
+  // @override
+  virtual void OnFrame(Direction direction, const uint8_t* data,
+                       size_t size);
+
+  // Returns the number of frames buffered for the file.
+  uint64_t frames_captured() const { return frames_captured_.load(); }
+
+  // Returns the number of frames dropped because the buffer was full or the
+  // file could not be written.
+  uint64_t frames_dropped() const { return frames_dropped_.load(); }
+
+ private:
+  // Writes buffered frames to the file until the capture is closed. Runs on
+  // the writer thread.
+  void WriterLoop();
+
+  // Appends the index record and the trailer to the file.
+  // @return false if the file could not be written.
+  bool WriteIndex();
+
+  util::Clock* const clock_;
+  size_t max_buffered_bytes_;
+  int fd_;
+  std::thread writer_thread_;
+
+  // Guards the state below, which is shared with the writer thread.
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool open_;
+  bool closing_;
+  bool failed_;
+
+  // Records waiting to be written. The writer thread swaps it with
+  // writing_, so both buffers keep their capacity.
+  std::vector<uint8_t> pending_;
+  std::vector<uint8_t> writing_;
+
+  // The file offset of the next record, and the number of frame records
+  // since the last index entry.
+  uint64_t next_offset_;
+  size_t unindexed_frames_;
+
+  // The timestamp and offset of every kCaptureIndexInterval-th record.
+  std::vector<std::pair<int64_t, uint64_t> > index_;
+
+  std::atomic<uint64_t> frames_captured_;
+  std::atomic<uint64_t> frames_dropped_;
+
+  // Disallow copy and assign.
+  CaptureWriter(const CaptureWriter&);
+  void operator=(const CaptureWriter&);
+};
+
+}  // namespace wire
+}  // namespace anymote
+
+#endif  // ANYMOTE_WIRE_CAPTUREWRITER_H_
@@ -0,0 +1,74 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <glog/logging.h>
+#include <string.h>
+#include "anymote/messages/remote.pb.h"
+#include "anymote/wire/framecache.h"
+#include "anymote/wire/inputeventcodec.h"
+
+namespace anymote {
+namespace wire {
+
+const size_t FrameCache::kMaxFrameSize;
+
+FrameCache::FrameCache() {
+  memset(key_events_, 0, sizeof(key_events_));
+
+  messages::RemoteMessage message;
+  messages::KeyEvent* key_event =
+      message.mutable_request_message()->mutable_key_event_message();
+  uint8_t frame[kMaxInputEventFrameSize];
+  for (int keycode = 0; keycode < messages::Code_ARRAYSIZE; ++keycode) {
+    if (!messages::Code_IsValid(keycode)) {
+      continue;
+    }
+    for (int action = 0; action < messages::Action_ARRAYSIZE; ++action) {
+      if (!messages::Action_IsValid(action)) {
+        continue;
+      }
+      key_event->set_keycode(static_cast<messages::Code>(keycode));
+      key_event->set_action(static_cast<messages::Action>(action));
+      size_t size = EncodeInputEventFrame(message, frame);
+      CHECK_GT(size, 0U) << "Key events must be input events";
+      CHECK_LE(size, kMaxFrameSize) << "Key event frame too large";
+      Slot* slot = &key_events_[keycode][action];
+      slot->size = static_cast<uint8_t>(size);
+      memcpy(slot->bytes, frame, size);
+    }
+  }
+}
+
+const FrameCache* FrameCache::Get() {
+  static FrameCache cache;
+  return &cache;
+}
+
+const uint8_t* FrameCache::KeyEventFrame(messages::Code keycode,
+                                         messages::Action action,
+                                         size_t* size) const {
+  if (keycode < 0 || keycode >= messages::Code_ARRAYSIZE ||
+      action < 0 || action >= messages::Action_ARRAYSIZE) {
+    return NULL;
+  }
+  const Slot& slot = key_events_[keycode][action];
+  if (slot.size == 0) {
+    return NULL;
+  }
+  *size = slot.size;
+  return slot.bytes;
+}
+
+}  // namespace wire
+}  // namespace anymote
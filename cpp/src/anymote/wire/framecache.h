@@ -0,0 +1,71 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_WIRE_FRAMECACHE_H_
+#define ANYMOTE_WIRE_FRAMECACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "anymote/messages/keycodes.pb.h"
+
+namespace anymote {
+namespace wire {
+
+// Frames of constant messages, encoded once and shared by every session. A
+// key event without a sequence number, such as a d-pad press, is the same
+// bytes every time it is sent, so sending it from the cache with
+// WireAdapter::SendEncodedFrame skips building and serializing the message.
+//
+// The cache holds a frame for both actions of every keycode. It is built on
+// first use and never changes afterwards, so it may be read from any thread.
+class FrameCache {
+ public:
+  // The maximum size of a cached frame, preamble included.
+  static const size_t kMaxFrameSize = 15;
+
+  // Returns the process-wide cache, building it on the first call.
+  static const FrameCache* Get();
+
+  // Returns the frame of a key event without a sequence number.
+  // @param keycode The keycode of the event.
+  // @param action The action of the event.
+  // @param size Set to the size of the frame, preamble included.
+  // @return The frame, or NULL if the keycode or action is not defined by the
+  //         protocol. It is valid for the lifetime of the process.
+  const uint8_t* KeyEventFrame(messages::Code keycode, messages::Action action,
+                               size_t* size) const;
+
+ private:
+  FrameCache();
+
+  // A frame, stored inline so that the frames of neighbouring keys, such as
+  // the d-pad, share cache lines.
+  struct Slot {
+    uint8_t size;
+    uint8_t bytes[kMaxFrameSize];
+  };
+
+  // The key event frames, indexed by keycode and action. Undefined keycodes
+  // have empty slots.
+  Slot key_events_[messages::Code_ARRAYSIZE][messages::Action_ARRAYSIZE];
+
+  // Disallow copy and assign.
+  FrameCache(const FrameCache&);
+  void operator=(const FrameCache&);
+};
+
+}  // namespace wire
+}  // namespace anymote
+
+#endif  // ANYMOTE_WIRE_FRAMECACHE_H_
@@ -0,0 +1,220 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Frames start with a varint32 preamble that holds their size. The common
+// case is a chunk holding whole frames, so the decoder works directly on the
+// chunk and only falls back to its internal state at a chunk boundary that
+// splits a frame. The state is resumed byte by byte for the preamble, which is
+// at most 5 bytes, and in bulk for the rest of the frame.
+//
+// Most frames are smaller than 128 bytes, so the preamble is usually a single
+// byte. Longer preambles are decoded 8 bytes at a time when the chunk has that
+// many bytes left: the bytes without a continuation bit are found with a mask
+// over the whole word, and the 7-bit groups are packed with shifts instead of
+// a loop with a branch per byte.
+
+#include "anymote/wire/framedecoder.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace anymote {
+namespace wire {
+
+const size_t FrameDecoder::kMaxPreambleSize;
+const uint32_t FrameDecoder::kDefaultMaxFrameSize;
+
+FrameDecoder::FrameDecoder()
+    : preamble_size_(0),
+      has_frame_size_(false),
+      frame_size_(0),
+      max_frame_size_(kDefaultMaxFrameSize),
+      pool_(util::BufferPool::GetDefaultPool()),
+      frame_(NULL),
+      frame_capacity_(0),
+      frame_received_(0) {
+}
+
+FrameDecoder::FrameDecoder(util::BufferPool* pool)
+    : preamble_size_(0),
+      has_frame_size_(false),
+      frame_size_(0),
+      max_frame_size_(kDefaultMaxFrameSize),
+      pool_(pool),
+      frame_(NULL),
+      frame_capacity_(0),
+      frame_received_(0) {
+}
+
+FrameDecoder::~FrameDecoder() {
+  Reset();
+}
+
+FrameDecoder::Result FrameDecoder::Decode(const uint8_t* data, size_t size,
+                                          Handler* handler) {
+  size_t offset = 0;
+  if (has_partial_frame()) {
+    Result result = ContinueFrame(data, size, handler, &offset);
+    if (result != kOk) {
+      return result;
+    }
+  }
+
+  while (offset < size) {
+    uint32_t frame_size = 0;
+    int preamble_size = DecodeVarint32(data + offset, size - offset,
+                                       &frame_size);
+    if (preamble_size < 0) {
+      return kInvalidPreamble;
+    }
+    if (preamble_size > 0 && frame_size > max_frame_size_) {
+      has_frame_size_ = true;
+      frame_size_ = frame_size;
+      return kFrameTooLarge;
+    }
+    if (preamble_size == 0 || size - offset - preamble_size < frame_size) {
+      // The frame continues in the next chunk, so keep what there is of it.
+      size_t consumed = 0;
+      return ContinueFrame(data + offset, size - offset, handler, &consumed);
+    }
+
+    offset += preamble_size;
+    handler->OnFrame(data + offset, frame_size);
+    offset += frame_size;
+  }
+  return kOk;
+}
+
+FrameDecoder::Result FrameDecoder::ContinueFrame(const uint8_t* data,
+                                                 size_t size,
+                                                 Handler* handler,
+                                                 size_t* consumed) {
+  size_t offset = 0;
+  while (!has_frame_size_) {
+    if (offset == size) {
+      *consumed = offset;
+      return kOk;
+    }
+    preamble_[preamble_size_++] = data[offset++];
+    int result = DecodeVarint32(preamble_, preamble_size_, &frame_size_);
+    if (result < 0) {
+      return kInvalidPreamble;
+    }
+    has_frame_size_ = result > 0;
+  }
+  if (frame_size_ > max_frame_size_) {
+    return kFrameTooLarge;
+  }
+
+  size_t available = size - offset;
+  if (frame_ == NULL && available >= frame_size_) {
+    // Only the preamble was split, so the frame is handed over from the chunk.
+    uint32_t frame_size = frame_size_;
+    Reset();
+    *consumed = offset + frame_size;
+    handler->OnFrame(data + offset, frame_size);
+    return kOk;
+  }
+
+  if (frame_ == NULL) {
+    if (available == 0) {
+      *consumed = offset;
+      return kOk;
+    }
+    frame_ = pool_->Acquire(frame_size_, &frame_capacity_);
+  }
+
+  size_t count = std::min(available, frame_size_ - frame_received_);
+  memcpy(frame_ + frame_received_, data + offset, count);
+  frame_received_ += count;
+  *consumed = offset + count;
+  if (frame_received_ == frame_size_) {
+    handler->OnFrame(frame_, frame_size_);
+    Reset();
+  }
+  return kOk;
+}
+
+void FrameDecoder::Reset() {
+  preamble_size_ = 0;
+  has_frame_size_ = false;
+  frame_size_ = 0;
+  if (frame_ != NULL) {
+    pool_->Release(frame_, frame_capacity_);
+    frame_ = NULL;
+  }
+  frame_capacity_ = 0;
+  frame_received_ = 0;
+}
+
+size_t FrameDecoder::bytes_needed() const {
+  return has_frame_size_ ? frame_size_ - frame_received_ : 1;
+}
+
+int FrameDecoder::DecodeVarint32(const uint8_t* data, size_t size,
+                                 uint32_t* value) {
+  if (size > 0 && data[0] < 0x80) {
+    *value = data[0];
+    return 1;
+  }
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if (size >= sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+
+    // The high bit of every byte that does not continue the varint.
+    uint64_t last_bytes = ~word & 0x8080808080808080ULL;
+    if (last_bytes == 0) {
+      return -1;
+    }
+    int length = (__builtin_ctzll(last_bytes) + 1) / 8;
+    if (length > static_cast<int>(kMaxPreambleSize)) {
+      return -1;
+    }
+
+    // Keep the payload bits of the bytes up to the last one, then close the
+    // one bit gap left by each continuation bit.
+    uint64_t bits =
+        word & (last_bytes ^ (last_bytes - 1)) & 0x7F7F7F7F7F7F7F7FULL;
+    uint64_t result = (bits & 0x7FULL) |
+                      ((bits >> 1) & (0x7FULL << 7)) |
+                      ((bits >> 2) & (0x7FULL << 14)) |
+                      ((bits >> 3) & (0x7FULL << 21)) |
+                      ((bits >> 4) & (0x7FULL << 28));
+    if (result > 0xFFFFFFFFULL) {
+      return -1;
+    }
+    *value = static_cast<uint32_t>(result);
+    return length;
+  }
+#endif
+
+  uint64_t result = 0;
+  for (size_t i = 0; i < size && i < kMaxPreambleSize; ++i) {
+    result |= static_cast<uint64_t>(data[i] & 0x7F) << (7 * i);
+    if (!(data[i] & 0x80)) {
+      if (result > 0xFFFFFFFFULL) {
+        return -1;
+      }
+      *value = static_cast<uint32_t>(result);
+      return i + 1;
+    }
+  }
+  return size >= kMaxPreambleSize ? -1 : 0;
+}
+
+}  // namespace wire
+}  // namespace anymote
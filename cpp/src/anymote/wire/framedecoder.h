@@ -0,0 +1,173 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_WIRE_FRAMEDECODER_H_
+#define ANYMOTE_WIRE_FRAMEDECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "anymote/util/bufferpool.h"
+
+namespace anymote {
+namespace wire {
+
+// Splits a byte stream into frames, each made of a varint32 preamble holding
+// the size of the frame followed by that many bytes.
+//
+// The stream may be fed in chunks split at arbitrary points: a chunk may end
+// in the middle of a preamble or of a frame, or hold any number of frames.
+// Frames that are complete within a chunk are handed to the handler straight
+// from the chunk, without copying. Only a frame that spans chunks is
+// reassembled, in a buffer acquired from a buffer pool for the time it takes
+// to complete the frame.
+//
+// Frames larger than a maximum size are rejected as soon as their preamble is
+// decoded, before any of their bytes are buffered.
+//
+// This class is not thread-safe.
+class FrameDecoder {
+ public:
+  // Receives the frames decoded from the stream.
+  class Handler {
+   public:
+    virtual ~Handler() {}
+
+    // Called for each complete frame, in stream order.
+    // @param data The frame, without its preamble. The data is only valid for
+    //             the duration of the call.
+    // @param size The size of the frame.
+    virtual void OnFrame(const uint8_t* data, size_t size) = 0;
+  };
+
+  // The result of decoding a chunk.
+  enum Result {
+    // The chunk was consumed. It may have ended in a partial frame, which is
+    // completed by the next chunks.
+    kOk,
+
+    // The stream contains a preamble longer than a varint32. The decoder must
+    // be reset before it is fed again.
+    kInvalidPreamble,
+
+    // The stream contains a frame larger than the maximum frame size. The
+    // decoder must be reset before it is fed again.
+    kFrameTooLarge,
+  };
+
+  // The maximum number of bytes in a varint32 preamble.
+  static const size_t kMaxPreambleSize = 5;
+
+  // The default maximum frame size, in bytes.
+  static const uint32_t kDefaultMaxFrameSize = 1 << 20;
+
+  // Creates a new decoder that buffers partial frames in the default buffer
+  // pool.
+  FrameDecoder();
+
+  // Creates a new decoder.
+  // @param pool The pool of the buffers used to reassemble frames. No
+  //             ownership is taken and the pointer must be valid for the
+  //             duration of the existence of this instance.
+  explicit FrameDecoder(util::BufferPool* pool);
+
+  ~FrameDecoder();
+
+  // Sets the maximum size of a frame. Larger frames are reported as
+  // kFrameTooLarge.
+  // @param max_frame_size The maximum frame size, in bytes.
+  void set_max_frame_size(uint32_t max_frame_size) {
+    max_frame_size_ = max_frame_size;
+  }
+
+  // Returns the maximum size of a frame.
+  uint32_t max_frame_size() const {
+    return max_frame_size_;
+  }
+
+  // Decodes the next chunk of the stream.
+  // @param data The bytes of the chunk.
+  // @param size The number of bytes in the chunk.
+  // @param handler Receives every frame completed by the chunk.
+  // @return kOk, or the error found in the stream. Frames before the error
+  //         have been handed to the handler.
+  Result Decode(const uint8_t* data, size_t size, Handler* handler);
+
+  // Discards any partial frame, so the next chunk starts a new frame.
+  void Reset();
+
+  // Returns the size of the frame being received, or of the frame that was
+  // rejected as too large, or 0 if its preamble has not been decoded.
+  uint32_t frame_size() const {
+    return has_frame_size_ ? frame_size_ : 0;
+  }
+
+  // Returns the number of bytes that are known to be missing from the current
+  // frame: the rest of the frame once its preamble has been decoded, or 1
+  // while the preamble is incomplete. Feeding exactly this many bytes at a
+  // time never splits a frame across more chunks than necessary.
+  size_t bytes_needed() const;
+
+  // Returns whether the decoder holds part of a frame.
+  bool has_partial_frame() const {
+    return preamble_size_ > 0;
+  }
+
+  // Decodes a varint32 at the start of the given bytes.
+  // @param data The bytes to decode.
+  // @param size The number of bytes available.
+  // @param value Set to the decoded value.
+  // @return The number of bytes of the varint, 0 if the bytes end before the
+  //         varint does, or -1 if the varint is longer than 5 bytes or its
+  //         value does not fit in 32 bits.
+  static int DecodeVarint32(const uint8_t* data, size_t size, uint32_t* value);
+
+ private:
+  // Feeds bytes to the frame started in an earlier chunk.
+  // @param data The bytes of the chunk.
+  // @param size The number of bytes in the chunk.
+  // @param handler Receives the frame once it is complete.
+  // @param consumed Set to the number of bytes used by the frame.
+  // @return kOk, or the error found in the stream.
+  Result ContinueFrame(const uint8_t* data, size_t size, Handler* handler,
+                       size_t* consumed);
+
+  // The bytes of the preamble of the partial frame, and how many there are.
+  // The preamble size is 0 when there is no partial frame.
+  uint8_t preamble_[kMaxPreambleSize];
+  size_t preamble_size_;
+
+  // Whether the preamble of the partial frame is complete, and the size of
+  // the frame it holds.
+  bool has_frame_size_;
+  uint32_t frame_size_;
+
+  // The maximum size of a frame.
+  uint32_t max_frame_size_;
+
+  // The buffer holding the bytes received so far of the partial frame, or
+  // NULL if none have been received, with its capacity in the pool.
+  util::BufferPool* const pool_;
+  uint8_t* frame_;
+  size_t frame_capacity_;
+  size_t frame_received_;
+
+  // Disallow copy and assign.
+  FrameDecoder(const FrameDecoder&);
+  void operator=(const FrameDecoder&);
+};
+
+}  // namespace wire
+}  // namespace anymote
+
+#endif  // ANYMOTE_WIRE_FRAMEDECODER_H_
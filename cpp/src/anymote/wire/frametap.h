@@ -0,0 +1,57 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_WIRE_FRAMETAP_H_
+#define ANYMOTE_WIRE_FRAMETAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace anymote {
+namespace wire {
+
+// Observer of the frames that pass through a ProtobufWireAdapter, used to
+// capture traffic.
+class FrameTap {
+ public:
+  // The direction of a frame, as seen by the adapter.
+  enum Direction {
+    kReceived = 0,
+    kSent = 1,
+  };
+
+  FrameTap() {}
+  virtual ~FrameTap() {}
+
+  // Handles a frame. Received frames are reported from the receiving thread,
+  // sent frames from any thread that sends messages, so implementations must
+  // be thread-safe. This is on the path of every message and should not
+  // block.
+  // @param direction The direction of the frame.
+  // @param data The serialized message, without its preamble. It is only
+  //             valid for the duration of the call.
+  // @param size The size of the message.
+  virtual void OnFrame(Direction direction, const uint8_t* data,
+                       size_t size) = 0;
+
+ private:
+  // Disallow copy and assign.
+  FrameTap(const FrameTap&);
+  void operator=(const FrameTap&);
+};
+
+}  // namespace wire
+}  // namespace anymote
+
+#endif  // ANYMOTE_WIRE_FRAMETAP_H_
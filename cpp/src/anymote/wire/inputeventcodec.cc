@@ -0,0 +1,272 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The wire format of an input event is, with the field tags in hex:
+//
+//   [08 sequence_number]           RemoteMessage.sequence_number, optional
+//   12 length                      RemoteMessage.request_message
+//     0A|12|1A length              RequestMessage.key_event_message,
+//                                  mouse_event_message or mouse_wheel_message
+//       08 value                   first field of the event
+//       10 value                   second field of the event
+//
+// All values are varints, and every length fits in a single byte. Negative
+// int32 values are sign extended to 64 bits, so they take 10 bytes. The
+// generic serializer writes fields in field number order, so the encoder
+// produces exactly its output. The decoder only accepts that layout and
+// leaves anything else, such as unknown fields or fields in another order, to
+// the generic parser.
+
+#include "anymote/wire/inputeventcodec.h"
+
+#include <google/protobuf/stubs/common.h>
+
+namespace anymote {
+namespace wire {
+
+// Field tags, made of the field number and the wire type.
+static const uint8_t kFirstFieldTag = 0x08;
+static const uint8_t kSecondFieldTag = 0x10;
+static const uint8_t kSequenceNumberTag = 0x08;
+static const uint8_t kRequestMessageTag = 0x12;
+static const uint8_t kKeyEventTag = 0x0A;
+static const uint8_t kMouseEventTag = 0x12;
+static const uint8_t kMouseWheelTag = 0x1A;
+
+// Returns whether the given message has unknown fields, which the generic
+// serializer would write back.
+template <typename Message>
+static inline bool HasUnknownFields(const Message& message) {
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+  return !message.unknown_fields().empty();
+#else
+  // Lite messages do not keep unknown fields before protobuf 3.
+  return false;
+#endif
+}
+
+// Writes a varint and returns the end of it.
+static inline uint8_t* WriteVarint64(uint64_t value, uint8_t* target) {
+  while (value >= 0x80) {
+    *target++ = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  *target++ = static_cast<uint8_t>(value);
+  return target;
+}
+
+// Writes an int32 as the generic serializer does, sign extending negative
+// values.
+static inline uint8_t* WriteInt32(int32_t value, uint8_t* target) {
+  return WriteVarint64(static_cast<uint64_t>(static_cast<int64_t>(value)),
+                       target);
+}
+
+// Writes an event with the given field values and returns the end of it.
+static inline uint8_t* WriteEvent(uint8_t tag, int32_t first, int32_t second,
+                                  uint8_t* target) {
+  target[0] = tag;
+  uint8_t* start = target + 2;
+  uint8_t* end = start;
+  *end++ = kFirstFieldTag;
+  end = WriteInt32(first, end);
+  *end++ = kSecondFieldTag;
+  end = WriteInt32(second, end);
+  target[1] = static_cast<uint8_t>(end - start);
+  return end;
+}
+
+size_t EncodeInputEventFrame(const messages::RemoteMessage& message,
+                             uint8_t* target) {
+  if (!message.has_request_message() || message.has_response_message() ||
+      HasUnknownFields(message)) {
+    return 0;
+  }
+  const messages::RequestMessage& request = message.request_message();
+  if (request.has_data_message() || request.has_connect_message() ||
+      request.has_fling_message() || HasUnknownFields(request)) {
+    return 0;
+  }
+
+  // Find the event and its field values before writing anything.
+  uint8_t tag = 0;
+  int32_t first = 0;
+  int32_t second = 0;
+  int num_events = 0;
+  if (request.has_key_event_message()) {
+    const messages::KeyEvent& event = request.key_event_message();
+    if (!event.has_keycode() || !event.has_action() ||
+        HasUnknownFields(event)) {
+      return 0;
+    }
+    tag = kKeyEventTag;
+    first = event.keycode();
+    second = event.action();
+    num_events++;
+  }
+  if (request.has_mouse_event_message()) {
+    const messages::MouseEvent& event = request.mouse_event_message();
+    if (!event.has_x_delta() || !event.has_y_delta() ||
+        HasUnknownFields(event)) {
+      return 0;
+    }
+    tag = kMouseEventTag;
+    first = event.x_delta();
+    second = event.y_delta();
+    num_events++;
+  }
+  if (request.has_mouse_wheel_message()) {
+    const messages::MouseWheel& event = request.mouse_wheel_message();
+    if (!event.has_x_scroll() || !event.has_y_scroll() ||
+        HasUnknownFields(event)) {
+      return 0;
+    }
+    tag = kMouseWheelTag;
+    first = event.x_scroll();
+    second = event.y_scroll();
+    num_events++;
+  }
+  if (num_events != 1) {
+    return 0;
+  }
+
+  // The preamble and both lengths always fit in a single byte, so the frame
+  // is written front to back with the lengths filled in afterwards.
+  uint8_t* end = target + 1;
+  if (message.has_sequence_number()) {
+    *end++ = kSequenceNumberTag;
+    end = WriteVarint64(message.sequence_number(), end);
+  }
+  *end++ = kRequestMessageTag;
+  uint8_t* request_start = end + 1;
+  end = WriteEvent(tag, first, second, request_start);
+
+  request_start[-1] = static_cast<uint8_t>(end - request_start);
+  target[0] = static_cast<uint8_t>(end - target - 1);
+  return end - target;
+}
+
+// Reads a varint of up to 10 bytes and keeps its low 32 bits, as the generic
+// parser does for int32, uint32 and enum fields.
+// @return The end of the varint, or NULL if it does not end before the end of
+//         the data.
+static inline const uint8_t* ReadVarint32(const uint8_t* data,
+                                          const uint8_t* end,
+                                          uint32_t* value) {
+  uint32_t result = 0;
+  for (int i = 0; i < 10 && data < end; ++i) {
+    uint8_t byte = *data++;
+    if (i < 5) {
+      result |= static_cast<uint32_t>(byte & 0x7F) << (7 * i);
+    }
+    if (!(byte & 0x80)) {
+      *value = result;
+      return data;
+    }
+  }
+  return NULL;
+}
+
+// Reads the length of a nested message and checks that the message ends at
+// the given end.
+// @return The start of the nested message, or NULL if it does not end there.
+static inline const uint8_t* ReadNested(const uint8_t* data,
+                                        const uint8_t* end) {
+  if (data == end || *data >= 0x80 || *data != end - data - 1) {
+    return NULL;
+  }
+  return data + 1;
+}
+
+// Reads the two fields of an event, which must end at the given end.
+// @return false if the data does not hold exactly the two fields.
+static inline bool ReadEvent(const uint8_t* data, const uint8_t* end,
+                             uint32_t* first, uint32_t* second) {
+  if (data == end || *data++ != kFirstFieldTag) {
+    return false;
+  }
+  data = ReadVarint32(data, end, first);
+  if (data == NULL || data == end || *data++ != kSecondFieldTag) {
+    return false;
+  }
+  data = ReadVarint32(data, end, second);
+  return data == end;
+}
+
+bool DecodeInputEvent(const uint8_t* data, size_t size,
+                      messages::RemoteMessage* message) {
+  const uint8_t* end = data + size;
+  bool has_sequence_number = false;
+  uint32_t sequence_number = 0;
+  if (data < end && *data == kSequenceNumberTag) {
+    data = ReadVarint32(data + 1, end, &sequence_number);
+    if (data == NULL) {
+      return false;
+    }
+    has_sequence_number = true;
+  }
+
+  if (data == end || *data++ != kRequestMessageTag) {
+    return false;
+  }
+  data = ReadNested(data, end);
+  if (data == NULL || data == end) {
+    return false;
+  }
+  uint8_t tag = *data++;
+  data = ReadNested(data, end);
+  uint32_t first = 0;
+  uint32_t second = 0;
+  if (data == NULL || !ReadEvent(data, end, &first, &second)) {
+    return false;
+  }
+
+  int32_t first_value = static_cast<int32_t>(first);
+  int32_t second_value = static_cast<int32_t>(second);
+  if (tag == kKeyEventTag) {
+    // Unknown enum values are not kept by the generic parser, which then
+    // fails on the missing required field.
+    if (!messages::Code_IsValid(first_value) ||
+        !messages::Action_IsValid(second_value)) {
+      return false;
+    }
+    message->Clear();
+    messages::KeyEvent* event =
+        message->mutable_request_message()->mutable_key_event_message();
+    event->set_keycode(static_cast<messages::Code>(first_value));
+    event->set_action(static_cast<messages::Action>(second_value));
+  } else if (tag == kMouseEventTag) {
+    message->Clear();
+    messages::MouseEvent* event =
+        message->mutable_request_message()->mutable_mouse_event_message();
+    event->set_x_delta(first_value);
+    event->set_y_delta(second_value);
+  } else if (tag == kMouseWheelTag) {
+    message->Clear();
+    messages::MouseWheel* event =
+        message->mutable_request_message()->mutable_mouse_wheel_message();
+    event->set_x_scroll(first_value);
+    event->set_y_scroll(second_value);
+  } else {
+    return false;
+  }
+
+  if (has_sequence_number) {
+    message->set_sequence_number(sequence_number);
+  }
+  return true;
+}
+
+}  // namespace wire
+}  // namespace anymote
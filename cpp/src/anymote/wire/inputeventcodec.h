@@ -0,0 +1,59 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_WIRE_INPUTEVENTCODEC_H_
+#define ANYMOTE_WIRE_INPUTEVENTCODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "anymote/messages/remote.pb.h"
+
+namespace anymote {
+namespace wire {
+
+// Hand-written codec for the messages that make up most of the traffic: a
+// RemoteMessage holding only a KeyEvent, a MouseEvent or a MouseWheel request,
+// and optionally a sequence number. Such messages have a fixed shape, so they
+// are encoded and decoded with straight-line code instead of the generic
+// protocol buffer serializer and parser. Both produce exactly the same bytes
+// and messages as the generic code; anything else is left to it.
+
+// The maximum size of a frame written by EncodeInputEventFrame.
+static const size_t kMaxInputEventFrameSize = 33;
+
+// Encodes a frame, preamble included, holding the given message if it is an
+// input event.
+// @param message The message to encode.
+// @param target The buffer to write to, at least kMaxInputEventFrameSize
+//               bytes long.
+// @return The size of the frame, or 0 if the message is not an input event,
+//         in which case nothing is written.
+size_t EncodeInputEventFrame(const messages::RemoteMessage& message,
+                             uint8_t* target);
+
+// Decodes a message holding an input event, encoded as the generic
+// serializer would.
+// @param data The message, without its preamble.
+// @param size The size of the message.
+// @param message Set to the decoded message. It is only modified if the data
+//                holds an input event.
+// @return true if the data held an input event, or false if it must be
+//         parsed by the generic parser.
+bool DecodeInputEvent(const uint8_t* data, size_t size,
+                      messages::RemoteMessage* message);
+
+}  // namespace wire
+}  // namespace anymote
+
+#endif  // ANYMOTE_WIRE_INPUTEVENTCODEC_H_
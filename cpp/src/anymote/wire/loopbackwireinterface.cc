@@ -0,0 +1,260 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "anymote/wire/loopbackwireinterface.h"
+
+#include <glog/logging.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <thread>
+
+namespace anymote {
+namespace wire {
+
+LoopbackWireInterface::LoopbackWireInterface()
+    : options_(),
+      clock_(util::Clock::GetRealClock()),
+      timed_(false),
+      peer_(NULL),
+      ring_(options_.ring_capacity),
+      backlog_offset_(0),
+      has_backlog_(false),
+      bytes_sent_(0),
+      link_free_micros_(0),
+      arrived_position_(0),
+      read_position_(0),
+      bytes_delivered_(0),
+      seed_(options_.seed) {
+}
+
+LoopbackWireInterface::LoopbackWireInterface(const Options& options)
+    : options_(options),
+      clock_(options.clock != NULL ? options.clock
+                                   : util::Clock::GetRealClock()),
+      timed_(options.latency_micros > 0 || options.bytes_per_second > 0),
+      peer_(NULL),
+      ring_(options.ring_capacity),
+      backlog_offset_(0),
+      has_backlog_(false),
+      bytes_sent_(0),
+      link_free_micros_(0),
+      arrived_position_(0),
+      read_position_(0),
+      bytes_delivered_(0),
+      seed_(options.seed) {
+}
+
+void LoopbackWireInterface::Connect(LoopbackWireInterface* first,
+                                    LoopbackWireInterface* second) {
+  first->peer_ = second;
+  second->peer_ = first;
+}
+
+void LoopbackWireInterface::Send(const std::vector<uint8_t>& data) {
+  CHECK(peer_ != NULL) << "Interface is not connected";
+  if (!data.empty()) {
+    peer_->Enqueue(&data[0], data.size());
+  }
+}
+
+void LoopbackWireInterface::SendOwned(std::vector<uint8_t>* data) {
+  Send(*data);
+}
+
+void LoopbackWireInterface::Receive(size_t num_bytes) {
+  CHECK_GT(num_bytes, 0U) << "Use ReceiveAvailable to receive any bytes";
+  requests_.push_back(num_bytes);
+}
+
+void LoopbackWireInterface::ReceiveAvailable() {
+  requests_.push_back(0);
+}
+
+size_t LoopbackWireInterface::queued_bytes() {
+  CHECK(peer_ != NULL) << "Interface is not connected";
+  // The read position never passes the bytes sent, so it is loaded first.
+  uint64_t read_position = peer_->read_position_;
+  return peer_->bytes_sent_ - read_position;
+}
+
+void LoopbackWireInterface::Enqueue(const uint8_t* data, size_t size) {
+  std::lock_guard<std::mutex> lock(send_mutex_);
+  bytes_sent_ += size;
+  if (timed_) {
+    // The link carries one send at a time, each starting once the previous
+    // one has been carried.
+    link_free_micros_ = std::max(link_free_micros_, clock_->NowMicros());
+    if (options_.bytes_per_second > 0) {
+      link_free_micros_ += static_cast<int64_t>(size) * 1000000 /
+          options_.bytes_per_second;
+    }
+    Arrival arrival = {bytes_sent_,
+                       link_free_micros_ + options_.latency_micros};
+    std::lock_guard<std::mutex> arrivals_lock(arrivals_mutex_);
+    arrivals_.push_back(arrival);
+  }
+
+  WriteBacklog();
+  size_t written = 0;
+  if (!has_backlog_.load(std::memory_order_relaxed)) {
+    written = ring_.Write(data, size);
+  }
+  if (written < size) {
+    backlog_.insert(backlog_.end(), data + written, data + size);
+    has_backlog_.store(true, std::memory_order_release);
+  }
+}
+
+void LoopbackWireInterface::WriteBacklog() {
+  if (!has_backlog_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  backlog_offset_ += ring_.Write(&backlog_[backlog_offset_],
+                                 backlog_.size() - backlog_offset_);
+  if (backlog_offset_ == backlog_.size()) {
+    backlog_.clear();
+    backlog_offset_ = 0;
+    has_backlog_.store(false, std::memory_order_release);
+  }
+}
+
+size_t LoopbackWireInterface::Pump() {
+  uint64_t delivered = bytes_delivered_;
+  while (!requests_.empty()) {
+    if (has_backlog_.load(std::memory_order_acquire)) {
+      // Act as the producer to move the backlog into the room that was freed.
+      std::lock_guard<std::mutex> lock(send_mutex_);
+      WriteBacklog();
+    }
+
+    size_t available = ArrivedBytes();
+    size_t request = requests_.front();
+    if (request == 0) {
+      if (available == 0) {
+        break;
+      }
+      Deliver(ChunkSize(available));
+    } else if (partial_.empty() && available >= request) {
+      Deliver(request);
+    } else {
+      // Gather the bytes of the request as they arrive, which also frees the
+      // ring for requests larger than it.
+      size_t size = std::min(available, request - partial_.size());
+      if (size == 0) {
+        break;
+      }
+      size_t offset = partial_.size();
+      partial_.resize(offset + size);
+      ring_.Peek(&partial_[offset], size);
+      ring_.Consume(size);
+      read_position_ += size;
+      if (partial_.size() == request) {
+        DeliverPartial();
+      }
+    }
+  }
+  return bytes_delivered_ - delivered;
+}
+
+size_t LoopbackWireInterface::Poll(int64_t timeout_micros) {
+  util::Clock* clock = util::Clock::GetRealClock();
+  int64_t deadline = clock->NowMicros() + timeout_micros;
+  for (;;) {
+    size_t delivered = Pump();
+    if (delivered > 0 || clock->NowMicros() >= deadline) {
+      return delivered;
+    }
+    std::this_thread::yield();
+  }
+}
+
+int64_t LoopbackWireInterface::next_delivery_micros() {
+  if (!timed_) {
+    return -1;
+  }
+  std::lock_guard<std::mutex> lock(arrivals_mutex_);
+  return arrivals_.empty() ? -1 : arrivals_.front().arrival_micros;
+}
+
+size_t LoopbackWireInterface::ArrivedBytes() {
+  size_t readable = ring_.readable();
+  if (!timed_) {
+    return readable;
+  }
+
+  int64_t now = clock_->NowMicros();
+  {
+    std::lock_guard<std::mutex> lock(arrivals_mutex_);
+    while (!arrivals_.empty() && arrivals_.front().arrival_micros <= now) {
+      arrived_position_ = arrivals_.front().end_position;
+      arrivals_.pop_front();
+    }
+  }
+  // Arrived bytes may still be in the backlog.
+  return std::min(readable,
+                  static_cast<size_t>(arrived_position_ - read_position_));
+}
+
+size_t LoopbackWireInterface::ChunkSize(size_t available) {
+  size_t size = available;
+  if (options_.max_chunk_size > 0) {
+    size = std::min(size, options_.max_chunk_size);
+  }
+
+  switch (options_.chunking) {
+    case kSingleBytes:
+      return 1;
+    case kRandomChunks:
+      return 1 + rand_r(&seed_) % size;
+    case kCoalesced:
+    default: {
+      // Do not copy bytes that wrap around the end of the ring; they are
+      // delivered by the next read.
+      size_t contiguous;
+      ring_.ReadableRegion(&contiguous);
+      return std::min(size, contiguous);
+    }
+  }
+}
+
+void LoopbackWireInterface::Deliver(size_t size) {
+  // The listener may request the next receive while handling this one.
+  requests_.pop_front();
+
+  size_t contiguous;
+  const uint8_t* data = ring_.ReadableRegion(&contiguous);
+  if (contiguous < size) {
+    read_buffer_.resize(size);
+    ring_.Peek(&read_buffer_[0], size);
+    data = &read_buffer_[0];
+  }
+
+  // The bytes are only freed for the peer once the listener has handled
+  // them, so they are delivered straight from the ring.
+  bytes_delivered_ += size;
+  listener()->OnBufferReceived(data, size);
+  ring_.Consume(size);
+  read_position_ += size;
+}
+
+void LoopbackWireInterface::DeliverPartial() {
+  requests_.pop_front();
+  read_buffer_.swap(partial_);
+  partial_.clear();
+  bytes_delivered_ += read_buffer_.size();
+  listener()->OnBufferReceived(&read_buffer_[0], read_buffer_.size());
+}
+
+}  // namespace wire
+}  // namespace anymote
@@ -0,0 +1,232 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_WIRE_LOOPBACKWIREINTERFACE_H_
+#define ANYMOTE_WIRE_LOOPBACKWIREINTERFACE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "anymote/util/clock.h"
+#include "anymote/util/spscring.h"
+#include "anymote/wire/wireinterface.h"
+
+namespace anymote {
+namespace wire {
+
+// Wire interface connected to a peer interface in the same process, for tests
+// and benchmarks. Bytes sent on one interface are written to a lock-free ring
+// buffer owned by its peer, and delivered to the peer's listener when the peer
+// is pumped, so nothing is delivered from within a send.
+//
+// How received bytes are split into reads, and how long they take to arrive,
+// can be configured to reproduce the behavior of a real transport.
+//
+// Send and SendOwned are thread-safe; concurrent senders are serialized by a
+// mutex that the consumer only takes when a send did not fit in the ring.
+// Receive, ReceiveAvailable, Pump and Poll must be invoked from a single
+// thread, which is the thread that notifies the listener.
+class LoopbackWireInterface : public WireInterface {
+ public:
+  // How the bytes available for a ReceiveAvailable request are delivered.
+  // Receive requests are always delivered in a single read of exactly the
+  // requested size.
+  enum Chunking {
+    // Delivers all the available bytes in one read, or as many as are
+    // contiguous in the ring buffer.
+    kCoalesced,
+
+    // Delivers one byte per read.
+    kSingleBytes,
+
+    // Delivers reads of random sizes.
+    kRandomChunks,
+  };
+
+  // Describes how the bytes sent to an interface are delivered to it.
+  struct Options {
+    Options()
+        : ring_capacity(64 * 1024),
+          chunking(kCoalesced),
+          max_chunk_size(0),
+          seed(1),
+          latency_micros(0),
+          bytes_per_second(0),
+          clock(NULL) {
+    }
+
+    // The size of the ring buffer in bytes. Must be a power of two. Bytes
+    // that do not fit are held until the ring has room for them.
+    size_t ring_capacity;
+
+    Chunking chunking;
+
+    // The maximum number of bytes delivered in a read for a ReceiveAvailable
+    // request, or 0 for no limit.
+    size_t max_chunk_size;
+
+    // The seed for the sizes of kRandomChunks reads.
+    unsigned int seed;
+
+    // The time it takes for sent bytes to arrive.
+    int64_t latency_micros;
+
+    // The bandwidth of the link, or 0 for an unlimited bandwidth. Each send
+    // is delivered once the link has carried all the bytes before it and the
+    // bytes of the send itself.
+    int64_t bytes_per_second;
+
+    // The clock used for the latency and bandwidth, or NULL for the real
+    // clock. No ownership is taken.
+    util::Clock* clock;
+  };
+
+  LoopbackWireInterface();
+
+  // Creates an interface that receives bytes as described by the options.
+  // @param options The options.
+  explicit LoopbackWireInterface(const Options& options);
+  virtual ~LoopbackWireInterface() {}
+
+  // Connects two interfaces to each other. Neither may be sent on before they
+  // are connected.
+  // @param first The first interface.
+  // @param second The second interface.
+  static void Connect(LoopbackWireInterface* first,
+                      LoopbackWireInterface* second);
+
+  // @override
+  virtual void Send(const std::vector<uint8_t>& data);
+
+  // Sends a copy of the data and leaves the buffer unchanged, so its capacity
+  // is reused by the caller.
+  // @override
+  virtual void SendOwned(std::vector<uint8_t>* data);
+
+  // @override
+  virtual void Receive(size_t num_bytes);
+
+  // @override
+  virtual void ReceiveAvailable();
+
+  // Returns the number of bytes sent on this interface that the peer has not
+  // read yet.
+  // @override
+  virtual size_t queued_bytes();
+
+  // Delivers received bytes to the listener for as many pending receives as
+  // the bytes that have arrived satisfy.
+  // @return The number of bytes delivered.
+  size_t Pump();
+
+  // Pumps until some bytes are delivered or the timeout expires.
+  // @param timeout_micros The maximum time to wait, in real time.
+  // @return The number of bytes delivered.
+  size_t Poll(int64_t timeout_micros);
+
+  // Returns the time, in microseconds of the options' clock, at which the
+  // next bytes in flight arrive, or -1 if there are none or the link has no
+  // latency or bandwidth limit.
+  int64_t next_delivery_micros();
+
+  // Returns the number of bytes delivered to the listener. This must be
+  // invoked from the thread that pumps the interface.
+  uint64_t bytes_delivered() const { return bytes_delivered_; }
+
+ private:
+  // The bytes of a send and the time at which its last byte arrives.
+  struct Arrival {
+    uint64_t end_position;
+    int64_t arrival_micros;
+  };
+
+  // Writes bytes sent by the peer to the ring buffer.
+  // @param data The bytes.
+  // @param size The number of bytes.
+  void Enqueue(const uint8_t* data, size_t size);
+
+  // Writes as many of the bytes that did not fit in the ring buffer as now
+  // fit. The send mutex must be held.
+  void WriteBacklog();
+
+  // Returns the number of bytes in the ring buffer that have arrived.
+  size_t ArrivedBytes();
+
+  // Returns the number of bytes to deliver for a ReceiveAvailable request.
+  // @param available The number of bytes that have arrived. Must not be 0.
+  size_t ChunkSize(size_t available);
+
+  // Pops the front request and delivers bytes from the ring buffer for it.
+  // @param size The number of bytes to deliver.
+  void Deliver(size_t size);
+
+  // Pops the front request and delivers the bytes that were gathered for it.
+  void DeliverPartial();
+
+  const Options options_;
+  util::Clock* const clock_;
+  const bool timed_;
+  LoopbackWireInterface* peer_;
+
+  // Bytes sent by the peer. The peer's senders write to it and this
+  // interface's dispatch thread reads from it.
+  util::SpscByteRing ring_;
+
+  // Serializes the peer's senders and guards the state below.
+  std::mutex send_mutex_;
+
+  // Bytes sent by the peer that did not fit in the ring buffer, starting at
+  // backlog_offset_. While there are any, sends are appended to them so that
+  // the bytes stay in order.
+  std::vector<uint8_t> backlog_;
+  size_t backlog_offset_;
+  std::atomic<bool> has_backlog_;
+
+  // The number of bytes sent by the peer, and the time at which the link
+  // has carried all of them.
+  std::atomic<uint64_t> bytes_sent_;
+  int64_t link_free_micros_;
+
+  // The arrivals of the bytes in flight, oldest first.
+  std::mutex arrivals_mutex_;
+  std::deque<Arrival> arrivals_;
+
+  // State of the dispatch thread.
+  // Pending receive sizes, 0 meaning any available bytes.
+  std::deque<size_t> requests_;
+
+  // The stream positions up to which bytes have arrived and have been read
+  // from the ring buffer. The read position is also read by the peer's
+  // senders.
+  uint64_t arrived_position_;
+  std::atomic<uint64_t> read_position_;
+  uint64_t bytes_delivered_;
+  unsigned int seed_;
+
+  // Bytes gathered for a Receive request that is larger than the bytes
+  // delivered so far, and bytes that wrap around the end of the ring.
+  std::vector<uint8_t> partial_;
+  std::vector<uint8_t> read_buffer_;
+
+  // Disallow copy and assign.
+  LoopbackWireInterface(const LoopbackWireInterface&);
+  void operator=(const LoopbackWireInterface&);
+};
+
+}  // namespace wire
+}  // namespace anymote
+
+#endif  // ANYMOTE_WIRE_LOOPBACKWIREINTERFACE_H_
@@ -15,26 +15,109 @@
 // AnyMote wire adapter implementation that uses protocol buffers for sending
 // and receiving messages. The protocol buffers are sent on the wire with
 // a varint32 preamble which indicates the size of the message. The varint32
-// is encoded using a variable number of bytes (up to 5). For this reason, the
-// preamble is read 1 byte at a time until the full varint has been read.
+// is encoded using a variable number of bytes (up to 5).
+//
+// Received bytes are split into messages by a FrameDecoder in both read
+// modes. In framed mode the adapter asks the interface for the bytes the
+// decoder is known to be missing: 1 byte at a time until the preamble is
+// complete, then the rest of the message. In streaming mode it asks for
+// whatever bytes are available, so one read from the interface may deliver
+// several messages, or only part of one.
+//
+// Key events, mouse events and mouse wheel events, which make up most of the
+// traffic, are encoded and decoded by a hand-written codec that produces the
+// same bytes and messages as the generic protocol buffer code.
+//
+// Outgoing messages are serialized back to back into a single buffer, so that
+// batched messages are sent to the interface in one contiguous write. Only the
+// thread that holds the sending_ flag writes to the buffer. Other senders
+// publish their frames to a lock-free queue instead, and the holder appends
+// them to the buffer before releasing the flag. Because a sender always
+// retries to take the flag after publishing a frame, and the holder checks
+// the queue again after releasing it, no frame is left behind. A holder only
+// writes its own frame straight to the buffer when the queue is empty;
+// otherwise a frame it queued earlier could still be waiting behind a slot
+// reserved by a slower sender, so it queues the new frame too.
+//
+// With priority lanes, bulk messages are serialized into a second buffer and
+// handed to the interface as bulk data, which the interface may write after
+// interactive data sent later.
+//
+// Frames encoded ahead of time, such as those of the FrameCache, take the
+// same path as serialized messages and are copied into the send buffer, so
+// they are batched and ordered with the other messages.
+//
+// A frame tap sees every message as a frame without its preamble: sent
+// messages as soon as they are serialized, received ones before they are
+// parsed.
 
 #include "anymote/wire/protobufwireadapter.h"
 
 #include <glog/logging.h>
 #include <google/protobuf/io/coded_stream.h>
-#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <thread>
+#include "anymote/wire/inputeventcodec.h"
 
-using ::google::protobuf::io::ArrayOutputStream;
 using ::google::protobuf::io::CodedOutputStream;
 
 namespace anymote {
 namespace wire {
 
+const size_t ProtobufWireAdapter::kDefaultSendQueueCapacity;
+
+// The size of the largest received message whose buffers are kept for
+// parsing the next messages.
+static const size_t kMaxRetainedMessageSize = 64 * 1024;
+
 ProtobufWireAdapter::ProtobufWireAdapter(WireInterface* interface)
     : WireAdapter(interface),
+      read_mode_(kFramedReads),
+      read_state_(kNone),
+      priority_lanes_(false),
+      bulk_chunk_bytes_(0),
+      batch_depth_(0),
+      auto_flush_bytes_(0),
+      auto_flush_delay_micros_(0),
+      clock_(NULL),
+      first_buffered_micros_(0),
+      sending_(false),
+      send_queue_(kDefaultSendQueueCapacity),
+      frame_tap_(NULL) {
+}
+
+ProtobufWireAdapter::ProtobufWireAdapter(WireInterface* interface,
+                                         ReadMode read_mode)
+    : WireAdapter(interface),
+      read_mode_(read_mode),
+      read_state_(kNone),
+      priority_lanes_(false),
+      bulk_chunk_bytes_(0),
+      batch_depth_(0),
+      auto_flush_bytes_(0),
+      auto_flush_delay_micros_(0),
+      clock_(NULL),
+      first_buffered_micros_(0),
+      sending_(false),
+      send_queue_(kDefaultSendQueueCapacity),
+      frame_tap_(NULL) {
+}
+
+ProtobufWireAdapter::ProtobufWireAdapter(WireInterface* interface,
+                                         ReadMode read_mode,
+                                         size_t send_queue_capacity)
+    : WireAdapter(interface),
+      read_mode_(read_mode),
       read_state_(kNone),
-      preamble_(0),
-      preamble_num_bytes_(0) {
+      priority_lanes_(false),
+      bulk_chunk_bytes_(0),
+      batch_depth_(0),
+      auto_flush_bytes_(0),
+      auto_flush_delay_micros_(0),
+      clock_(NULL),
+      first_buffered_micros_(0),
+      sending_(false),
+      send_queue_(send_queue_capacity),
+      frame_tap_(NULL) {
 }
 
 void ProtobufWireAdapter::GetNextMessage() {
@@ -42,87 +125,373 @@ void ProtobufWireAdapter::GetNextMessage() {
     return;
   }
 
-  VLOG(1) << "Reading first preamble byte";
-  read_state_ = kPreamble;
-  interface()->Receive(1);
+  if (read_mode_ == kStreamingReads) {
+    VLOG(1) << "Reading available bytes";
+    read_state_ = kStream;
+    interface()->ReceiveAvailable();
+    return;
+  }
+
+  VLOG(1) << "Reading bytes: " << decoder_.bytes_needed();
+  read_state_ = kFramed;
+  interface()->Receive(decoder_.bytes_needed());
 }
 
 void ProtobufWireAdapter::SendMessage(const messages::RemoteMessage& message) {
   VLOG(1) << "SendMessage";
+  SendFrame(&message, NULL, 0);
+}
+
+bool ProtobufWireAdapter::SendEncodedFrame(const uint8_t* frame,
+                                           size_t size) {
+  VLOG(1) << "SendEncodedFrame";
+  SendFrame(NULL, frame, size);
+  return true;
+}
+
+void ProtobufWireAdapter::SendFrame(const messages::RemoteMessage* message,
+                                    const uint8_t* frame, size_t size) {
   CHECK(initialized());
 
-  int message_size = message.ByteSize();
-  int size = CodedOutputStream::VarintSize32(message_size) + message_size;
+  metrics_.messages_sent.Increment();
+  bool bulk = message != NULL && IsBulk(*message);
+  if (TryLockSend()) {
+    // Frames queued earlier, possibly by this thread, go first.
+    bool was_empty = buffered_bytes() == 0;
+    bool appended = AppendQueuedFrames();
+
+    // A slot reserved by a sender that has not published its frame yet
+    // stops the drain, and frames this thread queued earlier may be behind
+    // it. The frame then queues behind them; the sender of the stalled slot
+    // drains the queue once it publishes its frame.
+    if (send_queue_.size() == 0) {
+      AppendFrame(message, frame, size, LaneBuffer(bulk));
+      if (bulk) {
+        SendFullBulkChunk();
+      }
+      ApplyFlushPolicy(was_empty);
+      UnlockSend();
+      return;
+    }
+    if (appended) {
+      ApplyFlushPolicy(was_empty);
+    }
+    UnlockSend();
+  }
+
+  // Another thread is sending or the queue is held up, so hand the frame to
+  // whichever thread drains the queue next.
+  uint64_t ticket = 0;
+  QueuedFrame* queued;
+  while ((queued = send_queue_.BeginPush(&ticket)) == NULL) {
+    // The queue is full. Help drain it rather than wait for the sender.
+    if (TryLockSend()) {
+      DrainQueue();
+      UnlockSend();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  queued->bytes.clear();
+  AppendFrame(message, frame, size, &queued->bytes);
+  queued->bulk = bulk;
+  send_queue_.CommitPush(ticket);
+  metrics_.send_queue_depth.Set(send_queue_.size());
+
+  // The sender may have finished before the frame was published.
+  if (TryLockSend()) {
+    DrainQueue();
+    UnlockSend();
+  }
+}
+
+bool ProtobufWireAdapter::TryLockSend() {
+  bool expected = false;
+  return sending_.compare_exchange_strong(expected, true);
+}
 
-  std::vector<uint8_t> buffer(size);
+void ProtobufWireAdapter::LockSend() {
+  while (!TryLockSend()) {
+    std::this_thread::yield();
+  }
+}
 
-  ArrayOutputStream aos(&buffer[0], buffer.size());
-  CodedOutputStream out(&aos);
+void ProtobufWireAdapter::UnlockSend() {
+  for (;;) {
+    sending_.store(false);
 
-  out.WriteVarint32(message_size);
-  message.SerializeToCodedStream(&out);
-  interface()->Send(buffer);
+    // A frame published after the last drain but before the flag was cleared
+    // would otherwise wait for the next send.
+    if (send_queue_.empty() || !TryLockSend()) {
+      return;
+    }
+    DrainQueue();
+  }
 }
 
-void ProtobufWireAdapter::OnBytesReceived(
-    const std::vector<uint8_t>& data) {
-  VLOG(1) << "OnBytesReceived: " << data.size();
-
-  if (read_state_ == kMessage) {
-    // We were waiting for a message, so parse the message and reset the read
-    // state.
-    read_state_ = kNone;
-    ParseMessage(data);
-    GetNextMessage();
-  } else if (read_state_ == kPreamble && data.size() == 1) {
-    HandlePreambleByte(data[0]);
-  } else {
-    LOG(ERROR) << "Unexpected state: " << read_state_
-        << " bytes: " << data.size();
-    OnError();
+void ProtobufWireAdapter::DrainQueue() {
+  bool was_empty = buffered_bytes() == 0;
+  if (AppendQueuedFrames()) {
+    ApplyFlushPolicy(was_empty);
   }
 }
 
-void ProtobufWireAdapter::HandlePreambleByte(uint8_t byte) {
-  VLOG(1) << "HandlePreambleByte: " << byte;
+bool ProtobufWireAdapter::AppendQueuedFrames() {
+  bool appended = false;
+  while (QueuedFrame* frame = send_queue_.Front()) {
+    std::vector<uint8_t>* buffer = LaneBuffer(frame->bulk);
+    buffer->insert(buffer->end(), frame->bytes.begin(), frame->bytes.end());
+    if (frame->bulk) {
+      SendFullBulkChunk();
+    }
+    send_queue_.Pop();
+    appended = true;
+  }
+  return appended;
+}
 
-  // This logic is based on the protobuf code for parsing varint32s.
-  preamble_ |= (byte & 0x7F) << (preamble_num_bytes_ * 7);
+bool ProtobufWireAdapter::IsBulk(
+    const messages::RemoteMessage& message) const {
+  if (!priority_lanes_) {
+    return false;
+  }
+  if (message.has_request_message()) {
+    const messages::RequestMessage& request = message.request_message();
+    return request.has_data_message() || request.has_fling_message();
+  }
+  return message.has_response_message() &&
+      message.response_message().has_data_message();
+}
 
-  preamble_num_bytes_++;
-  if (!(byte & 0x80)) {
-    // Done reading the preamble.
-    uint32_t message_size = preamble_;
+std::vector<uint8_t>* ProtobufWireAdapter::LaneBuffer(bool bulk) {
+  return bulk ? &bulk_buffer_ : &send_buffer_;
+}
 
-    VLOG(1) << "Done reading preamble: " << message_size;
+void ProtobufWireAdapter::SendFullBulkChunk() {
+  if (bulk_buffer_.size() >= bulk_chunk_bytes_) {
+    SendBulkBuffered();
+  }
+}
 
-    // Reset the preamble variables for the next read.
-    preamble_ = 0;
-    preamble_num_bytes_ = 0;
+void ProtobufWireAdapter::AppendFrame(const messages::RemoteMessage* message,
+                                      const uint8_t* frame, size_t size,
+                                      std::vector<uint8_t>* buffer) {
+  if (message != NULL) {
+    AppendMessage(*message, buffer);
+    return;
+  }
 
-    // Receive the message.
-    read_state_ = kMessage;
-    interface()->Receive(message_size);
-  } else {
-    if (preamble_num_bytes_ >= 5) {
-      LOG(ERROR) << "Invalid preamble, varint32 more than 5 bytes";
+  buffer->insert(buffer->end(), frame, frame + size);
+  if (frame_tap_) {
+    size_t preamble_size = 1;
+    while (preamble_size < size && (frame[preamble_size - 1] & 0x80)) {
+      preamble_size++;
+    }
+    frame_tap_->OnFrame(FrameTap::kSent, frame + preamble_size,
+                        size - preamble_size);
+  }
+}
 
-      // TODO(dhawkey): Supply error codes?
-      OnError();
-    } else {
-      VLOG(1) << "Getting next preamble byte";
-      // Get the next byte of the preamble.
-      interface()->Receive(1);
+void ProtobufWireAdapter::AppendMessage(
+    const messages::RemoteMessage& message, std::vector<uint8_t>* buffer) {
+  uint8_t input_event[kMaxInputEventFrameSize];
+  size_t input_event_size = EncodeInputEventFrame(message, input_event);
+  if (input_event_size > 0) {
+    buffer->insert(buffer->end(), input_event,
+                   input_event + input_event_size);
+    if (frame_tap_) {
+      // Input event frames are short enough for a one byte preamble.
+      frame_tap_->OnFrame(FrameTap::kSent, input_event + 1,
+                          input_event_size - 1);
+    }
+    return;
+  }
+
+  // ByteSizeLong caches the size of every sub-message, so the message is only
+  // walked once more to serialize it.
+  size_t message_size = message.ByteSizeLong();
+  CHECK_LE(message_size, static_cast<size_t>(google::protobuf::kint32max))
+      << "Message too large to send";
+  size_t size = CodedOutputStream::VarintSize32(message_size) + message_size;
+  size_t offset = buffer->size();
+
+  // Resizing keeps the existing capacity, so no allocation is needed once the
+  // buffer has grown to fit the largest batch sent.
+  buffer->resize(offset + size);
+
+  uint8_t* target = CodedOutputStream::WriteVarint32ToArray(
+      message_size, &(*buffer)[offset]);
+  message.SerializeWithCachedSizesToArray(target);
+  if (frame_tap_) {
+    frame_tap_->OnFrame(FrameTap::kSent, target, message_size);
+  }
+}
+
+void ProtobufWireAdapter::ApplyFlushPolicy(bool was_empty) {
+  if (clock_ == NULL) {
+    if (batch_depth_ == 0) {
+      SendBuffered();
     }
+    return;
+  }
+
+  int64_t now = clock_->NowMicros();
+  if (was_empty) {
+    first_buffered_micros_ = now;
+  }
+  if (buffered_bytes() >= auto_flush_bytes_ ||
+      (batch_depth_ == 0 &&
+       now - first_buffered_micros_ >= auto_flush_delay_micros_)) {
+    SendBuffered();
+  }
+}
+
+void ProtobufWireAdapter::BeginBatch() {
+  LockSend();
+  batch_depth_++;
+  UnlockSend();
+}
+
+void ProtobufWireAdapter::Flush() {
+  LockSend();
+  DrainQueue();
+  if (batch_depth_ > 0) {
+    batch_depth_--;
+  }
+  if (batch_depth_ == 0) {
+    SendBuffered();
+  }
+  UnlockSend();
+}
+
+void ProtobufWireAdapter::SetAutoFlush(size_t max_bytes,
+                                       int64_t max_delay_micros,
+                                       util::Clock* clock) {
+  CHECK_NOTNULL(clock);
+  LockSend();
+  auto_flush_bytes_ = max_bytes;
+  auto_flush_delay_micros_ = max_delay_micros;
+  clock_ = clock;
+  UnlockSend();
+}
+
+void ProtobufWireAdapter::FlushIfDue() {
+  LockSend();
+  DrainQueue();
+  if (batch_depth_ == 0 && clock_ != NULL && buffered_bytes() > 0 &&
+      clock_->NowMicros() >=
+          first_buffered_micros_ + auto_flush_delay_micros_) {
+    SendBuffered();
+  }
+  UnlockSend();
+}
+
+int64_t ProtobufWireAdapter::flush_deadline_micros() {
+  LockSend();
+  int64_t deadline = -1;
+  if (clock_ != NULL && buffered_bytes() > 0) {
+    deadline = first_buffered_micros_ + auto_flush_delay_micros_;
+  }
+  UnlockSend();
+  return deadline;
+}
+
+void ProtobufWireAdapter::EnablePriorityLanes(size_t chunk_bytes) {
+  LockSend();
+  priority_lanes_ = true;
+  bulk_chunk_bytes_ = chunk_bytes;
+  UnlockSend();
+}
+
+void ProtobufWireAdapter::SendBuffered() {
+  // Interactive messages go first, so they are not queued behind bulk
+  // messages buffered at the same time.
+  if (!send_buffer_.empty()) {
+    VLOG(1) << "Sending buffered bytes: " << send_buffer_.size();
+    metrics_.writes.Increment();
+    metrics_.bytes_sent.Add(send_buffer_.size());
+    interface()->SendOwned(&send_buffer_);
+    send_buffer_.clear();
   }
+  SendBulkBuffered();
 }
 
-void ProtobufWireAdapter::ParseMessage(const std::vector<uint8_t>& data) {
-  messages::RemoteMessage message;
-  message.ParseFromArray(&data[0], data.size());
+void ProtobufWireAdapter::SendBulkBuffered() {
+  if (bulk_buffer_.empty()) {
+    return;
+  }
+
+  VLOG(1) << "Sending buffered bulk bytes: " << bulk_buffer_.size();
+  metrics_.writes.Increment();
+  metrics_.bytes_sent.Add(bulk_buffer_.size());
+  interface()->SendBulk(&bulk_buffer_);
+  bulk_buffer_.clear();
+}
+
+void ProtobufWireAdapter::OnBytesReceived(
+    const std::vector<uint8_t>& data) {
+  OnBufferReceived(data.empty() ? NULL : &data[0], data.size());
+}
+
+void ProtobufWireAdapter::OnBufferReceived(const uint8_t* data, size_t size) {
+  VLOG(1) << "OnBufferReceived: " << size;
+  metrics_.bytes_received.Add(size);
+
+  if (read_state_ == kNone) {
+    LOG(ERROR) << "Unexpected bytes: " << size;
+    OnError();
+    return;
+  }
+
+  // The read state is only reset once the whole chunk is decoded, so a
+  // listener that asks for the next message while handling one does not
+  // start a read in the middle of the chunk.
+  FrameDecoder::Result result = decoder_.Decode(data, size, this);
+  read_state_ = kNone;
+  if (result == FrameDecoder::kInvalidPreamble) {
+    LOG(ERROR) << "Invalid preamble, varint32 more than 5 bytes";
+    metrics_.preamble_errors.Increment();
+    OnProtocolError(messages::MessageListener::kInvalidPreamble);
+    return;
+  }
+  if (result == FrameDecoder::kFrameTooLarge) {
+    LOG(ERROR) << "Message too large: " << decoder_.frame_size()
+        << " bytes, maximum " << decoder_.max_frame_size();
+    metrics_.oversized_frames.Increment();
+    OnProtocolError(messages::MessageListener::kFrameTooLarge);
+    return;
+  }
+
+  GetNextMessage();
+}
 
+void ProtobufWireAdapter::OnProtocolError(
+    messages::MessageListener::ProtocolError error) {
+  decoder_.Reset();
   if (listener()) {
-    listener()->OnMessage(message);
+    listener()->OnProtocolError(error);
+  }
+}
+
+void ProtobufWireAdapter::OnFrame(const uint8_t* data, size_t size) {
+  metrics_.messages_received.Increment();
+  if (frame_tap_) {
+    frame_tap_->OnFrame(FrameTap::kReceived, data, size);
+  }
+  if (!DecodeInputEvent(data, size, &message_)) {
+    message_.Clear();
+    if (!message_.ParseFromArray(data, size)) {
+      metrics_.parse_errors.Increment();
+    }
+  }
+
+  if (listener()) {
+    listener()->OnMessage(message_);
+  }
+
+  if (size > kMaxRetainedMessageSize) {
+    // Do not keep the buffers of an unusually large message around.
+    messages::RemoteMessage().Swap(&message_);
   }
 }
 
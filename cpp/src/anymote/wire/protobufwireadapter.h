@@ -16,33 +16,167 @@
 #define ANYMOTE_WIRE_PROTOBUFWIREADAPTER_H_
 
 #include <glog/logging.h>
+#include <atomic>
 #include <vector>
+#include "anymote/util/clock.h"
+#include "anymote/util/mpscqueue.h"
+#include "anymote/wire/framedecoder.h"
+#include "anymote/wire/frametap.h"
 #include "anymote/wire/wireadapter.h"
+#include "anymote/wire/wiremetrics.h"
 
 namespace anymote {
 namespace wire {
 
 // Anymote wire adapter that uses protocol buffers to send/receive messages.
-// This class is not thread-safe, so SendMessage and GetNextMessage should only
-// be invoked from a single thread.
-class ProtobufWireAdapter : public WireAdapter {
+//
+// SendMessage is thread-safe and lock-free. A sender that finds no other
+// thread sending serializes its message straight into the send buffer;
+// otherwise it serializes the message into a slot of an outbound queue and
+// the thread that is sending drains the queue before it finishes, so frames
+// from concurrent senders are written in batches. Messages sent from a single
+// thread are always sent in order.
+//
+// BeginBatch, Flush, SetAutoFlush and FlushIfDue are thread-safe too: they
+// take the same send lock as the senders. There is a single batch per
+// adapter, not one per thread, so batches opened by different threads nest
+// into each other and messages are held until the last of them is flushed.
+//
+// GetNextMessage and the receive callbacks must be invoked from a single
+// thread, usually the transport's dispatch thread.
+class ProtobufWireAdapter : public WireAdapter,
+                            private FrameDecoder::Handler {
  public:
-  // Creates a new Protobuf adapter on the given interface.
+  // How the adapter requests incoming data from the wire interface.
+  enum ReadMode {
+    // Reads the preamble one byte at a time, then reads exactly the rest of
+    // the message. This works with any wire interface.
+    kFramedReads,
+
+    // Reads whatever bytes are available and reassembles messages in an
+    // internal buffer, so a single receive may deliver any number of
+    // messages. This is most efficient with interfaces that override
+    // WireInterface::ReceiveAvailable.
+    kStreamingReads,
+  };
+
+  // Creates a new Protobuf adapter on the given interface that uses framed
+  // reads.
   // @param interface The interface used to send/receive data. No ownership is
   //                  taken and the pointer must be valid for the duration of
   //                  the existence of this instance.
   explicit ProtobufWireAdapter(WireInterface* interface);
+
+  // Creates a new Protobuf adapter on the given interface.
+  // @param interface The interface used to send/receive data. No ownership is
+  //                  taken and the pointer must be valid for the duration of
+  //                  the existence of this instance.
+  // @param read_mode How incoming data is requested from the interface.
+  ProtobufWireAdapter(WireInterface* interface, ReadMode read_mode);
+
+  // Creates a new Protobuf adapter on the given interface with a send queue
+  // of the given size. The queue is allocated up front, so adapters that are
+  // mostly idle, such as one of many server connections, should keep it
+  // small. Any size is correct: a sender that finds the queue full helps
+  // drain it.
+  // @param interface The interface used to send/receive data. No ownership is
+  //                  taken and the pointer must be valid for the duration of
+  //                  the existence of this instance.
+  // @param read_mode How incoming data is requested from the interface.
+  // @param send_queue_capacity The number of frames that concurrent senders
+  //                            can queue. Must be a power of two.
+  ProtobufWireAdapter(WireInterface* interface, ReadMode read_mode,
+                      size_t send_queue_capacity);
   virtual ~ProtobufWireAdapter() {}
 
+  // The number of frames that concurrent senders can queue by default.
+  static const size_t kDefaultSendQueueCapacity = 256;
+
   // @override
   virtual void GetNextMessage();
 
   // @override
   virtual void SendMessage(const messages::RemoteMessage& message);
 
+  // Sends the frame in the priority lane, so it must not hold a bulk
+  // message.
+  // @override
+  virtual bool SendEncodedFrame(const uint8_t* frame, size_t size);
+
+  // @override
+  virtual void BeginBatch();
+
+  // @override
+  virtual void Flush();
+
+  // Enables automatic coalescing of messages, similar to Nagle's algorithm.
+  // Messages are buffered and sent together once max_bytes are buffered or
+  // max_delay_micros have passed since the oldest buffered message was sent.
+  // The delay is only checked when a message is sent or FlushIfDue is
+  // invoked, so the owner should invoke FlushIfDue from a timer to bound the
+  // delay of the last message in a burst.
+  //
+  // @param max_bytes The number of buffered bytes that triggers a send.
+  // @param max_delay_micros The maximum time a message stays buffered.
+  // @param clock The clock used to measure the delay. No ownership is taken
+  //              and the pointer must be valid for the duration of the
+  //              existence of this instance.
+  void SetAutoFlush(size_t max_bytes, int64_t max_delay_micros,
+                    util::Clock* clock);
+
+  // Sends buffered messages if the auto-flush delay has passed. Messages in
+  // an open batch are not sent.
+  void FlushIfDue();
+
+  // Returns the time, in microseconds of the auto-flush clock, by which
+  // buffered messages should be sent, or -1 if auto-flush is disabled or
+  // there is nothing buffered.
+  int64_t flush_deadline_micros();
+
+  // Sends bulk messages in a separate lane, so that a large data transfer
+  // does not delay input. Data messages and flings are buffered apart from
+  // other messages and handed to the interface with WireInterface::SendBulk,
+  // in chunks of whole messages that are sent as soon as they reach
+  // chunk_bytes, even within a batch. Key events, mouse events, pings and
+  // other messages may then be written ahead of bulk messages that are still
+  // queued. Messages in each lane stay in order.
+  //
+  // A message is never split, so a single large message still occupies the
+  // link for as long as it takes to write. This must be invoked before the
+  // adapter is shared between threads.
+  //
+  // @param chunk_bytes The number of buffered bulk bytes that are sent
+  //                    together.
+  void EnablePriorityLanes(size_t chunk_bytes);
+
+  // Sets the maximum size of a received message. A larger message is
+  // reported to the listener as a kFrameTooLarge protocol error as soon as
+  // its preamble is read, without requesting or buffering the message. The
+  // default is FrameDecoder::kDefaultMaxFrameSize. This must be invoked from
+  // the thread that receives messages.
+  // @param max_frame_size The maximum message size, in bytes.
+  void set_max_frame_size(uint32_t max_frame_size) {
+    decoder_.set_max_frame_size(max_frame_size);
+  }
+
+  // Sets a tap that is shown every frame sent or received, for example a
+  // CaptureWriter. Sent frames are shown when their message is serialized,
+  // which may be before they are handed to the interface. This must be
+  // invoked before the adapter is shared between threads.
+  // @param tap The tap, or NULL to remove it. No ownership is taken and the
+  //            pointer must be valid until it is removed or this instance is
+  //            destroyed.
+  void set_frame_tap(FrameTap* tap) { frame_tap_ = tap; }
+
+  // Returns the metrics of this adapter.
+  const WireMetrics& metrics() const { return metrics_; }
+
   // @override
   virtual void OnBytesReceived(const std::vector<uint8_t>& data);
 
+  // @override
+  virtual void OnBufferReceived(const uint8_t* data, size_t size);
+
   // @override
   virtual void OnError();
 
@@ -52,25 +186,149 @@ class ProtobufWireAdapter : public WireAdapter {
     // There is no read operation in progress.
     kNone,
 
-    // Waiting to read the message preamble which is a varint32 representing
-    // the size of the next message.
-    kPreamble,
+    // Waiting for the bytes requested from the interface in framed mode.
+    kFramed,
 
-    // Waiting to read the message.
-    kMessage,
+    // Waiting for any available bytes in streaming mode.
+    kStream,
   };
 
-  // Handles a byte received as part of the message preamble.
-  // @param byte The preamble byte.
-  void HandlePreambleByte(uint8_t byte);
+  // Parses a frame received from the interface as an Anymote message.
+  // @override
+  virtual void OnFrame(const uint8_t* data, size_t size);
 
-  // Parses an Anymote message from the given data.
-  // @param data The data containing an Anymote message.
-  void ParseMessage(const std::vector<uint8_t>& data);
+  // Reports a protocol error to the listener.
+  // @param error The protocol error.
+  void OnProtocolError(messages::MessageListener::ProtocolError error);
 
+  const ReadMode read_mode_;
   ReadState read_state_;
-  uint32_t preamble_;
-  uint8_t preamble_num_bytes_;
+
+  // Splits the received bytes into messages, keeping any partial message for
+  // the next read.
+  FrameDecoder decoder_;
+
+  // The message every received frame is parsed into. Clearing it keeps its
+  // sub-messages and string buffers, so parsing a message similar to the
+  // previous one does not allocate.
+  messages::RemoteMessage message_;
+
+  // Tries to become the thread that writes to the send buffer.
+  // @return true if the calling thread now owns the send buffer.
+  bool TryLockSend();
+
+  // Waits until the calling thread owns the send buffer.
+  void LockSend();
+
+  // Releases the send buffer, first draining any frames that were queued by
+  // other threads in the meantime.
+  void UnlockSend();
+
+  // Appends all queued frames to the send buffer and applies the flush policy.
+  // The send buffer must be locked.
+  void DrainQueue();
+
+  // Appends all queued frames to the send buffers. The send buffer must be
+  // locked.
+  // @return true if any frame was appended.
+  bool AppendQueuedFrames();
+
+  // Returns whether a message goes in the bulk lane.
+  // @param message The message.
+  bool IsBulk(const messages::RemoteMessage& message) const;
+
+  // Returns the buffer of a lane. The send buffer must be locked.
+  // @param bulk Whether to return the bulk buffer.
+  std::vector<uint8_t>* LaneBuffer(bool bulk);
+
+  // Sends the bulk buffer if it has reached the chunk size, even within a
+  // batch. The send buffer must be locked.
+  void SendFullBulkChunk();
+
+  // Returns the number of buffered bytes in both lanes.
+  size_t buffered_bytes() const {
+    return send_buffer_.size() + bulk_buffer_.size();
+  }
+
+  // Sends a message, or a frame that is already encoded.
+  // @param message The message to serialize, or NULL to send the frame.
+  // @param frame The encoded frame, if message is NULL.
+  // @param size The size of the encoded frame.
+  void SendFrame(const messages::RemoteMessage* message,
+                 const uint8_t* frame, size_t size);
+
+  // Appends a message, or a frame that is already encoded, at the end of the
+  // given buffer and shows it to the frame tap, if any.
+  // @param message The message to serialize, or NULL to append the frame.
+  // @param frame The encoded frame, if message is NULL.
+  // @param size The size of the encoded frame.
+  // @param buffer The buffer to append the frame to.
+  void AppendFrame(const messages::RemoteMessage* message,
+                   const uint8_t* frame, size_t size,
+                   std::vector<uint8_t>* buffer);
+
+  // Serializes a message as a frame at the end of the given buffer and shows
+  // it to the frame tap, if any.
+  // @param message The message to serialize.
+  // @param buffer The buffer to append the frame to.
+  void AppendMessage(const messages::RemoteMessage& message,
+                     std::vector<uint8_t>* buffer);
+
+  // Sends the buffered messages if no batch is open and the auto-flush
+  // policy, if any, allows it. The send buffer must be locked.
+  // @param was_empty Whether the send buffer was empty before the latest
+  //                  messages were appended.
+  void ApplyFlushPolicy(bool was_empty);
+
+  // Sends all buffered messages to the interface. The send buffer must be
+  // locked.
+  void SendBuffered();
+
+  // Sends the buffered bulk messages to the interface. The send buffer must
+  // be locked.
+  void SendBulkBuffered();
+
+  // Buffer used to serialize outgoing messages. Buffered messages are
+  // appended to it until they are sent. Ownership of its contents is handed
+  // to the interface with SendOwned, which swaps back a buffer whose capacity
+  // can be reused.
+  std::vector<uint8_t> send_buffer_;
+
+  // Buffer used for bulk messages when priority lanes are enabled, which
+  // are sent once chunk_bytes_ are buffered.
+  bool priority_lanes_;
+  size_t bulk_chunk_bytes_;
+  std::vector<uint8_t> bulk_buffer_;
+
+  // The number of batches currently open.
+  int batch_depth_;
+
+  // Auto-flush settings. The clock is NULL if auto-flush is disabled.
+  size_t auto_flush_bytes_;
+  int64_t auto_flush_delay_micros_;
+  util::Clock* clock_;
+
+  // The time at which the oldest buffered message was sent.
+  int64_t first_buffered_micros_;
+
+  // Whether a thread owns send_buffer_ and the state above.
+  std::atomic<bool> sending_;
+
+  // A frame serialized by a thread that found another thread sending.
+  struct QueuedFrame {
+    std::vector<uint8_t> bytes;
+    bool bulk;
+  };
+
+  // Frames serialized by threads that found another thread sending. Every
+  // slot keeps its capacity, so queuing a frame does not allocate once the
+  // slot has held a frame of the same size.
+  util::MpscQueue<QueuedFrame> send_queue_;
+
+  // Observer of sent and received frames, or NULL.
+  FrameTap* frame_tap_;
+
+  WireMetrics metrics_;
 };
 
 }  // namespace anymote
@@ -0,0 +1,561 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Wire interface implementation that sends and receives data over
+// a non-blocking socket. Outgoing data is queued by any thread and written by
+// the dispatch thread with a single sendmsg call covering as many queued
+// buffers as possible. Incoming data is read into a buffer owned by the
+// event loop and handed to the listener without copying when a pending receive
+// request can be satisfied; only data that cannot be delivered yet is kept by
+// the interface. The socket is only watched for readability while
+// a receive request is pending, which pushes back on the peer when the
+// listener stops reading.
+
+#include "anymote/wire/socketwireinterface.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace anymote {
+namespace wire {
+
+// The number of bytes requested from the socket per read.
+static const size_t kReadChunkSize = 16 * 1024;
+
+// The maximum number of buffers written with a single call.
+static const int kMaxIovecs = 64;
+
+// The maximum number and size of written buffers kept for reuse. Together
+// with kMaxIdleBufferSize, these bound the memory held by an idle interface.
+static const size_t kMaxSpareBuffers = 4;
+static const size_t kMaxSpareBufferSize = 64 * 1024;
+
+// Read buffers larger than this are released once they have been delivered.
+static const size_t kMaxIdleBufferSize = 4 * 1024;
+
+SocketWireInterface::SocketWireInterface(util::EventLoop* loop, int fd,
+                                         TransportSecurity* security)
+    : loop_(loop),
+      fd_(fd),
+      security_(security),
+      flush_closure_(this, &SocketWireInterface::Flush),
+      send_offset_(0),
+      num_encrypted_(0),
+      queued_bytes_(0),
+      flush_posted_(false),
+      read_start_(0),
+      events_(0),
+      started_(false),
+      failed_(false),
+      error_pending_(false),
+      delivering_(false) {
+  CHECK_NOTNULL(loop);
+  CHECK_GE(fd, 0) << "Invalid socket";
+}
+
+SocketWireInterface::~SocketWireInterface() {
+  if (started_ && !failed_) {
+    loop_->RemoveFd(fd_, this);
+  }
+  loop_->Cancel(&flush_closure_);
+  close(fd_);
+}
+
+int SocketWireInterface::ConnectTcp(const std::string& host,
+                                    const std::string& port) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo* addresses;
+  int result = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+  if (result != 0) {
+    LOG(ERROR) << "Failed to resolve " << host << ": " << gai_strerror(result);
+    return -1;
+  }
+
+  int fd = -1;
+  for (struct addrinfo* address = addresses; address != NULL;
+       address = address->ai_next) {
+    fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC,
+                address->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addresses);
+
+  if (fd < 0) {
+    PLOG(ERROR) << "Failed to connect to " << host << ":" << port;
+  }
+  return fd;
+}
+
+bool SocketWireInterface::Start() {
+  CHECK(!started_) << "Interface already started";
+
+  int flags = fcntl(fd_, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd_, F_SETFL, flags | O_NONBLOCK) < 0) {
+    PLOG(ERROR) << "Failed to make socket non-blocking";
+    return false;
+  }
+
+  // Input events are tiny and latency sensitive, so never delay them. This
+  // fails harmlessly for sockets that are not TCP.
+  int no_delay = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+  if (!loop_->AddFd(fd_, 0, this)) {
+    return false;
+  }
+  started_ = true;
+
+  if (security_) {
+    security_output_.clear();
+    if (!security_->Start(&security_output_)) {
+      LOG(ERROR) << "Failed to start security handshake";
+      Fail();
+      return false;
+    }
+    if (!security_output_.empty()) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queued_bytes_ += security_output_.size();
+      send_queue_.push_front(std::vector<uint8_t>());
+      send_queue_.front().swap(security_output_);
+      num_encrypted_++;
+    }
+  }
+
+  Flush();
+  return true;
+}
+
+void SocketWireInterface::Send(const std::vector<uint8_t>& data) {
+  if (data.empty() || failed_) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    send_queue_.push_back(std::vector<uint8_t>());
+    std::vector<uint8_t>& buffer = send_queue_.back();
+    if (!spare_buffers_.empty()) {
+      buffer.swap(spare_buffers_.back());
+      spare_buffers_.pop_back();
+    }
+    buffer.assign(data.begin(), data.end());
+    queued_bytes_ += data.size();
+  }
+  ScheduleWrite();
+}
+
+void SocketWireInterface::SendOwned(std::vector<uint8_t>* data) {
+  QueueOwned(data, &send_queue_);
+}
+
+void SocketWireInterface::SendBulk(std::vector<uint8_t>* data) {
+  QueueOwned(data, &bulk_queue_);
+}
+
+void SocketWireInterface::QueueOwned(
+    std::vector<uint8_t>* data, std::deque<std::vector<uint8_t> >* queue) {
+  CHECK_NOTNULL(data);
+  if (data->empty() || failed_) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued_bytes_ += data->size();
+    queue->push_back(std::vector<uint8_t>());
+    queue->back().swap(*data);
+    if (!spare_buffers_.empty()) {
+      data->swap(spare_buffers_.back());
+      spare_buffers_.pop_back();
+    }
+  }
+  ScheduleWrite();
+}
+
+void SocketWireInterface::Receive(size_t num_bytes) {
+  CHECK_GT(num_bytes, 0) << "Use ReceiveAvailable to receive any bytes";
+  QueueReceive(num_bytes);
+}
+
+void SocketWireInterface::ReceiveAvailable() {
+  QueueReceive(0);
+}
+
+void SocketWireInterface::OnEvents(uint32_t events) {
+  if (failed_) {
+    return;
+  }
+
+  if ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && !ReadSocket()) {
+    Fail();
+    return;
+  }
+  Flush();
+}
+
+void SocketWireInterface::RecycleLocked(std::vector<uint8_t>* buffer) {
+  if (spare_buffers_.size() < kMaxSpareBuffers &&
+      buffer->capacity() <= kMaxSpareBufferSize) {
+    buffer->clear();
+    spare_buffers_.push_back(std::vector<uint8_t>());
+    spare_buffers_.back().swap(*buffer);
+  }
+}
+
+bool SocketWireInterface::EncryptQueuedLocked() {
+  while (num_encrypted_ < send_queue_.size()) {
+    std::vector<uint8_t>& data = send_queue_[num_encrypted_];
+    security_output_.clear();
+    if (!security_->Encrypt(&data[0], data.size(), &security_output_)) {
+      LOG(ERROR) << "Failed to encrypt data";
+      return false;
+    }
+
+    if (security_output_.empty()) {
+      // The engine is holding on to the data until the handshake completes.
+      queued_bytes_ -= data.size();
+      RecycleLocked(&data);
+      send_queue_.erase(send_queue_.begin() + num_encrypted_);
+    } else {
+      // The plaintext buffer becomes the scratch buffer for the next call.
+      queued_bytes_ += security_output_.size();
+      queued_bytes_ -= data.size();
+      data.swap(security_output_);
+      num_encrypted_++;
+    }
+  }
+  return true;
+}
+
+void SocketWireInterface::QueueReceive(size_t num_bytes) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    receive_requests_.push_back(num_bytes);
+  }
+  ScheduleFlush();
+}
+
+void SocketWireInterface::ScheduleFlush() {
+  if (loop_->IsInLoopThread()) {
+    Flush();
+  } else if (!flush_posted_.exchange(true)) {
+    loop_->Post(&flush_closure_);
+  }
+}
+
+void SocketWireInterface::ScheduleWrite() {
+  if (!loop_->IsInLoopThread()) {
+    ScheduleFlush();
+    return;
+  }
+
+  if (!started_ || failed_) {
+    return;
+  }
+  if (!WriteSocket()) {
+    // The sender may be holding internal state, so report the error from a
+    // posted flush rather than from within Send.
+    MarkFailed();
+    error_pending_ = true;
+    if (!flush_posted_.exchange(true)) {
+      loop_->Post(&flush_closure_);
+    }
+    return;
+  }
+  UpdateEvents();
+}
+
+void SocketWireInterface::Flush() {
+  flush_posted_ = false;
+  if (error_pending_) {
+    error_pending_ = false;
+    NotifyError();
+    return;
+  }
+  if (!started_ || failed_) {
+    return;
+  }
+
+  if (!WriteSocket()) {
+    Fail();
+    return;
+  }
+
+  DeliverReads();
+  if (!failed_) {
+    UpdateEvents();
+  }
+}
+
+bool SocketWireInterface::ReadSocket() {
+  // Read at least enough to satisfy the next receive request.
+  size_t buffered = read_buffer_.size() - read_start_;
+  size_t read_size = kReadChunkSize;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!receive_requests_.empty() &&
+        receive_requests_.front() > buffered + read_size) {
+      read_size = receive_requests_.front() - buffered;
+    }
+  }
+
+  std::vector<uint8_t>* scratch = loop_->scratch_buffer();
+  if (scratch->size() < read_size) {
+    scratch->resize(read_size);
+  }
+
+  ssize_t num_read;
+  do {
+    num_read = read(fd_, &(*scratch)[0], read_size);
+  } while (num_read < 0 && errno == EINTR);
+
+  if (num_read == 0) {
+    LOG(ERROR) << "Connection closed by peer";
+    return false;
+  }
+  if (num_read < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return true;
+    }
+    PLOG(ERROR) << "Failed to read from socket";
+    return false;
+  }
+
+  const uint8_t* data = &(*scratch)[0];
+  if (buffered == 0 && !security_) {
+    // Deliver straight from the scratch buffer and only keep what is left.
+    size_t delivered = DeliverFrom(data, num_read);
+    read_buffer_.assign(data + delivered, data + num_read);
+    read_start_ = 0;
+    return true;
+  }
+
+  // Move any undelivered data to the front of the buffer before appending.
+  if (read_start_ > 0) {
+    read_buffer_.erase(read_buffer_.begin(),
+                       read_buffer_.begin() + read_start_);
+    read_start_ = 0;
+  }
+
+  if (!security_) {
+    read_buffer_.insert(read_buffer_.end(), data, data + num_read);
+    return true;
+  }
+
+  security_output_.clear();
+  if (!security_->Decrypt(data, num_read, &read_buffer_, &security_output_)) {
+    LOG(ERROR) << "Failed to decrypt data";
+    return false;
+  }
+
+  // Handshake data goes out ahead of application data that has not been
+  // encrypted yet.
+  if (!security_output_.empty()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued_bytes_ += security_output_.size();
+    send_queue_.insert(send_queue_.begin() + num_encrypted_,
+                       std::vector<uint8_t>());
+    send_queue_[num_encrypted_].swap(security_output_);
+    num_encrypted_++;
+  }
+  return true;
+}
+
+bool SocketWireInterface::WriteSocket() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (security_ && !EncryptQueuedLocked()) {
+    return false;
+  }
+
+  for (;;) {
+    if (send_queue_.empty()) {
+      // Move the next bulk buffer only now, so that data sent in the
+      // meantime is written ahead of it.
+      if (bulk_queue_.empty()) {
+        return true;
+      }
+      send_queue_.push_back(std::vector<uint8_t>());
+      send_queue_.back().swap(bulk_queue_.front());
+      bulk_queue_.pop_front();
+      if (security_ && !EncryptQueuedLocked()) {
+        return false;
+      }
+      continue;
+    }
+
+    struct iovec iov[kMaxIovecs];
+    int count = 0;
+    for (std::deque<std::vector<uint8_t> >::iterator it = send_queue_.begin();
+         it != send_queue_.end() && count < kMaxIovecs; ++it, ++count) {
+      size_t offset = count == 0 ? send_offset_ : 0;
+      iov[count].iov_base = &(*it)[offset];
+      iov[count].iov_len = it->size() - offset;
+    }
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    message.msg_iovlen = count;
+
+    // Use sendmsg rather than writev so that a closed connection reports
+    // EPIPE instead of raising SIGPIPE.
+    ssize_t written = sendmsg(fd_, &message, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return true;
+      }
+      PLOG(ERROR) << "Failed to write to socket";
+      return false;
+    }
+
+    queued_bytes_ -= written;
+    size_t remaining = written;
+    while (remaining > 0) {
+      std::vector<uint8_t>& front = send_queue_.front();
+      size_t left = front.size() - send_offset_;
+      if (remaining < left) {
+        send_offset_ += remaining;
+        break;
+      }
+      remaining -= left;
+      RecycleLocked(&front);
+      send_queue_.pop_front();
+      send_offset_ = 0;
+      if (security_) {
+        num_encrypted_--;
+      }
+    }
+  }
+}
+
+void SocketWireInterface::DeliverReads() {
+  size_t available = read_buffer_.size() - read_start_;
+  if (delivering_ || available == 0) {
+    return;
+  }
+
+  read_start_ += DeliverFrom(&read_buffer_[read_start_], available);
+
+  if (read_start_ == read_buffer_.size()) {
+    if (read_buffer_.capacity() > kMaxIdleBufferSize) {
+      std::vector<uint8_t>().swap(read_buffer_);
+    } else {
+      read_buffer_.clear();
+    }
+    read_start_ = 0;
+  }
+}
+
+size_t SocketWireInterface::DeliverFrom(const uint8_t* data, size_t size) {
+  // The listener may queue another receive while being notified, which will
+  // be handled by this loop.
+  if (delivering_) {
+    return 0;
+  }
+  delivering_ = true;
+
+  size_t offset = 0;
+  while (!failed_) {
+    size_t num_bytes;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (receive_requests_.empty()) {
+        break;
+      }
+      num_bytes = receive_requests_.front();
+      if (num_bytes == 0) {
+        num_bytes = size - offset;
+      }
+      if (num_bytes == 0 || size - offset < num_bytes) {
+        break;
+      }
+      receive_requests_.pop_front();
+    }
+
+    offset += num_bytes;
+    if (listener()) {
+      listener()->OnBufferReceived(data + offset - num_bytes, num_bytes);
+    }
+  }
+
+  delivering_ = false;
+  return offset;
+}
+
+void SocketWireInterface::UpdateEvents() {
+  uint32_t events = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!send_queue_.empty() || !bulk_queue_.empty()) {
+      events |= EPOLLOUT;
+    }
+    if (!receive_requests_.empty()) {
+      size_t available = read_buffer_.size() - read_start_;
+      size_t num_bytes = receive_requests_.front();
+      if (num_bytes == 0 ? available == 0 : available < num_bytes) {
+        events |= EPOLLIN;
+      }
+    }
+  }
+
+  if (events != events_ && loop_->ModifyFd(fd_, events, this)) {
+    events_ = events;
+  }
+}
+
+void SocketWireInterface::Fail() {
+  if (!failed_) {
+    MarkFailed();
+    NotifyError();
+  }
+}
+
+void SocketWireInterface::MarkFailed() {
+  if (!failed_) {
+    failed_ = true;
+    loop_->RemoveFd(fd_, this);
+  }
+}
+
+void SocketWireInterface::NotifyError() {
+  if (listener()) {
+    listener()->OnError();
+  }
+}
+
+}  // namespace wire
+}  // namespace anymote
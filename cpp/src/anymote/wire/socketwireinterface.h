@@ -0,0 +1,235 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_WIRE_SOCKETWIREINTERFACE_H_
+#define ANYMOTE_WIRE_SOCKETWIREINTERFACE_H_
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "anymote/util/closure.h"
+#include "anymote/util/eventloop.h"
+#include "anymote/wire/transportsecurity.h"
+#include "anymote/wire/wireinterface.h"
+
+namespace anymote {
+namespace wire {
+
+// Wire interface backed by a non-blocking stream socket, such as a TCP
+// connection, and driven by an epoll event loop. The listener is invoked from
+// the event loop's dispatch thread. Send and SendOwned may be invoked from
+// any thread. Queued data is written with a single scatter/gather call.
+// Bulk data waits in a queue of its own and is only moved to the send queue
+// one buffer at a time, once the send queue has been written, so data sent
+// with Send or SendOwned overtakes all but one of the queued bulk buffers.
+//
+// Data may optionally be protected by a TransportSecurity engine, such as
+// TLS. Without one, data is sent in the clear, which is mostly useful for
+// tests.
+//
+// Example:
+//
+//   int fd = SocketWireInterface::ConnectTcp(host, port);
+//   SocketWireInterface interface(&loop, fd, tls_engine);
+//   ProtobufWireAdapter adapter(&interface,
+//                               ProtobufWireAdapter::kStreamingReads);
+//   interface.Start();
+//   loop.Run();
+class SocketWireInterface : public WireInterface,
+                            public util::EventLoop::Handler {
+ public:
+  // Creates a new socket interface. The interface must be started with Start
+  // before any data is received.
+  //
+  // @param loop The event loop that dispatches socket events. No ownership
+  //        is taken and the pointer must be valid for the duration of the
+  //        existence of this instance.
+  // @param fd A connected stream socket. Ownership is taken and the socket is
+  //        closed when this instance is destroyed.
+  // @param security The security engine, or NULL to send data in the clear.
+  //        No ownership is taken and the pointer must be valid for the
+  //        duration of the existence of this instance.
+  SocketWireInterface(util::EventLoop* loop, int fd,
+                      TransportSecurity* security);
+
+  // Destroys the interface and closes the socket. This must be invoked from
+  // the dispatch thread, or while the event loop is not running.
+  virtual ~SocketWireInterface();
+
+  // Connects a TCP socket to the given address. This blocks until the
+  // connection is established.
+  //
+  // @param host The host name or address.
+  // @param port The port number or service name.
+  // @return The connected socket, or -1 on failure.
+  static int ConnectTcp(const std::string& host, const std::string& port);
+
+  // Registers the socket with the event loop and starts the security
+  // handshake, if any. This must be invoked from the dispatch thread, or
+  // before the event loop starts running.
+  //
+  // @return false if the socket could not be registered.
+  bool Start();
+
+  // @override
+  virtual void Send(const std::vector<uint8_t>& data);
+
+  // @override
+  virtual void SendOwned(std::vector<uint8_t>* data);
+
+  // @override
+  virtual void SendBulk(std::vector<uint8_t>* data);
+
+  // @override
+  virtual void Receive(size_t num_bytes);
+
+  // @override
+  virtual void ReceiveAvailable();
+
+  // @override
+  virtual size_t queued_bytes() { return queued_bytes_; }
+
+  // @override
+  virtual void OnEvents(uint32_t events);
+
+ private:
+  // Queues a buffer, handing back a spare buffer.
+  // @param data The data to queue.
+  // @param queue The queue to add the data to.
+  void QueueOwned(std::vector<uint8_t>* data,
+                  std::deque<std::vector<uint8_t> >* queue);
+
+  // Returns a written buffer to the spare buffers. mutex_ must be held.
+  // @param buffer The buffer, whose contents are swapped out.
+  void RecycleLocked(std::vector<uint8_t>* buffer);
+
+  // Replaces queued application data with the output of the security engine.
+  // mutex_ must be held.
+  // @return false on a fatal error.
+  bool EncryptQueuedLocked();
+
+  // Queues a receive request and schedules it to be processed.
+  // @param num_bytes The number of bytes to receive, or 0 for any.
+  void QueueReceive(size_t num_bytes);
+
+  // Processes queued work now if invoked from the dispatch thread, or
+  // schedules it otherwise.
+  void ScheduleFlush();
+
+  // Writes queued data now if invoked from the dispatch thread, or schedules
+  // a flush otherwise. Unlike ScheduleFlush this never delivers data or
+  // reports errors, so sending does not call back into the listener.
+  void ScheduleWrite();
+
+  // Writes queued data, delivers buffered data and updates the watched events.
+  // Invoked from the dispatch thread.
+  void Flush();
+
+  // Reads available data from the socket.
+  // @return false if the connection was closed or failed.
+  bool ReadSocket();
+
+  // Writes as much queued data as the socket accepts.
+  // @return false if the connection failed.
+  bool WriteSocket();
+
+  // Delivers buffered data to the listener for as many pending receive
+  // requests as can be satisfied.
+  void DeliverReads();
+
+  // Delivers data to the listener for as many pending receive requests as
+  // can be satisfied.
+  // @param data The data to deliver.
+  // @param size The number of bytes of data.
+  // @return The number of bytes delivered.
+  size_t DeliverFrom(const uint8_t* data, size_t size);
+
+  // Watches the socket for the events required by pending work.
+  void UpdateEvents();
+
+  // Handles a fatal error by unregistering the socket and notifying the
+  // listener.
+  void Fail();
+
+  // Unregisters the socket after a fatal error without notifying the
+  // listener.
+  void MarkFailed();
+
+  // Notifies the listener of a fatal error.
+  void NotifyError();
+
+  util::EventLoop* loop_;
+  int fd_;
+  TransportSecurity* security_;
+  // Closure posted to the event loop to process queued work.
+  util::MethodClosure<SocketWireInterface> flush_closure_;
+
+  // Guards the members below, up to read_buffer_.
+  std::mutex mutex_;
+
+  // Buffers waiting to be written, and the number of bytes already written
+  // from the first one. With a security engine, only the first
+  // num_encrypted_ buffers have been encrypted and may be written.
+  std::deque<std::vector<uint8_t> > send_queue_;
+  size_t send_offset_;
+  size_t num_encrypted_;
+
+  // Bulk buffers waiting to be moved to the send queue. They have not been
+  // encrypted.
+  std::deque<std::vector<uint8_t> > bulk_queue_;
+
+  // The number of bytes in both queues that have not been written. Only
+  // modified with mutex_ held, but read without it.
+  std::atomic<size_t> queued_bytes_;
+
+  // Written buffers kept to be swapped back by SendOwned.
+  std::vector<std::vector<uint8_t> > spare_buffers_;
+
+  // Pending receive requests. A request of 0 bytes accepts any amount.
+  std::deque<size_t> receive_requests_;
+
+  // Whether a FlushClosure has been posted but not run yet.
+  std::atomic<bool> flush_posted_;
+
+  // Data read from the socket but not yet delivered, starting at read_start_.
+  // Data is read into the event loop's scratch buffer and only copied here if
+  // it cannot be delivered right away, so idle interfaces hold no read
+  // buffer. Only accessed from the dispatch thread.
+  std::vector<uint8_t> read_buffer_;
+  size_t read_start_;
+
+  // Scratch buffer for the security engine.
+  std::vector<uint8_t> security_output_;
+
+  // The events currently watched.
+  uint32_t events_;
+
+  bool started_;
+  std::atomic<bool> failed_;
+  // Whether a write error raised while sending has yet to be reported by
+  // Flush. Only accessed from the dispatch thread.
+  bool error_pending_;
+  bool delivering_;
+
+  // Disallow copy and assign.
+  SocketWireInterface(const SocketWireInterface&);
+  void operator=(const SocketWireInterface&);
+};
+
+}  // namespace wire
+}  // namespace anymote
+
+#endif  // ANYMOTE_WIRE_SOCKETWIREINTERFACE_H_
@@ -0,0 +1,66 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_WIRE_TRANSPORTSECURITY_H_
+#define ANYMOTE_WIRE_TRANSPORTSECURITY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace anymote {
+namespace wire {
+
+// Interface for a pluggable security layer, such as a TLS implementation,
+// used by SocketWireInterface. The engine only transforms buffers and never
+// touches the socket, so it can be backed by any library that supports
+// memory-based I/O. All functions are invoked from the dispatch thread.
+class TransportSecurity {
+ public:
+  virtual ~TransportSecurity() {}
+
+  // Starts the handshake with the peer.
+  //
+  // @param to_peer Bytes to send to the peer are appended here.
+  // @return false if the handshake could not be started.
+  virtual bool Start(std::vector<uint8_t>* to_peer) = 0;
+
+  // Protects application data to send to the peer. Data written before the
+  // handshake completes must be buffered by the engine.
+  //
+  // @param data The application data.
+  // @param size The number of bytes of application data.
+  // @param to_peer Bytes to send to the peer are appended here.
+  // @return false on a fatal error.
+  virtual bool Encrypt(const uint8_t* data, size_t size,
+                       std::vector<uint8_t>* to_peer) = 0;
+
+  // Processes bytes received from the peer. Partial records must be buffered
+  // by the engine until the rest is received.
+  //
+  // @param data The bytes received.
+  // @param size The number of bytes received.
+  // @param plaintext Decrypted application data is appended here.
+  // @param to_peer Bytes to send to the peer, such as handshake messages, are
+  //        appended here.
+  // @return false on a fatal error.
+  virtual bool Decrypt(const uint8_t* data, size_t size,
+                       std::vector<uint8_t>* plaintext,
+                       std::vector<uint8_t>* to_peer) = 0;
+};
+
+}  // namespace wire
+}  // namespace anymote
+
+#endif  // ANYMOTE_WIRE_TRANSPORTSECURITY_H_
@@ -67,8 +67,40 @@ class WireAdapter : public WireListener {
   // @param message The message to send.
   virtual void SendMessage(const messages::RemoteMessage& message) = 0;
 
+  // Sends a message that is already encoded as a frame, preamble included,
+  // such as a frame from the FrameCache, without serializing anything. This
+  // function is thread-safe. Messages sent with either function from one
+  // thread are sent in order.
+  //
+  // The default implementation sends nothing and returns false, in which case
+  // the caller must send the message with SendMessage instead.
+  // @param frame The frame. It is only read before this function returns.
+  // @param size The size of the frame.
+  // @return true if the frame was sent.
+  virtual bool SendEncodedFrame(const uint8_t* frame, size_t size) {
+    return false;
+  }
+
+  // Starts a batch of messages. Messages sent until the matching Flush are
+  // written to the interface together with a single send. Batches may be
+  // nested, in which case messages are sent when the outermost batch is
+  // flushed.
+  //
+  // The default implementation does nothing, so every message is sent as
+  // soon as SendMessage is invoked.
+  virtual void BeginBatch() {}
+
+  // Ends the current batch, if any, and sends all buffered messages unless an
+  // enclosing batch is still open.
+  virtual void Flush() {}
+
   bool initialized() { return initialized_; }
 
+  // Returns the number of sent bytes queued by the interface. Messages that
+  // the adapter itself holds in an open batch are not counted. This function
+  // is thread-safe.
+  size_t queued_bytes() { return interface_->queued_bytes(); }
+
  protected:
   // Asynchronously receives the next message. The listener will be invoked
   // when a message has been received. Once a message is received, this function
@@ -28,7 +28,7 @@ namespace wire {
 // the listener will be invoked from the dispatch thread.
 class WireInterface {
  public:
-  WireInterface() {}
+  WireInterface() : listener_(NULL) {}
   virtual ~WireInterface() {}
 
   // Sets the listener that will receive incoming data and error notifications.
@@ -41,9 +41,34 @@ class WireInterface {
   }
 
   // Sends data over the interface asynchronously. This function is thread-safe
-  // and will queue the message to be sent, returning immediately.
+  // and will queue the message to be sent, returning immediately. It must not
+  // invoke the listener, since adapters may send while holding internal state.
   virtual void Send(const std::vector<uint8_t>& data) = 0;
 
+  // Sends data over the interface asynchronously, taking ownership of the
+  // buffer rather than copying it. This function is thread-safe and will queue
+  // the data to be sent, returning immediately.
+  //
+  // The contents of data are swapped with a buffer the caller may reuse for
+  // its next send, such as one the interface has finished writing. This lets
+  // a caller send repeatedly without allocating. The size and contents of the
+  // returned buffer are unspecified.
+  //
+  // The default implementation calls Send and leaves data unchanged.
+  // @param data The data to send. Must not be NULL.
+  virtual void SendOwned(std::vector<uint8_t>* data) { Send(*data); }
+
+  // Sends bulk data, such as large data messages, which may be overtaken by
+  // latency-sensitive data sent later with Send or SendOwned. The buffer must
+  // hold whole messages, since other data may be written before or after it
+  // but never inside it. Bulk buffers are sent in order among themselves. The
+  // buffer is handled as by SendOwned.
+  //
+  // The default implementation calls SendOwned, so bulk data is sent in
+  // order with all other data.
+  // @param data The data to send. Must not be NULL.
+  virtual void SendBulk(std::vector<uint8_t>* data) { SendOwned(data); }
+
   // Receives the given number of bytes from the interface asynchronously. The
   // request will be queued if there is already a pending receive operation.
   // This function will return immediately and the listener will be notified
@@ -51,6 +76,24 @@ class WireInterface {
   // @param num_bytes The number of bytes to receive over the interface.
   virtual void Receive(size_t num_bytes) = 0;
 
+  // Receives whatever bytes are available from the interface asynchronously,
+  // rather than an exact number of bytes. The listener will be notified from
+  // the dispatch thread with one or more bytes once data is available. The
+  // request will be queued if there is already a pending receive operation.
+  //
+  // The default implementation receives a single byte, which is correct for
+  // any interface but does not reduce the number of receive operations.
+  // Interfaces that can deliver partial reads should override this.
+  virtual void ReceiveAvailable() { Receive(1); }
+
+  // Returns the number of bytes that were sent but have not been written to
+  // the transport yet. Sessions compare it to watermarks to detect a slow
+  // peer. This function is thread-safe.
+  //
+  // The default implementation returns 0, for interfaces that write
+  // synchronously or do not track their queue.
+  virtual size_t queued_bytes() { return 0; }
+
  protected:
   WireListener* listener() const { return listener_; }
 
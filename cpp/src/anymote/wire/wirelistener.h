@@ -15,6 +15,7 @@
 #ifndef ANYMOTE_WIRE_WIRELISTENER_H_
 #define ANYMOTE_WIRE_WIRELISTENER_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <vector>
 
@@ -31,6 +32,18 @@ class WireListener {
   // @param data The data received.
   virtual void OnBytesReceived(const std::vector<uint8_t>& data) = 0;
 
+  // Handles data received over the interface without copying it. This allows
+  // interfaces to pass their own receive buffers straight through. The data
+  // is owned by the caller and is only valid for the duration of this call.
+  //
+  // The default implementation copies the data and forwards it to
+  // OnBytesReceived, so existing listeners do not need to implement this.
+  // @param data The data received.
+  // @param size The number of bytes received.
+  virtual void OnBufferReceived(const uint8_t* data, size_t size) {
+    OnBytesReceived(std::vector<uint8_t>(data, data + size));
+  }
+
   // Handles a protocol error from the wire interface if there was an error
   // sending or receiving data. This should be treated as a fatal error and the
   // session should be aborted.
@@ -0,0 +1,78 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANYMOTE_WIRE_WIREMETRICS_H_
+#define ANYMOTE_WIRE_WIREMETRICS_H_
+
+#include "anymote/util/metrics.h"
+
+namespace anymote {
+namespace wire {
+
+// A snapshot of WireMetrics.
+struct WireMetricsSnapshot {
+  uint64_t messages_sent;
+  uint64_t bytes_sent;
+  uint64_t writes;
+  uint64_t messages_received;
+  uint64_t bytes_received;
+  uint64_t preamble_errors;
+  uint64_t oversized_frames;
+  uint64_t parse_errors;
+  int64_t send_queue_depth;
+  int64_t max_send_queue_depth;
+};
+
+// Metrics of a wire adapter. See util/metrics.h.
+struct WireMetrics {
+  // Messages sent, and the bytes and interface writes they were sent with.
+  util::Counter messages_sent;
+  util::Counter bytes_sent;
+  util::Counter writes;
+
+  // Messages and bytes received.
+  util::Counter messages_received;
+  util::Counter bytes_received;
+
+  // Preambles longer than a varint32, messages larger than the maximum frame
+  // size, and messages that failed to parse.
+  util::Counter preamble_errors;
+  util::Counter oversized_frames;
+  util::Counter parse_errors;
+
+  // The number of frames queued by contending senders, sampled when a frame
+  // is queued.
+  util::Gauge send_queue_depth;
+
+  // Returns a snapshot of the metrics.
+  WireMetricsSnapshot Snapshot() const {
+    WireMetricsSnapshot snapshot;
+    snapshot.messages_sent = messages_sent.value();
+    snapshot.bytes_sent = bytes_sent.value();
+    snapshot.writes = writes.value();
+    snapshot.messages_received = messages_received.value();
+    snapshot.bytes_received = bytes_received.value();
+    snapshot.preamble_errors = preamble_errors.value();
+    snapshot.oversized_frames = oversized_frames.value();
+    snapshot.parse_errors = parse_errors.value();
+    snapshot.send_queue_depth = send_queue_depth.value();
+    snapshot.max_send_queue_depth = send_queue_depth.max();
+    return snapshot;
+  }
+};
+
+}  // namespace wire
+}  // namespace anymote
+
+#endif  // ANYMOTE_WIRE_WIREMETRICS_H_
@@ -0,0 +1,115 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for DeviceSessionManager.
+
+#include <anymote/device/devicesessionmanager.h>
+#include <gtest/gtest.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+
+namespace anymote {
+namespace device {
+
+// Listener that counts acks.
+class CountingAnymoteListener : public AnymoteListener {
+ public:
+  CountingAnymoteListener() : acks(0), errors(0) {}
+
+  virtual void OnAck() { acks++; }
+  virtual void OnData(const std::string& type, const std::string& data) {}
+  virtual void OnFlingResult(bool success, uint32_t sequence_number) {}
+  virtual void OnError() { errors++; }
+
+  std::atomic<int> acks;
+  std::atomic<int> errors;
+};
+
+// Closure that sends a ping on a session.
+class PingClosure : public util::Closure {
+ public:
+  explicit PingClosure(DeviceSession* session) : session_(session) {}
+  virtual void Run() { session_->SendPing(); }
+
+ private:
+  DeviceSession* session_;
+};
+
+// Waits until a condition holds, for up to 5 seconds.
+#define WAIT_FOR(condition) \
+  for (int i = 0; i < 5000 && !(condition); ++i) usleep(1000)
+
+// Tests running several sessions on a pool and removing them.
+TEST(DeviceSessionManagerTest, TestSessions) {
+  const int kNumSessions = 8;
+
+  util::EventLoopPool pool(2);
+  ASSERT_TRUE(pool.Start());
+
+  CountingAnymoteListener listener;
+  int peers[kNumSessions];
+  DeviceSessionManager::ManagedSession* sessions[kNumSessions];
+  {
+    DeviceSessionManager manager(&pool);
+    for (int i = 0; i < kNumSessions; ++i) {
+      int fds[2];
+      ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+      peers[i] = fds[1];
+      sessions[i] = manager.AddSession(fds[0], &listener, NULL);
+    }
+    EXPECT_EQ(kNumSessions, manager.num_sessions());
+
+    for (int i = 0; i < kNumSessions; ++i) {
+      PingClosure ping(sessions[i]->session());
+      sessions[i]->loop()->Post(&ping);
+
+      // The first ping has sequence number 1 and an empty request.
+      uint8_t expected[5] = {4, 8, 1, 18, 0};
+      uint8_t received[5];
+      ASSERT_EQ(5, read(peers[i], received, 5));
+      EXPECT_EQ(0, memcmp(expected, received, 5));
+
+      // Reply with an ack.
+      uint8_t ack[3] = {2, 8, 1};
+      ASSERT_EQ(3, write(peers[i], ack, 3));
+    }
+
+    WAIT_FOR(listener.acks == kNumSessions);
+    EXPECT_EQ(kNumSessions, listener.acks);
+
+    // Removing sessions closes their sockets.
+    for (int i = 0; i < kNumSessions / 2; ++i) {
+      manager.RemoveSession(sessions[i]);
+    }
+    WAIT_FOR(manager.num_sessions() == kNumSessions / 2);
+    EXPECT_EQ(kNumSessions / 2, manager.num_sessions());
+
+    char byte;
+    EXPECT_EQ(0, read(peers[0], &byte, 1));
+
+    // The remaining sessions are destroyed with the manager.
+    pool.Stop();
+  }
+
+  EXPECT_EQ(0, listener.errors);
+  for (int i = 0; i < kNumSessions; ++i) {
+    close(peers[i]);
+  }
+}
+
+}  // namespace device
+}  // namespace anymote
@@ -17,10 +17,21 @@
 #include <anymote/device/devicesession.h>
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
-
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "anymote/util/fakeclock.h"
+
+using ::testing::_;
+using ::testing::AnyNumber;
 using ::testing::InSequence;
+using ::testing::Invoke;
 using ::testing::Mock;
+using ::testing::NotNull;
 using ::testing::Return;
+using ::testing::ReturnPointee;
 using ::testing::StrictMock;
 
 namespace anymote {
@@ -34,6 +45,16 @@ class MockAnymoteListener : public AnymoteListener {
                                 const std::string& data));
   MOCK_METHOD2(OnFlingResult, void(bool success, uint32_t sequence_number));
   MOCK_METHOD0(OnError, void());
+  MOCK_METHOD1(OnBackpressure, void(bool congested));
+};
+
+// Mock request callback.
+class MockRequestCallback : public RequestCallback {
+ public:
+  MOCK_METHOD4(OnRequestComplete,
+               void(int32_t sequence_number, Result result,
+                    const messages::ResponseMessage* response,
+                    int64_t rtt_micros));
 };
 
 // Mock wire adapter.
@@ -44,16 +65,28 @@ class MockWireAdapter : public wire::WireAdapter {
 
   MOCK_METHOD0(Init, void());
   MOCK_METHOD1(SendMessage, void(const messages::RemoteMessage& message));
+  MOCK_METHOD0(BeginBatch, void());
+  MOCK_METHOD0(Flush, void());
   MOCK_METHOD0(GetNextMessage, void());
   MOCK_METHOD1(OnBytesReceived, void(const std::vector<uint8_t>& data));
   MOCK_METHOD0(OnError, void());
 };
 
+// Mock wire adapter that sends encoded frames.
+class MockCachingWireAdapter : public MockWireAdapter {
+ public:
+  explicit MockCachingWireAdapter(wire::WireInterface* interface)
+      : MockWireAdapter(interface) {}
+
+  MOCK_METHOD2(SendEncodedFrame, bool(const uint8_t* frame, size_t size));
+};
+
 // Mock wire interface.
 class MockWireInterface : public wire::WireInterface {
  public:
   MOCK_METHOD1(Send, void(const std::vector<uint8_t>& data));
   MOCK_METHOD1(Receive, void(size_t num_bytes));
+  MOCK_METHOD0(queued_bytes, size_t());
 };
 
 // Test fixture for a DeviceSession test.
@@ -121,6 +154,107 @@ TEST_F(DeviceSessionTest, TestSendKeyEvent) {
   session.SendKeyEvent(messages::KEYCODE_TV_POWER, messages::DOWN);
 }
 
+// Returns a message holding a key event.
+static messages::RemoteMessage KeyEventMessage(messages::Code keycode,
+                                               messages::Action action) {
+  messages::RemoteMessage message;
+  messages::KeyEvent* key_event =
+      message.mutable_request_message()->mutable_key_event_message();
+  key_event->set_keycode(keycode);
+  key_event->set_action(action);
+  return message;
+}
+
+// Tests typing text.
+TEST_F(DeviceSessionTest, TestSendText) {
+  InSequence sequence;
+
+  EXPECT_CALL(adapter, BeginBatch());
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(
+      KeyEventMessage(messages::KEYCODE_A, messages::DOWN))));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(
+      KeyEventMessage(messages::KEYCODE_A, messages::UP))));
+
+  // Shift stays down for consecutive characters that need it.
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(
+      KeyEventMessage(messages::KEYCODE_SHIFT_LEFT, messages::DOWN))));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(
+      KeyEventMessage(messages::KEYCODE_B, messages::DOWN))));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(
+      KeyEventMessage(messages::KEYCODE_B, messages::UP))));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(
+      KeyEventMessage(messages::KEYCODE_1, messages::DOWN))));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(
+      KeyEventMessage(messages::KEYCODE_1, messages::UP))));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(
+      KeyEventMessage(messages::KEYCODE_SHIFT_LEFT, messages::UP))));
+
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(
+      KeyEventMessage(messages::KEYCODE_SPACE, messages::DOWN))));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(
+      KeyEventMessage(messages::KEYCODE_SPACE, messages::UP))));
+
+  // Shift is released at the end of the text.
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(
+      KeyEventMessage(messages::KEYCODE_SHIFT_LEFT, messages::DOWN))));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(
+      KeyEventMessage(messages::KEYCODE_SLASH, messages::DOWN))));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(
+      KeyEventMessage(messages::KEYCODE_SLASH, messages::UP))));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(
+      KeyEventMessage(messages::KEYCODE_SHIFT_LEFT, messages::UP))));
+  EXPECT_CALL(adapter, Flush());
+
+  // The two bytes of the UTF-8 character and the carriage return are skipped.
+  EXPECT_EQ(5, session.SendText("aB!\xc3\xa9 \r?"));
+}
+
+// Tests typing empty text.
+TEST_F(DeviceSessionTest, TestSendEmptyText) {
+  InSequence sequence;
+
+  EXPECT_CALL(adapter, BeginBatch());
+  EXPECT_CALL(adapter, Flush());
+
+  EXPECT_EQ(0, session.SendText(""));
+}
+
+// Tests that key events are sent from the frame cache when the adapter
+// supports it, and that sending text uses it too.
+TEST(DeviceSessionFrameCacheTest, TestKeyEventFromCache) {
+  StrictMock<MockWireInterface> interface;
+  StrictMock<MockCachingWireAdapter> adapter(&interface);
+  MockAnymoteListener listener;
+  DeviceSession session(&adapter, &listener);
+
+  size_t down_size = 0;
+  const uint8_t* down = wire::FrameCache::Get()->KeyEventFrame(
+      messages::KEYCODE_DPAD_DOWN, messages::DOWN, &down_size);
+  size_t up_size = 0;
+  const uint8_t* up = wire::FrameCache::Get()->KeyEventFrame(
+      messages::KEYCODE_DPAD_DOWN, messages::UP, &up_size);
+  ASSERT_TRUE(down != NULL);
+  ASSERT_TRUE(up != NULL);
+
+  {
+    InSequence sequence;
+    EXPECT_CALL(adapter, SendEncodedFrame(down, down_size))
+        .WillOnce(Return(true));
+    EXPECT_CALL(adapter, SendEncodedFrame(up, up_size))
+        .WillOnce(Return(true));
+  }
+  session.SendKeyEvent(messages::KEYCODE_DPAD_DOWN, messages::DOWN);
+  session.SendKeyEvent(messages::KEYCODE_DPAD_DOWN, messages::UP);
+  Mock::VerifyAndClear(&adapter);
+
+  EXPECT_CALL(adapter, BeginBatch());
+  EXPECT_CALL(adapter, SendEncodedFrame(NotNull(), _))
+      .Times(2)
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(adapter, Flush());
+  EXPECT_EQ(1, session.SendText("x"));
+}
+
 // Tests sending a mouse move event.
 TEST_F(DeviceSessionTest, TestSendMouseMove) {
   messages::RemoteMessage message;
@@ -160,6 +294,23 @@ TEST_F(DeviceSessionTest, TestSendData) {
   session.SendData("foo", "bar");
 }
 
+// Tests that the buffers of a large payload are not kept after it is sent.
+TEST_F(DeviceSessionTest, TestSendLargeData) {
+  std::string large(100 * 1024, 'x');
+  std::vector<size_t> capacities;
+  EXPECT_CALL(adapter, SendMessage(_)).Times(2).WillRepeatedly(Invoke(
+      [&capacities](const messages::RemoteMessage& message) {
+        capacities.push_back(
+            message.request_message().data_message().data().capacity());
+      }));
+
+  session.SendData("foo", large);
+  session.SendData("foo", "bar");
+  ASSERT_EQ(2U, capacities.size());
+  EXPECT_GE(capacities[0], large.size());
+  EXPECT_LT(capacities[1], large.size());
+}
+
 // Tests sending a connect message.
 TEST_F(DeviceSessionTest, TestSendConnect) {
   messages::RemoteMessage message;
@@ -185,6 +336,483 @@ TEST_F(DeviceSessionTest, TestSendFling) {
   session.SendFling("http://foo", 123);
 }
 
+// Returns a remote message containing a mouse movement.
+static messages::RemoteMessage MouseMoveMessage(int x_delta, int y_delta) {
+  messages::RemoteMessage message;
+  message.mutable_request_message()->mutable_mouse_event_message()
+      ->set_x_delta(x_delta);
+  message.mutable_request_message()->mutable_mouse_event_message()
+      ->set_y_delta(y_delta);
+  return message;
+}
+
+// Returns a remote message containing a mouse wheel movement.
+static messages::RemoteMessage MouseWheelMessage(int x_scroll, int y_scroll) {
+  messages::RemoteMessage message;
+  message.mutable_request_message()->mutable_mouse_wheel_message()
+      ->set_x_scroll(x_scroll);
+  message.mutable_request_message()->mutable_mouse_wheel_message()
+      ->set_y_scroll(y_scroll);
+  return message;
+}
+
+// Tests that mouse movements within the coalescing interval are summed.
+TEST_F(DeviceSessionTest, TestCoalesceMouseMove) {
+  InSequence sequence;
+
+  util::FakeClock clock;
+  session.EnableMotionCoalescing(8000, &clock);
+
+  // The first movement is sent immediately.
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(MouseMoveMessage(1, 2))));
+  session.SendMouseMove(1, 2);
+  Mock::VerifyAndClear(&adapter);
+
+  // Movements within the interval are held back.
+  clock.Advance(1000);
+  session.SendMouseMove(3, 4);
+  session.SendMouseMove(-1, 10);
+  EXPECT_EQ(8000, session.motion_flush_deadline_micros());
+  Mock::VerifyAndClear(&adapter);
+
+  // The summed movement is sent once the interval has passed.
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(MouseMoveMessage(7, 15))));
+  clock.Advance(7000);
+  session.SendMouseMove(5, 1);
+
+  EXPECT_EQ(-1, session.motion_flush_deadline_micros());
+  EXPECT_EQ(2, session.motion_events_merged());
+  EXPECT_EQ(2, session.motion_messages_sent());
+}
+
+// Tests that a pending movement is flushed from a timer.
+TEST_F(DeviceSessionTest, TestFlushPendingMotion) {
+  InSequence sequence;
+
+  util::FakeClock clock;
+  session.EnableMotionCoalescing(8000, &clock);
+
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(MouseWheelMessage(0, 1))));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(MouseWheelMessage(0, 2))));
+
+  session.SendMouseWheel(0, 1);
+  session.SendMouseWheel(0, 1);
+  session.SendMouseWheel(0, 1);
+  session.FlushPendingMotion();
+}
+
+// Tests that other messages are never reordered with a pending movement.
+TEST_F(DeviceSessionTest, TestCoalescePreservesOrder) {
+  InSequence sequence;
+
+  util::FakeClock clock;
+  session.EnableMotionCoalescing(8000, &clock);
+
+  messages::RemoteMessage key;
+  key.mutable_request_message()->mutable_key_event_message()
+      ->set_keycode(messages::KEYCODE_ENTER);
+  key.mutable_request_message()->mutable_key_event_message()
+      ->set_action(messages::DOWN);
+
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(MouseMoveMessage(1, 1))));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(MouseMoveMessage(2, 2))));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(key)));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(MouseMoveMessage(3, 3))));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(MouseWheelMessage(4, 4))));
+
+  session.SendMouseMove(1, 1);
+  session.SendMouseMove(1, 1);
+  session.SendMouseMove(1, 1);
+  session.SendKeyEvent(messages::KEYCODE_ENTER, messages::DOWN);
+  session.SendMouseMove(3, 3);
+  session.SendMouseWheel(4, 4);
+  session.FlushPendingMotion();
+}
+
+// Returns a remote message containing a data request.
+static messages::RemoteMessage DataMessage(const std::string& type) {
+  messages::RemoteMessage message;
+  message.mutable_request_message()->mutable_data_message()->set_type(type);
+  message.mutable_request_message()->mutable_data_message()->set_data("x");
+  return message;
+}
+
+// Test fixture for a DeviceSession test with backpressure enabled. The bytes
+// queued by the interface are set by the test.
+class DeviceSessionBackpressureTest : public DeviceSessionTest {
+ protected:
+  DeviceSessionBackpressureTest() : queued(0) {
+    EXPECT_CALL(interface, queued_bytes())
+        .WillRepeatedly(ReturnPointee(&queued));
+    EXPECT_CALL(listener, OnBackpressure(_)).Times(AnyNumber());
+    options.high_watermark_bytes = 100;
+    options.low_watermark_bytes = 10;
+    options.max_deferred_requests = 2;
+    options.max_retries = 2;
+  }
+
+  size_t queued;
+  DeviceSession::BackpressureOptions options;
+};
+
+// Tests that movements are held back and summed while congested, and that
+// key events are still sent in order with them.
+TEST_F(DeviceSessionBackpressureTest, TestHoldMotion) {
+  session.EnableBackpressure(options);
+
+  messages::RemoteMessage key;
+  key.mutable_request_message()->mutable_key_event_message()
+      ->set_keycode(messages::KEYCODE_ENTER);
+  key.mutable_request_message()->mutable_key_event_message()
+      ->set_action(messages::DOWN);
+
+  {
+    InSequence sequence;
+    EXPECT_CALL(adapter, SendMessage(ProtoMatcher(MouseMoveMessage(1, 1))));
+    EXPECT_CALL(listener, OnBackpressure(true));
+    EXPECT_CALL(adapter, SendMessage(ProtoMatcher(MouseMoveMessage(4, 6))));
+    EXPECT_CALL(adapter, SendMessage(ProtoMatcher(key)));
+    EXPECT_CALL(adapter, SendMessage(ProtoMatcher(MouseMoveMessage(10, 0))));
+    EXPECT_CALL(listener, OnBackpressure(false));
+  }
+
+  session.SendMouseMove(1, 1);
+  queued = 200;
+  session.SendMouseMove(1, 2);
+  EXPECT_TRUE(session.congested());
+  session.SendMouseMove(3, 4);
+  session.SendKeyEvent(messages::KEYCODE_ENTER, messages::DOWN);
+  session.SendMouseMove(5, 0);
+  session.SendMouseMove(5, 0);
+  EXPECT_EQ(-1, session.motion_flush_deadline_micros());
+
+  // The queue is still above the low watermark.
+  queued = 50;
+  EXPECT_TRUE(session.CheckBackpressure());
+  queued = 10;
+  EXPECT_FALSE(session.CheckBackpressure());
+  EXPECT_FALSE(session.congested());
+}
+
+// Tests that only the latest held movement is sent under the drop-oldest
+// policy.
+TEST_F(DeviceSessionBackpressureTest, TestDropOldestMotion) {
+  options.motion_policy = DeviceSession::kDropOldestMotion;
+  session.EnableBackpressure(options);
+
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(MouseWheelMessage(0, 3))));
+
+  queued = 100;
+  session.SendMouseWheel(0, 1);
+  session.SendMouseWheel(0, 2);
+  session.SendMouseWheel(0, 3);
+  queued = 0;
+  session.CheckBackpressure();
+  EXPECT_EQ(2, session.motion_events_dropped());
+}
+
+// Tests that data and fling requests are held back while congested and sent
+// in order once the queue drains.
+TEST_F(DeviceSessionBackpressureTest, TestDeferRequests) {
+  session.EnableBackpressure(options);
+
+  messages::RemoteMessage fling;
+  fling.mutable_request_message()->mutable_fling_message()
+      ->set_uri("http://foo");
+  fling.set_sequence_number(7);
+
+  {
+    InSequence sequence;
+    EXPECT_CALL(adapter, SendMessage(ProtoMatcher(DataMessage("a"))));
+    EXPECT_CALL(adapter, SendMessage(ProtoMatcher(fling)));
+    EXPECT_CALL(adapter, SendMessage(ProtoMatcher(DataMessage("b"))));
+  }
+
+  queued = 100;
+  session.SendData("a", "x");
+  session.SendFling("http://foo", 7);
+  EXPECT_EQ(2, session.requests_deferred());
+
+  queued = 0;
+  session.SendData("b", "x");
+  EXPECT_EQ(0, session.requests_dropped());
+}
+
+// Tests that a request sent while the held requests are being sent is held
+// back rather than waiting for them, and is sent after them.
+TEST_F(DeviceSessionBackpressureTest, TestDeferWhileResuming) {
+  session.EnableBackpressure(options);
+
+  {
+    InSequence sequence;
+    EXPECT_CALL(adapter, SendMessage(ProtoMatcher(DataMessage("a"))))
+        .WillOnce(Invoke([this](const messages::RemoteMessage& message) {
+          session.SendData("c", "x");
+        }));
+    EXPECT_CALL(adapter, SendMessage(ProtoMatcher(DataMessage("b"))));
+    EXPECT_CALL(adapter, SendMessage(ProtoMatcher(DataMessage("c"))));
+    EXPECT_CALL(adapter, SendMessage(ProtoMatcher(DataMessage("d"))));
+  }
+
+  queued = 100;
+  session.SendData("a", "x");
+  session.SendData("b", "x");
+
+  queued = 0;
+  session.SendData("d", "x");
+  EXPECT_EQ(3, session.requests_deferred());
+  EXPECT_FALSE(session.congested());
+}
+
+// Tests that requests are dropped when too many are held or when they are
+// held for too long, and that dropped flings are reported as failed.
+TEST_F(DeviceSessionBackpressureTest, TestDropRequests) {
+  session.EnableBackpressure(options);
+
+  {
+    InSequence sequence;
+    EXPECT_CALL(listener, OnFlingResult(false, 3));
+    EXPECT_CALL(listener, OnFlingResult(false, 1));
+  }
+
+  queued = 100;
+  session.SendFling("http://foo", 1);
+  session.SendData("a", "x");
+  session.SendFling("http://foo", 3);
+  EXPECT_EQ(1, session.requests_dropped());
+
+  EXPECT_TRUE(session.CheckBackpressure());
+  EXPECT_EQ(1, session.requests_dropped());
+  EXPECT_TRUE(session.CheckBackpressure());
+  EXPECT_EQ(3, session.requests_dropped());
+}
+
+// Tests that tracked flings are only tracked once they are sent, and that
+// the callbacks of dropped flings are aborted rather than left to time out.
+TEST_F(DeviceSessionBackpressureTest, TestDropTrackedRequests) {
+  util::FakeClock clock;
+  session.EnableRequestTracking(1000, &clock);
+  session.EnableBackpressure(options);
+  StrictMock<MockRequestCallback> callback;
+
+  {
+    InSequence sequence;
+    EXPECT_CALL(listener, OnFlingResult(false, 3));
+    EXPECT_CALL(callback, OnRequestComplete(3, RequestCallback::kAborted,
+                                            NULL, 0));
+    EXPECT_CALL(listener, OnFlingResult(false, 1));
+    EXPECT_CALL(callback, OnRequestComplete(1, RequestCallback::kAborted,
+                                            NULL, 0));
+  }
+
+  queued = 100;
+  session.SendFling("http://foo", 1, &callback);
+  session.SendData("a", "x");
+  session.SendFling("http://foo", 3, &callback);
+  EXPECT_EQ(0, session.pending_requests()->size());
+
+  EXPECT_TRUE(session.CheckBackpressure());
+  EXPECT_TRUE(session.CheckBackpressure());
+  EXPECT_EQ(3, session.requests_dropped());
+
+  // Nothing is left to time out.
+  clock.Advance(2000);
+  EXPECT_EQ(0, session.ExpireRequests());
+}
+
+// Tests that the round trip of a deferred tracked fling is measured from the
+// time it is sent.
+TEST_F(DeviceSessionBackpressureTest, TestDeferTrackedRequest) {
+  util::FakeClock clock;
+  session.EnableRequestTracking(1000, &clock);
+  session.EnableBackpressure(options);
+  StrictMock<MockRequestCallback> callback;
+
+  queued = 100;
+  session.SendFling("http://foo", 5, &callback);
+  EXPECT_EQ(0, session.pending_requests()->size());
+
+  clock.Advance(800);
+  queued = 0;
+  EXPECT_CALL(adapter, SendMessage(_)).Times(2);
+  session.SendData("a", "x");
+  EXPECT_EQ(1, session.pending_requests()->size());
+
+  clock.Advance(100);
+  messages::RemoteMessage fling_result;
+  fling_result.mutable_response_message()->mutable_fling_result_message()
+      ->set_result(messages::FlingResult_Result_SUCCESS);
+  fling_result.set_sequence_number(5);
+  EXPECT_CALL(callback, OnRequestComplete(5, RequestCallback::kResponse,
+                                          NotNull(), 100));
+  EXPECT_CALL(listener, OnFlingResult(true, 5));
+  session.OnMessage(fling_result);
+}
+
+// Wire adapter that records the sequence numbers of the messages sent.
+class RecordingWireAdapter : public wire::WireAdapter {
+ public:
+  explicit RecordingWireAdapter(wire::WireInterface* interface)
+      : WireAdapter(interface) {}
+
+  virtual void SendMessage(const messages::RemoteMessage& message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    sequence_numbers.push_back(message.sequence_number());
+  }
+  virtual void GetNextMessage() {}
+  virtual void OnBytesReceived(const std::vector<uint8_t>& data) {}
+  virtual void OnError() {}
+
+  std::mutex mutex;
+  std::vector<int32_t> sequence_numbers;
+};
+
+// Tests that pings sent concurrently from several threads each get a distinct
+// sequence number.
+TEST(DeviceSessionConcurrencyTest, TestConcurrentPings) {
+  const int kNumThreads = 4;
+  const int kNumPings = 1000;
+
+  MockWireInterface interface;
+  RecordingWireAdapter adapter(&interface);
+  MockAnymoteListener listener;
+  DeviceSession session(&adapter, &listener);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.push_back(std::thread([&session, kNumPings]() {
+      for (int j = 0; j < kNumPings; ++j) {
+        session.SendPing();
+      }
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+
+  std::vector<int32_t> sequence_numbers = adapter.sequence_numbers;
+  ASSERT_EQ(kNumThreads * kNumPings, sequence_numbers.size());
+  std::sort(sequence_numbers.begin(), sequence_numbers.end());
+  for (size_t i = 0; i < sequence_numbers.size(); ++i) {
+    EXPECT_EQ(static_cast<int32_t>(i + 1), sequence_numbers[i]);
+  }
+}
+
+// Wire interface whose queue size is set by the test from any thread.
+class QueueWireInterface : public wire::WireInterface {
+ public:
+  QueueWireInterface() : queued(0) {}
+
+  virtual void Send(const std::vector<uint8_t>& data) {}
+  virtual void Receive(size_t num_bytes) {}
+  virtual size_t queued_bytes() { return queued; }
+
+  std::atomic<size_t> queued;
+};
+
+// Listener that records backpressure notifications and checks that they are
+// never invoked concurrently.
+class BackpressureRecorder : public AnymoteListener {
+ public:
+  BackpressureRecorder() : active(0), overlapped(false) {}
+
+  virtual void OnAck() {}
+  virtual void OnData(const std::string& type, const std::string& data) {}
+  virtual void OnFlingResult(bool success, uint32_t sequence_number) {}
+  virtual void OnError() {}
+  virtual void OnBackpressure(bool congested) {
+    if (active.fetch_add(1) != 0) {
+      overlapped = true;
+    }
+    states.push_back(congested);
+    if (congested && on_congested) {
+      std::function<void()> hook;
+      hook.swap(on_congested);
+      hook();
+    }
+    active.fetch_sub(1);
+  }
+
+  // Invoked once, during the first notification that the session is
+  // congested.
+  std::function<void()> on_congested;
+
+  std::atomic<int> active;
+  std::atomic<bool> overlapped;
+  std::vector<bool> states;
+};
+
+// Tests that backpressure notifications from concurrent senders alternate,
+// and end with the final state.
+TEST(DeviceSessionConcurrencyTest, TestConcurrentBackpressure) {
+  const int kNumThreads = 4;
+  const int kNumSends = 2000;
+
+  QueueWireInterface interface;
+  RecordingWireAdapter adapter(&interface);
+  BackpressureRecorder listener;
+  DeviceSession session(&adapter, &listener);
+  DeviceSession::BackpressureOptions options;
+  options.high_watermark_bytes = 100;
+  options.low_watermark_bytes = 10;
+  session.EnableBackpressure(options);
+
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < kNumThreads; ++thread) {
+    threads.push_back(std::thread([&interface, &session, thread,
+                                   kNumSends]() {
+      for (int i = 0; i < kNumSends; ++i) {
+        if (thread == 0 && i % 8 == 0) {
+          interface.queued = interface.queued == 0 ? 200 : 0;
+        }
+        session.SendKeyEvent(messages::KEYCODE_A, messages::DOWN);
+      }
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+  interface.queued = 0;
+  session.CheckBackpressure();
+
+  EXPECT_FALSE(listener.overlapped);
+  ASSERT_FALSE(listener.states.empty());
+  for (size_t i = 0; i < listener.states.size(); ++i) {
+    EXPECT_EQ(i % 2 == 0, listener.states[i]) << i;
+  }
+  EXPECT_FALSE(listener.states.back());
+  EXPECT_FALSE(session.congested());
+}
+
+// Tests that a state change made by another thread while the listener is
+// being notified is reported after the notification, not during it.
+TEST(DeviceSessionConcurrencyTest, TestBackpressureChangedDuringNotification) {
+  QueueWireInterface interface;
+  RecordingWireAdapter adapter(&interface);
+  BackpressureRecorder listener;
+  DeviceSession session(&adapter, &listener);
+  DeviceSession::BackpressureOptions options;
+  options.high_watermark_bytes = 100;
+  options.low_watermark_bytes = 10;
+  session.EnableBackpressure(options);
+
+  listener.on_congested = [&interface, &session]() {
+    interface.queued = 0;
+    std::thread sender([&session]() {
+      session.SendKeyEvent(messages::KEYCODE_A, messages::DOWN);
+    });
+    sender.join();
+  };
+  interface.queued = 200;
+  session.SendKeyEvent(messages::KEYCODE_A, messages::DOWN);
+
+  EXPECT_FALSE(listener.overlapped);
+  ASSERT_EQ(2, listener.states.size());
+  EXPECT_TRUE(listener.states[0]);
+  EXPECT_FALSE(listener.states[1]);
+  EXPECT_FALSE(session.congested());
+}
+
 // Tests handling an ack response.
 TEST_F(DeviceSessionTest, TestOnMessageAck) {
   messages::RemoteMessage message;
@@ -192,7 +820,9 @@ TEST_F(DeviceSessionTest, TestOnMessageAck) {
 
   EXPECT_CALL(listener, OnAck());
 
+  EXPECT_EQ(0, session.last_ack_sequence_number());
   session.OnMessage(message);
+  EXPECT_EQ(123, session.last_ack_sequence_number());
 }
 
 // Tests handling a data response.
@@ -218,5 +848,90 @@ TEST_F(DeviceSessionTest, TestOnMessageFlingResult) {
   session.OnMessage(message);
 }
 
+// Tests that responses to tracked pings and flings are matched to their
+// requests while several are in flight.
+TEST_F(DeviceSessionTest, TestTrackedRequests) {
+  util::FakeClock clock;
+  session.EnableRequestTracking(1000000, &clock);
+  MockRequestCallback callback;
+
+  EXPECT_CALL(adapter, SendMessage(_)).Times(2);
+  EXPECT_EQ(1, session.SendPing(&callback));
+  session.SendFling("http://foo", 100, &callback);
+  EXPECT_EQ(2, session.pending_requests()->size());
+
+  clock.Advance(300);
+  messages::RemoteMessage fling_result;
+  fling_result.mutable_response_message()->mutable_fling_result_message()
+      ->set_result(messages::FlingResult_Result_SUCCESS);
+  fling_result.set_sequence_number(100);
+  EXPECT_CALL(callback, OnRequestComplete(100, RequestCallback::kResponse,
+                                          NotNull(), 300));
+  EXPECT_CALL(listener, OnFlingResult(true, 100));
+  session.OnMessage(fling_result);
+
+  clock.Advance(200);
+  messages::RemoteMessage ack;
+  ack.set_sequence_number(1);
+  EXPECT_CALL(callback, OnRequestComplete(1, RequestCallback::kResponse,
+                                          NotNull(), 500));
+  EXPECT_CALL(listener, OnAck());
+  session.OnMessage(ack);
+
+  EXPECT_EQ(0, session.pending_requests()->size());
+}
+
+// Tests that a tracked fling with the sequence number of a ping in flight
+// neither aborts the ping nor takes its ack.
+TEST_F(DeviceSessionTest, TestTrackedPingAndFlingShareSequenceNumber) {
+  util::FakeClock clock;
+  session.EnableRequestTracking(1000000, &clock);
+  MockRequestCallback ping_callback;
+  MockRequestCallback fling_callback;
+
+  EXPECT_CALL(adapter, SendMessage(_)).Times(2);
+  EXPECT_EQ(1, session.SendPing(&ping_callback));
+  session.SendFling("http://foo", 1, &fling_callback);
+  EXPECT_EQ(2, session.pending_requests()->size());
+
+  messages::RemoteMessage ack;
+  ack.set_sequence_number(1);
+  EXPECT_CALL(ping_callback, OnRequestComplete(1, RequestCallback::kResponse,
+                                               NotNull(), 0));
+  EXPECT_CALL(listener, OnAck());
+  session.OnMessage(ack);
+  Mock::VerifyAndClearExpectations(&fling_callback);
+
+  messages::RemoteMessage fling_result;
+  fling_result.mutable_response_message()->mutable_fling_result_message()
+      ->set_result(messages::FlingResult_Result_SUCCESS);
+  fling_result.set_sequence_number(1);
+  EXPECT_CALL(fling_callback, OnRequestComplete(1, RequestCallback::kResponse,
+                                                NotNull(), 0));
+  EXPECT_CALL(listener, OnFlingResult(true, 1));
+  session.OnMessage(fling_result);
+
+  EXPECT_EQ(0, session.pending_requests()->size());
+}
+
+// Tests that tracked requests time out, and are aborted by an error.
+TEST_F(DeviceSessionTest, TestTrackedRequestsTimeoutAndError) {
+  util::FakeClock clock;
+  session.EnableRequestTracking(1000, &clock);
+  MockRequestCallback callback;
+
+  EXPECT_CALL(adapter, SendMessage(_)).Times(2);
+  session.SendPing(&callback);
+  clock.Advance(1000);
+  session.SendPing(&callback);
+
+  EXPECT_CALL(callback, OnRequestComplete(1, RequestCallback::kTimeout, _, _));
+  EXPECT_EQ(1, session.ExpireRequests());
+
+  EXPECT_CALL(callback, OnRequestComplete(2, RequestCallback::kAborted, _, _));
+  EXPECT_CALL(listener, OnError());
+  session.OnError();
+}
+
 }  // namespace device
 }  // namespace anymote
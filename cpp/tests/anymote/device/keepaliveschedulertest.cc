@@ -0,0 +1,239 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for KeepaliveScheduler.
+
+#include <anymote/device/keepalivescheduler.h>
+#include <anymote/server/serversession.h>
+#include <anymote/wire/loopbackwireinterface.h>
+#include <anymote/wire/protobufwireadapter.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string>
+#include "anymote/util/fakeclock.h"
+
+using ::testing::Invoke;
+using ::testing::WithArg;
+using ::testing::StrictMock;
+
+namespace anymote {
+namespace device {
+
+namespace {
+
+// Mock keepalive listener.
+class MockKeepaliveListener : public KeepaliveScheduler::Listener {
+ public:
+  MOCK_METHOD2(OnLivenessFailure,
+               void(DeviceSession* session,
+                    int32_t last_ping_sequence_number));
+};
+
+// Response listener that ignores everything.
+class IgnoringAnymoteListener : public AnymoteListener {
+ public:
+  virtual void OnAck() {}
+  virtual void OnData(const std::string& type, const std::string& data) {}
+  virtual void OnFlingResult(bool success, uint32_t sequence_number) {}
+  virtual void OnError() {}
+};
+
+// Request listener that ignores everything.
+class IgnoringRequestListener : public server::RequestListener {
+ public:
+  virtual void OnKeyEvent(messages::Code keycode, messages::Action action) {}
+  virtual void OnMouseEvent(int32_t x_delta, int32_t y_delta) {}
+  virtual void OnMouseWheel(int32_t x_scroll, int32_t y_scroll) {}
+  virtual void OnData(const std::string& type, const std::string& data) {}
+  virtual void OnConnect(const std::string& device_name, int32_t version) {}
+  virtual bool OnFling(const std::string& uri) { return true; }
+  virtual void OnError() {}
+};
+
+// A device session linked to a server session over a loopback link. Data
+// only moves when the link is pumped, so a server that is never pumped looks
+// dead.
+class SessionPair {
+ public:
+  SessionPair()
+      : device_adapter(&device_interface,
+                       wire::ProtobufWireAdapter::kStreamingReads),
+        server_adapter(&server_interface,
+                       wire::ProtobufWireAdapter::kStreamingReads),
+        device(&device_adapter, &device_listener),
+        server(&server_adapter, &server_listener) {
+    wire::LoopbackWireInterface::Connect(&device_interface,
+                                         &server_interface);
+    device.StartSession();
+    server.StartSession();
+  }
+
+  // Delivers everything in flight in both directions.
+  void Pump() {
+    while (server_interface.Pump() + device_interface.Pump() > 0) {
+    }
+  }
+
+  wire::LoopbackWireInterface device_interface;
+  wire::LoopbackWireInterface server_interface;
+  wire::ProtobufWireAdapter device_adapter;
+  wire::ProtobufWireAdapter server_adapter;
+  IgnoringAnymoteListener device_listener;
+  IgnoringRequestListener server_listener;
+  DeviceSession device;
+  server::ServerSession server;
+};
+
+}  // namespace
+
+// Test fixture with a scheduler that checks sessions every 1000 us and waits
+// 100 us for answers.
+class KeepaliveSchedulerTest : public ::testing::Test {
+ protected:
+  KeepaliveSchedulerTest() : scheduler(Options(), &listener, &clock) {}
+
+  static KeepaliveScheduler::Options Options() {
+    KeepaliveScheduler::Options options;
+    options.idle_interval_micros = 1000;
+    options.ping_timeout_micros = 100;
+    options.max_missed_pings = 3;
+    options.tick_micros = 10;
+    return options;
+  }
+
+  // Advances the clock and the scheduler.
+  // @return The number of pings sent.
+  int AdvanceTo(int64_t now_micros) {
+    clock.Advance(now_micros - clock.NowMicros());
+    return scheduler.Advance();
+  }
+
+  util::FakeClock clock;
+  StrictMock<MockKeepaliveListener> listener;
+  KeepaliveScheduler scheduler;
+};
+
+// Tests that an idle session is pinged and that an answer keeps it alive.
+TEST_F(KeepaliveSchedulerTest, TestIdleSessionPinged) {
+  SessionPair pair;
+  scheduler.AddSession(&pair.device);
+  EXPECT_EQ(1, scheduler.num_sessions());
+
+  EXPECT_EQ(0, AdvanceTo(999));
+  EXPECT_EQ(1, AdvanceTo(1000));
+  pair.Pump();
+  EXPECT_EQ(1, pair.server.requests_received());
+
+  // The ack counts as traffic, so the next ping is a whole interval later.
+  EXPECT_EQ(0, AdvanceTo(1100));
+  EXPECT_EQ(0, AdvanceTo(2099));
+  EXPECT_EQ(1, AdvanceTo(2100));
+  pair.Pump();
+  EXPECT_EQ(0, AdvanceTo(3000));
+  EXPECT_EQ(2, scheduler.pings_sent());
+}
+
+// Tests that a session that keeps receiving data is never pinged.
+TEST_F(KeepaliveSchedulerTest, TestActiveSessionNotPinged) {
+  SessionPair pair;
+  scheduler.AddSession(&pair.device);
+
+  for (int64_t now = 0; now < 10000; now += 500) {
+    pair.server.SendData("type", "data");
+    pair.Pump();
+    EXPECT_EQ(0, AdvanceTo(now));
+  }
+  EXPECT_EQ(0, scheduler.pings_sent());
+}
+
+// Tests that a session whose server stops answering is reported after the
+// configured number of missed pings, and then left alone.
+TEST_F(KeepaliveSchedulerTest, TestLivenessFailure) {
+  SessionPair pair;
+  scheduler.AddSession(&pair.device);
+
+  EXPECT_EQ(1, AdvanceTo(1000));
+  EXPECT_EQ(1, AdvanceTo(1100));
+  EXPECT_EQ(1, AdvanceTo(1200));
+
+  EXPECT_CALL(listener, OnLivenessFailure(&pair.device, 3));
+  EXPECT_EQ(0, AdvanceTo(1300));
+  EXPECT_EQ(1, scheduler.liveness_failures());
+
+  EXPECT_EQ(0, AdvanceTo(100000));
+  EXPECT_EQ(3, scheduler.pings_sent());
+}
+
+// Tests that traffic other than the ack does not answer a ping.
+TEST_F(KeepaliveSchedulerTest, TestDataDoesNotAnswerPing) {
+  SessionPair pair;
+  scheduler.AddSession(&pair.device);
+
+  // The server keeps sending data but never reads the pings.
+  EXPECT_EQ(1, AdvanceTo(1000));
+  for (int64_t now = 1050; now < 1300; now += 50) {
+    pair.server.SendData("type", "data");
+    pair.device_interface.Pump();
+    EXPECT_EQ(now % 100 == 0 ? 1 : 0, AdvanceTo(now)) << now;
+  }
+
+  EXPECT_CALL(listener, OnLivenessFailure(&pair.device, 3));
+  EXPECT_EQ(0, AdvanceTo(1300));
+  EXPECT_EQ(0, pair.server.requests_received());
+}
+
+// Tests that a late answer resets the count of missed pings.
+TEST_F(KeepaliveSchedulerTest, TestLateAnswer) {
+  SessionPair pair;
+  scheduler.AddSession(&pair.device);
+
+  EXPECT_EQ(1, AdvanceTo(1000));
+  EXPECT_EQ(1, AdvanceTo(1100));
+  EXPECT_EQ(1, AdvanceTo(1200));
+  pair.Pump();
+  EXPECT_EQ(0, AdvanceTo(1300));
+
+  EXPECT_EQ(1, AdvanceTo(2300));
+  EXPECT_EQ(1, AdvanceTo(2400));
+  EXPECT_EQ(1, AdvanceTo(2500));
+  EXPECT_CALL(listener, OnLivenessFailure(&pair.device, 6));
+  EXPECT_EQ(0, AdvanceTo(2600));
+}
+
+// Tests that removed sessions are not pinged, and that the listener may
+// remove the session that failed.
+TEST_F(KeepaliveSchedulerTest, TestRemoveSession) {
+  SessionPair removed;
+  SessionPair failing;
+  scheduler.AddSession(&removed.device);
+  scheduler.AddSession(&failing.device);
+  scheduler.AddSession(&failing.device);
+  EXPECT_EQ(2, scheduler.num_sessions());
+  scheduler.RemoveSession(&removed.device);
+  EXPECT_EQ(1, scheduler.num_sessions());
+
+  EXPECT_CALL(listener, OnLivenessFailure(&failing.device, 3))
+      .WillOnce(WithArg<0>(
+          Invoke(&scheduler, &KeepaliveScheduler::RemoveSession)));
+  EXPECT_EQ(1, AdvanceTo(1000));
+  EXPECT_EQ(1, AdvanceTo(1100));
+  EXPECT_EQ(1, AdvanceTo(1200));
+  EXPECT_EQ(0, AdvanceTo(1300));
+  EXPECT_EQ(0, scheduler.num_sessions());
+  removed.Pump();
+  EXPECT_EQ(0, removed.server.requests_received());
+}
+
+}  // namespace device
+}  // namespace anymote
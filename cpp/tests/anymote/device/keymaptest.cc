@@ -0,0 +1,78 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for LookupKeyStroke.
+
+#include <anymote/device/keymap.h>
+#include <gtest/gtest.h>
+
+namespace anymote {
+namespace device {
+
+// Expects a character to be typed with the given key stroke.
+static void ExpectStroke(char c, messages::Code keycode, bool shift) {
+  KeyStroke stroke;
+  ASSERT_TRUE(LookupKeyStroke(c, &stroke)) << "'" << c << "'";
+  EXPECT_EQ(keycode, stroke.keycode) << "'" << c << "'";
+  EXPECT_EQ(shift, stroke.shift) << "'" << c << "'";
+}
+
+// Tests letters and digits.
+TEST(KeymapTest, TestAlphanumeric) {
+  for (int i = 0; i < 26; ++i) {
+    messages::Code keycode =
+        static_cast<messages::Code>(messages::KEYCODE_A + i);
+    ExpectStroke('a' + i, keycode, false);
+    ExpectStroke('A' + i, keycode, true);
+  }
+  for (int i = 0; i < 10; ++i) {
+    ExpectStroke('0' + i,
+                 static_cast<messages::Code>(messages::KEYCODE_0 + i), false);
+  }
+}
+
+// Tests punctuation and whitespace.
+TEST(KeymapTest, TestPunctuation) {
+  ExpectStroke(' ', messages::KEYCODE_SPACE, false);
+  ExpectStroke('\n', messages::KEYCODE_ENTER, false);
+  ExpectStroke('\t', messages::KEYCODE_TAB, false);
+  ExpectStroke('\b', messages::KEYCODE_DEL, false);
+  ExpectStroke('@', messages::KEYCODE_AT, false);
+  ExpectStroke('.', messages::KEYCODE_PERIOD, false);
+  ExpectStroke('>', messages::KEYCODE_PERIOD, true);
+  ExpectStroke('!', messages::KEYCODE_1, true);
+  ExpectStroke(')', messages::KEYCODE_0, true);
+  ExpectStroke('"', messages::KEYCODE_APOSTROPHE, true);
+  ExpectStroke('~', messages::KEYCODE_GRAVE, true);
+  ExpectStroke('_', messages::KEYCODE_MINUS, true);
+}
+
+// Tests that every printable ASCII character can be typed, and nothing else.
+TEST(KeymapTest, TestCoverage) {
+  for (int c = 0; c < 256; ++c) {
+    KeyStroke stroke;
+    stroke.keycode = messages::KEYCODE_UNKNOWN;
+    bool printable = c >= 0x20 && c < 0x7f;
+    bool typed = LookupKeyStroke(static_cast<char>(c), &stroke);
+    EXPECT_EQ(printable || c == '\n' || c == '\t' || c == '\b', typed) << c;
+    if (typed) {
+      EXPECT_NE(messages::KEYCODE_UNKNOWN, stroke.keycode) << c;
+    } else {
+      EXPECT_EQ(messages::KEYCODE_UNKNOWN, stroke.keycode) << c;
+    }
+  }
+}
+
+}  // namespace device
+}  // namespace anymote
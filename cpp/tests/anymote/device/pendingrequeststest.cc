@@ -0,0 +1,161 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for PendingRequests.
+
+#include <anymote/device/pendingrequests.h>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "anymote/util/fakeclock.h"
+
+using ::testing::InSequence;
+using ::testing::IsNull;
+using ::testing::NotNull;
+
+namespace anymote {
+namespace device {
+
+// Mock request callback.
+class MockRequestCallback : public RequestCallback {
+ public:
+  MOCK_METHOD4(OnRequestComplete,
+               void(int32_t sequence_number, Result result,
+                    const messages::ResponseMessage* response,
+                    int64_t rtt_micros));
+};
+
+// Test fixture for a PendingRequests test.
+class PendingRequestsTest : public ::testing::Test {
+ public:
+  PendingRequestsTest()
+      : clock(),
+        requests(64000, &clock) {
+  }
+
+ protected:
+  util::FakeClock clock;
+  PendingRequests requests;
+  MockRequestCallback callback;
+  messages::ResponseMessage response;
+};
+
+// Tests that responses complete the matching request with its round-trip
+// time, in any order.
+TEST_F(PendingRequestsTest, TestComplete) {
+  InSequence sequence;
+
+  requests.Add(1, kAckResponse, &callback);
+  clock.Advance(100);
+  requests.Add(2, kAckResponse, &callback);
+  EXPECT_EQ(2, requests.size());
+
+  clock.Advance(50);
+  EXPECT_CALL(callback, OnRequestComplete(2, RequestCallback::kResponse,
+                                          NotNull(), 50));
+  EXPECT_TRUE(requests.Complete(2, response));
+
+  clock.Advance(50);
+  EXPECT_CALL(callback, OnRequestComplete(1, RequestCallback::kResponse,
+                                          NotNull(), 200));
+  EXPECT_TRUE(requests.Complete(1, response));
+
+  EXPECT_FALSE(requests.Complete(1, response));
+  EXPECT_EQ(0, requests.size());
+
+  RttStats stats = requests.rtt_stats();
+  EXPECT_EQ(2, stats.count);
+  EXPECT_EQ(250, stats.total_micros);
+  EXPECT_EQ(50, stats.min_micros);
+  EXPECT_EQ(200, stats.max_micros);
+  EXPECT_EQ(200, stats.last_micros);
+}
+
+// Tests that unanswered requests time out.
+TEST_F(PendingRequestsTest, TestTimeout) {
+  requests.Add(1, kAckResponse, &callback);
+  clock.Advance(32000);
+  requests.Add(2, kAckResponse, &callback);
+
+  clock.Advance(31999);
+  EXPECT_EQ(0, requests.Expire());
+
+  clock.Advance(1000);
+  EXPECT_CALL(callback, OnRequestComplete(1, RequestCallback::kTimeout,
+                                          IsNull(), 64999));
+  EXPECT_EQ(1, requests.Expire());
+  EXPECT_EQ(1, requests.size());
+
+  // A late response is ignored.
+  EXPECT_FALSE(requests.Complete(1, response));
+  EXPECT_EQ(0, requests.rtt_stats().count);
+}
+
+// Tests that a request with a sequence number already in flight aborts the
+// previous request.
+TEST_F(PendingRequestsTest, TestReplace) {
+  MockRequestCallback other_callback;
+  requests.Add(1, kAckResponse, &callback);
+
+  EXPECT_CALL(callback, OnRequestComplete(1, RequestCallback::kAborted,
+                                          IsNull(), 0));
+  requests.Add(1, kAckResponse, &other_callback);
+
+  EXPECT_CALL(other_callback, OnRequestComplete(1, RequestCallback::kResponse,
+                                                NotNull(), 0));
+  requests.Complete(1, response);
+}
+
+// Tests that requests with the same sequence number are told apart by the
+// kind of response that answers them.
+TEST_F(PendingRequestsTest, TestResponseTypes) {
+  MockRequestCallback fling_callback;
+  requests.Add(1, kAckResponse, &callback);
+  requests.Add(1, kFlingResultResponse, &fling_callback);
+  EXPECT_EQ(2, requests.size());
+
+  // A data response answers neither.
+  messages::ResponseMessage data;
+  data.mutable_data_message()->set_type("type");
+  EXPECT_FALSE(requests.Complete(1, data));
+
+  messages::ResponseMessage fling_result;
+  fling_result.mutable_fling_result_message()->set_result(
+      messages::FlingResult_Result_SUCCESS);
+  EXPECT_CALL(fling_callback,
+              OnRequestComplete(1, RequestCallback::kResponse, NotNull(), 0));
+  EXPECT_TRUE(requests.Complete(1, fling_result));
+  EXPECT_FALSE(requests.Complete(1, fling_result));
+
+  EXPECT_CALL(callback,
+              OnRequestComplete(1, RequestCallback::kResponse, NotNull(), 0));
+  EXPECT_TRUE(requests.Complete(1, response));
+  EXPECT_EQ(0, requests.size());
+}
+
+// Tests aborting all requests.
+TEST_F(PendingRequestsTest, TestAbortAll) {
+  requests.Add(1, kAckResponse, &callback);
+  requests.Add(2, kAckResponse, &callback);
+
+  EXPECT_CALL(callback, OnRequestComplete(1, RequestCallback::kAborted,
+                                          IsNull(), 0));
+  EXPECT_CALL(callback, OnRequestComplete(2, RequestCallback::kAborted,
+                                          IsNull(), 0));
+  requests.AbortAll();
+  EXPECT_EQ(0, requests.size());
+  EXPECT_EQ(0, requests.Expire());
+}
+
+}  // namespace device
+}  // namespace anymote
@@ -0,0 +1,338 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for ServerSession.
+
+#include <anymote/device/devicesession.h>
+#include <anymote/server/serversession.h>
+#include <anymote/wire/protobufwireadapter.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using ::testing::_;
+using ::testing::InSequence;
+using ::testing::Invoke;
+using ::testing::Return;
+using ::testing::StrictMock;
+
+namespace anymote {
+namespace server {
+
+// Mock request listener.
+class MockRequestListener : public RequestListener {
+ public:
+  MOCK_METHOD2(OnKeyEvent, void(messages::Code keycode,
+                                messages::Action action));
+  MOCK_METHOD2(OnMouseEvent, void(int32_t x_delta, int32_t y_delta));
+  MOCK_METHOD2(OnMouseWheel, void(int32_t x_scroll, int32_t y_scroll));
+  MOCK_METHOD2(OnData, void(const std::string& type,
+                            const std::string& data));
+  MOCK_METHOD2(OnConnect, void(const std::string& device_name,
+                               int32_t version));
+  MOCK_METHOD1(OnFling, bool(const std::string& uri));
+  MOCK_METHOD0(OnError, void());
+};
+
+// Mock wire adapter.
+class MockWireAdapter : public wire::WireAdapter {
+ public:
+  explicit MockWireAdapter(wire::WireInterface* interface)
+      : WireAdapter(interface) {}
+
+  MOCK_METHOD0(Init, void());
+  MOCK_METHOD1(SendMessage, void(const messages::RemoteMessage& message));
+  MOCK_METHOD0(GetNextMessage, void());
+  MOCK_METHOD1(OnBytesReceived, void(const std::vector<uint8_t>& data));
+  MOCK_METHOD0(OnError, void());
+};
+
+// Mock wire interface.
+class MockWireInterface : public wire::WireInterface {
+ public:
+  MOCK_METHOD1(Send, void(const std::vector<uint8_t>& data));
+  MOCK_METHOD1(Receive, void(size_t num_bytes));
+};
+
+// Test fixture for a ServerSession test.
+class ServerSessionTest : public ::testing::Test {
+ public:
+  ServerSessionTest()
+      : interface(),
+        adapter(&interface),
+        listener(),
+        session(&adapter, &listener) {
+  }
+
+ protected:
+  StrictMock<MockWireInterface> interface;
+  StrictMock<MockWireAdapter> adapter;
+  StrictMock<MockRequestListener> listener;
+  ServerSession session;
+};
+
+// Defines a matcher for protobuf messages.
+MATCHER_P(ProtoMatcher, proto, "") {
+  return proto.SerializeAsString() == arg.SerializeAsString();
+}
+
+// Tests starting a session.
+TEST_F(ServerSessionTest, TestStartSession) {
+  EXPECT_CALL(adapter, Init());
+
+  session.StartSession();
+}
+
+// Tests that a ping is acked with its sequence number.
+TEST_F(ServerSessionTest, TestPing) {
+  messages::RemoteMessage ping;
+  ping.set_sequence_number(7);
+  ping.mutable_request_message();
+
+  messages::RemoteMessage ack;
+  ack.set_sequence_number(7);
+  ack.mutable_response_message();
+
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(ack)));
+
+  session.OnMessage(ping);
+  EXPECT_EQ(1, session.responses_sent());
+}
+
+// Tests that input events are dispatched and not answered, even with a
+// sequence number.
+TEST_F(ServerSessionTest, TestInputEvents) {
+  InSequence sequence;
+
+  messages::RemoteMessage key_event;
+  key_event.set_sequence_number(1);
+  key_event.mutable_request_message()->mutable_key_event_message()
+      ->set_keycode(messages::KEYCODE_TV_POWER);
+  key_event.mutable_request_message()->mutable_key_event_message()
+      ->set_action(messages::DOWN);
+
+  messages::RemoteMessage mouse_event;
+  mouse_event.mutable_request_message()->mutable_mouse_event_message()
+      ->set_x_delta(-50);
+  mouse_event.mutable_request_message()->mutable_mouse_event_message()
+      ->set_y_delta(100);
+
+  messages::RemoteMessage mouse_wheel;
+  mouse_wheel.mutable_request_message()->mutable_mouse_wheel_message()
+      ->set_x_scroll(10);
+  mouse_wheel.mutable_request_message()->mutable_mouse_wheel_message()
+      ->set_y_scroll(-20);
+
+  EXPECT_CALL(listener, OnKeyEvent(messages::KEYCODE_TV_POWER,
+                                   messages::DOWN));
+  EXPECT_CALL(listener, OnMouseEvent(-50, 100));
+  EXPECT_CALL(listener, OnMouseWheel(10, -20));
+
+  session.OnMessage(key_event);
+  session.OnMessage(mouse_event);
+  session.OnMessage(mouse_wheel);
+  EXPECT_EQ(3, session.requests_received());
+  EXPECT_EQ(0, session.responses_sent());
+}
+
+// Tests that data and connect messages are dispatched and not answered.
+TEST_F(ServerSessionTest, TestDataAndConnect) {
+  InSequence sequence;
+
+  messages::RemoteMessage data;
+  data.mutable_request_message()->mutable_data_message()->set_type("foo");
+  data.mutable_request_message()->mutable_data_message()->set_data("bar");
+
+  messages::RemoteMessage connect;
+  connect.mutable_request_message()->mutable_connect_message()
+      ->set_device_name("device");
+  connect.mutable_request_message()->mutable_connect_message()
+      ->set_version(3);
+
+  EXPECT_CALL(listener, OnData("foo", "bar"));
+  EXPECT_CALL(listener, OnConnect("device", 3));
+
+  session.OnMessage(data);
+  session.OnMessage(connect);
+}
+
+// Tests that flings are answered with the result of the listener.
+TEST_F(ServerSessionTest, TestFling) {
+  InSequence sequence;
+
+  messages::RemoteMessage fling;
+  fling.set_sequence_number(12);
+  fling.mutable_request_message()->mutable_fling_message()
+      ->set_uri("http://foo");
+
+  messages::RemoteMessage success;
+  success.set_sequence_number(12);
+  success.mutable_response_message()->mutable_fling_result_message()
+      ->set_result(messages::FlingResult_Result_SUCCESS);
+
+  messages::RemoteMessage failure;
+  failure.set_sequence_number(12);
+  failure.mutable_response_message()->mutable_fling_result_message()
+      ->set_result(messages::FlingResult_Result_FAILURE);
+
+  EXPECT_CALL(listener, OnFling("http://foo")).WillOnce(Return(true));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(success)));
+  EXPECT_CALL(listener, OnFling("http://foo")).WillOnce(Return(false));
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(failure)));
+
+  session.OnMessage(fling);
+  session.OnMessage(fling);
+}
+
+// Tests that messages without a request, and requests without a sequence
+// number or any content, are ignored.
+TEST_F(ServerSessionTest, TestIgnoredMessages) {
+  messages::RemoteMessage response;
+  response.set_sequence_number(1);
+  response.mutable_response_message();
+
+  messages::RemoteMessage empty_request;
+  empty_request.mutable_request_message();
+
+  session.OnMessage(response);
+  session.OnMessage(empty_request);
+  EXPECT_EQ(1, session.requests_received());
+}
+
+// Tests sending data to the device.
+TEST_F(ServerSessionTest, TestSendData) {
+  messages::RemoteMessage message;
+  message.mutable_response_message()->mutable_data_message()
+      ->set_type("foo");
+  message.mutable_response_message()->mutable_data_message()
+      ->set_data("bar");
+
+  EXPECT_CALL(adapter, SendMessage(ProtoMatcher(message)));
+
+  session.SendData("foo", "bar");
+}
+
+// Tests that the buffers of a large payload are not kept after it is sent.
+TEST_F(ServerSessionTest, TestSendLargeData) {
+  std::string large(100 * 1024, 'x');
+  std::vector<size_t> capacities;
+  EXPECT_CALL(adapter, SendMessage(_)).Times(2).WillRepeatedly(Invoke(
+      [&capacities](const messages::RemoteMessage& message) {
+        capacities.push_back(
+            message.response_message().data_message().data().capacity());
+      }));
+
+  session.SendData("foo", large);
+  session.SendData("foo", "bar");
+  ASSERT_EQ(2U, capacities.size());
+  EXPECT_GE(capacities[0], large.size());
+  EXPECT_LT(capacities[1], large.size());
+}
+
+// Tests that errors are forwarded to the listener.
+TEST_F(ServerSessionTest, TestError) {
+  EXPECT_CALL(listener, OnError());
+
+  session.OnError();
+}
+
+// Wire interface that queues sent bytes for a peer, which receives them when
+// the test pumps the queue.
+class QueueWireInterface : public wire::WireInterface {
+ public:
+  QueueWireInterface() : peer(NULL) {}
+
+  virtual void Send(const std::vector<uint8_t>& data) {
+    peer->pending.insert(peer->pending.end(), data.begin(), data.end());
+  }
+
+  virtual void Receive(size_t num_bytes) {}
+
+  // Delivers the bytes sent by the peer.
+  // @return Whether there were any.
+  bool Deliver() {
+    if (pending.empty()) {
+      return false;
+    }
+    std::vector<uint8_t> data;
+    data.swap(pending);
+    listener()->OnBufferReceived(&data[0], data.size());
+    return true;
+  }
+
+  QueueWireInterface* peer;
+  std::vector<uint8_t> pending;
+};
+
+// Anymote listener that records the responses of the server.
+class RecordingAnymoteListener : public device::AnymoteListener {
+ public:
+  RecordingAnymoteListener() : acks(0), fling_sequence_number(0) {}
+  virtual void OnAck() { acks++; }
+  virtual void OnData(const std::string& type, const std::string& data) {
+    this->data = type + ":" + data;
+  }
+  virtual void OnFlingResult(bool success, uint32_t sequence_number) {
+    fling_sequence_number = sequence_number;
+  }
+  virtual void OnError() { FAIL() << "Unexpected error"; }
+
+  int acks;
+  std::string data;
+  uint32_t fling_sequence_number;
+};
+
+// Tests a device session and a server session talking to each other.
+TEST(ServerSessionLoopbackTest, TestDeviceToServer) {
+  QueueWireInterface device_interface;
+  QueueWireInterface server_interface;
+  device_interface.peer = &server_interface;
+  server_interface.peer = &device_interface;
+  wire::ProtobufWireAdapter device_adapter(
+      &device_interface, wire::ProtobufWireAdapter::kStreamingReads);
+  wire::ProtobufWireAdapter server_adapter(
+      &server_interface, wire::ProtobufWireAdapter::kStreamingReads);
+
+  RecordingAnymoteListener device_listener;
+  StrictMock<MockRequestListener> server_listener;
+  device::DeviceSession device(&device_adapter, &device_listener);
+  ServerSession server(&server_adapter, &server_listener);
+  device.StartSession();
+  server.StartSession();
+
+  {
+    InSequence sequence;
+    EXPECT_CALL(server_listener, OnConnect("device", 1));
+    EXPECT_CALL(server_listener, OnKeyEvent(messages::KEYCODE_A,
+                                            messages::UP));
+    EXPECT_CALL(server_listener, OnFling("http://foo"))
+        .WillOnce(Return(true));
+  }
+
+  device.SendConnect("device", 1);
+  device.SendKeyEvent(messages::KEYCODE_A, messages::UP);
+  device.SendPing();
+  device.SendFling("http://foo", 42);
+  server.SendData("type", "data");
+  while (server_interface.Deliver() || device_interface.Deliver()) {
+  }
+
+  EXPECT_EQ(1, device_listener.acks);
+  EXPECT_EQ(42, device_listener.fling_sequence_number);
+  EXPECT_EQ("type:data", device_listener.data);
+}
+
+}  // namespace server
+}  // namespace anymote
@@ -0,0 +1,131 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for BufferPool.
+
+#include <anymote/util/bufferpool.h>
+#include <gtest/gtest.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+namespace anymote {
+namespace util {
+
+// Tests that requests are served from the smallest size class that fits.
+TEST(BufferPoolTest, TestSizeClasses) {
+  BufferPool pool(4);
+  const size_t sizes[] = {0, 64, 65, 512, 513, 4096, 4097, 65536, 65537,
+                          262144, 262145, 1048576};
+  const size_t capacities[] = {64, 64, 512, 512, 4096, 4096, 65536, 65536,
+                               262144, 262144, 1048576, 1048576};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    size_t capacity = 0;
+    uint8_t* buffer = pool.Acquire(sizes[i], &capacity);
+    EXPECT_EQ(capacities[i], capacity);
+    memset(buffer, 0xAB, capacity);
+    pool.Release(buffer, capacity);
+  }
+  EXPECT_EQ(1U, pool.free_buffers(0));
+  EXPECT_EQ(1U, pool.free_buffers(3));
+  EXPECT_EQ(1U, pool.free_buffers(5));
+}
+
+// Tests that released buffers are reused without allocating.
+TEST(BufferPoolTest, TestReuse) {
+  BufferPool pool(4);
+  size_t capacity = 0;
+  uint8_t* first = pool.Acquire(100, &capacity);
+  pool.Release(first, capacity);
+  EXPECT_EQ(1, pool.allocations());
+
+  for (int i = 0; i < 100; ++i) {
+    uint8_t* buffer = pool.Acquire(200, &capacity);
+    EXPECT_EQ(first, buffer);
+    pool.Release(buffer, capacity);
+  }
+  EXPECT_EQ(1, pool.allocations());
+}
+
+// Tests that no more than the maximum number of free buffers is kept.
+TEST(BufferPoolTest, TestMaxFreeBuffers) {
+  BufferPool pool(2);
+  std::vector<uint8_t*> buffers;
+  size_t capacity = 0;
+  for (int i = 0; i < 5; ++i) {
+    buffers.push_back(pool.Acquire(10, &capacity));
+  }
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    pool.Release(buffers[i], capacity);
+  }
+  EXPECT_EQ(2U, pool.free_buffers(0));
+  EXPECT_EQ(5, pool.allocations());
+}
+
+// Tests that the large classes keep fewer free buffers.
+TEST(BufferPoolTest, TestMaxFreeBytes) {
+  BufferPool pool(64);
+  std::vector<uint8_t*> buffers;
+  size_t capacity = 0;
+  for (int i = 0; i < 8; ++i) {
+    buffers.push_back(pool.Acquire(1000000, &capacity));
+  }
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    pool.Release(buffers[i], capacity);
+  }
+  EXPECT_EQ(4U, pool.free_buffers(BufferPool::kNumSizeClasses - 1));
+}
+
+// Tests that buffers larger than every size class are not pooled.
+TEST(BufferPoolTest, TestLargeBuffers) {
+  BufferPool pool(4);
+  size_t capacity = 0;
+  uint8_t* buffer = pool.Acquire(2000000, &capacity);
+  EXPECT_EQ(2000000U, capacity);
+  memset(buffer, 0, capacity);
+  pool.Release(buffer, capacity);
+  for (int i = 0; i < BufferPool::kNumSizeClasses; ++i) {
+    EXPECT_EQ(0U, pool.free_buffers(i));
+  }
+  EXPECT_EQ(1, pool.allocations());
+}
+
+// Tests that buffers can be acquired and released from several threads.
+TEST(BufferPoolTest, TestConcurrentUse) {
+  const int kNumThreads = 4;
+  BufferPool pool(8);
+
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < kNumThreads; ++thread) {
+    threads.push_back(std::thread([&pool, thread]() {
+      for (int i = 0; i < 10000; ++i) {
+        size_t capacity = 0;
+        uint8_t* buffer = pool.Acquire(1 + (i * 37) % 5000, &capacity);
+        buffer[0] = static_cast<uint8_t>(thread);
+        buffer[capacity - 1] = static_cast<uint8_t>(i);
+        EXPECT_EQ(static_cast<uint8_t>(thread), buffer[0]);
+        pool.Release(buffer, capacity);
+      }
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+
+  // Each thread holds at most one buffer at a time.
+  EXPECT_LE(pool.allocations(), kNumThreads * 3);
+}
+
+}  // namespace util
+}  // namespace anymote
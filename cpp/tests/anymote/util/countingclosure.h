@@ -0,0 +1,36 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Closure for tests that check how often work is run.
+
+#ifndef TV_GTVREMOTE_TESTS_ANYMOTE_UTIL_COUNTINGCLOSURE_H_
+#define TV_GTVREMOTE_TESTS_ANYMOTE_UTIL_COUNTINGCLOSURE_H_
+
+#include <anymote/util/closure.h>
+
+namespace anymote {
+namespace util {
+
+// Closure that counts how many times it has run.
+class CountingClosure : public Closure {
+ public:
+  CountingClosure() : count(0) {}
+  virtual void Run() { count++; }
+  int count;
+};
+
+}  // namespace util
+}  // namespace anymote
+
+#endif  // TV_GTVREMOTE_TESTS_ANYMOTE_UTIL_COUNTINGCLOSURE_H_
@@ -0,0 +1,81 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for EventLoopPool.
+
+#include <anymote/util/eventlooppool.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+
+namespace anymote {
+namespace util {
+
+// Closure that records the thread it ran on.
+class ThreadRecordingClosure : public Closure {
+ public:
+  ThreadRecordingClosure() : done(false) {}
+
+  virtual void Run() {
+    thread_id = std::this_thread::get_id();
+    done = true;
+  }
+
+  void Wait() {
+    while (!done) {
+      usleep(1000);
+    }
+  }
+
+  std::thread::id thread_id;
+  std::atomic<bool> done;
+};
+
+// Tests that loops are handed out least-loaded first.
+TEST(EventLoopPoolTest, TestAcquireLeastLoaded) {
+  EventLoopPool pool(3);
+
+  EventLoop* first = pool.AcquireLoop();
+  EventLoop* second = pool.AcquireLoop();
+  EventLoop* third = pool.AcquireLoop();
+  EXPECT_NE(first, second);
+  EXPECT_NE(first, third);
+  EXPECT_NE(second, third);
+
+  // Once a loop is released, it is the least loaded again.
+  pool.ReleaseLoop(second);
+  EXPECT_EQ(second, pool.AcquireLoop());
+}
+
+// Tests that every loop runs on its own thread.
+TEST(EventLoopPoolTest, TestLoopsRunOnThreads) {
+  EventLoopPool pool(2);
+  ASSERT_TRUE(pool.Start());
+
+  ThreadRecordingClosure closure0;
+  ThreadRecordingClosure closure1;
+  pool.loop(0)->Post(&closure0);
+  pool.loop(1)->Post(&closure1);
+  closure0.Wait();
+  closure1.Wait();
+
+  EXPECT_NE(closure0.thread_id, closure1.thread_id);
+  EXPECT_NE(std::this_thread::get_id(), closure0.thread_id);
+
+  pool.Stop();
+}
+
+}  // namespace util
+}  // namespace anymote
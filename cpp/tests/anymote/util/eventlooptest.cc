@@ -0,0 +1,106 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for EventLoop.
+
+#include <anymote/util/eventloop.h>
+#include <gtest/gtest.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <thread>
+#include "anymote/util/countingclosure.h"
+
+namespace anymote {
+namespace util {
+
+// Handler that records the events it receives.
+class RecordingHandler : public EventLoop::Handler {
+ public:
+  RecordingHandler() : events(0), count(0) {}
+  virtual void OnEvents(uint32_t ready) {
+    events = ready;
+    count++;
+  }
+  uint32_t events;
+  int count;
+};
+
+// Test fixture for an EventLoop test.
+class EventLoopTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    ASSERT_TRUE(loop.Init());
+  }
+
+  EventLoop loop;
+};
+
+// Tests that posted closures run on the next iteration.
+TEST_F(EventLoopTest, TestPost) {
+  CountingClosure closure;
+  loop.Post(&closure);
+  EXPECT_EQ(0, closure.count);
+
+  loop.RunOnce(0);
+  EXPECT_EQ(1, closure.count);
+
+  // Closures only run once per post.
+  loop.RunOnce(0);
+  EXPECT_EQ(1, closure.count);
+}
+
+// Tests that cancelled closures do not run.
+TEST_F(EventLoopTest, TestCancel) {
+  CountingClosure closure;
+  loop.Post(&closure);
+  loop.Cancel(&closure);
+
+  loop.RunOnce(0);
+  EXPECT_EQ(0, closure.count);
+}
+
+// Tests that handlers are notified when a file descriptor is ready.
+TEST_F(EventLoopTest, TestFdEvents) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+
+  RecordingHandler handler;
+  ASSERT_TRUE(loop.AddFd(fds[0], EPOLLIN, &handler));
+
+  loop.RunOnce(0);
+  EXPECT_EQ(0, handler.count);
+
+  ASSERT_EQ(1, write(fds[1], "x", 1));
+  loop.RunOnce(1000);
+  EXPECT_EQ(1, handler.count);
+  EXPECT_TRUE(handler.events & EPOLLIN);
+
+  // Removed file descriptors are no longer watched.
+  loop.RemoveFd(fds[0], &handler);
+  loop.RunOnce(0);
+  EXPECT_EQ(1, handler.count);
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// Tests that Stop makes Run return when invoked from another thread.
+TEST_F(EventLoopTest, TestStopFromOtherThread) {
+  std::thread thread(&EventLoop::Run, &loop);
+  loop.Stop();
+  thread.join();
+}
+
+}  // namespace util
+}  // namespace anymote
@@ -0,0 +1,43 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Fake clock for tests that depend on the passage of time.
+
+#ifndef TV_GTVREMOTE_TESTS_ANYMOTE_UTIL_FAKECLOCK_H_
+#define TV_GTVREMOTE_TESTS_ANYMOTE_UTIL_FAKECLOCK_H_
+
+#include <anymote/util/clock.h>
+
+namespace anymote {
+namespace util {
+
+// Clock that only moves when advanced by the test.
+class FakeClock : public Clock {
+ public:
+  FakeClock() : now_micros_(0) {}
+
+  virtual int64_t NowMicros() { return now_micros_; }
+
+  // Moves the clock forward.
+  // @param micros The number of microseconds to advance by.
+  void Advance(int64_t micros) { now_micros_ += micros; }
+
+ private:
+  int64_t now_micros_;
+};
+
+}  // namespace util
+}  // namespace anymote
+
+#endif  // TV_GTVREMOTE_TESTS_ANYMOTE_UTIL_FAKECLOCK_H_
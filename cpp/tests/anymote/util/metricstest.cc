@@ -0,0 +1,254 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for the metrics primitives and the metrics of the adapter and the
+// session. There is nothing to test when metrics are compiled out.
+
+#ifndef ANYMOTE_DISABLE_METRICS
+
+#include <anymote/device/devicesession.h>
+#include <anymote/util/metrics.h>
+#include <anymote/wire/protobufwireadapter.h>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "anymote/util/fakeclock.h"
+#include "anymote/wire/mocks.h"
+
+using ::testing::NiceMock;
+
+namespace anymote {
+namespace util {
+
+// Tests counting.
+TEST(MetricsTest, TestCounter) {
+  Counter counter;
+  counter.Increment();
+  counter.Add(41);
+  EXPECT_EQ(42, counter.value());
+}
+
+// Tests that a gauge remembers its maximum.
+TEST(MetricsTest, TestGauge) {
+  Gauge gauge;
+  gauge.Set(3);
+  gauge.Set(7);
+  gauge.Set(2);
+  EXPECT_EQ(2, gauge.value());
+  EXPECT_EQ(7, gauge.max());
+}
+
+// Tests that small values are counted exactly.
+TEST(MetricsTest, TestHistogramSmallValues) {
+  Histogram histogram;
+  for (int i = 1; i <= 10; ++i) {
+    histogram.Record(i);
+  }
+
+  HistogramSnapshot snapshot = histogram.Snapshot();
+  EXPECT_EQ(10, snapshot.count);
+  EXPECT_EQ(55, snapshot.sum);
+  EXPECT_EQ(1, snapshot.min);
+  EXPECT_EQ(10, snapshot.max);
+  EXPECT_DOUBLE_EQ(5.5, snapshot.Mean());
+  EXPECT_EQ(5, snapshot.Percentile(50));
+  EXPECT_EQ(9, snapshot.Percentile(90));
+  EXPECT_EQ(10, snapshot.Percentile(100));
+}
+
+// Tests that percentiles of large values are within the precision of the
+// histogram.
+TEST(MetricsTest, TestHistogramPrecision) {
+  Histogram histogram;
+  for (int64_t i = 1; i <= 100000; ++i) {
+    histogram.Record(i);
+  }
+
+  HistogramSnapshot snapshot = histogram.Snapshot();
+  EXPECT_EQ(100000, snapshot.max);
+  int64_t p50 = snapshot.Percentile(50);
+  int64_t p99 = snapshot.Percentile(99);
+  EXPECT_GE(p50, 50000);
+  EXPECT_LE(p50, 50000 + 50000 / 16);
+  EXPECT_GE(p99, 99000);
+  EXPECT_LE(p99, 100000);
+}
+
+// Tests that out of range values are clamped.
+TEST(MetricsTest, TestHistogramClamping) {
+  Histogram histogram;
+  histogram.Record(-5);
+  histogram.Record(static_cast<int64_t>(1) << 40);
+
+  HistogramSnapshot snapshot = histogram.Snapshot();
+  EXPECT_EQ(2, snapshot.count);
+  EXPECT_EQ(0, snapshot.min);
+  EXPECT_EQ((static_cast<int64_t>(1) << 32) - 1, snapshot.max);
+  EXPECT_EQ(0, snapshot.Percentile(50));
+  EXPECT_EQ(snapshot.max, snapshot.Percentile(100));
+}
+
+// Tests an empty histogram.
+TEST(MetricsTest, TestHistogramEmpty) {
+  HistogramSnapshot snapshot = Histogram().Snapshot();
+  EXPECT_EQ(0, snapshot.count);
+  EXPECT_EQ(0, snapshot.min);
+  EXPECT_EQ(0, snapshot.Percentile(99));
+}
+
+}  // namespace util
+
+namespace wire {
+
+// Listener that ignores everything.
+class NullMessageListener : public messages::MessageListener {
+ public:
+  virtual void OnMessage(const messages::RemoteMessage& message) {}
+  virtual void OnError() {}
+};
+
+// Tests the metrics of an adapter.
+TEST(WireMetricsTest, TestAdapterMetrics) {
+  NiceMock<MockWireInterface> interface;
+  ProtobufWireAdapter adapter(&interface,
+                              ProtobufWireAdapter::kStreamingReads);
+  NullMessageListener listener;
+  adapter.set_listener(&listener);
+  adapter.Init();
+
+  messages::RemoteMessage message;
+  message.mutable_request_message()->mutable_connect_message()
+      ->set_device_name("foo");
+  adapter.BeginBatch();
+  adapter.SendMessage(message);
+  adapter.SendMessage(message);
+  adapter.Flush();
+
+  uint8_t frames[20] = {9, 18, 7, 42, 5, 10, 3, 'f', 'o', 'o',
+                        9, 18, 7, 42, 5, 10, 3, 'f', 'o', 'o'};
+  adapter.OnBufferReceived(frames, 20);
+
+  WireMetricsSnapshot snapshot = adapter.metrics().Snapshot();
+  EXPECT_EQ(2, snapshot.messages_sent);
+  EXPECT_EQ(20, snapshot.bytes_sent);
+  EXPECT_EQ(1, snapshot.writes);
+  EXPECT_EQ(2, snapshot.messages_received);
+  EXPECT_EQ(20, snapshot.bytes_received);
+  EXPECT_EQ(0, snapshot.preamble_errors);
+  EXPECT_EQ(0, snapshot.oversized_frames);
+  EXPECT_EQ(0, snapshot.parse_errors);
+
+  // A message that is not a valid protocol buffer.
+  uint8_t invalid[2] = {1, 0xFF};
+  adapter.OnBufferReceived(invalid, 2);
+  EXPECT_EQ(1, adapter.metrics().Snapshot().parse_errors);
+
+  // A message larger than the maximum frame size.
+  adapter.set_max_frame_size(10);
+  uint8_t oversized[1] = {11};
+  adapter.OnBufferReceived(oversized, 1);
+  EXPECT_EQ(1, adapter.metrics().Snapshot().oversized_frames);
+}
+
+}  // namespace wire
+
+namespace device {
+
+// Listener that ignores everything.
+class NullAnymoteListener : public AnymoteListener {
+ public:
+  virtual void OnAck() {}
+  virtual void OnData(const std::string& type, const std::string& data) {}
+  virtual void OnFlingResult(bool success, uint32_t sequence_number) {}
+  virtual void OnError() {}
+};
+
+// Callback that ignores completions.
+class NullRequestCallback : public RequestCallback {
+ public:
+  virtual void OnRequestComplete(int32_t sequence_number, Result result,
+                                 const messages::ResponseMessage* response,
+                                 int64_t rtt_micros) {}
+};
+
+// Tests the metrics of a session.
+TEST(SessionMetricsTest, TestSessionMetrics) {
+  NiceMock<wire::MockWireInterface> interface;
+  wire::ProtobufWireAdapter adapter(&interface);
+  NullAnymoteListener listener;
+  DeviceSession session(&adapter, &listener);
+  session.StartSession();
+
+  util::FakeClock clock;
+  session.EnableRequestTracking(1000000, &clock);
+  NullRequestCallback callback;
+
+  session.SendKeyEvent(messages::KEYCODE_ENTER, messages::DOWN);
+  session.SendKeyEvent(messages::KEYCODE_ENTER, messages::UP);
+  session.SendMouseMove(1, 1);
+  int32_t sequence_number = session.SendPing(&callback);
+
+  clock.Advance(250);
+  messages::RemoteMessage ack;
+  ack.set_sequence_number(sequence_number);
+  session.OnMessage(ack);
+
+  SessionMetricsSnapshot snapshot = session.metrics().Snapshot();
+  EXPECT_EQ(2, snapshot.requests_sent[kKeyEventRequest]);
+  EXPECT_EQ(1, snapshot.requests_sent[kMouseMoveRequest]);
+  EXPECT_EQ(1, snapshot.requests_sent[kPingRequest]);
+  EXPECT_EQ(0, snapshot.requests_sent[kFlingRequest]);
+  EXPECT_EQ(1, snapshot.responses_received[kAckResponse]);
+  EXPECT_EQ(1, snapshot.ack_latency_micros.count);
+  EXPECT_EQ(250, snapshot.ack_latency_micros.max);
+  EXPECT_EQ(1, snapshot.listener_nanos.count);
+}
+
+// Tests sessions that share histograms or record none.
+TEST(SessionMetricsTest, TestSharedHistograms) {
+  NiceMock<wire::MockWireInterface> interfaces[3];
+  wire::ProtobufWireAdapter first_adapter(&interfaces[0]);
+  wire::ProtobufWireAdapter second_adapter(&interfaces[1]);
+  wire::ProtobufWireAdapter none_adapter(&interfaces[2]);
+  NullAnymoteListener listener;
+  SessionHistograms histograms;
+  DeviceSession first(&first_adapter, &listener, &histograms);
+  DeviceSession second(&second_adapter, &listener, &histograms);
+  DeviceSession none(&none_adapter, &listener, NULL);
+
+  util::FakeClock clock;
+  NullRequestCallback callback;
+  DeviceSession* sessions[] = { &first, &second, &none };
+  for (int i = 0; i < 3; ++i) {
+    sessions[i]->StartSession();
+    sessions[i]->EnableRequestTracking(1000000, &clock);
+    int32_t sequence_number = sessions[i]->SendPing(&callback);
+    clock.Advance(100);
+    messages::RemoteMessage ack;
+    ack.set_sequence_number(sequence_number);
+    sessions[i]->OnMessage(ack);
+  }
+
+  EXPECT_EQ(2, histograms.ack_latency_micros.Snapshot().count);
+  EXPECT_EQ(2, histograms.listener_nanos.Snapshot().count);
+  EXPECT_EQ(2, first.metrics().Snapshot().ack_latency_micros.count);
+  SessionMetricsSnapshot snapshot = none.metrics().Snapshot();
+  EXPECT_EQ(1, snapshot.responses_received[kAckResponse]);
+  EXPECT_EQ(0, snapshot.ack_latency_micros.count);
+  EXPECT_EQ(0, snapshot.listener_nanos.count);
+}
+
+}  // namespace device
+}  // namespace anymote
+
+#endif  // ANYMOTE_DISABLE_METRICS
@@ -0,0 +1,141 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for MpscQueue.
+
+#include <anymote/util/mpscqueue.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace anymote {
+namespace util {
+
+// Tests that elements are popped in the order they were pushed.
+TEST(MpscQueueTest, TestFifo) {
+  MpscQueue<int> queue(4);
+  EXPECT_TRUE(queue.empty());
+  EXPECT_TRUE(queue.Front() == NULL);
+
+  for (int i = 1; i <= 3; ++i) {
+    uint64_t ticket = 0;
+    int* value = queue.BeginPush(&ticket);
+    ASSERT_TRUE(value != NULL);
+    *value = i;
+    queue.CommitPush(ticket);
+  }
+
+  for (int i = 1; i <= 3; ++i) {
+    ASSERT_FALSE(queue.empty());
+    EXPECT_EQ(i, *queue.Front());
+    queue.Pop();
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+// Tests that a full queue rejects pushes until an element is popped.
+TEST(MpscQueueTest, TestFull) {
+  MpscQueue<int> queue(2);
+  uint64_t ticket = 0;
+  ASSERT_TRUE(queue.BeginPush(&ticket) != NULL);
+  queue.CommitPush(ticket);
+  ASSERT_TRUE(queue.BeginPush(&ticket) != NULL);
+  queue.CommitPush(ticket);
+  EXPECT_TRUE(queue.BeginPush(&ticket) == NULL);
+
+  queue.Pop();
+  EXPECT_TRUE(queue.BeginPush(&ticket) != NULL);
+}
+
+// Tests that an element is not visible until it has been committed, even if
+// later elements have been.
+TEST(MpscQueueTest, TestUncommitted) {
+  MpscQueue<int> queue(4);
+  uint64_t first = 0;
+  uint64_t second = 0;
+  *queue.BeginPush(&first) = 1;
+  *queue.BeginPush(&second) = 2;
+  queue.CommitPush(second);
+  EXPECT_TRUE(queue.empty());
+  EXPECT_TRUE(queue.Front() == NULL);
+
+  queue.CommitPush(first);
+  EXPECT_EQ(1, *queue.Front());
+}
+
+// Tests that slots keep their values, so buffers keep their capacity.
+TEST(MpscQueueTest, TestSlotReuse) {
+  MpscQueue<std::vector<uint8_t> > queue(1);
+  uint64_t ticket = 0;
+  queue.BeginPush(&ticket)->resize(100);
+  queue.CommitPush(ticket);
+  queue.Pop();
+
+  std::vector<uint8_t>* buffer = queue.BeginPush(&ticket);
+  EXPECT_GE(buffer->capacity(), 100U);
+}
+
+// Tests that elements from concurrent producers are all received, in order
+// for each producer, and that the size seen by producers stays within the
+// capacity while the consumer pops.
+TEST(MpscQueueTest, TestConcurrentProducers) {
+  const int kNumProducers = 4;
+  const int kNumElements = 10000;
+  const size_t kCapacity = 64;
+  MpscQueue<std::pair<int, int> > queue(kCapacity);
+  std::atomic<bool> size_in_range(true);
+
+  std::vector<std::thread> producers;
+  for (int producer = 0; producer < kNumProducers; ++producer) {
+    producers.push_back(std::thread([&queue, &size_in_range, producer,
+                                     kNumElements, kCapacity]() {
+      for (int i = 0; i < kNumElements; ++i) {
+        uint64_t ticket = 0;
+        std::pair<int, int>* element;
+        while ((element = queue.BeginPush(&ticket)) == NULL) {
+          std::this_thread::yield();
+        }
+        *element = std::make_pair(producer, i);
+        queue.CommitPush(ticket);
+        if (queue.size() > kCapacity) {
+          size_in_range = false;
+        }
+      }
+    }));
+  }
+
+  std::vector<int> next(kNumProducers, 0);
+  int received = 0;
+  while (received < kNumProducers * kNumElements) {
+    std::pair<int, int>* element = queue.Front();
+    if (element == NULL) {
+      std::this_thread::yield();
+      continue;
+    }
+    EXPECT_EQ(next[element->first], element->second);
+    next[element->first] = element->second + 1;
+    queue.Pop();
+    received++;
+  }
+
+  for (size_t i = 0; i < producers.size(); ++i) {
+    producers[i].join();
+  }
+  EXPECT_TRUE(queue.empty());
+  EXPECT_TRUE(size_in_range);
+}
+
+}  // namespace util
+}  // namespace anymote
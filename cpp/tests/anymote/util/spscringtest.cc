@@ -0,0 +1,119 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for SpscByteRing.
+
+#include <anymote/util/spscring.h>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+namespace anymote {
+namespace util {
+
+// Tests writing and reading bytes, including a write that does not fit.
+TEST(SpscByteRingTest, TestWriteAndRead) {
+  SpscByteRing ring(8);
+  EXPECT_EQ(8, ring.capacity());
+  EXPECT_EQ(0, ring.readable());
+
+  const uint8_t data[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  EXPECT_EQ(6, ring.Write(data, 6));
+  EXPECT_EQ(2, ring.Write(data + 6, 4));
+  EXPECT_EQ(0, ring.Write(data + 8, 2));
+  EXPECT_EQ(8, ring.readable());
+
+  size_t size = 0;
+  const uint8_t* region = ring.ReadableRegion(&size);
+  ASSERT_EQ(8, size);
+  EXPECT_EQ(std::vector<uint8_t>(data, data + 8),
+            std::vector<uint8_t>(region, region + size));
+  ring.Consume(3);
+  EXPECT_EQ(5, ring.readable());
+}
+
+// Tests that bytes written across the end of the ring are read back in order.
+TEST(SpscByteRingTest, TestWrapAround) {
+  SpscByteRing ring(8);
+  const uint8_t data[] = {1, 2, 3, 4, 5, 6, 7, 8};
+  ASSERT_EQ(6, ring.Write(data, 6));
+  ring.Consume(6);
+  ASSERT_EQ(5, ring.Write(data, 5));
+
+  // Only the bytes up to the end of the ring are contiguous.
+  size_t size = 0;
+  const uint8_t* region = ring.ReadableRegion(&size);
+  ASSERT_EQ(2, size);
+  EXPECT_EQ(1, region[0]);
+  EXPECT_EQ(2, region[1]);
+
+  uint8_t copy[5];
+  ring.Peek(copy, 5);
+  EXPECT_EQ(std::vector<uint8_t>(data, data + 5),
+            std::vector<uint8_t>(copy, copy + 5));
+
+  ring.Consume(2);
+  region = ring.ReadableRegion(&size);
+  ASSERT_EQ(3, size);
+  EXPECT_EQ(3, region[0]);
+}
+
+// Tests that a producer and a consumer on different threads see every byte
+// in order.
+TEST(SpscByteRingTest, TestConcurrent) {
+  const size_t kBytes = 1 << 18;
+  SpscByteRing ring(256);
+
+  std::thread producer([&ring, kBytes]() {
+    uint8_t chunk[37];
+    size_t sent = 0;
+    while (sent < kBytes) {
+      size_t size = std::min(sizeof(chunk), kBytes - sent);
+      for (size_t i = 0; i < size; ++i) {
+        chunk[i] = static_cast<uint8_t>((sent + i) * 7);
+      }
+      size_t written = 0;
+      while (written < size) {
+        size_t count = ring.Write(chunk + written, size - written);
+        if (count == 0) {
+          std::this_thread::yield();
+        }
+        written += count;
+      }
+      sent += size;
+    }
+  });
+
+  size_t received = 0;
+  size_t mismatches = 0;
+  while (received < kBytes) {
+    size_t size = 0;
+    const uint8_t* region = ring.ReadableRegion(&size);
+    for (size_t i = 0; i < size; ++i) {
+      if (region[i] != static_cast<uint8_t>((received + i) * 7)) {
+        mismatches++;
+      }
+    }
+    if (size == 0) {
+      std::this_thread::yield();
+    }
+    ring.Consume(size);
+    received += size;
+  }
+  producer.join();
+  EXPECT_EQ(0, mismatches);
+}
+
+}  // namespace util
+}  // namespace anymote
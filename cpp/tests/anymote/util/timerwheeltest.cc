@@ -0,0 +1,212 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for TimerWheel.
+
+#include <anymote/util/timerwheel.h>
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <vector>
+#include "anymote/util/countingclosure.h"
+
+namespace anymote {
+namespace util {
+
+// Tests that a timer fires once its deadline has passed, and only once.
+TEST(TimerWheelTest, TestExpire) {
+  TimerWheel wheel(0, 10, 8);
+  CountingClosure closure;
+  TimerWheel::Timer timer(&closure);
+
+  wheel.Schedule(&timer, 25);
+  EXPECT_TRUE(timer.scheduled());
+  EXPECT_EQ(0, wheel.Advance(24));
+  EXPECT_EQ(0, closure.count);
+
+  EXPECT_EQ(1, wheel.Advance(25));
+  EXPECT_EQ(1, closure.count);
+  EXPECT_FALSE(timer.scheduled());
+
+  EXPECT_EQ(0, wheel.Advance(100));
+  EXPECT_EQ(1, closure.count);
+}
+
+// Tests that timers further away than one lap of the wheel wait for their
+// deadline.
+TEST(TimerWheelTest, TestMultipleLaps) {
+  TimerWheel wheel(0, 10, 4);
+  CountingClosure near_closure;
+  CountingClosure far_closure;
+  TimerWheel::Timer near_timer(&near_closure);
+  TimerWheel::Timer far_timer(&far_closure);
+
+  // Both timers share a slot.
+  wheel.Schedule(&near_timer, 10);
+  wheel.Schedule(&far_timer, 50);
+
+  wheel.Advance(10);
+  EXPECT_EQ(1, near_closure.count);
+  EXPECT_EQ(0, far_closure.count);
+
+  wheel.Advance(49);
+  EXPECT_EQ(0, far_closure.count);
+  wheel.Advance(50);
+  EXPECT_EQ(1, far_closure.count);
+}
+
+// Tests that a large jump in time fires every timer that is due.
+TEST(TimerWheelTest, TestLargeAdvance) {
+  TimerWheel wheel(0, 10, 4);
+  CountingClosure closure;
+  TimerWheel::Timer timer1(&closure);
+  TimerWheel::Timer timer2(&closure);
+  TimerWheel::Timer timer3(&closure);
+  wheel.Schedule(&timer1, 5);
+  wheel.Schedule(&timer2, 35);
+  wheel.Schedule(&timer3, 1000);
+
+  EXPECT_EQ(2, wheel.Advance(500));
+  EXPECT_TRUE(timer3.scheduled());
+}
+
+// Tests cancelling and rescheduling timers.
+TEST(TimerWheelTest, TestCancelAndReschedule) {
+  TimerWheel wheel(0, 10, 8);
+  CountingClosure closure;
+  TimerWheel::Timer timer(&closure);
+
+  wheel.Schedule(&timer, 20);
+  wheel.Cancel(&timer);
+  EXPECT_FALSE(timer.scheduled());
+  EXPECT_EQ(0, wheel.Advance(30));
+
+  wheel.Schedule(&timer, 40);
+  wheel.Schedule(&timer, 60);
+  EXPECT_EQ(0, wheel.Advance(50));
+  EXPECT_EQ(1, wheel.Advance(60));
+}
+
+// Tests that a timer scheduled in the past fires on the next advance.
+TEST(TimerWheelTest, TestPastDeadline) {
+  TimerWheel wheel(100, 10, 8);
+  CountingClosure closure;
+  TimerWheel::Timer timer(&closure);
+
+  wheel.Schedule(&timer, 50);
+  EXPECT_EQ(1, wheel.Advance(100));
+}
+
+// Closure that records the time at which it ran.
+class RecordingClosure : public Closure {
+ public:
+  RecordingClosure() : now_micros(NULL), fired_micros(-1) {}
+  virtual void Run() { fired_micros = *now_micros; }
+  const int64_t* now_micros;
+  int64_t fired_micros;
+};
+
+// Tests that timers in every level, and beyond the top level, fire at their
+// deadline when the wheel advances one tick at a time.
+TEST(TimerWheelTest, TestLevels) {
+  // Four slots per level, so the levels reach 4, 16, 64 and 256 ticks away.
+  TimerWheel wheel(0, 10, 4);
+  const int kNumTimers = 700;
+  std::vector<RecordingClosure> closures(kNumTimers);
+  std::vector<TimerWheel::Timer*> timers;
+  int64_t now = 0;
+  for (int i = 0; i < kNumTimers; ++i) {
+    closures[i].now_micros = &now;
+    timers.push_back(new TimerWheel::Timer(&closures[i]));
+    wheel.Schedule(timers[i], 10 * i + 3);
+  }
+
+  for (now = 0; now <= 10 * kNumTimers; now += 10) {
+    wheel.Advance(now);
+  }
+  for (int i = 0; i < kNumTimers; ++i) {
+    EXPECT_EQ(10 * i + 10, closures[i].fired_micros) << "Timer " << i;
+    delete timers[i];
+  }
+}
+
+// Tests random schedules, cancellations and advances of various sizes
+// against the deadlines of the timers.
+TEST(TimerWheelTest, TestRandomSchedule) {
+  TimerWheel wheel(0, 10, 8);
+  const int kNumTimers = 200;
+  std::vector<RecordingClosure> closures(kNumTimers);
+  std::vector<TimerWheel::Timer*> timers;
+  int64_t now = 0;
+  for (int i = 0; i < kNumTimers; ++i) {
+    closures[i].now_micros = &now;
+    timers.push_back(new TimerWheel::Timer(&closures[i]));
+  }
+
+  unsigned int seed = 1;
+  for (int round = 0; round < 2000; ++round) {
+    TimerWheel::Timer* timer = timers[rand_r(&seed) % kNumTimers];
+    if (rand_r(&seed) % 4 == 0) {
+      wheel.Cancel(timer);
+    } else {
+      // Deadlines up to well past the reach of the top level.
+      int64_t delay = rand_r(&seed) % (1 << (rand_r(&seed) % 17));
+      wheel.Schedule(timer, now + delay);
+    }
+
+    int64_t previous = now;
+    now += rand_r(&seed) % (1 << (rand_r(&seed) % 12));
+    wheel.Advance(now);
+    for (int i = 0; i < kNumTimers; ++i) {
+      if (timers[i]->scheduled()) {
+        // Every timer that is due has fired.
+        EXPECT_GT(timers[i]->deadline_micros(), now);
+      } else if (closures[i].fired_micros == now && previous != now) {
+        EXPECT_LE(timers[i]->deadline_micros(), now);
+      }
+    }
+  }
+
+  for (int i = 0; i < kNumTimers; ++i) {
+    delete timers[i];
+  }
+}
+
+// Closure that cancels another timer when it runs.
+class CancellingClosure : public Closure {
+ public:
+  CancellingClosure(TimerWheel* wheel, TimerWheel::Timer* timer)
+      : wheel_(wheel), timer_(timer) {}
+  virtual void Run() { wheel_->Cancel(timer_); }
+
+ private:
+  TimerWheel* wheel_;
+  TimerWheel::Timer* timer_;
+};
+
+// Tests that a closure may cancel a timer that expired at the same time.
+TEST(TimerWheelTest, TestCancelFromClosure) {
+  TimerWheel wheel(0, 10, 8);
+  CountingClosure counting_closure;
+  TimerWheel::Timer counting_timer(&counting_closure);
+  CancellingClosure cancelling_closure(&wheel, &counting_timer);
+  TimerWheel::Timer cancelling_timer(&cancelling_closure);
+
+  wheel.Schedule(&cancelling_timer, 10);
+  wheel.Schedule(&counting_timer, 10);
+  EXPECT_EQ(1, wheel.Advance(10));
+  EXPECT_EQ(0, counting_closure.count);
+}
+
+}  // namespace util
+}  // namespace anymote
@@ -0,0 +1,207 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for CaptureReplayer.
+
+#include <anymote/wire/capturereader.h>
+#include <anymote/wire/capturereplayer.h>
+#include <anymote/wire/capturewriter.h>
+#include <anymote/wire/protobufwireadapter.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "anymote/util/fakeclock.h"
+#include "anymote/wire/mocks.h"
+
+using ::testing::NiceMock;
+
+namespace anymote {
+namespace wire {
+
+namespace {
+
+// Wire interface that records every write.
+class RecordingWireInterface : public WireInterface {
+ public:
+  virtual void Send(const std::vector<uint8_t>& data) {
+    writes.push_back(data);
+  }
+
+  virtual void Receive(size_t num_bytes) {}
+
+  std::vector<std::vector<uint8_t> > writes;
+};
+
+// Listener that records the sequence numbers of the messages it receives.
+class SequenceRecorder : public messages::MessageListener {
+ public:
+  virtual void OnMessage(const messages::RemoteMessage& message) {
+    sequence_numbers.push_back(message.sequence_number());
+  }
+  virtual void OnError() { ADD_FAILURE() << "Unexpected error"; }
+
+  std::vector<int32_t> sequence_numbers;
+};
+
+}  // namespace
+
+// Test fixture that captures the traffic of an adapter.
+class CaptureReplayerTest : public ::testing::Test {
+ protected:
+  CaptureReplayerTest()
+      : path(::testing::TempDir() + "capturereplayertest_capture"),
+        writer(&clock),
+        adapter(&interface, ProtobufWireAdapter::kStreamingReads) {
+  }
+
+  virtual void SetUp() {
+    adapter.set_frame_tap(&writer);
+    adapter.Init();
+    ASSERT_TRUE(writer.Open(path));
+  }
+
+  // Sends a ping with the given sequence number through the adapter.
+  void SendPing(int32_t sequence_number) {
+    messages::RemoteMessage ping;
+    ping.set_sequence_number(sequence_number);
+    ping.mutable_request_message();
+    adapter.SendMessage(ping);
+  }
+
+  // Finishes the capture and opens it for reading.
+  void OpenCapture() {
+    writer.Close();
+    ASSERT_TRUE(reader.Open(path));
+  }
+
+  // Returns the sequence numbers of the messages in the recorded writes.
+  std::vector<int32_t> Decode(const RecordingWireInterface& recorded) {
+    NiceMock<MockWireInterface> reader_interface;
+    SequenceRecorder recorder;
+    ProtobufWireAdapter decoder(&reader_interface,
+                                ProtobufWireAdapter::kStreamingReads);
+    decoder.set_listener(&recorder);
+    decoder.Init();
+    for (size_t i = 0; i < recorded.writes.size(); ++i) {
+      decoder.OnBytesReceived(recorded.writes[i]);
+    }
+    return recorder.sequence_numbers;
+  }
+
+  std::string path;
+  util::FakeClock clock;
+  CaptureWriter writer;
+  NiceMock<MockWireInterface> interface;
+  ProtobufWireAdapter adapter;
+  CaptureReader reader;
+};
+
+// Tests that frames are replayed with the pacing they were captured with.
+TEST_F(CaptureReplayerTest, TestOriginalPacing) {
+  clock.Advance(5000);
+  SendPing(1);
+  clock.Advance(100);
+  SendPing(2);
+  clock.Advance(150);
+  SendPing(3);
+  SendPing(4);
+  OpenCapture();
+
+  RecordingWireInterface replayed;
+  CaptureReplayer replayer(&reader, FrameTap::kSent, &replayed,
+                           CaptureReplayer::kOriginalPacing, &clock);
+  int64_t start = clock.NowMicros();
+  EXPECT_EQ(start, replayer.next_send_micros());
+  EXPECT_EQ(1, replayer.SendDue());
+
+  EXPECT_EQ(start + 100, replayer.next_send_micros());
+  clock.Advance(99);
+  EXPECT_EQ(0, replayer.SendDue());
+  clock.Advance(1);
+  EXPECT_EQ(1, replayer.SendDue());
+
+  // Frames due together are sent in one write.
+  clock.Advance(1000);
+  EXPECT_EQ(2, replayer.SendDue());
+  EXPECT_TRUE(replayer.done());
+  EXPECT_EQ(-1, replayer.next_send_micros());
+
+  EXPECT_EQ(3, replayed.writes.size());
+  EXPECT_EQ(4, replayer.frames_sent());
+  std::vector<int32_t> expected;
+  for (int32_t i = 1; i <= 4; ++i) {
+    expected.push_back(i);
+  }
+  EXPECT_EQ(expected, Decode(replayed));
+}
+
+// Tests that frames are replayed at once, and only in the chosen direction.
+TEST_F(CaptureReplayerTest, TestAsFastAsPossible) {
+  std::vector<int32_t> expected;
+  for (int32_t i = 0; i < 20000; ++i) {
+    SendPing(i);
+    expected.push_back(i);
+    clock.Advance(1000);
+
+    if (i % 2000 == 0) {
+      // A received frame, which is not replayed.
+      messages::RemoteMessage response;
+      response.set_sequence_number(-1);
+      response.mutable_response_message();
+      std::string bytes = response.SerializeAsString();
+      std::vector<uint8_t> frame(1, static_cast<uint8_t>(bytes.size()));
+      frame.insert(frame.end(), bytes.begin(), bytes.end());
+      adapter.OnBufferReceived(&frame[0], frame.size());
+    }
+  }
+  OpenCapture();
+
+  RecordingWireInterface replayed;
+  CaptureReplayer replayer(&reader, FrameTap::kSent, &replayed,
+                           CaptureReplayer::kAsFastAsPossible, &clock);
+  EXPECT_EQ(20000, replayer.SendDue());
+  EXPECT_TRUE(replayer.done());
+
+  // The frames are split into writes of at most kMaxWriteBytes.
+  EXPECT_LT(1, replayed.writes.size());
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < replayed.writes.size(); ++i) {
+    EXPECT_GE(CaptureReplayer::kMaxWriteBytes, replayed.writes[i].size());
+    bytes += replayed.writes[i].size();
+  }
+  EXPECT_EQ(bytes, replayer.bytes_sent());
+  EXPECT_EQ(expected, Decode(replayed));
+}
+
+// Tests that the received frames of a capture can be replayed.
+TEST_F(CaptureReplayerTest, TestReplayReceived) {
+  SendPing(1);
+  std::vector<uint8_t> frame;
+  frame.push_back(2);
+  frame.push_back(8);  // sequence_number = 7
+  frame.push_back(7);
+  adapter.OnBufferReceived(&frame[0], frame.size());
+  OpenCapture();
+
+  RecordingWireInterface replayed;
+  CaptureReplayer replayer(&reader, FrameTap::kReceived, &replayed,
+                           CaptureReplayer::kOriginalPacing, &clock);
+  EXPECT_EQ(1, replayer.Run());
+  ASSERT_EQ(1, replayed.writes.size());
+  EXPECT_EQ(frame, replayed.writes[0]);
+}
+
+}  // namespace wire
+}  // namespace anymote
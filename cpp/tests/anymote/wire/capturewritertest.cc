@@ -0,0 +1,234 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for CaptureWriter and CaptureReader.
+
+#include <anymote/wire/captureformat.h>
+#include <anymote/wire/capturereader.h>
+#include <anymote/wire/capturewriter.h>
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "anymote/util/fakeclock.h"
+
+namespace anymote {
+namespace wire {
+
+// Returns the path of a file for the given test in the temporary directory.
+static std::string CapturePath(const std::string& name) {
+  return ::testing::TempDir() + "capturewritertest_" + name;
+}
+
+// Returns the contents of a file.
+static std::vector<uint8_t> ReadFile(const std::string& path) {
+  std::vector<uint8_t> contents;
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    return contents;
+  }
+  uint8_t buffer[4096];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    contents.insert(contents.end(), buffer, buffer + size);
+  }
+  fclose(file);
+  return contents;
+}
+
+// Replaces the contents of a file.
+static void WriteFile(const std::string& path,
+                      const std::vector<uint8_t>& contents) {
+  FILE* file = fopen(path.c_str(), "wb");
+  ASSERT_TRUE(file != NULL);
+  if (!contents.empty()) {
+    fwrite(&contents[0], 1, contents.size(), file);
+  }
+  fclose(file);
+}
+
+// Returns the contents of a frame.
+static std::string FrameData(const CaptureReader::Frame& frame) {
+  return std::string(reinterpret_cast<const char*>(frame.data), frame.size);
+}
+
+// Shows a frame holding the given string to a tap.
+static void ShowFrame(FrameTap* tap, FrameTap::Direction direction,
+                      const std::string& data) {
+  tap->OnFrame(direction, reinterpret_cast<const uint8_t*>(data.data()),
+               data.size());
+}
+
+// Captures frames whose contents are their index, 10 microseconds apart.
+static void WriteNumberedFrames(const std::string& path, int count) {
+  util::FakeClock clock;
+  CaptureWriter writer(&clock);
+  ASSERT_TRUE(writer.Open(path));
+  for (int i = 0; i < count; ++i) {
+    ShowFrame(&writer, i % 2 ? FrameTap::kSent : FrameTap::kReceived,
+              std::to_string(i));
+    clock.Advance(10);
+  }
+  writer.Close();
+  EXPECT_EQ(count, writer.frames_captured());
+}
+
+// Tests that frames are read back with their direction and timestamp.
+TEST(CaptureWriterTest, TestRoundTrip) {
+  std::string path = CapturePath("roundtrip");
+  util::FakeClock clock;
+  clock.Advance(1000);
+  CaptureWriter writer(&clock);
+  ASSERT_TRUE(writer.Open(path));
+
+  ShowFrame(&writer, FrameTap::kSent, "foo");
+  clock.Advance(250);
+  ShowFrame(&writer, FrameTap::kReceived, "");
+  clock.Advance(1);
+  ShowFrame(&writer, FrameTap::kReceived, std::string(100000, 'x'));
+  writer.Close();
+
+  // Frames shown after the capture is closed are ignored.
+  ShowFrame(&writer, FrameTap::kSent, "bar");
+  EXPECT_EQ(3, writer.frames_captured());
+  EXPECT_EQ(0, writer.frames_dropped());
+
+  CaptureReader reader;
+  ASSERT_TRUE(reader.Open(path));
+  EXPECT_TRUE(reader.indexed());
+
+  CaptureReader::Frame frame;
+  ASSERT_TRUE(reader.Next(&frame));
+  EXPECT_EQ(1000, frame.timestamp_micros);
+  EXPECT_EQ(FrameTap::kSent, frame.direction);
+  EXPECT_EQ("foo", FrameData(frame));
+
+  ASSERT_TRUE(reader.Next(&frame));
+  EXPECT_EQ(1250, frame.timestamp_micros);
+  EXPECT_EQ(FrameTap::kReceived, frame.direction);
+  EXPECT_EQ(0, frame.size);
+
+  ASSERT_TRUE(reader.Next(&frame));
+  EXPECT_EQ(1251, frame.timestamp_micros);
+  EXPECT_EQ(std::string(100000, 'x'), FrameData(frame));
+
+  // The index is not read as a frame.
+  EXPECT_FALSE(reader.Next(&frame));
+
+  reader.Rewind();
+  ASSERT_TRUE(reader.Next(&frame));
+  EXPECT_EQ("foo", FrameData(frame));
+}
+
+// Tests seeking by time with the index.
+TEST(CaptureWriterTest, TestSeekToTime) {
+  std::string path = CapturePath("seek");
+  WriteNumberedFrames(path, 1000);
+
+  CaptureReader reader;
+  ASSERT_TRUE(reader.Open(path));
+  ASSERT_TRUE(reader.indexed());
+
+  CaptureReader::Frame frame;
+  reader.SeekToTime(5005);
+  ASSERT_TRUE(reader.Next(&frame));
+  EXPECT_EQ(5010, frame.timestamp_micros);
+  EXPECT_EQ("501", FrameData(frame));
+
+  reader.SeekToTime(2560);
+  ASSERT_TRUE(reader.Next(&frame));
+  EXPECT_EQ("256", FrameData(frame));
+
+  reader.SeekToTime(-1);
+  ASSERT_TRUE(reader.Next(&frame));
+  EXPECT_EQ("0", FrameData(frame));
+
+  reader.SeekToTime(10000);
+  EXPECT_FALSE(reader.Next(&frame));
+}
+
+// Tests that a capture cut off while it was written is read up to its last
+// complete record, without an index.
+TEST(CaptureWriterTest, TestTruncatedCapture) {
+  std::string path = CapturePath("truncated");
+  WriteNumberedFrames(path, 300);
+
+  // Cut the capture in the middle of the record of frame 299.
+  std::vector<uint8_t> contents = ReadFile(path);
+  size_t records_size = 0;
+  for (int i = 0; i < 299; ++i) {
+    records_size += kCaptureRecordHeaderSize + std::to_string(i).size();
+  }
+  contents.resize(kCaptureFileHeaderSize + records_size + 5);
+  WriteFile(path, contents);
+
+  CaptureReader reader;
+  ASSERT_TRUE(reader.Open(path));
+  EXPECT_FALSE(reader.indexed());
+
+  CaptureReader::Frame frame;
+  int frames = 0;
+  while (reader.Next(&frame)) {
+    EXPECT_EQ(std::to_string(frames), FrameData(frame));
+    frames++;
+  }
+  EXPECT_EQ(299, frames);
+
+  // Seeking scans the capture.
+  reader.SeekToTime(2980);
+  ASSERT_TRUE(reader.Next(&frame));
+  EXPECT_EQ("298", FrameData(frame));
+}
+
+// Tests that frames are dropped rather than buffered beyond the limit.
+TEST(CaptureWriterTest, TestBufferLimit) {
+  std::string path = CapturePath("limit");
+  util::FakeClock clock;
+  CaptureWriter writer(&clock);
+  writer.set_max_buffered_bytes(kCaptureRecordHeaderSize + 8);
+  ASSERT_TRUE(writer.Open(path));
+
+  ShowFrame(&writer, FrameTap::kSent, "too large");
+  ShowFrame(&writer, FrameTap::kSent, "fits");
+  writer.Close();
+  EXPECT_EQ(1, writer.frames_captured());
+  EXPECT_EQ(1, writer.frames_dropped());
+
+  CaptureReader reader;
+  ASSERT_TRUE(reader.Open(path));
+  CaptureReader::Frame frame;
+  ASSERT_TRUE(reader.Next(&frame));
+  EXPECT_EQ("fits", FrameData(frame));
+  EXPECT_FALSE(reader.Next(&frame));
+}
+
+// Tests that files which are missing or not captures are rejected.
+TEST(CaptureWriterTest, TestInvalidFiles) {
+  util::FakeClock clock;
+  CaptureWriter writer(&clock);
+  EXPECT_FALSE(writer.Open(CapturePath("missing/capture")));
+
+  CaptureReader reader;
+  EXPECT_FALSE(reader.Open(CapturePath("missing/capture")));
+
+  std::string path = CapturePath("invalid");
+  WriteFile(path, std::vector<uint8_t>(64, 'x'));
+  EXPECT_FALSE(reader.Open(path));
+
+  WriteFile(path, std::vector<uint8_t>());
+  EXPECT_FALSE(reader.Open(path));
+}
+
+}  // namespace wire
+}  // namespace anymote
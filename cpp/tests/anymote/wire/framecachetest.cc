@@ -0,0 +1,84 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for FrameCache.
+
+#include <anymote/messages/remote.pb.h>
+#include <anymote/wire/framecache.h>
+#include <gtest/gtest.h>
+#include <string>
+
+namespace anymote {
+namespace wire {
+
+// Returns a key event serialized by the generic serializer, preamble
+// included.
+static std::string KeyEventFrame(int keycode, int action) {
+  messages::RemoteMessage message;
+  messages::KeyEvent* key_event =
+      message.mutable_request_message()->mutable_key_event_message();
+  key_event->set_keycode(static_cast<messages::Code>(keycode));
+  key_event->set_action(static_cast<messages::Action>(action));
+  std::string bytes = message.SerializeAsString();
+  return std::string(1, static_cast<char>(bytes.size())) + bytes;
+}
+
+// Tests that every cached frame holds the same bytes as the generic
+// serializer writes.
+TEST(FrameCacheTest, TestKeyEventFrames) {
+  const FrameCache* cache = FrameCache::Get();
+  int num_frames = 0;
+  for (int keycode = 0; keycode < messages::Code_ARRAYSIZE; ++keycode) {
+    for (int action = 0; action < messages::Action_ARRAYSIZE; ++action) {
+      size_t size = 0;
+      const uint8_t* frame = cache->KeyEventFrame(
+          static_cast<messages::Code>(keycode),
+          static_cast<messages::Action>(action), &size);
+      if (!messages::Code_IsValid(keycode)) {
+        EXPECT_TRUE(frame == NULL) << keycode;
+        continue;
+      }
+      ASSERT_TRUE(frame != NULL) << keycode;
+      EXPECT_LE(size, FrameCache::kMaxFrameSize);
+      EXPECT_EQ(KeyEventFrame(keycode, action),
+                std::string(reinterpret_cast<const char*>(frame), size))
+          << keycode << " " << action;
+      num_frames++;
+    }
+  }
+  EXPECT_GT(num_frames, 200);
+}
+
+// Tests that events outside the protocol are not cached.
+TEST(FrameCacheTest, TestUndefinedEvents) {
+  const FrameCache* cache = FrameCache::Get();
+  size_t size = 0;
+  EXPECT_TRUE(cache->KeyEventFrame(static_cast<messages::Code>(-1),
+                                   messages::DOWN, &size) == NULL);
+  EXPECT_TRUE(cache->KeyEventFrame(
+      static_cast<messages::Code>(messages::Code_ARRAYSIZE), messages::DOWN,
+      &size) == NULL);
+  EXPECT_TRUE(cache->KeyEventFrame(messages::KEYCODE_HOME,
+                                   static_cast<messages::Action>(2),
+                                   &size) == NULL);
+  EXPECT_EQ(0, size);
+}
+
+// Tests that the cache is shared.
+TEST(FrameCacheTest, TestShared) {
+  EXPECT_EQ(FrameCache::Get(), FrameCache::Get());
+}
+
+}  // namespace wire
+}  // namespace anymote
@@ -0,0 +1,342 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for FrameDecoder.
+
+#include <anymote/wire/framedecoder.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+using ::google::protobuf::io::CodedOutputStream;
+
+namespace anymote {
+namespace wire {
+
+// Handler that keeps a copy of every frame.
+class CollectingHandler : public FrameDecoder::Handler {
+ public:
+  virtual void OnFrame(const uint8_t* data, size_t size) {
+    frames.push_back(std::vector<uint8_t>(data, data + size));
+  }
+
+  std::vector<std::vector<uint8_t> > frames;
+};
+
+// Appends a frame holding the given bytes to a stream.
+static void AppendFrame(const std::vector<uint8_t>& frame,
+                        std::vector<uint8_t>* stream) {
+  uint8_t preamble[FrameDecoder::kMaxPreambleSize];
+  uint8_t* end = CodedOutputStream::WriteVarint32ToArray(frame.size(),
+                                                         preamble);
+  stream->insert(stream->end(), preamble, end);
+  stream->insert(stream->end(), frame.begin(), frame.end());
+}
+
+// Returns a frame of the given size filled with a pattern based on its index.
+static std::vector<uint8_t> MakeFrame(size_t index, size_t size) {
+  std::vector<uint8_t> frame(size);
+  for (size_t i = 0; i < size; ++i) {
+    frame[i] = static_cast<uint8_t>(index * 31 + i);
+  }
+  return frame;
+}
+
+// Tests that varints of every length are decoded, with and without enough
+// trailing bytes for the word at a time scan.
+TEST(FrameDecoderTest, TestDecodeVarint32) {
+  const uint32_t values[] = {
+    0, 1, 127, 128, 300, 16383, 16384, 2097151, 2097152, 268435455,
+    268435456, 0xFFFFFFFF,
+  };
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    uint8_t bytes[16];
+    memset(bytes, 0xFF, sizeof(bytes));
+    int length = CodedOutputStream::WriteVarint32ToArray(values[i], bytes) -
+        bytes;
+
+    uint32_t value = 0;
+    EXPECT_EQ(length, FrameDecoder::DecodeVarint32(bytes, sizeof(bytes),
+                                                   &value));
+    EXPECT_EQ(values[i], value);
+
+    value = 0;
+    EXPECT_EQ(length, FrameDecoder::DecodeVarint32(bytes, length, &value));
+    EXPECT_EQ(values[i], value);
+
+    // Every proper prefix is incomplete.
+    for (int prefix = 0; prefix < length; ++prefix) {
+      EXPECT_EQ(0, FrameDecoder::DecodeVarint32(bytes, prefix, &value));
+    }
+  }
+}
+
+// Tests that varints longer than 5 bytes or larger than 32 bits are rejected.
+TEST(FrameDecoderTest, TestDecodeVarint32Invalid) {
+  uint32_t value = 0;
+  uint8_t too_long[8] = {0x80, 0x80, 0x80, 0x80, 0x80, 0x01, 0, 0};
+  EXPECT_EQ(-1, FrameDecoder::DecodeVarint32(too_long, 8, &value));
+  EXPECT_EQ(-1, FrameDecoder::DecodeVarint32(too_long, 6, &value));
+  EXPECT_EQ(-1, FrameDecoder::DecodeVarint32(too_long, 5, &value));
+
+  uint8_t too_large[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0x10, 0, 0, 0};
+  EXPECT_EQ(-1, FrameDecoder::DecodeVarint32(too_large, 8, &value));
+  EXPECT_EQ(-1, FrameDecoder::DecodeVarint32(too_large, 5, &value));
+
+  uint8_t continued[8];
+  memset(continued, 0x80, sizeof(continued));
+  EXPECT_EQ(-1, FrameDecoder::DecodeVarint32(continued, 8, &value));
+}
+
+// Tests that frames within a single chunk are handed over without copying.
+TEST(FrameDecoderTest, TestWholeFrames) {
+  std::vector<uint8_t> stream;
+  AppendFrame(MakeFrame(0, 3), &stream);
+  AppendFrame(MakeFrame(1, 0), &stream);
+  AppendFrame(MakeFrame(2, 200), &stream);
+
+  // Handler that checks that every frame points into the stream.
+  class InPlaceHandler : public FrameDecoder::Handler {
+   public:
+    explicit InPlaceHandler(const std::vector<uint8_t>& stream)
+        : stream(stream), count(0) {}
+    virtual void OnFrame(const uint8_t* data, size_t size) {
+      EXPECT_GE(data, &stream[0]);
+      EXPECT_LE(data + size, &stream[0] + stream.size());
+      count++;
+    }
+    const std::vector<uint8_t>& stream;
+    int count;
+  };
+
+  FrameDecoder decoder;
+  InPlaceHandler handler(stream);
+  EXPECT_EQ(FrameDecoder::kOk,
+            decoder.Decode(&stream[0], stream.size(), &handler));
+  EXPECT_EQ(3, handler.count);
+  EXPECT_FALSE(decoder.has_partial_frame());
+}
+
+// Tests that bytes_needed reports the missing bytes of a split frame.
+TEST(FrameDecoderTest, TestBytesNeeded) {
+  std::vector<uint8_t> stream;
+  AppendFrame(MakeFrame(0, 300), &stream);
+
+  FrameDecoder decoder;
+  CollectingHandler handler;
+  EXPECT_EQ(1U, decoder.bytes_needed());
+
+  // The preamble of a 300 byte frame takes 2 bytes.
+  decoder.Decode(&stream[0], 1, &handler);
+  EXPECT_TRUE(decoder.has_partial_frame());
+  EXPECT_EQ(1U, decoder.bytes_needed());
+
+  decoder.Decode(&stream[1], 1, &handler);
+  EXPECT_EQ(300U, decoder.bytes_needed());
+
+  decoder.Decode(&stream[2], 100, &handler);
+  EXPECT_EQ(200U, decoder.bytes_needed());
+  EXPECT_TRUE(handler.frames.empty());
+
+  decoder.Decode(&stream[102], 200, &handler);
+  EXPECT_EQ(1U, decoder.bytes_needed());
+  EXPECT_FALSE(decoder.has_partial_frame());
+  ASSERT_EQ(1U, handler.frames.size());
+  EXPECT_EQ(MakeFrame(0, 300), handler.frames[0]);
+}
+
+// Tests that an invalid preamble split across chunks is reported, and that
+// the decoder can be reused once reset.
+TEST(FrameDecoderTest, TestInvalidPreamble) {
+  FrameDecoder decoder;
+  CollectingHandler handler;
+  uint8_t byte = 0x80;
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(FrameDecoder::kOk, decoder.Decode(&byte, 1, &handler));
+  }
+  EXPECT_EQ(FrameDecoder::kInvalidPreamble,
+            decoder.Decode(&byte, 1, &handler));
+
+  decoder.Reset();
+  uint8_t frame[2] = {1, 42};
+  EXPECT_EQ(FrameDecoder::kOk, decoder.Decode(frame, 2, &handler));
+  ASSERT_EQ(1U, handler.frames.size());
+  EXPECT_EQ(std::vector<uint8_t>(1, 42), handler.frames[0]);
+}
+
+// Tests that frames found before an invalid preamble are still handed over.
+TEST(FrameDecoderTest, TestInvalidPreambleAfterFrames) {
+  std::vector<uint8_t> stream;
+  AppendFrame(MakeFrame(0, 10), &stream);
+  stream.insert(stream.end(), 8, 0x80);
+
+  FrameDecoder decoder;
+  CollectingHandler handler;
+  EXPECT_EQ(FrameDecoder::kInvalidPreamble,
+            decoder.Decode(&stream[0], stream.size(), &handler));
+  EXPECT_EQ(1U, handler.frames.size());
+}
+
+// Tests that frames larger than the maximum size are rejected as soon as
+// their preamble is decoded, whether or not it is split.
+TEST(FrameDecoderTest, TestFrameTooLarge) {
+  std::vector<uint8_t> stream;
+  AppendFrame(MakeFrame(0, 100), &stream);
+  AppendFrame(MakeFrame(1, 300), &stream);
+
+  FrameDecoder decoder;
+  decoder.set_max_frame_size(200);
+  CollectingHandler handler;
+  EXPECT_EQ(FrameDecoder::kFrameTooLarge,
+            decoder.Decode(&stream[0], stream.size(), &handler));
+  EXPECT_EQ(1U, handler.frames.size());
+  EXPECT_EQ(300U, decoder.frame_size());
+
+  // The preamble of the second frame alone, a byte at a time.
+  decoder.Reset();
+  EXPECT_EQ(FrameDecoder::kOk, decoder.Decode(&stream[101], 1, &handler));
+  EXPECT_EQ(FrameDecoder::kFrameTooLarge,
+            decoder.Decode(&stream[102], 1, &handler));
+  EXPECT_EQ(1U, handler.frames.size());
+}
+
+// Tests that frames split across chunks are reassembled in pooled buffers,
+// which are returned as soon as the frame is complete.
+TEST(FrameDecoderTest, TestPooledBuffers) {
+  std::vector<uint8_t> stream;
+  AppendFrame(MakeFrame(0, 1000), &stream);
+
+  util::BufferPool pool(4);
+  FrameDecoder decoder(&pool);
+  CollectingHandler handler;
+  for (int i = 0; i < 10; ++i) {
+    decoder.Decode(&stream[0], 500, &handler);
+    EXPECT_EQ(0U, pool.free_buffers(2));
+    decoder.Decode(&stream[500], stream.size() - 500, &handler);
+    EXPECT_EQ(1U, pool.free_buffers(2));
+  }
+  EXPECT_EQ(10U, handler.frames.size());
+  EXPECT_EQ(MakeFrame(0, 1000), handler.frames.back());
+  EXPECT_EQ(1, pool.allocations());
+
+  // A partial frame is returned to the pool when the decoder is reset.
+  decoder.Decode(&stream[0], 500, &handler);
+  decoder.Reset();
+  EXPECT_EQ(1U, pool.free_buffers(2));
+}
+
+// Tests that frames up to the default maximum size are reassembled in pooled
+// buffers too.
+TEST(FrameDecoderTest, TestPooledLargeBuffers) {
+  std::vector<uint8_t> stream;
+  AppendFrame(MakeFrame(0, FrameDecoder::kDefaultMaxFrameSize), &stream);
+
+  util::BufferPool pool(4);
+  FrameDecoder decoder(&pool);
+  CollectingHandler handler;
+  for (int i = 0; i < 3; ++i) {
+    decoder.Decode(&stream[0], 500, &handler);
+    decoder.Decode(&stream[500], stream.size() - 500, &handler);
+  }
+  ASSERT_EQ(3U, handler.frames.size());
+  EXPECT_EQ(FrameDecoder::kDefaultMaxFrameSize, handler.frames.back().size());
+  EXPECT_EQ(1U, pool.free_buffers(util::BufferPool::kNumSizeClasses - 1));
+  EXPECT_EQ(1, pool.allocations());
+}
+
+// Feeds random frames split at random points and checks that every frame
+// comes out intact and in order.
+TEST(FrameDecoderTest, TestRandomChunks) {
+  unsigned int seed = 42;
+  for (int round = 0; round < 200; ++round) {
+    std::vector<std::vector<uint8_t> > frames;
+    std::vector<uint8_t> stream;
+    int num_frames = rand_r(&seed) % 20;
+    for (int i = 0; i < num_frames; ++i) {
+      // Mostly small frames, with some needing 2 and 3 byte preambles.
+      size_t size;
+      switch (rand_r(&seed) % 4) {
+        case 0: size = 0; break;
+        case 1: size = rand_r(&seed) % 20000; break;
+        default: size = rand_r(&seed) % 130; break;
+      }
+      frames.push_back(MakeFrame(i, size));
+      AppendFrame(frames.back(), &stream);
+    }
+
+    FrameDecoder decoder;
+    decoder.set_max_frame_size(20000);
+    CollectingHandler handler;
+    size_t offset = 0;
+    while (offset < stream.size()) {
+      size_t chunk;
+      switch (rand_r(&seed) % 3) {
+        case 0: chunk = 1; break;
+        case 1: chunk = 1 + rand_r(&seed) % 8; break;
+        default: chunk = 1 + rand_r(&seed) % 40000; break;
+      }
+      chunk = std::min(chunk, stream.size() - offset);
+
+      // Copy the chunk, so reading past it would be caught by sanitizers.
+      std::vector<uint8_t> bytes(stream.begin() + offset,
+                                 stream.begin() + offset + chunk);
+      ASSERT_EQ(FrameDecoder::kOk,
+                decoder.Decode(&bytes[0], bytes.size(), &handler));
+      offset += chunk;
+    }
+
+    EXPECT_FALSE(decoder.has_partial_frame());
+    ASSERT_EQ(frames.size(), handler.frames.size());
+    for (size_t i = 0; i < frames.size(); ++i) {
+      EXPECT_EQ(frames[i], handler.frames[i]) << "round " << round
+          << " frame " << i;
+    }
+  }
+}
+
+// Tests that the word at a time scan agrees with a byte at a time decode on
+// random varints, including invalid ones.
+TEST(FrameDecoderTest, TestRandomVarints) {
+  unsigned int seed = 7;
+  for (int i = 0; i < 100000; ++i) {
+    uint8_t bytes[8];
+    int length = 1 + rand_r(&seed) % 6;
+    for (int j = 0; j < 8; ++j) {
+      bytes[j] = static_cast<uint8_t>(rand_r(&seed));
+      if (j < length - 1) {
+        bytes[j] |= 0x80;
+      } else if (j == length - 1) {
+        bytes[j] &= 0x7F;
+      }
+    }
+
+    uint32_t expected_value = 0;
+    int expected = 0;
+    for (size_t size = 1; size <= 7 && expected == 0; ++size) {
+      expected = FrameDecoder::DecodeVarint32(bytes, size, &expected_value);
+    }
+
+    uint32_t value = 0;
+    ASSERT_EQ(expected, FrameDecoder::DecodeVarint32(bytes, 8, &value));
+    if (expected > 0) {
+      EXPECT_EQ(expected_value, value);
+    }
+  }
+}
+
+}  // namespace wire
+}  // namespace anymote
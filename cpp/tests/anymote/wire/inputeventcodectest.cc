@@ -0,0 +1,261 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Differential tests for the input event codec against the generic protocol
+// buffer code.
+
+#include <anymote/wire/inputeventcodec.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <limits>
+#include <string>
+#include <vector>
+
+using ::google::protobuf::io::CodedOutputStream;
+
+namespace anymote {
+namespace wire {
+
+// Returns the frame the generic serializer writes for a message.
+static std::string GenericFrame(const messages::RemoteMessage& message) {
+  std::string bytes = message.SerializeAsString();
+  uint8_t preamble[5];
+  uint8_t* end = CodedOutputStream::WriteVarint32ToArray(bytes.size(),
+                                                         preamble);
+  return std::string(preamble, end) + bytes;
+}
+
+// Returns the frame the input event codec writes for a message, or an empty
+// string if it does not handle the message.
+static std::string FastFrame(const messages::RemoteMessage& message) {
+  uint8_t frame[kMaxInputEventFrameSize];
+  size_t size = EncodeInputEventFrame(message, frame);
+  return std::string(frame, frame + size);
+}
+
+// Checks that a message is encoded as the generic serializer does, and that
+// decoding the result gives the message back.
+static void ExpectSameAsGeneric(const messages::RemoteMessage& message) {
+  std::string frame = GenericFrame(message);
+  ASSERT_EQ(frame, FastFrame(message)) << message.DebugString();
+
+  messages::RemoteMessage decoded;
+  decoded.set_sequence_number(12345);
+  decoded.mutable_response_message()->mutable_data_message()->set_data("x");
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(frame.data());
+  ASSERT_TRUE(DecodeInputEvent(data + 1, frame.size() - 1, &decoded));
+  EXPECT_EQ(message.SerializeAsString(), decoded.SerializeAsString());
+}
+
+// Interesting int32 values, including those that take 10 bytes on the wire.
+static const int32_t kInt32Values[] = {
+  0, 1, -1, 63, 64, 127, 128, -128, 300, -300, 16383, 16384,
+  std::numeric_limits<int32_t>::max(), std::numeric_limits<int32_t>::min(),
+};
+
+// Sequence numbers, including none at all.
+static const int64_t kSequenceNumbers[] = {
+  -1, 0, 1, 127, 128, 0xFFFFFFFFLL,
+};
+
+static const size_t kNumInt32Values =
+    sizeof(kInt32Values) / sizeof(kInt32Values[0]);
+static const size_t kNumSequenceNumbers =
+    sizeof(kSequenceNumbers) / sizeof(kSequenceNumbers[0]);
+
+// Returns a message with the given sequence number, or none if negative.
+static messages::RemoteMessage MessageWithSequenceNumber(
+    int64_t sequence_number) {
+  messages::RemoteMessage message;
+  if (sequence_number >= 0) {
+    message.set_sequence_number(static_cast<uint32_t>(sequence_number));
+  }
+  return message;
+}
+
+// Tests every key code and action.
+TEST(InputEventCodecTest, TestKeyEvents) {
+  for (size_t s = 0; s < kNumSequenceNumbers; ++s) {
+    for (int keycode = -10; keycode < 1000; ++keycode) {
+      if (!messages::Code_IsValid(keycode)) {
+        continue;
+      }
+      for (int action = 0; action < 2; ++action) {
+        messages::RemoteMessage message =
+            MessageWithSequenceNumber(kSequenceNumbers[s]);
+        messages::KeyEvent* event =
+            message.mutable_request_message()->mutable_key_event_message();
+        event->set_keycode(static_cast<messages::Code>(keycode));
+        event->set_action(static_cast<messages::Action>(action));
+        ExpectSameAsGeneric(message);
+      }
+    }
+  }
+}
+
+// Tests mouse events and mouse wheel events with every pair of interesting
+// values.
+TEST(InputEventCodecTest, TestMouseEvents) {
+  for (size_t s = 0; s < kNumSequenceNumbers; ++s) {
+    for (size_t x = 0; x < kNumInt32Values; ++x) {
+      for (size_t y = 0; y < kNumInt32Values; ++y) {
+        messages::RemoteMessage mouse_event =
+            MessageWithSequenceNumber(kSequenceNumbers[s]);
+        messages::MouseEvent* event = mouse_event.mutable_request_message()
+            ->mutable_mouse_event_message();
+        event->set_x_delta(kInt32Values[x]);
+        event->set_y_delta(kInt32Values[y]);
+        ExpectSameAsGeneric(mouse_event);
+
+        messages::RemoteMessage mouse_wheel =
+            MessageWithSequenceNumber(kSequenceNumbers[s]);
+        messages::MouseWheel* wheel = mouse_wheel.mutable_request_message()
+            ->mutable_mouse_wheel_message();
+        wheel->set_x_scroll(kInt32Values[x]);
+        wheel->set_y_scroll(kInt32Values[y]);
+        ExpectSameAsGeneric(mouse_wheel);
+      }
+    }
+  }
+}
+
+// Tests that messages of any other shape are left to the generic code.
+TEST(InputEventCodecTest, TestOtherMessages) {
+  std::vector<messages::RemoteMessage> messages;
+
+  messages::RemoteMessage empty;
+  messages.push_back(empty);
+
+  messages::RemoteMessage ping;
+  ping.set_sequence_number(1);
+  ping.mutable_request_message();
+  messages.push_back(ping);
+
+  messages::RemoteMessage data;
+  data.mutable_request_message()->mutable_data_message()->set_type("t");
+  data.mutable_request_message()->mutable_data_message()->set_data("d");
+  messages.push_back(data);
+
+  messages::RemoteMessage two_events;
+  two_events.mutable_request_message()->mutable_mouse_event_message()
+      ->set_x_delta(1);
+  two_events.mutable_request_message()->mutable_mouse_event_message()
+      ->set_y_delta(1);
+  two_events.mutable_request_message()->mutable_mouse_wheel_message()
+      ->set_x_scroll(1);
+  two_events.mutable_request_message()->mutable_mouse_wheel_message()
+      ->set_y_scroll(1);
+  messages.push_back(two_events);
+
+  messages::RemoteMessage missing_field;
+  missing_field.mutable_request_message()->mutable_key_event_message()
+      ->set_keycode(messages::KEYCODE_A);
+  messages.push_back(missing_field);
+
+  messages::RemoteMessage with_response;
+  with_response.mutable_request_message()->mutable_mouse_wheel_message()
+      ->set_x_scroll(1);
+  with_response.mutable_request_message()->mutable_mouse_wheel_message()
+      ->set_y_scroll(1);
+  with_response.mutable_response_message();
+  messages.push_back(with_response);
+
+  for (size_t i = 0; i < messages.size(); ++i) {
+    EXPECT_EQ("", FastFrame(messages[i])) << i;
+
+    std::string bytes = messages[i].SerializePartialAsString();
+    messages::RemoteMessage decoded;
+    EXPECT_FALSE(DecodeInputEvent(
+        reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size(),
+        &decoded)) << i;
+  }
+}
+
+// Tests that input events encoded differently from the generic serializer
+// are left to the generic parser.
+TEST(InputEventCodecTest, TestUnusualEncodings) {
+  const uint8_t unknown_field[] = {0x12, 0x06, 0x0A, 0x04, 0x08, 0x1D,
+                                   0x10, 0x00, 0x20, 0x01};
+  const uint8_t swapped_fields[] = {0x12, 0x06, 0x0A, 0x04, 0x10, 0x00,
+                                    0x08, 0x1D};
+  const uint8_t trailing_field[] = {0x12, 0x06, 0x0A, 0x04, 0x08, 0x1D,
+                                    0x10, 0x00, 0x08, 0x01};
+  const uint8_t invalid_action[] = {0x12, 0x06, 0x0A, 0x04, 0x08, 0x1D,
+                                    0x10, 0x07};
+  const uint8_t truncated[] = {0x12, 0x06, 0x0A, 0x04, 0x08, 0x1D, 0x10};
+
+  messages::RemoteMessage message;
+  EXPECT_FALSE(DecodeInputEvent(unknown_field, sizeof(unknown_field),
+                                &message));
+  EXPECT_FALSE(DecodeInputEvent(swapped_fields, sizeof(swapped_fields),
+                                &message));
+  EXPECT_FALSE(DecodeInputEvent(trailing_field, sizeof(trailing_field),
+                                &message));
+  EXPECT_FALSE(DecodeInputEvent(invalid_action, sizeof(invalid_action),
+                                &message));
+  EXPECT_FALSE(DecodeInputEvent(truncated, sizeof(truncated), &message));
+  EXPECT_FALSE(message.has_request_message());
+}
+
+// Mutates encoded input events at random and checks that whenever the codec
+// decodes the result, the generic parser agrees on the message.
+TEST(InputEventCodecTest, TestRandomMutations) {
+  unsigned int seed = 16;
+  int decoded_count = 0;
+  for (int i = 0; i < 100000; ++i) {
+    messages::RemoteMessage message;
+    if (rand_r(&seed) % 2) {
+      message.set_sequence_number(rand_r(&seed));
+    }
+    messages::MouseEvent* event =
+        message.mutable_request_message()->mutable_mouse_event_message();
+    event->set_x_delta(rand_r(&seed) - RAND_MAX / 2);
+    event->set_y_delta(rand_r(&seed) % 256 - 128);
+    std::string bytes = message.SerializeAsString();
+
+    int num_mutations = 1 + rand_r(&seed) % 3;
+    for (int j = 0; j < num_mutations; ++j) {
+      size_t index = rand_r(&seed) % bytes.size();
+      switch (rand_r(&seed) % 3) {
+        case 0:
+          bytes[index] = static_cast<char>(rand_r(&seed));
+          break;
+        case 1:
+          bytes.erase(index, 1);
+          break;
+        default:
+          bytes.insert(index, 1, static_cast<char>(rand_r(&seed)));
+          break;
+      }
+      if (bytes.empty()) {
+        bytes.push_back(0);
+      }
+    }
+
+    messages::RemoteMessage decoded;
+    if (!DecodeInputEvent(reinterpret_cast<const uint8_t*>(bytes.data()),
+                          bytes.size(), &decoded)) {
+      continue;
+    }
+    decoded_count++;
+    messages::RemoteMessage parsed;
+    ASSERT_TRUE(parsed.ParseFromString(bytes));
+    ASSERT_EQ(parsed.SerializeAsString(), decoded.SerializeAsString());
+  }
+  EXPECT_GT(decoded_count, 0);
+}
+
+}  // namespace wire
+}  // namespace anymote
@@ -0,0 +1,344 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for LoopbackWireInterface.
+
+#include <anymote/device/devicesession.h>
+#include <anymote/server/serversession.h>
+#include <anymote/wire/loopbackwireinterface.h>
+#include <anymote/wire/protobufwireadapter.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "anymote/util/fakeclock.h"
+
+namespace anymote {
+namespace wire {
+
+namespace {
+
+// Wire listener that records the reads it receives. If it is set to keep
+// reading, it requests the available bytes again after every read.
+class RecordingWireListener : public WireListener {
+ public:
+  RecordingWireListener(LoopbackWireInterface* interface, bool keep_reading)
+      : interface_(interface), keep_reading_(keep_reading) {
+    interface->set_listener(this);
+  }
+
+  virtual void OnBytesReceived(const std::vector<uint8_t>& data) {
+    reads.push_back(data.size());
+    bytes.insert(bytes.end(), data.begin(), data.end());
+    if (keep_reading_) {
+      interface_->ReceiveAvailable();
+    }
+  }
+
+  virtual void OnError() { ADD_FAILURE() << "Unexpected error"; }
+
+  std::vector<size_t> reads;
+  std::vector<uint8_t> bytes;
+
+ private:
+  LoopbackWireInterface* interface_;
+  bool keep_reading_;
+};
+
+// Returns count bytes starting at the given value.
+std::vector<uint8_t> MakeBytes(size_t count, int start) {
+  std::vector<uint8_t> bytes(count);
+  for (size_t i = 0; i < count; ++i) {
+    bytes[i] = static_cast<uint8_t>(start + i);
+  }
+  return bytes;
+}
+
+}  // namespace
+
+// Tests that receives of an exact size are delivered once pumped.
+TEST(LoopbackWireInterfaceTest, TestReceiveExact) {
+  LoopbackWireInterface sender;
+  LoopbackWireInterface receiver;
+  LoopbackWireInterface::Connect(&sender, &receiver);
+  RecordingWireListener listener(&receiver, false);
+
+  sender.Send(MakeBytes(10, 0));
+  receiver.Receive(4);
+  receiver.Receive(6);
+  EXPECT_TRUE(listener.reads.empty());
+  EXPECT_EQ(10, sender.queued_bytes());
+
+  EXPECT_EQ(10, receiver.Pump());
+  EXPECT_EQ(0, sender.queued_bytes());
+  ASSERT_EQ(2, listener.reads.size());
+  EXPECT_EQ(4, listener.reads[0]);
+  EXPECT_EQ(6, listener.reads[1]);
+  EXPECT_EQ(MakeBytes(10, 0), listener.bytes);
+  EXPECT_EQ(10, receiver.bytes_delivered());
+
+  // Nothing more is delivered until more bytes are requested and sent.
+  receiver.Receive(1);
+  EXPECT_EQ(0, receiver.Pump());
+}
+
+// Tests that each chunking mode delivers the stream intact.
+TEST(LoopbackWireInterfaceTest, TestChunking) {
+  const LoopbackWireInterface::Chunking kModes[] = {
+    LoopbackWireInterface::kCoalesced,
+    LoopbackWireInterface::kSingleBytes,
+    LoopbackWireInterface::kRandomChunks,
+  };
+  for (size_t mode = 0; mode < 3; ++mode) {
+    LoopbackWireInterface::Options options;
+    options.ring_capacity = 256;
+    options.chunking = kModes[mode];
+    options.max_chunk_size = 50;
+    LoopbackWireInterface sender;
+    LoopbackWireInterface receiver(options);
+    LoopbackWireInterface::Connect(&sender, &receiver);
+    RecordingWireListener listener(&receiver, true);
+    receiver.ReceiveAvailable();
+
+    std::vector<uint8_t> sent;
+    for (int i = 0; i < 20; ++i) {
+      std::vector<uint8_t> data = MakeBytes(30 + i, i);
+      sender.Send(data);
+      sent.insert(sent.end(), data.begin(), data.end());
+      if (i % 3 == 0) {
+        receiver.Pump();
+      }
+    }
+    while (receiver.Pump() > 0) {
+    }
+    EXPECT_EQ(sent, listener.bytes) << "mode " << mode;
+
+    size_t max_read = 0;
+    size_t min_read = sent.size();
+    for (size_t i = 0; i < listener.reads.size(); ++i) {
+      max_read = std::max(max_read, listener.reads[i]);
+      min_read = std::min(min_read, listener.reads[i]);
+    }
+    EXPECT_LE(max_read, 50);
+    if (kModes[mode] == LoopbackWireInterface::kSingleBytes) {
+      EXPECT_EQ(1, max_read);
+    } else {
+      EXPECT_LT(min_read, max_read) << "mode " << mode;
+    }
+  }
+}
+
+// Tests that sends larger than the ring are held until the receiver has
+// room for them, and that a receive larger than the ring is delivered whole.
+TEST(LoopbackWireInterfaceTest, TestBacklog) {
+  LoopbackWireInterface::Options options;
+  options.ring_capacity = 16;
+  LoopbackWireInterface sender;
+  LoopbackWireInterface receiver(options);
+  LoopbackWireInterface::Connect(&sender, &receiver);
+  RecordingWireListener listener(&receiver, false);
+
+  sender.Send(MakeBytes(100, 0));
+  sender.Send(MakeBytes(20, 100));
+  receiver.Receive(110);
+  receiver.Receive(10);
+  EXPECT_EQ(120, receiver.Pump());
+  ASSERT_EQ(2, listener.reads.size());
+  EXPECT_EQ(110, listener.reads[0]);
+  EXPECT_EQ(MakeBytes(120, 0), listener.bytes);
+}
+
+// Tests that sent bytes arrive after the latency.
+TEST(LoopbackWireInterfaceTest, TestLatency) {
+  util::FakeClock clock;
+  LoopbackWireInterface::Options options;
+  options.latency_micros = 100;
+  options.clock = &clock;
+  LoopbackWireInterface sender;
+  LoopbackWireInterface receiver(options);
+  LoopbackWireInterface::Connect(&sender, &receiver);
+  RecordingWireListener listener(&receiver, true);
+  receiver.ReceiveAvailable();
+
+  EXPECT_EQ(-1, receiver.next_delivery_micros());
+  sender.Send(MakeBytes(5, 0));
+  clock.Advance(50);
+  sender.Send(MakeBytes(5, 5));
+  EXPECT_EQ(100, receiver.next_delivery_micros());
+
+  clock.Advance(49);
+  EXPECT_EQ(0, receiver.Pump());
+  clock.Advance(1);
+  EXPECT_EQ(5, receiver.Pump());
+  EXPECT_EQ(150, receiver.next_delivery_micros());
+  clock.Advance(50);
+  EXPECT_EQ(5, receiver.Pump());
+  EXPECT_EQ(MakeBytes(10, 0), listener.bytes);
+  EXPECT_EQ(-1, receiver.next_delivery_micros());
+}
+
+// Tests that sends arrive no faster than the bandwidth allows.
+TEST(LoopbackWireInterfaceTest, TestBandwidth) {
+  util::FakeClock clock;
+  LoopbackWireInterface::Options options;
+  options.bytes_per_second = 1000;
+  options.clock = &clock;
+  LoopbackWireInterface sender;
+  LoopbackWireInterface receiver(options);
+  LoopbackWireInterface::Connect(&sender, &receiver);
+  RecordingWireListener listener(&receiver, true);
+  receiver.ReceiveAvailable();
+
+  // Both sends are queued on the link, so the second one finishes after the
+  // first.
+  sender.Send(MakeBytes(10, 0));
+  sender.Send(MakeBytes(10, 10));
+  EXPECT_EQ(10000, receiver.next_delivery_micros());
+  clock.Advance(10000);
+  EXPECT_EQ(10, receiver.Pump());
+  clock.Advance(9999);
+  EXPECT_EQ(0, receiver.Pump());
+  clock.Advance(1);
+  EXPECT_EQ(10, receiver.Pump());
+
+  // An idle link starts carrying the next send right away.
+  clock.Advance(100000);
+  sender.Send(MakeBytes(1, 0));
+  EXPECT_EQ(121000, receiver.next_delivery_micros());
+}
+
+// Tests that concurrent senders are serialized and that the receiver sees
+// every send whole and in order per sender while it reads concurrently.
+TEST(LoopbackWireInterfaceTest, TestConcurrentSenders) {
+  const int kSenders = 3;
+  const int kSends = 20000;
+  LoopbackWireInterface::Options options;
+  options.ring_capacity = 64;
+  options.chunking = LoopbackWireInterface::kRandomChunks;
+  LoopbackWireInterface sender;
+  LoopbackWireInterface receiver(options);
+  LoopbackWireInterface::Connect(&sender, &receiver);
+  RecordingWireListener listener(&receiver, true);
+  receiver.ReceiveAvailable();
+
+  std::vector<std::thread> threads;
+  for (int id = 0; id < kSenders; ++id) {
+    threads.push_back(std::thread([&sender, id, kSends]() {
+      std::vector<uint8_t> data(4);
+      for (int i = 0; i < kSends; ++i) {
+        data[0] = static_cast<uint8_t>(id);
+        data[1] = static_cast<uint8_t>(i >> 8);
+        data[2] = static_cast<uint8_t>(i);
+        data[3] = 0xff;
+        sender.SendOwned(&data);
+      }
+    }));
+  }
+
+  const size_t kTotal = kSenders * kSends * 4;
+  while (receiver.bytes_delivered() < kTotal) {
+    receiver.Poll(1000000);
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+
+  ASSERT_EQ(kTotal, listener.bytes.size());
+  int next[kSenders] = {0};
+  for (size_t offset = 0; offset < kTotal; offset += 4) {
+    const uint8_t* send = &listener.bytes[offset];
+    ASSERT_LT(send[0], kSenders);
+    ASSERT_EQ(0xff, send[3]);
+    int sequence = (send[1] << 8) | send[2];
+    ASSERT_EQ(static_cast<uint8_t>(next[send[0]] >> 8), send[1]);
+    ASSERT_EQ(next[send[0]] & 0xff, send[2]) << sequence;
+    next[send[0]]++;
+  }
+}
+
+namespace {
+
+// Anymote listener that counts acks.
+class CountingAnymoteListener : public device::AnymoteListener {
+ public:
+  CountingAnymoteListener() : acks(0) {}
+  virtual void OnAck() { acks++; }
+  virtual void OnData(const std::string& type, const std::string& data) {}
+  virtual void OnFlingResult(bool success, uint32_t sequence_number) {}
+  virtual void OnError() { ADD_FAILURE() << "Unexpected error"; }
+
+  int acks;
+};
+
+// Request listener that counts key events.
+class CountingRequestListener : public server::RequestListener {
+ public:
+  CountingRequestListener() : key_events(0) {}
+  virtual void OnKeyEvent(messages::Code keycode, messages::Action action) {
+    key_events++;
+  }
+  virtual void OnMouseEvent(int32_t x_delta, int32_t y_delta) {}
+  virtual void OnMouseWheel(int32_t x_scroll, int32_t y_scroll) {}
+  virtual void OnData(const std::string& type, const std::string& data) {}
+  virtual void OnConnect(const std::string& device_name, int32_t version) {}
+  virtual bool OnFling(const std::string& uri) { return true; }
+  virtual void OnError() { ADD_FAILURE() << "Unexpected error"; }
+
+  int key_events;
+};
+
+}  // namespace
+
+// Tests a device session and a server session over a connection that splits
+// the stream at random points, with both read modes.
+TEST(LoopbackWireInterfaceTest, TestSessions) {
+  LoopbackWireInterface::Options options;
+  options.ring_capacity = 128;
+  options.chunking = LoopbackWireInterface::kRandomChunks;
+  options.max_chunk_size = 7;
+  LoopbackWireInterface device_interface(options);
+  LoopbackWireInterface server_interface(options);
+  LoopbackWireInterface::Connect(&device_interface, &server_interface);
+
+  ProtobufWireAdapter device_adapter(&device_interface,
+                                     ProtobufWireAdapter::kStreamingReads);
+  ProtobufWireAdapter server_adapter(&server_interface,
+                                     ProtobufWireAdapter::kFramedReads);
+  CountingAnymoteListener device_listener;
+  CountingRequestListener server_listener;
+  device::DeviceSession device(&device_adapter, &device_listener);
+  server::ServerSession server(&server_adapter, &server_listener);
+  device.StartSession();
+  server.StartSession();
+
+  const int kRounds = 200;
+  for (int i = 0; i < kRounds; ++i) {
+    device.SendKeyEvent(messages::KEYCODE_A, messages::DOWN);
+    device.SendKeyEvent(messages::KEYCODE_A, messages::UP);
+    device.SendPing();
+    if (i % 10 == 0) {
+      while (server_interface.Pump() + device_interface.Pump() > 0) {
+      }
+    }
+  }
+  while (server_interface.Pump() + device_interface.Pump() > 0) {
+  }
+
+  EXPECT_EQ(2 * kRounds, server_listener.key_events);
+  EXPECT_EQ(kRounds, device_listener.acks);
+}
+
+}  // namespace wire
+}  // namespace anymote
@@ -28,7 +28,9 @@ namespace wire {
 class MockWireInterface : public wire::WireInterface {
  public:
   MOCK_METHOD1(Send, void(const std::vector<uint8_t>& data));
+  MOCK_METHOD1(SendBulk, void(std::vector<uint8_t>* data));
   MOCK_METHOD1(Receive, void(size_t num_bytes));
+  MOCK_METHOD0(ReceiveAvailable, void());
 };
 
 // Mock wire listener.
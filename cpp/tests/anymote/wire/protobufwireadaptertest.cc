@@ -17,11 +17,18 @@
 #include <anymote/wire/protobufwireadapter.h>
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "anymote/util/fakeclock.h"
 #include "anymote/wire/mocks.h"
 
 using ::testing::InSequence;
 using ::testing::Mock;
+using ::testing::NiceMock;
+using ::testing::Pointee;
 using ::testing::Return;
+using ::testing::SizeIs;
 using ::testing::StrictMock;
 
 namespace anymote {
@@ -31,6 +38,7 @@ class MockMessageListener : public messages::MessageListener {
  public:
   MOCK_METHOD1(OnMessage, void(const messages::RemoteMessage& message));
   MOCK_METHOD0(OnError, void());
+  MOCK_METHOD1(OnProtocolError, void(ProtocolError error));
 };
 
 // Test fixture for a ProtobufWireAdapter test.
@@ -94,6 +102,546 @@ TEST_F(ProtobufWireAdapterTest, TestSendMessage) {
   adapter.SendMessage(message);
 }
 
+// Wire interface that takes ownership of sent buffers and hands back the
+// previously sent buffer, as a transport recycling its write buffers would.
+class SwappingWireInterface : public WireInterface {
+ public:
+  virtual void Send(const std::vector<uint8_t>& data) {
+    FAIL() << "Send should not be called";
+  }
+
+  virtual void SendOwned(std::vector<uint8_t>* data) {
+    sent.push_back(*data);
+    data->swap(spare);
+    addresses.push_back(&spare[0]);
+  }
+
+  virtual void Receive(size_t num_bytes) {}
+
+  std::vector<std::vector<uint8_t> > sent;
+  std::vector<const uint8_t*> addresses;
+  std::vector<uint8_t> spare;
+};
+
+// Tests that messages are handed to the interface with SendOwned and that the
+// buffer swapped back is reused for the next message.
+TEST(ProtobufWireAdapterSendOwnedTest, TestSendOwned) {
+  SwappingWireInterface interface;
+  ProtobufWireAdapter adapter(&interface);
+  adapter.Init();
+
+  messages::RemoteMessage message;
+  message.mutable_request_message()->mutable_connect_message()
+      ->set_device_name("foo");
+
+  adapter.SendMessage(message);
+  adapter.SendMessage(message);
+  adapter.SendMessage(message);
+
+  uint8_t bytes[10] = {9, 18, 7, 42, 5, 10, 3, 'f', 'o', 'o'};
+  std::vector<uint8_t> data(bytes, bytes + 10);
+
+  ASSERT_EQ(3, interface.sent.size());
+  for (size_t i = 0; i < interface.sent.size(); ++i) {
+    EXPECT_EQ(data, interface.sent[i]);
+  }
+
+  // After the first two sends, the adapter and the interface keep trading the
+  // same two buffers back and forth.
+  EXPECT_EQ(interface.addresses[0], interface.addresses[2]);
+}
+
+// Wire interface that appends everything sent to a single stream.
+class CollectingWireInterface : public WireInterface {
+ public:
+  virtual void Send(const std::vector<uint8_t>& data) {
+    std::lock_guard<std::mutex> lock(mutex);
+    stream.insert(stream.end(), data.begin(), data.end());
+    num_sends++;
+  }
+
+  virtual void Receive(size_t num_bytes) {}
+
+  std::mutex mutex;
+  std::vector<uint8_t> stream;
+  int num_sends;
+};
+
+// Listener that records the sequence numbers of the messages it receives.
+class SequenceRecorder : public messages::MessageListener {
+ public:
+  virtual void OnMessage(const messages::RemoteMessage& message) {
+    sequence_numbers.push_back(message.sequence_number());
+  }
+  virtual void OnError() { FAIL() << "Unexpected error"; }
+
+  std::vector<int32_t> sequence_numbers;
+};
+
+// Tests that messages sent concurrently from several threads are all sent
+// intact, in order for each thread.
+// Sends messages from several threads on an adapter with the given send queue
+// capacity, and checks that each thread's messages arrive in order.
+static void CheckConcurrentSendMessage(size_t send_queue_capacity) {
+  const int kNumThreads = 4;
+  const int kNumMessages = 5000;
+
+  CollectingWireInterface interface;
+  interface.num_sends = 0;
+  ProtobufWireAdapter adapter(&interface, ProtobufWireAdapter::kFramedReads,
+                              send_queue_capacity);
+  adapter.Init();
+
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < kNumThreads; ++thread) {
+    threads.push_back(std::thread([&adapter, thread, kNumMessages]() {
+      messages::RemoteMessage message;
+      message.mutable_request_message()->mutable_data_message()
+          ->set_type("thread");
+      for (int i = 0; i < kNumMessages; ++i) {
+        message.set_sequence_number(thread * kNumMessages + i + 1);
+        adapter.SendMessage(message);
+      }
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+
+  // Parse the stream back into messages.
+  NiceMock<MockWireInterface> reader_interface;
+  SequenceRecorder recorder;
+  ProtobufWireAdapter reader(&reader_interface,
+                             ProtobufWireAdapter::kStreamingReads);
+  reader.set_listener(&recorder);
+  reader.Init();
+  reader.OnBytesReceived(interface.stream);
+
+  ASSERT_EQ(kNumThreads * kNumMessages, recorder.sequence_numbers.size());
+  std::vector<int32_t> next(kNumThreads);
+  for (int thread = 0; thread < kNumThreads; ++thread) {
+    next[thread] = thread * kNumMessages + 1;
+  }
+  for (size_t i = 0; i < recorder.sequence_numbers.size(); ++i) {
+    int32_t sequence_number = recorder.sequence_numbers[i];
+    int thread = (sequence_number - 1) / kNumMessages;
+    EXPECT_EQ(next[thread], sequence_number);
+    next[thread] = sequence_number + 1;
+  }
+
+  // Frames queued by contending threads are sent in batches.
+  EXPECT_LE(interface.num_sends, kNumThreads * kNumMessages);
+}
+
+TEST(ProtobufWireAdapterConcurrencyTest, TestConcurrentSendMessage) {
+  CheckConcurrentSendMessage(ProtobufWireAdapter::kDefaultSendQueueCapacity);
+}
+
+TEST(ProtobufWireAdapterConcurrencyTest, TestSmallSendQueue) {
+  // Senders that find the queue full help drain it.
+  CheckConcurrentSendMessage(2);
+}
+
+// A gate that threads wait at until it is opened.
+class Gate {
+ public:
+  Gate() : open_(false) {}
+
+  void Open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    open_ = true;
+    opened_.notify_all();
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    opened_.wait(lock, [this]() { return open_; });
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable opened_;
+  bool open_;
+};
+
+// Wire interface that collects everything sent, but holds the first send
+// until it is released.
+class BlockingWireInterface : public CollectingWireInterface {
+ public:
+  BlockingWireInterface() : blocked_(false) {}
+
+  virtual void Send(const std::vector<uint8_t>& data) {
+    CollectingWireInterface::Send(data);
+    if (!blocked_) {
+      blocked_ = true;
+      entered.Open();
+      release.Wait();
+    }
+  }
+
+  Gate entered;
+  Gate release;
+
+ private:
+  bool blocked_;
+};
+
+// Frame tap that stalls the sender of the frame with a given sequence number
+// while the frame is being queued.
+class StallingFrameTap : public FrameTap {
+ public:
+  explicit StallingFrameTap(int32_t sequence_number)
+      : sequence_number_(sequence_number) {}
+
+  virtual void OnFrame(Direction direction, const uint8_t* data,
+                       size_t size) {
+    messages::RemoteMessage message;
+    if (message.ParseFromArray(data, size) &&
+        message.sequence_number() == sequence_number_) {
+      stalled.Open();
+      release.Wait();
+    }
+  }
+
+  Gate stalled;
+  Gate release;
+
+ private:
+  int32_t sequence_number_;
+};
+
+// Tests that a thread's messages stay in order when a frame it queued waits
+// behind a slot reserved by another sender that has not published its frame
+// yet.
+TEST(ProtobufWireAdapterConcurrencyTest, TestStalledProducer) {
+  BlockingWireInterface interface;
+  interface.num_sends = 0;
+  StallingFrameTap tap(2);
+  ProtobufWireAdapter adapter(&interface);
+  adapter.set_frame_tap(&tap);
+  adapter.Init();
+
+  messages::RemoteMessage messages[4];
+  for (int i = 0; i < 4; ++i) {
+    messages[i].set_sequence_number(i + 1);
+    messages[i].mutable_request_message();
+  }
+
+  // The first sender holds the send buffer while the interface blocks.
+  std::thread holder([&]() { adapter.SendMessage(messages[0]); });
+  interface.entered.Wait();
+
+  // The second sender reserves a slot and stalls before publishing it.
+  std::thread producer([&]() { adapter.SendMessage(messages[1]); });
+  tap.stalled.Wait();
+
+  // This thread queues its first message behind the stalled slot, then
+  // sends its second one once the send buffer is free.
+  adapter.SendMessage(messages[2]);
+  interface.release.Open();
+  holder.join();
+  adapter.SendMessage(messages[3]);
+
+  tap.release.Open();
+  producer.join();
+
+  NiceMock<MockWireInterface> reader_interface;
+  SequenceRecorder recorder;
+  ProtobufWireAdapter reader(&reader_interface,
+                             ProtobufWireAdapter::kStreamingReads);
+  reader.set_listener(&recorder);
+  reader.Init();
+  reader.OnBytesReceived(interface.stream);
+
+  ASSERT_EQ(4, recorder.sequence_numbers.size());
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(i + 1, recorder.sequence_numbers[i]);
+  }
+}
+
+// Listener that records the address of every message and whether it held a
+// connect message.
+class MessageRecorder : public messages::MessageListener {
+ public:
+  virtual void OnMessage(const messages::RemoteMessage& message) {
+    addresses.push_back(&message);
+    has_connect.push_back(message.request_message().has_connect_message());
+  }
+  virtual void OnError() { FAIL() << "Unexpected error"; }
+
+  std::vector<const messages::RemoteMessage*> addresses;
+  std::vector<bool> has_connect;
+};
+
+// Tests that received messages are parsed into the same message object, and
+// that nothing is left over from the previous message.
+TEST(ProtobufWireAdapterReceiveTest, TestMessageReused) {
+  messages::RemoteMessage connect;
+  connect.set_sequence_number(1);
+  connect.mutable_request_message()->mutable_connect_message()
+      ->set_device_name("foo");
+  messages::RemoteMessage ping;
+  ping.set_sequence_number(2);
+  ping.mutable_request_message();
+
+  CollectingWireInterface interface;
+  ProtobufWireAdapter writer(&interface);
+  writer.Init();
+  writer.SendMessage(connect);
+  writer.SendMessage(ping);
+  writer.SendMessage(connect);
+
+  NiceMock<MockWireInterface> reader_interface;
+  MessageRecorder recorder;
+  ProtobufWireAdapter reader(&reader_interface,
+                             ProtobufWireAdapter::kStreamingReads);
+  reader.set_listener(&recorder);
+  reader.Init();
+  reader.OnBytesReceived(interface.stream);
+
+  ASSERT_EQ(3, recorder.addresses.size());
+  EXPECT_EQ(recorder.addresses[0], recorder.addresses[1]);
+  EXPECT_EQ(recorder.addresses[0], recorder.addresses[2]);
+  EXPECT_TRUE(recorder.has_connect[0]);
+  EXPECT_FALSE(recorder.has_connect[1]);
+  EXPECT_TRUE(recorder.has_connect[2]);
+}
+
+// Tests that messages sent in a batch are sent together when flushed.
+TEST_F(ProtobufWireAdapterTest, TestBatch) {
+  InSequence sequence;
+
+  messages::RemoteMessage message;
+  message.mutable_request_message()->mutable_connect_message()
+      ->set_device_name("foo");
+
+  uint8_t bytes[10] = {9, 18, 7, 42, 5, 10, 3, 'f', 'o', 'o'};
+  std::vector<uint8_t> data;
+  for (int i = 0; i < 3; ++i) {
+    data.insert(data.end(), bytes, bytes + 10);
+  }
+
+  EXPECT_CALL(interface, Send(data));
+
+  adapter.BeginBatch();
+  adapter.SendMessage(message);
+
+  // Nested batches are only sent when the outermost batch is flushed.
+  adapter.BeginBatch();
+  adapter.SendMessage(message);
+  adapter.Flush();
+
+  adapter.SendMessage(message);
+  adapter.Flush();
+
+  // Messages sent after the batch are sent immediately.
+  std::vector<uint8_t> single(bytes, bytes + 10);
+  EXPECT_CALL(interface, Send(single));
+  adapter.SendMessage(message);
+}
+
+// Returns a message serialized as a frame.
+static std::vector<uint8_t> Frame(const messages::RemoteMessage& message) {
+  std::string bytes = message.SerializeAsString();
+  std::vector<uint8_t> frame(1, static_cast<uint8_t>(bytes.size()));
+  frame.insert(frame.end(), bytes.begin(), bytes.end());
+  return frame;
+}
+
+// Tests that bulk messages are sent apart from other messages, in chunks.
+TEST_F(ProtobufWireAdapterTest, TestPriorityLanes) {
+  InSequence sequence;
+  adapter.EnablePriorityLanes(16);
+
+  messages::RemoteMessage data;
+  data.mutable_request_message()->mutable_data_message()->set_type("type");
+  data.mutable_request_message()->mutable_data_message()
+      ->set_data("0123456789");
+  messages::RemoteMessage key;
+  key.mutable_request_message()->mutable_key_event_message()
+      ->set_keycode(messages::KEYCODE_A);
+  key.mutable_request_message()->mutable_key_event_message()
+      ->set_action(messages::DOWN);
+
+  std::vector<uint8_t> data_frame = Frame(data);
+  std::vector<uint8_t> keys = Frame(key);
+  keys.insert(keys.end(), keys.begin(), keys.end());
+  ASSERT_GT(data_frame.size(), 16);
+
+  // Each data message fills a chunk, so it is sent right away even though
+  // the batch is still open. The key events wait for the batch.
+  EXPECT_CALL(interface, SendBulk(Pointee(data_frame))).Times(2);
+  EXPECT_CALL(interface, Send(keys));
+
+  adapter.BeginBatch();
+  adapter.SendMessage(data);
+  adapter.SendMessage(key);
+  adapter.SendMessage(data);
+  adapter.SendMessage(key);
+  adapter.Flush();
+}
+
+// Tests that a full bulk chunk is sent within a batch without waiting for
+// another bulk message or the flush.
+TEST_F(ProtobufWireAdapterTest, TestPriorityLanesFullChunk) {
+  adapter.EnablePriorityLanes(16);
+
+  messages::RemoteMessage data;
+  data.mutable_request_message()->mutable_data_message()->set_type("type");
+  data.mutable_request_message()->mutable_data_message()
+      ->set_data("0123456789");
+  std::vector<uint8_t> data_frame = Frame(data);
+  ASSERT_GE(data_frame.size(), 16);
+
+  adapter.BeginBatch();
+  EXPECT_CALL(interface, SendBulk(Pointee(data_frame)));
+  adapter.SendMessage(data);
+  Mock::VerifyAndClearExpectations(&interface);
+
+  adapter.Flush();
+}
+
+// Frame tap that records every frame it is shown.
+class RecordingFrameTap : public FrameTap {
+ public:
+  virtual void OnFrame(Direction direction, const uint8_t* data,
+                       size_t size) {
+    directions.push_back(direction);
+    frames.push_back(std::vector<uint8_t>(data, data + size));
+  }
+
+  std::vector<Direction> directions;
+  std::vector<std::vector<uint8_t> > frames;
+};
+
+// Tests that the frame tap is shown sent and received frames without their
+// preambles, including input events encoded by the hand-written codec.
+TEST(ProtobufWireAdapterTapTest, TestFrameTap) {
+  messages::RemoteMessage key;
+  key.mutable_request_message()->mutable_key_event_message()
+      ->set_keycode(messages::KEYCODE_A);
+  key.mutable_request_message()->mutable_key_event_message()
+      ->set_action(messages::DOWN);
+  messages::RemoteMessage connect;
+  connect.mutable_request_message()->mutable_connect_message()
+      ->set_device_name("foo");
+
+  NiceMock<MockWireInterface> interface;
+  NiceMock<MockMessageListener> listener;
+  RecordingFrameTap tap;
+  ProtobufWireAdapter adapter(&interface,
+                              ProtobufWireAdapter::kStreamingReads);
+  adapter.set_listener(&listener);
+  adapter.set_frame_tap(&tap);
+  adapter.Init();
+
+  adapter.SendMessage(key);
+  adapter.SendMessage(connect);
+  std::vector<uint8_t> received = Frame(connect);
+  adapter.OnBufferReceived(&received[0], received.size());
+
+  ASSERT_EQ(3, tap.frames.size());
+  EXPECT_EQ(FrameTap::kSent, tap.directions[0]);
+  EXPECT_EQ(key.SerializeAsString(),
+            std::string(tap.frames[0].begin(), tap.frames[0].end()));
+  EXPECT_EQ(FrameTap::kSent, tap.directions[1]);
+  EXPECT_EQ(connect.SerializeAsString(),
+            std::string(tap.frames[1].begin(), tap.frames[1].end()));
+  EXPECT_EQ(FrameTap::kReceived, tap.directions[2]);
+  EXPECT_EQ(connect.SerializeAsString(),
+            std::string(tap.frames[2].begin(), tap.frames[2].end()));
+}
+
+// Tests that encoded frames are batched and ordered with serialized messages
+// and shown to the frame tap.
+TEST(ProtobufWireAdapterTapTest, TestSendEncodedFrame) {
+  messages::RemoteMessage connect;
+  connect.mutable_request_message()->mutable_connect_message()
+      ->set_device_name("foo");
+  messages::RemoteMessage key;
+  key.mutable_request_message()->mutable_key_event_message()
+      ->set_keycode(messages::KEYCODE_DPAD_UP);
+  key.mutable_request_message()->mutable_key_event_message()
+      ->set_action(messages::DOWN);
+  std::vector<uint8_t> key_frame = Frame(key);
+
+  std::vector<uint8_t> data = Frame(connect);
+  data.insert(data.end(), key_frame.begin(), key_frame.end());
+  std::vector<uint8_t> connect_frame = Frame(connect);
+  data.insert(data.end(), connect_frame.begin(), connect_frame.end());
+
+  StrictMock<MockWireInterface> interface;
+  NiceMock<MockMessageListener> listener;
+  RecordingFrameTap tap;
+  ProtobufWireAdapter adapter(&interface);
+  EXPECT_CALL(interface, Receive(1));
+  adapter.set_listener(&listener);
+  adapter.set_frame_tap(&tap);
+  adapter.Init();
+
+  EXPECT_CALL(interface, Send(data));
+  adapter.BeginBatch();
+  adapter.SendMessage(connect);
+  EXPECT_TRUE(adapter.SendEncodedFrame(&key_frame[0], key_frame.size()));
+  adapter.SendMessage(connect);
+  adapter.Flush();
+
+  ASSERT_EQ(3, tap.frames.size());
+  EXPECT_EQ(key.SerializeAsString(),
+            std::string(tap.frames[1].begin(), tap.frames[1].end()));
+}
+
+// Tests that auto-flush sends messages once enough bytes are buffered.
+TEST_F(ProtobufWireAdapterTest, TestAutoFlushBytes) {
+  InSequence sequence;
+
+  util::FakeClock clock;
+  adapter.SetAutoFlush(20, 2000, &clock);
+
+  messages::RemoteMessage message;
+  message.mutable_request_message()->mutable_connect_message()
+      ->set_device_name("foo");
+
+  adapter.SendMessage(message);
+  Mock::VerifyAndClear(&interface);
+
+  EXPECT_CALL(interface, Send(SizeIs(20)));
+  adapter.SendMessage(message);
+  EXPECT_EQ(-1, adapter.flush_deadline_micros());
+}
+
+// Tests that auto-flush sends messages once the delay has passed.
+TEST_F(ProtobufWireAdapterTest, TestAutoFlushDelay) {
+  InSequence sequence;
+
+  util::FakeClock clock;
+  adapter.SetAutoFlush(1400, 2000, &clock);
+
+  messages::RemoteMessage message;
+  message.mutable_request_message()->mutable_connect_message()
+      ->set_device_name("foo");
+
+  adapter.SendMessage(message);
+  EXPECT_EQ(2000, adapter.flush_deadline_micros());
+
+  clock.Advance(1999);
+  adapter.FlushIfDue();
+  Mock::VerifyAndClear(&interface);
+
+  EXPECT_CALL(interface, Send(SizeIs(10)));
+  clock.Advance(1);
+  adapter.FlushIfDue();
+  Mock::VerifyAndClear(&interface);
+
+  // A message sent after the delay has passed is sent along with the
+  // buffered messages.
+  adapter.SendMessage(message);
+  clock.Advance(2500);
+
+  EXPECT_CALL(interface, Send(SizeIs(20)));
+  adapter.SendMessage(message);
+}
+
 // Tests reading the preamble.
 TEST_F(ProtobufWireAdapterTest, TestHandleBytesReceivedPreamble) {
   InSequence sequence;
@@ -133,10 +681,25 @@ TEST_F(ProtobufWireAdapterTest, TestHandleBytesReceivedInvalidPreamble) {
   adapter.OnBytesReceived(preamble);
 
   // This fifth byte will cause an error because it exceeds the varint32 size.
-  EXPECT_CALL(listener, OnError());
+  EXPECT_CALL(listener,
+              OnProtocolError(messages::MessageListener::kInvalidPreamble));
   adapter.OnBytesReceived(preamble);
 }
 
+// Tests that a message larger than the maximum frame size is rejected before
+// it is requested from the interface.
+TEST_F(ProtobufWireAdapterTest, TestFrameTooLarge) {
+  InSequence sequence;
+  adapter.set_max_frame_size(100);
+
+  EXPECT_CALL(interface, Receive(1));
+  adapter.OnBytesReceived(std::vector<uint8_t>(1, 0x80 | 101));
+
+  EXPECT_CALL(listener,
+              OnProtocolError(messages::MessageListener::kFrameTooLarge));
+  adapter.OnBytesReceived(std::vector<uint8_t>(1, 0x00));
+}
+
 // Tests that a received message is successfully parsed.
 TEST_F(ProtobufWireAdapterTest, TestParseMessage) {
   InSequence sequence;
@@ -159,5 +722,140 @@ TEST_F(ProtobufWireAdapterTest, TestParseMessage) {
   adapter.OnBytesReceived(data);
 }
 
+// Tests that framed reads cope with an interface that delivers more or fewer
+// bytes than requested.
+TEST_F(ProtobufWireAdapterTest, TestUnrequestedChunks) {
+  InSequence sequence;
+
+  messages::RemoteMessage message;
+  message.mutable_request_message()->mutable_connect_message()
+      ->set_device_name("foo");
+
+  // A whole message and the start of the next one, which is then missing 5
+  // bytes.
+  uint8_t bytes[15] = {9, 18, 7, 42, 5, 10, 3, 'f', 'o', 'o',
+                       9, 18, 7, 42, 5};
+  EXPECT_CALL(listener, OnMessage(ProtoMatcher(message)));
+  EXPECT_CALL(interface, Receive(5));
+  adapter.OnBufferReceived(bytes, sizeof(bytes));
+
+  EXPECT_CALL(listener, OnMessage(ProtoMatcher(message)));
+  EXPECT_CALL(interface, Receive(1));
+  adapter.OnBufferReceived(bytes + 5, 5);
+}
+
+// Test fixture for a ProtobufWireAdapter test in streaming mode.
+class ProtobufWireAdapterStreamingTest : public ::testing::Test {
+ public:
+  ProtobufWireAdapterStreamingTest()
+      : interface(),
+        adapter(&interface, ProtobufWireAdapter::kStreamingReads) {
+  }
+
+ protected:
+  virtual void SetUp() {
+    // The adapter will start reading available bytes when initialized.
+    EXPECT_CALL(interface, ReceiveAvailable());
+
+    adapter.set_listener(&listener);
+    adapter.Init();
+
+    Mock::VerifyAndClear(&interface);
+
+    message.mutable_request_message()->mutable_connect_message()
+        ->set_device_name("foo");
+  }
+
+  StrictMock<MockWireInterface> interface;
+  StrictMock<MockMessageListener> listener;
+  ProtobufWireAdapter adapter;
+  messages::RemoteMessage message;
+};
+
+// A preamble and a connect message for device "foo".
+static const uint8_t kFooFrame[10] = {
+    9, 18, 7, 42, 5, 10, 3, 'f', 'o', 'o'};
+
+// Tests that several messages received at once are all parsed.
+TEST_F(ProtobufWireAdapterStreamingTest, TestMultipleMessages) {
+  InSequence sequence;
+
+  std::vector<uint8_t> data;
+  for (int i = 0; i < 3; ++i) {
+    data.insert(data.end(), kFooFrame, kFooFrame + sizeof(kFooFrame));
+  }
+
+  EXPECT_CALL(listener, OnMessage(ProtoMatcher(message))).Times(3);
+  EXPECT_CALL(interface, ReceiveAvailable());
+
+  adapter.OnBytesReceived(data);
+}
+
+// Tests that a message split across reads is reassembled.
+TEST_F(ProtobufWireAdapterStreamingTest, TestSplitMessage) {
+  InSequence sequence;
+
+  // A full message followed by the first 3 bytes of the next one.
+  std::vector<uint8_t> data1(kFooFrame, kFooFrame + sizeof(kFooFrame));
+  data1.insert(data1.end(), kFooFrame, kFooFrame + 3);
+
+  EXPECT_CALL(listener, OnMessage(ProtoMatcher(message)));
+  EXPECT_CALL(interface, ReceiveAvailable());
+  adapter.OnBytesReceived(data1);
+
+  // The rest of the second message.
+  std::vector<uint8_t> data2(kFooFrame + 3, kFooFrame + sizeof(kFooFrame));
+
+  EXPECT_CALL(listener, OnMessage(ProtoMatcher(message)));
+  EXPECT_CALL(interface, ReceiveAvailable());
+  adapter.OnBytesReceived(data2);
+}
+
+// Tests that messages delivered one byte at a time are reassembled.
+TEST_F(ProtobufWireAdapterStreamingTest, TestSingleBytes) {
+  InSequence sequence;
+
+  for (size_t i = 0; i < sizeof(kFooFrame); ++i) {
+    if (i == sizeof(kFooFrame) - 1) {
+      EXPECT_CALL(listener, OnMessage(ProtoMatcher(message)));
+    }
+    EXPECT_CALL(interface, ReceiveAvailable());
+    adapter.OnBytesReceived(std::vector<uint8_t>(1, kFooFrame[i]));
+  }
+}
+
+// Tests that messages can be parsed directly from a caller-owned buffer.
+TEST_F(ProtobufWireAdapterStreamingTest, TestBufferReceived) {
+  InSequence sequence;
+
+  EXPECT_CALL(listener, OnMessage(ProtoMatcher(message)));
+  EXPECT_CALL(interface, ReceiveAvailable());
+  adapter.OnBufferReceived(kFooFrame, sizeof(kFooFrame));
+}
+
+// Tests that listeners which only implement OnBytesReceived still receive
+// data passed to OnBufferReceived.
+TEST(WireListenerTest, TestBufferReceivedForwardsBytes) {
+  StrictMock<MockWireListener> listener;
+
+  std::vector<uint8_t> data(kFooFrame, kFooFrame + sizeof(kFooFrame));
+  EXPECT_CALL(listener, OnBytesReceived(data));
+
+  listener.OnBufferReceived(kFooFrame, sizeof(kFooFrame));
+}
+
+// Tests reading an invalid preamble with too many bytes.
+TEST_F(ProtobufWireAdapterStreamingTest, TestInvalidPreamble) {
+  InSequence sequence;
+
+  EXPECT_CALL(interface, ReceiveAvailable());
+  adapter.OnBytesReceived(std::vector<uint8_t>(4, 0x80));
+
+  // The fifth byte exceeds the varint32 size.
+  EXPECT_CALL(listener,
+              OnProtocolError(messages::MessageListener::kInvalidPreamble));
+  adapter.OnBytesReceived(std::vector<uint8_t>(1, 0x80));
+}
+
 }  // namespace wire
 }  // namespace anymote
@@ -0,0 +1,279 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests for SocketWireInterface.
+
+#include <anymote/wire/socketwireinterface.h>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include "anymote/wire/mocks.h"
+
+using ::testing::InSequence;
+using ::testing::Invoke;
+using ::testing::Mock;
+using ::testing::StrictMock;
+
+namespace anymote {
+namespace wire {
+
+// Security engine that XORs every byte, so tests can verify that data passes
+// through the engine in both directions.
+class XorSecurity : public TransportSecurity {
+ public:
+  virtual bool Start(std::vector<uint8_t>* to_peer) {
+    return true;
+  }
+
+  virtual bool Encrypt(const uint8_t* data, size_t size,
+                       std::vector<uint8_t>* to_peer) {
+    for (size_t i = 0; i < size; ++i) {
+      to_peer->push_back(data[i] ^ kKey);
+    }
+    return true;
+  }
+
+  virtual bool Decrypt(const uint8_t* data, size_t size,
+                       std::vector<uint8_t>* plaintext,
+                       std::vector<uint8_t>* to_peer) {
+    return Encrypt(data, size, plaintext);
+  }
+
+  static const uint8_t kKey = 0x5a;
+};
+
+// Test fixture for a SocketWireInterface test. The interface is connected to
+// a raw socket that the test reads and writes directly.
+class SocketWireInterfaceTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    ASSERT_TRUE(loop.Init());
+
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    peer = fds[1];
+    CreateInterface(fds[0], NULL);
+  }
+
+  virtual void TearDown() {
+    interface.reset();
+    if (peer >= 0) {
+      close(peer);
+    }
+  }
+
+  void CreateInterface(int fd, TransportSecurity* security) {
+    interface.reset(new SocketWireInterface(&loop, fd, security));
+    interface->set_listener(&listener);
+    ASSERT_TRUE(interface->Start());
+
+    // Run the loop once so that this thread becomes the dispatch thread.
+    loop.RunOnce(0);
+  }
+
+  // Writes a string to the peer socket.
+  void WritePeer(const std::string& data) {
+    ASSERT_EQ(data.size(), write(peer, data.data(), data.size()));
+  }
+
+  // Reads exactly num_bytes from the peer socket.
+  std::string ReadPeer(size_t num_bytes) {
+    std::string data(num_bytes, '\0');
+    size_t offset = 0;
+    while (offset < num_bytes) {
+      ssize_t num_read = read(peer, &data[offset], num_bytes - offset);
+      if (num_read <= 0) {
+        break;
+      }
+      offset += num_read;
+    }
+    data.resize(offset);
+    return data;
+  }
+
+  static std::vector<uint8_t> Bytes(const std::string& data) {
+    return std::vector<uint8_t>(data.begin(), data.end());
+  }
+
+  util::EventLoop loop;
+  StrictMock<MockWireListener> listener;
+  std::unique_ptr<SocketWireInterface> interface;
+  int peer;
+};
+
+// Tests receiving exact numbers of bytes.
+TEST_F(SocketWireInterfaceTest, TestReceive) {
+  InSequence sequence;
+
+  WritePeer("hello");
+
+  EXPECT_CALL(listener, OnBytesReceived(Bytes("hel")));
+  interface->Receive(3);
+  loop.RunOnce(1000);
+  Mock::VerifyAndClear(&listener);
+
+  // The rest of the data is already buffered, so it is delivered right away.
+  EXPECT_CALL(listener, OnBytesReceived(Bytes("lo")));
+  interface->Receive(2);
+}
+
+// Tests receiving whatever bytes are available.
+TEST_F(SocketWireInterfaceTest, TestReceiveAvailable) {
+  WritePeer("hello world");
+
+  EXPECT_CALL(listener, OnBytesReceived(Bytes("hello world")));
+  interface->ReceiveAvailable();
+  loop.RunOnce(1000);
+}
+
+// Tests that nothing is read while no receive is pending.
+TEST_F(SocketWireInterfaceTest, TestNoReceivePending) {
+  WritePeer("hello");
+  loop.RunOnce(0);
+}
+
+// Tests sending data from the dispatch thread and from another thread.
+TEST_F(SocketWireInterfaceTest, TestSend) {
+  interface->Send(Bytes("foo"));
+  EXPECT_EQ("foo", ReadPeer(3));
+
+  std::thread thread(&SocketWireInterface::Send, interface.get(),
+                     Bytes("bar"));
+  thread.join();
+  loop.RunOnce(1000);
+  EXPECT_EQ("bar", ReadPeer(3));
+}
+
+// Tests that a large amount of queued data is written as the peer reads it.
+TEST_F(SocketWireInterfaceTest, TestSendOwnedLarge) {
+  const size_t kChunkSize = 64 * 1024;
+  const int kNumChunks = 64;
+
+  for (int i = 0; i < kNumChunks; ++i) {
+    std::vector<uint8_t> data(kChunkSize, static_cast<uint8_t>(i));
+    interface->SendOwned(&data);
+  }
+
+  // The socket buffer cannot hold all the data, so some of it is queued.
+  size_t queued = interface->queued_bytes();
+  EXPECT_GT(queued, 0);
+  EXPECT_LT(queued, kChunkSize * kNumChunks);
+
+  std::string received;
+  std::atomic<bool> done(false);
+  std::thread reader([&]() {
+    received = ReadPeer(kChunkSize * kNumChunks);
+    done = true;
+  });
+  while (!done) {
+    loop.RunOnce(10);
+  }
+  reader.join();
+  EXPECT_EQ(0, interface->queued_bytes());
+
+  ASSERT_EQ(kChunkSize * kNumChunks, received.size());
+  for (int i = 0; i < kNumChunks; ++i) {
+    EXPECT_EQ(static_cast<char>(i), received[i * kChunkSize]);
+    EXPECT_EQ(static_cast<char>(i), received[(i + 1) * kChunkSize - 1]);
+  }
+}
+
+// Tests that data sent while bulk data is queued is written after the bulk
+// buffer being written, ahead of the other bulk buffers.
+TEST_F(SocketWireInterfaceTest, TestSendBulk) {
+  const size_t kBulkSize = 1024 * 1024;
+  for (int i = 0; i < 3; ++i) {
+    std::vector<uint8_t> data(kBulkSize, static_cast<uint8_t>('a' + i));
+    interface->SendBulk(&data);
+  }
+  interface->Send(Bytes("key"));
+
+  std::string received;
+  std::atomic<bool> done(false);
+  std::thread reader([&]() {
+    received = ReadPeer(3 * kBulkSize + 3);
+    done = true;
+  });
+  while (!done) {
+    loop.RunOnce(10);
+  }
+  reader.join();
+
+  ASSERT_EQ(3 * kBulkSize + 3, received.size());
+  EXPECT_EQ(std::string(kBulkSize, 'a'), received.substr(0, kBulkSize));
+  EXPECT_EQ("key", received.substr(kBulkSize, 3));
+  EXPECT_EQ(std::string(kBulkSize, 'b'), received.substr(kBulkSize + 3,
+                                                         kBulkSize));
+  EXPECT_EQ('c', received[received.size() - 1]);
+  EXPECT_EQ(0, interface->queued_bytes());
+}
+
+// Tests that the listener is notified when the peer closes the connection.
+TEST_F(SocketWireInterfaceTest, TestPeerClosed) {
+  close(peer);
+  peer = -1;
+
+  EXPECT_CALL(listener, OnError());
+  interface->ReceiveAvailable();
+  loop.RunOnce(1000);
+}
+
+// Tests that a write error raised while sending from the dispatch thread is
+// reported after Send returns rather than from within it.
+TEST_F(SocketWireInterfaceTest, TestSendErrorNotReentrant) {
+  close(peer);
+  peer = -1;
+
+  bool sending = false;
+  EXPECT_CALL(listener, OnError())
+      .WillOnce(Invoke([&sending]() { EXPECT_FALSE(sending); }));
+
+  sending = true;
+  interface->Send(Bytes("foo"));
+  sending = false;
+
+  loop.RunOnce(0);
+}
+
+// Tests that data passes through the security engine in both directions.
+TEST_F(SocketWireInterfaceTest, TestSecurity) {
+  XorSecurity security;
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  close(peer);
+  peer = fds[1];
+  CreateInterface(fds[0], &security);
+
+  interface->Send(Bytes("abc"));
+
+  std::string expected;
+  expected += 'a' ^ XorSecurity::kKey;
+  expected += 'b' ^ XorSecurity::kKey;
+  expected += 'c' ^ XorSecurity::kKey;
+  EXPECT_EQ(expected, ReadPeer(3));
+  EXPECT_EQ(0, interface->queued_bytes());
+
+  WritePeer(expected);
+  EXPECT_CALL(listener, OnBytesReceived(Bytes("abc")));
+  interface->Receive(3);
+  loop.RunOnce(1000);
+}
+
+}  // namespace wire
+}  // namespace anymote
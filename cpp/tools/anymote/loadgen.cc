@@ -0,0 +1,803 @@
+// Copyright 2012 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Load generator for Anymote servers and gateways. It opens many device
+// sessions, spread over worker threads, and drives each of them with a random
+// mix of key events, mouse moves, data, flings and pings at a target rate.
+// Pings and flings are tracked, and the achieved throughput and their
+// round-trip times are printed as JSON when the run ends.
+//
+// Sessions run over one of two transports:
+//
+//   loopback  Each session is paired with a server session on the same
+//             worker thread, over an in-process LoopbackWireInterface link.
+//             This measures the library without the kernel.
+//   tcp       Each session connects to a server over a localhost socket and
+//             runs on its worker's event loop. The server is started in
+//             process unless --server gives the port of one to connect to.
+//
+// Example:
+//
+//   anymote-loadgen --sessions=1000 --threads=4 --rate=200
+//       --transport=tcp --mix=key:70,mouse:25,ping:5 --duration=30
+
+#include <anymote/device/anymotelistener.h>
+#include <anymote/device/devicesession.h>
+#include <anymote/server/requestlistener.h>
+#include <anymote/server/serversession.h>
+#include <anymote/util/clock.h>
+#include <anymote/util/closure.h>
+#include <anymote/util/eventloop.h>
+#include <anymote/util/eventlooppool.h>
+#include <anymote/wire/loopbackwireinterface.h>
+#include <anymote/wire/protobufwireadapter.h>
+#include <anymote/wire/socketwireinterface.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <glog/logging.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace anymote {
+namespace loadgen {
+
+// The kinds of input a session generates.
+enum LoadKind {
+  // A key press: a key down event followed by a key up event.
+  kKeyLoad,
+  kMouseLoad,
+  kDataLoad,
+  kFlingLoad,
+  kPingLoad,
+  kNumLoadKinds,
+};
+
+static const char* const kLoadKindNames[kNumLoadKinds] = {
+  "key", "mouse", "data", "fling", "ping",
+};
+
+// The transports sessions run over.
+enum Transport {
+  kLoopbackTransport,
+  kTcpTransport,
+};
+
+// How often tracked requests are checked for timeouts.
+static const int64_t kExpireIntervalMicros = 100 * 1000;
+
+// How long workers wait for outstanding requests once the run is over.
+static const int64_t kDrainMicros = 2 * 1000 * 1000;
+
+// The longest a worker sleeps or waits for socket events at once.
+static const int64_t kMaxIdleMicros = 1000;
+
+// The settings of a run, parsed from the command line.
+struct LoadConfig {
+  LoadConfig()
+      : sessions(64),
+        threads(4),
+        server_threads(1),
+        duration_seconds(10),
+        rate(100),
+        data_size(256),
+        request_timeout_micros(5 * 1000 * 1000),
+        transport(kLoopbackTransport) {
+    int weights[kNumLoadKinds] = {60, 30, 4, 1, 5};
+    std::copy(weights, weights + kNumLoadKinds, mix);
+  }
+
+  int sessions;
+  int threads;
+  int server_threads;
+  double duration_seconds;
+
+  // The number of input events per second each session sends on average.
+  double rate;
+
+  // The relative frequency of each kind of input.
+  int mix[kNumLoadKinds];
+
+  size_t data_size;
+  int64_t request_timeout_micros;
+  Transport transport;
+
+  // The port of a server to connect to, or empty to start one in process.
+  std::string server_port;
+};
+
+// Request listener of the server end, which accepts every fling.
+class AcceptingRequestListener : public server::RequestListener {
+ public:
+  virtual void OnKeyEvent(messages::Code keycode, messages::Action action) {}
+  virtual void OnMouseEvent(int32_t x_delta, int32_t y_delta) {}
+  virtual void OnMouseWheel(int32_t x_scroll, int32_t y_scroll) {}
+  virtual void OnData(const std::string& type, const std::string& data) {}
+  virtual void OnConnect(const std::string& device_name, int32_t version) {}
+  virtual bool OnFling(const std::string& uri) { return true; }
+  virtual void OnError() {}
+};
+
+// Collects the round-trip times of tracked requests of one kind. It is only
+// used by the thread of one worker.
+class RttRecorder : public device::RequestCallback {
+ public:
+  RttRecorder() : timeouts(0), aborted(0) {}
+
+  virtual void OnRequestComplete(int32_t sequence_number, Result result,
+                                 const messages::ResponseMessage* response,
+                                 int64_t rtt_micros) {
+    switch (result) {
+      case kResponse:
+        rtts_micros.push_back(rtt_micros);
+        break;
+      case kTimeout:
+        timeouts++;
+        break;
+      case kAborted:
+        aborted++;
+        break;
+    }
+  }
+
+  std::vector<int64_t> rtts_micros;
+  uint64_t timeouts;
+  uint64_t aborted;
+};
+
+// A device session under load.
+class LoadSession {
+ public:
+  LoadSession()
+      : next_event_micros(0),
+        next_fling_sequence_number(1) {
+  }
+  virtual ~LoadSession() {}
+
+  // Starts the session. This is invoked on the worker thread.
+  // @return false if the session could not be started.
+  virtual bool Start() = 0;
+
+  // Delivers the data in flight of an in-process link, if any.
+  // @return the number of bytes delivered.
+  virtual size_t Pump() { return 0; }
+
+  virtual device::DeviceSession* device() = 0;
+
+  int64_t next_event_micros;
+  int32_t next_fling_sequence_number;
+
+ private:
+  // Disallow copy and assign.
+  LoadSession(const LoadSession&);
+  void operator=(const LoadSession&);
+};
+
+// A device session linked to a server session over a loopback link. Both
+// ends run on the thread of the worker.
+class LoopbackLoadSession : public LoadSession {
+ public:
+  LoopbackLoadSession(device::AnymoteListener* listener,
+                      server::RequestListener* server_listener)
+      : device_adapter_(&device_interface_,
+                        wire::ProtobufWireAdapter::kStreamingReads),
+        server_adapter_(&server_interface_,
+                        wire::ProtobufWireAdapter::kStreamingReads),
+        device_(&device_adapter_, listener),
+        server_(&server_adapter_, server_listener) {
+    wire::LoopbackWireInterface::Connect(&device_interface_,
+                                         &server_interface_);
+  }
+
+  virtual bool Start() {
+    device_.StartSession();
+    server_.StartSession();
+    return true;
+  }
+
+  virtual size_t Pump() {
+    size_t total = 0;
+    size_t delivered;
+    while ((delivered = server_interface_.Pump() +
+                        device_interface_.Pump()) > 0) {
+      total += delivered;
+    }
+    return total;
+  }
+
+  virtual device::DeviceSession* device() { return &device_; }
+
+ private:
+  wire::LoopbackWireInterface device_interface_;
+  wire::LoopbackWireInterface server_interface_;
+  wire::ProtobufWireAdapter device_adapter_;
+  wire::ProtobufWireAdapter server_adapter_;
+  device::DeviceSession device_;
+  server::ServerSession server_;
+};
+
+// A device session over a socket, driven by the event loop of the worker.
+class SocketLoadSession : public LoadSession {
+ public:
+  SocketLoadSession(util::EventLoop* loop, int fd,
+                    device::AnymoteListener* listener)
+      : interface_(loop, fd, NULL),
+        adapter_(&interface_, wire::ProtobufWireAdapter::kStreamingReads),
+        device_(&adapter_, listener) {
+  }
+
+  virtual bool Start() {
+    device_.StartSession();
+    return interface_.Start();
+  }
+
+  virtual device::DeviceSession* device() { return &device_; }
+
+ private:
+  wire::SocketWireInterface interface_;
+  wire::ProtobufWireAdapter adapter_;
+  device::DeviceSession device_;
+};
+
+// Server that accepts localhost connections and answers them with server
+// sessions, spread over a pool of event loops.
+class LoadServer : public util::EventLoop::Handler {
+ public:
+  explicit LoadServer(int num_threads)
+      : pool_(num_threads),
+        listen_fd_(-1),
+        accept_loop_(NULL) {
+  }
+
+  // Stops the server and closes all connections.
+  virtual ~LoadServer() {
+    pool_.Stop();
+    for (size_t i = 0; i < connections_.size(); ++i) {
+      pool_.ReleaseLoop(connections_[i]->loop);
+      delete connections_[i];
+    }
+    if (listen_fd_ >= 0) {
+      close(listen_fd_);
+    }
+  }
+
+  // Listens on an ephemeral localhost port and starts serving.
+  // @return false if the server could not be started.
+  bool Start() {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        0);
+    if (listen_fd_ < 0) {
+      PLOG(ERROR) << "Failed to create socket";
+      return false;
+    }
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t address_size = sizeof(address);
+    if (bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&address),
+             sizeof(address)) != 0 ||
+        listen(listen_fd_, SOMAXCONN) != 0 ||
+        getsockname(listen_fd_, reinterpret_cast<struct sockaddr*>(&address),
+                    &address_size) != 0) {
+      PLOG(ERROR) << "Failed to listen";
+      return false;
+    }
+    port_ = std::to_string(ntohs(address.sin_port));
+
+    if (!pool_.Start()) {
+      return false;
+    }
+    accept_loop_ = pool_.loop(0);
+    return accept_loop_->AddFd(listen_fd_, EPOLLIN, this);
+  }
+
+  // Returns the port the server listens on.
+  const std::string& port() const { return port_; }
+
+  // Accepts pending connections. Runs on the accepting loop.
+  // @override
+  virtual void OnEvents(uint32_t events) {
+    int fd;
+    while ((fd = accept4(listen_fd_, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+      Connection* connection = new Connection(pool_.AcquireLoop(), fd,
+                                              &listener_);
+      connections_.push_back(connection);
+      connection->loop->Post(&connection->start_closure);
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      PLOG(ERROR) << "Failed to accept";
+    }
+  }
+
+ private:
+  // A server session and the objects it needs, pinned to one event loop.
+  struct Connection {
+    Connection(util::EventLoop* loop, int fd,
+               server::RequestListener* listener)
+        : loop(loop),
+          interface(loop, fd, NULL),
+          adapter(&interface, wire::ProtobufWireAdapter::kStreamingReads),
+          session(&adapter, listener),
+          start_closure(this, &Connection::Start) {
+    }
+
+    // Starts the interface and the session. Runs on the session's loop.
+    void Start() {
+      session.StartSession();
+      interface.Start();
+    }
+
+    util::EventLoop* loop;
+    wire::SocketWireInterface interface;
+    wire::ProtobufWireAdapter adapter;
+    server::ServerSession session;
+    util::MethodClosure<Connection> start_closure;
+  };
+
+  util::EventLoopPool pool_;
+  int listen_fd_;
+  std::string port_;
+  util::EventLoop* accept_loop_;
+  AcceptingRequestListener listener_;
+
+  // Only used on the accepting loop, or once the pool is stopped.
+  std::vector<Connection*> connections_;
+
+  // Disallow copy and assign.
+  LoadServer(const LoadServer&);
+  void operator=(const LoadServer&);
+};
+
+// Drives a share of the sessions on a thread of its own.
+class LoadWorker : public device::AnymoteListener {
+ public:
+  LoadWorker(const LoadConfig& config, int index)
+      : config_(config),
+        clock_(util::Clock::GetRealClock()),
+        random_(index + 1),
+        interval_seconds_(config.rate),
+        data_(config.data_size, 'x'),
+        errors_(0) {
+    std::fill(events_sent_, events_sent_ + kNumLoadKinds, 0);
+    total_weight_ = 0;
+    for (int i = 0; i < kNumLoadKinds; ++i) {
+      total_weight_ += config.mix[i];
+    }
+  }
+
+  virtual ~LoadWorker() {
+    for (size_t i = 0; i < sessions_.size(); ++i) {
+      delete sessions_[i];
+    }
+  }
+
+  // Prepares the event loop of the worker.
+  // @return false if the loop could not be created.
+  bool Init() {
+    return config_.transport != kTcpTransport || loop_.Init();
+  }
+
+  // Adds a session over a loopback link.
+  void AddLoopbackSession() {
+    AddSession(new LoopbackLoadSession(this, &server_listener_));
+  }
+
+  // Adds a session over a connected socket.
+  // @param fd The socket. Ownership is taken.
+  void AddSocketSession(int fd) {
+    AddSession(new SocketLoadSession(&loop_, fd, this));
+  }
+
+  // Runs the sessions until the given time, then waits a little for their
+  // outstanding requests.
+  // @param start_micros The time at which the run starts.
+  // @param end_micros The time at which the sessions stop sending.
+  void Run(int64_t start_micros, int64_t end_micros) {
+    std::uniform_real_distribution<double> phase(0, 1.0 / config_.rate);
+    for (size_t i = 0; i < sessions_.size(); ++i) {
+      if (!sessions_[i]->Start()) {
+        errors_++;
+      }
+      sessions_[i]->next_event_micros =
+          start_micros + static_cast<int64_t>(phase(random_) * 1e6);
+    }
+
+    int64_t next_expire_micros = start_micros + kExpireIntervalMicros;
+    for (;;) {
+      int64_t now = clock_->NowMicros();
+      bool sending = now < end_micros;
+      int64_t next_event_micros = end_micros;
+      for (size_t i = 0; i < sessions_.size() && sending; ++i) {
+        LoadSession* session = sessions_[i];
+        while (session->next_event_micros <= now) {
+          SendEvent(session);
+          session->next_event_micros +=
+              static_cast<int64_t>(interval_seconds_(random_) * 1e6);
+        }
+        next_event_micros = std::min(next_event_micros,
+                                     session->next_event_micros);
+      }
+
+      size_t delivered = 0;
+      for (size_t i = 0; i < sessions_.size(); ++i) {
+        delivered += sessions_[i]->Pump();
+      }
+
+      if (now >= next_expire_micros) {
+        for (size_t i = 0; i < sessions_.size(); ++i) {
+          sessions_[i]->device()->ExpireRequests();
+        }
+        next_expire_micros = now + kExpireIntervalMicros;
+      }
+
+      if (!sending &&
+          (outstanding_requests() == 0 || now >= end_micros + kDrainMicros)) {
+        break;
+      }
+
+      int64_t idle_micros = std::min(next_event_micros - clock_->NowMicros(),
+                                     kMaxIdleMicros);
+      if (!sending) {
+        idle_micros = kMaxIdleMicros;
+      }
+      if (config_.transport == kTcpTransport) {
+        loop_.RunOnce(idle_micros > 0 ? (idle_micros + 999) / 1000 : 0);
+      } else if (delivered == 0 && idle_micros > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(idle_micros));
+      }
+    }
+  }
+
+  // Returns the number of tracked requests still waiting for a response.
+  size_t outstanding_requests() {
+    size_t outstanding = 0;
+    for (size_t i = 0; i < sessions_.size(); ++i) {
+      outstanding += sessions_[i]->device()->pending_requests()->size();
+    }
+    return outstanding;
+  }
+
+  // @override
+  virtual void OnAck() {}
+
+  // @override
+  virtual void OnData(const std::string& type, const std::string& data) {}
+
+  // @override
+  virtual void OnFlingResult(bool success, uint32_t sequence_number) {}
+
+  // @override
+  virtual void OnError() { errors_++; }
+
+  const uint64_t* events_sent() const { return events_sent_; }
+  const RttRecorder& ping_rtts() const { return ping_rtts_; }
+  const RttRecorder& fling_rtts() const { return fling_rtts_; }
+  uint64_t errors() const { return errors_; }
+
+ private:
+  // Adds a session and enables request tracking on it.
+  void AddSession(LoadSession* session) {
+    session->device()->EnableRequestTracking(config_.request_timeout_micros,
+                                             clock_);
+    sessions_.push_back(session);
+  }
+
+  // Sends one input event of a random kind.
+  void SendEvent(LoadSession* session) {
+    device::DeviceSession* device = session->device();
+    LoadKind kind = PickKind();
+    switch (kind) {
+      case kKeyLoad: {
+        messages::Code keycode = static_cast<messages::Code>(
+            messages::KEYCODE_A + random_() % 26);
+        device->SendKeyEvent(keycode, messages::DOWN);
+        device->SendKeyEvent(keycode, messages::UP);
+        break;
+      }
+      case kMouseLoad:
+        device->SendMouseMove(static_cast<int>(random_() % 17) - 8,
+                              static_cast<int>(random_() % 17) - 8);
+        break;
+      case kDataLoad:
+        device->SendData("loadgen", data_);
+        break;
+      case kFlingLoad:
+        device->SendFling("http://www.example.com/",
+                          session->next_fling_sequence_number++,
+                          &fling_rtts_);
+        break;
+      case kPingLoad:
+      case kNumLoadKinds:
+        device->SendPing(&ping_rtts_);
+        break;
+    }
+    events_sent_[kind]++;
+  }
+
+  // Returns a random kind of input, following the mix.
+  LoadKind PickKind() {
+    int pick = random_() % total_weight_;
+    for (int i = 0; i < kNumLoadKinds; ++i) {
+      if (pick < config_.mix[i]) {
+        return static_cast<LoadKind>(i);
+      }
+      pick -= config_.mix[i];
+    }
+    return kPingLoad;
+  }
+
+  const LoadConfig& config_;
+  util::Clock* clock_;
+  util::EventLoop loop_;
+  std::mt19937 random_;
+  std::exponential_distribution<double> interval_seconds_;
+  int total_weight_;
+  const std::string data_;
+  AcceptingRequestListener server_listener_;
+  std::vector<LoadSession*> sessions_;
+
+  uint64_t events_sent_[kNumLoadKinds];
+  RttRecorder ping_rtts_;
+  RttRecorder fling_rtts_;
+  uint64_t errors_;
+
+  // Disallow copy and assign.
+  LoadWorker(const LoadWorker&);
+  void operator=(const LoadWorker&);
+};
+
+// Prints the round-trip times of one kind of request as a JSON member.
+static void PrintRtts(const char* name,
+                      const std::vector<const RttRecorder*>& recorders,
+                      bool last) {
+  std::vector<int64_t> rtts;
+  uint64_t timeouts = 0;
+  uint64_t aborted = 0;
+  for (size_t i = 0; i < recorders.size(); ++i) {
+    rtts.insert(rtts.end(), recorders[i]->rtts_micros.begin(),
+                recorders[i]->rtts_micros.end());
+    timeouts += recorders[i]->timeouts;
+    aborted += recorders[i]->aborted;
+  }
+  std::sort(rtts.begin(), rtts.end());
+
+  printf("  \"%s_rtt_micros\": {\"count\": %zu, \"timeouts\": %llu, "
+         "\"aborted\": %llu", name, rtts.size(),
+         static_cast<unsigned long long>(timeouts),
+         static_cast<unsigned long long>(aborted));
+  const double kPercentiles[] = {50, 90, 99, 99.9};
+  const char* const kPercentileNames[] = {"p50", "p90", "p99", "p999"};
+  for (int i = 0; i < 4 && !rtts.empty(); ++i) {
+    size_t rank = static_cast<size_t>(kPercentiles[i] / 100 * rtts.size());
+    printf(", \"%s\": %lld", kPercentileNames[i],
+           static_cast<long long>(rtts[std::min(rank, rtts.size() - 1)]));
+  }
+  if (!rtts.empty()) {
+    printf(", \"max\": %lld", static_cast<long long>(rtts.back()));
+  }
+  printf("}%s\n", last ? "" : ",");
+}
+
+// Prints the results of a run as JSON.
+static void PrintReport(const LoadConfig& config,
+                        const std::vector<LoadWorker*>& workers,
+                        double elapsed_seconds) {
+  uint64_t events_sent[kNumLoadKinds] = {0};
+  uint64_t errors = 0;
+  std::vector<const RttRecorder*> ping_rtts;
+  std::vector<const RttRecorder*> fling_rtts;
+  for (size_t i = 0; i < workers.size(); ++i) {
+    for (int kind = 0; kind < kNumLoadKinds; ++kind) {
+      events_sent[kind] += workers[i]->events_sent()[kind];
+    }
+    errors += workers[i]->errors();
+    ping_rtts.push_back(&workers[i]->ping_rtts());
+    fling_rtts.push_back(&workers[i]->fling_rtts());
+  }
+
+  uint64_t total_events = 0;
+  uint64_t total_messages = 0;
+  for (int kind = 0; kind < kNumLoadKinds; ++kind) {
+    total_events += events_sent[kind];
+    total_messages += events_sent[kind] * (kind == kKeyLoad ? 2 : 1);
+  }
+
+  printf("{\n");
+  printf("  \"transport\": \"%s\",\n",
+         config.transport == kTcpTransport ? "tcp" : "loopback");
+  printf("  \"sessions\": %d,\n", config.sessions);
+  printf("  \"threads\": %d,\n", config.threads);
+  printf("  \"seconds\": %.3f,\n", elapsed_seconds);
+  printf("  \"target_events_per_second\": %.1f,\n",
+         config.rate * config.sessions);
+  printf("  \"events_per_second\": %.1f,\n", total_events / elapsed_seconds);
+  printf("  \"messages_per_second\": %.1f,\n",
+         total_messages / elapsed_seconds);
+  printf("  \"events_sent\": {");
+  for (int kind = 0; kind < kNumLoadKinds; ++kind) {
+    printf("%s\"%s\": %llu", kind ? ", " : "", kLoadKindNames[kind],
+           static_cast<unsigned long long>(events_sent[kind]));
+  }
+  printf("},\n");
+  printf("  \"errors\": %llu,\n", static_cast<unsigned long long>(errors));
+  PrintRtts("ping", ping_rtts, false);
+  PrintRtts("fling", fling_rtts, true);
+  printf("}\n");
+}
+
+// Parses a mix such as "key:60,mouse:30,ping:10". Kinds that are not listed
+// are not sent.
+// @return false if the mix is malformed.
+static bool ParseMix(const std::string& text, int* mix) {
+  std::fill(mix, mix + kNumLoadKinds, 0);
+  int total = 0;
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find(',', start);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    std::string item = text.substr(start, end - start);
+    size_t colon = item.find(':');
+    if (colon == std::string::npos) {
+      return false;
+    }
+    std::string name = item.substr(0, colon);
+    int weight = atoi(item.c_str() + colon + 1);
+    int kind = 0;
+    while (kind < kNumLoadKinds && name != kLoadKindNames[kind]) {
+      kind++;
+    }
+    if (kind == kNumLoadKinds || weight < 0) {
+      return false;
+    }
+    mix[kind] = weight;
+    total += weight;
+    start = end + 1;
+  }
+  return total > 0;
+}
+
+// Parses the command line.
+// @return false if it is malformed.
+static bool ParseFlags(int argc, char** argv, LoadConfig* config) {
+  for (int i = 1; i < argc; ++i) {
+    std::string flag = argv[i];
+    size_t equals = flag.find('=');
+    if (flag.compare(0, 2, "--") != 0 || equals == std::string::npos) {
+      return false;
+    }
+    std::string name = flag.substr(2, equals - 2);
+    std::string value = flag.substr(equals + 1);
+    if (name == "sessions") {
+      config->sessions = std::max(1, atoi(value.c_str()));
+    } else if (name == "threads") {
+      config->threads = std::max(1, atoi(value.c_str()));
+    } else if (name == "server_threads") {
+      config->server_threads = std::max(1, atoi(value.c_str()));
+    } else if (name == "duration") {
+      config->duration_seconds = atof(value.c_str());
+    } else if (name == "rate") {
+      config->rate = atof(value.c_str());
+    } else if (name == "data_size") {
+      config->data_size = atoi(value.c_str());
+    } else if (name == "timeout_ms") {
+      config->request_timeout_micros = atoll(value.c_str()) * 1000;
+    } else if (name == "transport" && value == "loopback") {
+      config->transport = kLoopbackTransport;
+    } else if (name == "transport" && value == "tcp") {
+      config->transport = kTcpTransport;
+    } else if (name == "server") {
+      config->server_port = value;
+    } else if (name == "mix") {
+      if (!ParseMix(value, config->mix)) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  }
+  return config->duration_seconds > 0 && config->rate > 0 &&
+      config->request_timeout_micros > 0;
+}
+
+static int Main(int argc, char** argv) {
+  LoadConfig config;
+  if (!ParseFlags(argc, argv, &config)) {
+    fprintf(stderr,
+            "Usage: %s [--sessions=<count>] [--threads=<count>]\n"
+            "    [--duration=<seconds>] [--rate=<events per second per "
+            "session>]\n"
+            "    [--mix=key:<weight>,mouse:<weight>,data:<weight>,"
+            "fling:<weight>,ping:<weight>]\n"
+            "    [--data_size=<bytes>] [--timeout_ms=<milliseconds>]\n"
+            "    [--transport=loopback|tcp] [--server=<port>] "
+            "[--server_threads=<count>]\n", argv[0]);
+    return 2;
+  }
+  config.threads = std::min(config.threads, config.sessions);
+
+  LoadServer* server = NULL;
+  std::string port = config.server_port;
+  if (config.transport == kTcpTransport && port.empty()) {
+    server = new LoadServer(config.server_threads);
+    if (!server->Start()) {
+      delete server;
+      return 1;
+    }
+    port = server->port();
+  }
+
+  std::vector<LoadWorker*> workers;
+  bool ready = true;
+  for (int i = 0; i < config.threads; ++i) {
+    workers.push_back(new LoadWorker(config, i));
+    ready = ready && workers.back()->Init();
+  }
+  for (int i = 0; i < config.sessions && ready; ++i) {
+    LoadWorker* worker = workers[i % config.threads];
+    if (config.transport == kLoopbackTransport) {
+      worker->AddLoopbackSession();
+      continue;
+    }
+    int fd = wire::SocketWireInterface::ConnectTcp("127.0.0.1", port);
+    if (fd < 0) {
+      ready = false;
+      break;
+    }
+    worker->AddSocketSession(fd);
+  }
+
+  if (ready) {
+    util::Clock* clock = util::Clock::GetRealClock();
+    int64_t start_micros = clock->NowMicros();
+    int64_t end_micros =
+        start_micros + static_cast<int64_t>(config.duration_seconds * 1e6);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers.size(); ++i) {
+      threads.push_back(std::thread(&LoadWorker::Run, workers[i],
+                                    start_micros, end_micros));
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+      threads[i].join();
+    }
+    PrintReport(config, workers, config.duration_seconds);
+  }
+
+  // Stop the server first, so that it does not see the sessions go away.
+  delete server;
+  for (size_t i = 0; i < workers.size(); ++i) {
+    delete workers[i];
+  }
+  return ready ? 0 : 1;
+}
+
+}  // namespace loadgen
+}  // namespace anymote
+
+int main(int argc, char* argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  return anymote::loadgen::Main(argc, argv);
+}